@@ -38,6 +38,48 @@ project "VolcanicPong"
 		"%{VULKAN_SDK}/Lib/vulkan-1.lib"
 	}
 	
+	filter "system:windows"
+		systemversion "latest"
+		defines "PLATFORM_WINDOWS"
+		
+	filter "configurations:Debug"
+		defines "CONFIGURATION_DEBUG"
+		runtime "Debug"
+		symbols "on"
+	
+	filter "configurations:Release"
+		defines "CONFIGURATION_RELEASE"
+		runtime "Debug"
+		symbols "off"
+		optimize "on"
+			
+	filter "configurations:Dist"
+		defines "CONFIGURATION_DIST"
+		runtime "Release"
+		symbols "off"
+		optimize "on"
+
+-- The game rules and VectorEnv on their own, for training code that loads PongEnv.h's C functions from a shared library
+project "PongEnv"
+	kind "SharedLib"
+	language "C++"
+	cppdialect "C++17"
+	
+	targetdir ("bin/" .. outputdir .. "/%{prj.name}")
+	objdir ("bin-int/" .. outputdir .. "/%{prj.name}")
+	
+	files { "src/PongSim.h", "src/PongSim.cpp", "src/PongEnv.h", "src/CustomAssert.h" }
+	
+	includedirs
+	{
+		"vendor/glm",
+
+		"src",
+	}
+
+	defines "PONG_ENV_EXPORTS"
+	visibility "Hidden"
+	
 	filter "system:windows"
 		systemversion "latest"
 		defines "PLATFORM_WINDOWS"
@@ -16,6 +16,12 @@ for %%f in (*.vert) do (
 	echo %%~nf shader was successfully compiled
 )
 
+for %%f in (*.comp) do (
+	%VULKAN_SDK%\Bin\glslc.exe "%%f" -o "%%f.spv"
+
+	echo %%~nf compute shader was successfully compiled
+)
+
 echo Done
 
 pause
\ No newline at end of file
@@ -1,10 +1,14 @@
 #version 450
 
-layout(location = 0) in vec3 v_Color;
+layout(location = 0) in vec4 v_Color;
+layout(location = 1) in vec2 v_UV;
 
 layout(location = 0) out vec4 o_Color;
 
+// See SpriteAtlas
+layout(set = 0, binding = 0) uniform sampler2D u_Atlas;
+
 void main()
 {
-	o_Color = vec4(v_Color, 1.0);
+	o_Color = texture(u_Atlas, v_UV) * v_Color;
 }
\ No newline at end of file
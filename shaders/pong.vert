@@ -3,17 +3,26 @@
 layout(location = 0) in vec2 a_Position;
 layout(location = 1) in vec3 a_Color;
 
-layout(location = 0) out vec3 v_Color;
+// Per instance, see QuadInstance
+layout(location = 2) in vec2 i_Position;
+layout(location = 3) in vec2 i_Size;
+layout(location = 4) in vec4 i_Color;
+layout(location = 5) in vec4 i_UV;
+
+layout(location = 0) out vec4 v_Color;
+layout(location = 1) out vec2 v_UV;
 
 layout (push_constant) uniform Push
 {
 	mat4 Projection;
-	mat4 Transform;
 } u_Push;
 
 void main()
 {
-	v_Color = a_Color;
+	v_Color = vec4(a_Color, 1.0) * i_Color;
+
+	// The quad goes from -0.5 to 0.5, i_UV is the top left and bottom right corner in the atlas
+	v_UV = mix(i_UV.xy, i_UV.zw, a_Position + 0.5);
 
-	gl_Position = u_Push.Projection * u_Push.Transform * vec4(a_Position, 0.0, 1.0);
+	gl_Position = u_Push.Projection * vec4(a_Position * i_Size + i_Position, 0.0, 1.0);
 }
\ No newline at end of file
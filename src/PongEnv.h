@@ -0,0 +1,29 @@
+#pragma once
+
+// VectorEnv as plain C functions for training code that isn't C++ (ctypes, cffi, ...), the PongEnv project builds them
+// into a shared library. env is a VectorEnv, see PongSim.h for how the buffers are laid out
+
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(PONG_ENV_EXPORTS)
+	#define PONG_ENV_API __declspec(dllexport)
+#elif defined(__GNUC__)
+	#define PONG_ENV_API __attribute__((visibility("default")))
+#else
+	#define PONG_ENV_API
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	PONG_ENV_API void* PongEnvCreate(uint32_t matchCount, uint64_t seed, int autoReset);
+	PONG_ENV_API void PongEnvBind(void* env, float* observations, float* rewards, uint8_t* dones);
+	PONG_ENV_API void PongEnvReset(void* env, const uint32_t* seeds);
+	PONG_ENV_API void PongEnvStep(void* env, const uint8_t* actions);
+	PONG_ENV_API void PongEnvDestroy(void* env);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,1083 @@
+#include "PongSim.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <glm/gtc/constants.hpp>
+
+#include "CustomAssert.h"
+
+void MovePlayer(float& position, float amount)
+{
+	float newPosition = position + amount;
+
+	// Collision detection
+
+	for (int i = 0; i < 2; i++)
+	{
+		int sign = 2 * i - 1;
+		float bound = newPosition + sign * (PLAYER_HEIGHT / 2.0f + PADDING);
+
+		if (abs(bound) >= 1.0f)
+		{
+			return;
+		}
+	}
+
+	position = newPosition;
+}
+
+int MoveBall(std::array<glm::vec2, 3>& positions, glm::vec2& direction, PhiloxStream& random, float timeScale /* = 1.0f */, ImpactList* impacts /* = nullptr */)
+{
+	// Swept collision: find the time of the next impact along the ball's path, move there, bounce, repeat with what's left of the step
+	// That way the ball never tunnels or loses time, no matter how long a step is
+
+	glm::vec2& ballPosition = positions[2];
+
+	// Time left in this step, in ticks at REFERENCE_TICK_RATE
+	float remaining = timeScale;
+
+	for (int impact = 0; impact < MAX_BALL_IMPACTS; impact++)
+	{
+		float ballSpeed = MAX_BALL_SPEED * abs(direction.y) / glm::pi<float>();
+		ballSpeed = std::max(MIN_BALL_SPEED, ballSpeed);
+
+		glm::vec2 velocity = direction * ballSpeed;
+
+		// Only the ceiling/floor and the paddle line the ball is heading towards can be hit
+
+		float wallY = velocity.y > 0.0f ? BALL_LIMIT_Y : -BALL_LIMIT_Y;
+		float wallTime = velocity.y != 0.0f ? (wallY - ballPosition.y) / velocity.y : INFINITY;
+
+		float paddleX = velocity.x > 0.0f ? BALL_LIMIT_X : -BALL_LIMIT_X;
+		float paddleTime = (paddleX - ballPosition.x) / velocity.x;
+
+		bool hitWall = wallTime <= paddleTime;
+		float hitTime = hitWall ? wallTime : paddleTime;
+
+		if (!(hitTime < remaining))
+		{
+			ballPosition.x += velocity.x * remaining;
+			ballPosition.y += velocity.y * remaining;
+
+			return 0;
+		}
+
+		// Slightly past a bound already (float error), bounce right here
+		hitTime = hitTime > 0.0f ? hitTime : 0.0f;
+		remaining -= hitTime;
+
+		if (hitWall)
+		{
+			ballPosition.x += velocity.x * hitTime;
+			ballPosition.y = wallY;
+
+			if (impacts)
+			{
+				impacts->Add({ ballPosition.x, ballPosition.y + glm::sign(wallY) * BALL_SIZE / 2.0f }, { 0.0f, -glm::sign(wallY) }, IMPACT_WALL);
+			}
+
+			Bounce({ 0.0f, 1.0f }, direction, random);
+			continue;
+		}
+
+		ballPosition.x = paddleX;
+		ballPosition.y += velocity.y * hitTime;
+
+		// Player collision
+
+		int player = velocity.x > 0.0f ? 1 : 0;
+
+		glm::vec2 contact = { ballPosition.x + glm::sign(paddleX) * BALL_SIZE / 2.0f, ballPosition.y };
+		glm::vec2 normal = { -glm::sign(paddleX), 0.0f };
+
+		if (ballPosition.y - BALL_SIZE > (positions[player].y + PLAYER_HEIGHT / 2.0f) || ballPosition.y + BALL_SIZE < (positions[player].y - PLAYER_HEIGHT / 2.0f))
+		{
+			if (impacts)
+			{
+				impacts->Add(contact, normal, IMPACT_GOAL);
+			}
+
+			ballPosition = { 0.0f, 0.0f };
+			direction = glm::normalize(glm::vec2(1.0f - player * 2.0f, 1.0f));
+
+			return 2 - player;
+		}
+
+		if (impacts)
+		{
+			impacts->Add(contact, normal, IMPACT_PADDLE);
+		}
+
+		Bounce({ 1.0f, 0.0f }, direction, random);
+	}
+
+	return 0;
+}
+
+void Bounce(const glm::vec2& surfaceNormal, glm::vec2& direction, PhiloxStream& random)
+{
+	float offset = RandomBounceOffset(random);
+
+	direction = glm::reflect(direction, surfaceNormal + glm::vec2(offset, 0.0f));
+
+	int sign = glm::sign(direction.x);
+	direction.x = sign * std::max(0.5f, abs(direction.x));
+}
+
+void PongSim::Reset(uint64_t seed /* = DEFAULT_SEED */, uint32_t stream /* = 0 */)
+{
+	Positions = { {
+		{ -ASPECT_RATIO + PLAYER_POSITION, 0.0f },
+		{  ASPECT_RATIO - PLAYER_POSITION, 0.0f },
+		{  0.0f, 0.0f },
+	} };
+
+	BallDirection = glm::normalize(glm::vec2(1.0f, 1.0f));
+
+	Scores[0] = 0;
+	Scores[1] = 0;
+
+	StepCount = 0;
+
+	Random.Seed = seed;
+	Random.Stream = stream;
+	Random.Position = 0;
+}
+
+int PongSim::Step(uint8_t inputs)
+{
+	if (inputs & INPUT_PLAYER1_UP)
+	{
+		MovePlayer(Positions[0].y, -MOVEMENT_SPEED * TimeScale);
+	}
+
+	if (inputs & INPUT_PLAYER1_DOWN)
+	{
+		MovePlayer(Positions[0].y, MOVEMENT_SPEED * TimeScale);
+	}
+
+	if (inputs & INPUT_PLAYER2_UP)
+	{
+		MovePlayer(Positions[1].y, -MOVEMENT_SPEED * TimeScale);
+	}
+
+	if (inputs & INPUT_PLAYER2_DOWN)
+	{
+		MovePlayer(Positions[1].y, MOVEMENT_SPEED * TimeScale);
+	}
+
+	Impacts.Count = 0;
+
+	int scoringPlayer = MoveBall(Positions, BallDirection, Random, TimeScale, &Impacts);
+
+	if (scoringPlayer)
+	{
+		Scores[scoringPlayer - 1]++;
+	}
+
+	StepCount++;
+
+	return scoringPlayer;
+}
+
+bool PongSim::IsOver() const
+{
+	return Scores[0] >= WINNING_SCORE || Scores[1] >= WINNING_SCORE || StepCount >= MAX_MATCH_STEPS;
+}
+
+float RandomBounceOffset(PhiloxStream& random)
+{
+	return random.NextFloat() * 0.1f - 0.05f;
+}
+
+std::array<uint32_t, 4> Philox4x32(std::array<uint32_t, 4> counter, uint64_t key)
+{
+	uint32_t key0 = (uint32_t)key;
+	uint32_t key1 = (uint32_t)(key >> 32);
+
+	for (int round = 0; round < PHILOX_ROUNDS; round++)
+	{
+		if (round > 0)
+		{
+			key0 += PHILOX_W0;
+			key1 += PHILOX_W1;
+		}
+
+		uint64_t product0 = (uint64_t)PHILOX_M0 * counter[0];
+		uint64_t product1 = (uint64_t)PHILOX_M1 * counter[2];
+
+		counter = {
+			(uint32_t)(product1 >> 32) ^ counter[1] ^ key0,
+			(uint32_t)product1,
+			(uint32_t)(product0 >> 32) ^ counter[3] ^ key1,
+			(uint32_t)product0,
+		};
+	}
+
+	return counter;
+}
+
+float PhiloxStream::NextFloat()
+{
+	// Only the first word is used, that way draw n of every stream is independent of all other draws
+	uint32_t bits = Philox4x32({ Position, Stream, 0, 0 }, Seed)[0];
+	Position++;
+
+	// 24 bits fit into a float exactly
+	return (bits >> 8) * (1.0f / 16777216.0f);
+}
+
+// Same as Philox4x32(...)[0] for 4 streams at once, counter words 2 and 3 start at 0 and every round is the full one
+__m128 PhiloxFloatSSE(__m128i positions, __m128i streams, uint64_t seed)
+{
+	__m128i counter0 = positions;
+	__m128i counter1 = streams;
+	__m128i counter2 = _mm_setzero_si128();
+	__m128i counter3 = _mm_setzero_si128();
+
+	uint32_t key0 = (uint32_t)seed;
+	uint32_t key1 = (uint32_t)(seed >> 32);
+
+	const __m128i multiplier0 = _mm_set1_epi32((int)PHILOX_M0);
+	const __m128i multiplier1 = _mm_set1_epi32((int)PHILOX_M1);
+
+	for (int round = 0; round < PHILOX_ROUNDS; round++)
+	{
+		if (round > 0)
+		{
+			key0 += PHILOX_W0;
+			key1 += PHILOX_W1;
+		}
+
+		// SSE2 only has 32x32 -> 64 multiplies for the even lanes, so do the odd ones separately and shuffle them back together
+		__m128i even0 = _mm_mul_epu32(counter0, multiplier0);
+		__m128i odd0 = _mm_mul_epu32(_mm_srli_epi64(counter0, 32), multiplier0);
+		__m128i even1 = _mm_mul_epu32(counter2, multiplier1);
+		__m128i odd1 = _mm_mul_epu32(_mm_srli_epi64(counter2, 32), multiplier1);
+
+		__m128i low0 = _mm_unpacklo_epi32(_mm_shuffle_epi32(even0, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd0, _MM_SHUFFLE(0, 0, 2, 0)));
+		__m128i high0 = _mm_unpacklo_epi32(_mm_shuffle_epi32(even0, _MM_SHUFFLE(0, 0, 3, 1)), _mm_shuffle_epi32(odd0, _MM_SHUFFLE(0, 0, 3, 1)));
+		__m128i low1 = _mm_unpacklo_epi32(_mm_shuffle_epi32(even1, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd1, _MM_SHUFFLE(0, 0, 2, 0)));
+		__m128i high1 = _mm_unpacklo_epi32(_mm_shuffle_epi32(even1, _MM_SHUFFLE(0, 0, 3, 1)), _mm_shuffle_epi32(odd1, _MM_SHUFFLE(0, 0, 3, 1)));
+
+		__m128i next0 = _mm_xor_si128(_mm_xor_si128(high1, counter1), _mm_set1_epi32((int)key0));
+		__m128i next2 = _mm_xor_si128(_mm_xor_si128(high0, counter3), _mm_set1_epi32((int)key1));
+
+		counter0 = next0;
+		counter1 = low1;
+		counter2 = next2;
+		counter3 = low0;
+	}
+
+	__m128i bits = _mm_srli_epi32(counter0, 8);
+	return _mm_mul_ps(_mm_cvtepi32_ps(bits), _mm_set1_ps(1.0f / 16777216.0f));
+}
+
+TARGET_AVX2 __m256 PhiloxFloatAVX2(__m256i positions, __m256i streams, uint64_t seed)
+{
+	__m256i counter0 = positions;
+	__m256i counter1 = streams;
+	__m256i counter2 = _mm256_setzero_si256();
+	__m256i counter3 = _mm256_setzero_si256();
+
+	uint32_t key0 = (uint32_t)seed;
+	uint32_t key1 = (uint32_t)(seed >> 32);
+
+	const __m256i multiplier0 = _mm256_set1_epi32((int)PHILOX_M0);
+	const __m256i multiplier1 = _mm256_set1_epi32((int)PHILOX_M1);
+
+	for (int round = 0; round < PHILOX_ROUNDS; round++)
+	{
+		if (round > 0)
+		{
+			key0 += PHILOX_W0;
+			key1 += PHILOX_W1;
+		}
+
+		// mullo gives the low halves directly, the high halves come from the even/odd 64 bit products
+		__m256i low0 = _mm256_mullo_epi32(counter0, multiplier0);
+		__m256i high0 = _mm256_blend_epi32(
+			_mm256_srli_epi64(_mm256_mul_epu32(counter0, multiplier0), 32),
+			_mm256_mul_epu32(_mm256_srli_epi64(counter0, 32), multiplier0),
+			0xAA
+		);
+
+		__m256i low1 = _mm256_mullo_epi32(counter2, multiplier1);
+		__m256i high1 = _mm256_blend_epi32(
+			_mm256_srli_epi64(_mm256_mul_epu32(counter2, multiplier1), 32),
+			_mm256_mul_epu32(_mm256_srli_epi64(counter2, 32), multiplier1),
+			0xAA
+		);
+
+		__m256i next0 = _mm256_xor_si256(_mm256_xor_si256(high1, counter1), _mm256_set1_epi32((int)key0));
+		__m256i next2 = _mm256_xor_si256(_mm256_xor_si256(high0, counter3), _mm256_set1_epi32((int)key1));
+
+		counter0 = next0;
+		counter1 = low1;
+		counter2 = next2;
+		counter3 = low0;
+	}
+
+	__m256i bits = _mm256_srli_epi32(counter0, 8);
+	return _mm256_mul_ps(_mm256_cvtepi32_ps(bits), _mm256_set1_ps(1.0f / 16777216.0f));
+}
+
+SimdLevel DetectSimdLevel()
+{
+	// x64 always has SSE2, AVX2 needs both CPU and OS support (the OS has to save the ymm registers)
+#if defined(_MSC_VER)
+	int info[4];
+
+	__cpuid(info, 1);
+	bool hasAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+
+	__cpuidex(info, 7, 0);
+	bool hasAvx2 = info[1] & (1 << 5);
+
+	if (hasAvx && hasAvx2 && (_xgetbv(0) & 6) == 6)
+	{
+		return SIMD_AVX2;
+	}
+#else
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return SIMD_AVX2;
+	}
+#endif
+
+	return SIMD_SSE;
+}
+
+const char* GetSimdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+		case SIMD_SCALAR: return "Scalar";
+		case SIMD_SSE: return "SSE";
+		case SIMD_AVX2: return "AVX2";
+	}
+
+	return "Unknown";
+}
+
+BatchSim::BatchSim()
+{
+	Level = DetectSimdLevel();
+}
+
+void BatchSim::Reset(uint32_t matchCount, uint64_t seed /* = DEFAULT_SEED */)
+{
+	MatchCount = matchCount;
+	Seed = seed;
+
+	BallX.assign(matchCount, 0.0f);
+	BallY.assign(matchCount, 0.0f);
+	DirectionX.resize(matchCount);
+	DirectionY.resize(matchCount);
+	Paddle1Y.assign(matchCount, 0.0f);
+	Paddle2Y.assign(matchCount, 0.0f);
+	Scores1.assign(matchCount, 0);
+	Scores2.assign(matchCount, 0);
+	ScoringPlayers.assign(matchCount, 0);
+	RandomStreams.assign(matchCount, 0);
+	RandomPositions.assign(matchCount, 0);
+
+	for (uint32_t i = 0; i < matchCount; i++)
+	{
+		ResetMatch(i, i);
+	}
+
+	StepCount = 0;
+}
+
+void BatchSim::ResetMatch(uint32_t match, uint32_t stream)
+{
+	// Same starting state as PongSim::Reset()
+	glm::vec2 direction = glm::normalize(glm::vec2(1.0f, 1.0f));
+
+	BallX[match] = 0.0f;
+	BallY[match] = 0.0f;
+	DirectionX[match] = direction.x;
+	DirectionY[match] = direction.y;
+	Paddle1Y[match] = 0.0f;
+	Paddle2Y[match] = 0.0f;
+	Scores1[match] = 0;
+	Scores2[match] = 0;
+	ScoringPlayers[match] = 0;
+	RandomStreams[match] = stream;
+	RandomPositions[match] = 0;
+}
+
+void BatchSim::Step(const uint8_t* inputs)
+{
+	StepRange(inputs, 0, MatchCount);
+	StepCount++;
+}
+
+void BatchSim::StepRange(const uint8_t* inputs, uint32_t begin, uint32_t end)
+{
+	switch (Level)
+	{
+		case SIMD_AVX2: StepBatchAVX2(*this, inputs, begin, end); break;
+		case SIMD_SSE: StepBatchSSE(*this, inputs, begin, end); break;
+		default: StepBatchScalar(*this, inputs, begin, end); break;
+	}
+}
+
+void StepBatchScalar(BatchSim& batch, const uint8_t* inputs, uint32_t begin, uint32_t end)
+{
+	// Reference path: runs the exact same MovePlayer/MoveBall code as PongSim, one match at a time
+
+	const float playerAmount = MOVEMENT_SPEED * batch.TimeScale;
+
+	for (uint32_t i = begin; i < end; i++)
+	{
+		std::array<glm::vec2, 3> positions = { {
+			{ -ASPECT_RATIO + PLAYER_POSITION, batch.Paddle1Y[i] },
+			{  ASPECT_RATIO - PLAYER_POSITION, batch.Paddle2Y[i] },
+			{  batch.BallX[i], batch.BallY[i] },
+		} };
+
+		glm::vec2 direction = { batch.DirectionX[i], batch.DirectionY[i] };
+
+		PhiloxStream random;
+		random.Seed = batch.Seed;
+		random.Stream = batch.RandomStreams[i];
+		random.Position = batch.RandomPositions[i];
+
+		if (inputs[i] & INPUT_PLAYER1_UP) MovePlayer(positions[0].y, -playerAmount);
+		if (inputs[i] & INPUT_PLAYER1_DOWN) MovePlayer(positions[0].y, playerAmount);
+		if (inputs[i] & INPUT_PLAYER2_UP) MovePlayer(positions[1].y, -playerAmount);
+		if (inputs[i] & INPUT_PLAYER2_DOWN) MovePlayer(positions[1].y, playerAmount);
+
+		int scoringPlayer = MoveBall(positions, direction, random, batch.TimeScale);
+
+		batch.Paddle1Y[i] = positions[0].y;
+		batch.Paddle2Y[i] = positions[1].y;
+		batch.BallX[i] = positions[2].x;
+		batch.BallY[i] = positions[2].y;
+		batch.DirectionX[i] = direction.x;
+		batch.DirectionY[i] = direction.y;
+		batch.RandomPositions[i] = random.Position;
+
+		batch.Scores1[i] += scoringPlayer == 1;
+		batch.Scores2[i] += scoringPlayer == 2;
+		batch.ScoringPlayers[i] = scoringPlayer;
+	}
+}
+
+// The SIMD kernels below are MoveBall/MovePlayer/Bounce written without branches:
+// every outcome (wall bounce, paddle bounce, goal, free flight) is computed for all lanes and picked with masks,
+// the impact loop keeps going until no lane in the block is still bouncing.
+// The float operations happen in exactly the same order as in the scalar code, so the results are bit identical.
+// Random numbers come from each match's own Philox stream, computed for all lanes at once.
+
+static inline __m128 SelectSSE(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128 AbsSSE(__m128 v)
+{
+	return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+}
+
+static inline __m128 MovePlayerSSE(__m128 position, __m128 pressed, float amount)
+{
+	const __m128 extent = _mm_set1_ps(PLAYER_HEIGHT / 2.0f + PADDING);
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	__m128 newPosition = _mm_add_ps(position, _mm_set1_ps(amount));
+
+	__m128 blocked = _mm_or_ps(
+		_mm_cmpge_ps(AbsSSE(_mm_sub_ps(newPosition, extent)), one),
+		_mm_cmpge_ps(AbsSSE(_mm_add_ps(newPosition, extent)), one)
+	);
+
+	return SelectSSE(_mm_andnot_ps(blocked, pressed), newPosition, position);
+}
+
+static inline __m128 InputMaskSSE(__m128i inputs, int flag)
+{
+	__m128i bit = _mm_set1_epi32(flag);
+	return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(inputs, bit), bit));
+}
+
+void StepBatchSSE(BatchSim& batch, const uint8_t* inputs, uint32_t begin, uint32_t end)
+{
+	const float playerAmount = MOVEMENT_SPEED * batch.TimeScale;
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 ballSize = _mm_set1_ps(BALL_SIZE);
+	const __m128 halfPlayer = _mm_set1_ps(PLAYER_HEIGHT / 2.0f);
+	const __m128 limitX = _mm_set1_ps(BALL_LIMIT_X);
+	const __m128 negativeLimitX = _mm_set1_ps(-BALL_LIMIT_X);
+	const __m128 limitY = _mm_set1_ps(BALL_LIMIT_Y);
+	const __m128 negativeLimitY = _mm_set1_ps(-BALL_LIMIT_Y);
+	const __m128 infinity = _mm_set1_ps(INFINITY);
+	const __m128 maxSpeed = _mm_set1_ps(MAX_BALL_SPEED);
+	const __m128 minSpeed = _mm_set1_ps(MIN_BALL_SPEED);
+	const __m128 pi = _mm_set1_ps(glm::pi<float>());
+	const __m128 timeScale = _mm_set1_ps(batch.TimeScale);
+	const __m128 minDirectionX = _mm_set1_ps(0.5f);
+
+	const glm::vec2 leftServe = glm::normalize(glm::vec2(1.0f, 1.0f));
+	const glm::vec2 rightServe = glm::normalize(glm::vec2(-1.0f, 1.0f));
+
+	uint32_t i = begin;
+
+	for (; i + 4 <= end; i += 4)
+	{
+		int packedInputs;
+		memcpy(&packedInputs, inputs + i, sizeof(packedInputs));
+
+		__m128i zeroInt = _mm_setzero_si128();
+		__m128i laneInputs = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packedInputs), zeroInt), zeroInt);
+
+		__m128 paddle1 = _mm_loadu_ps(&batch.Paddle1Y[i]);
+		__m128 paddle2 = _mm_loadu_ps(&batch.Paddle2Y[i]);
+
+		paddle1 = MovePlayerSSE(paddle1, InputMaskSSE(laneInputs, INPUT_PLAYER1_UP), -playerAmount);
+		paddle1 = MovePlayerSSE(paddle1, InputMaskSSE(laneInputs, INPUT_PLAYER1_DOWN), playerAmount);
+		paddle2 = MovePlayerSSE(paddle2, InputMaskSSE(laneInputs, INPUT_PLAYER2_UP), -playerAmount);
+		paddle2 = MovePlayerSSE(paddle2, InputMaskSSE(laneInputs, INPUT_PLAYER2_DOWN), playerAmount);
+
+		_mm_storeu_ps(&batch.Paddle1Y[i], paddle1);
+		_mm_storeu_ps(&batch.Paddle2Y[i], paddle2);
+
+		__m128 ballX = _mm_loadu_ps(&batch.BallX[i]);
+		__m128 ballY = _mm_loadu_ps(&batch.BallY[i]);
+		__m128 directionX = _mm_loadu_ps(&batch.DirectionX[i]);
+		__m128 directionY = _mm_loadu_ps(&batch.DirectionY[i]);
+
+		// Same impact loop as MoveBall, lanes drop out once they fly freely or score
+		__m128 remaining = timeScale;
+		__m128 active = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+		__m128i player1Scored = _mm_setzero_si128();
+		__m128i player2Scored = _mm_setzero_si128();
+
+		for (int impact = 0; impact < MAX_BALL_IMPACTS && _mm_movemask_ps(active); impact++)
+		{
+			__m128 speed = _mm_div_ps(_mm_mul_ps(maxSpeed, AbsSSE(directionY)), pi);
+			speed = _mm_max_ps(speed, minSpeed);
+
+			__m128 velocityX = _mm_mul_ps(directionX, speed);
+			__m128 velocityY = _mm_mul_ps(directionY, speed);
+
+			__m128 wallY = SelectSSE(_mm_cmpgt_ps(velocityY, zero), limitY, negativeLimitY);
+			__m128 wallTime = SelectSSE(_mm_cmpneq_ps(velocityY, zero), _mm_div_ps(_mm_sub_ps(wallY, ballY), velocityY), infinity);
+
+			__m128 towardsPlayer2 = _mm_cmpgt_ps(velocityX, zero);
+			__m128 paddleX = SelectSSE(towardsPlayer2, limitX, negativeLimitX);
+			__m128 paddleTime = _mm_div_ps(_mm_sub_ps(paddleX, ballX), velocityX);
+
+			__m128 hitWall = _mm_cmple_ps(wallTime, paddleTime);
+			__m128 hitTime = SelectSSE(hitWall, wallTime, paddleTime);
+
+			__m128 flying = _mm_and_ps(active, _mm_cmpnlt_ps(hitTime, remaining));
+			__m128 impacted = _mm_andnot_ps(flying, active);
+
+			__m128 flyX = _mm_add_ps(ballX, _mm_mul_ps(velocityX, remaining));
+			__m128 flyY = _mm_add_ps(ballY, _mm_mul_ps(velocityY, remaining));
+
+			hitTime = _mm_max_ps(hitTime, zero);
+			remaining = SelectSSE(impacted, _mm_sub_ps(remaining, hitTime), remaining);
+
+			__m128 impactX = SelectSSE(hitWall, _mm_add_ps(ballX, _mm_mul_ps(velocityX, hitTime)), paddleX);
+			__m128 impactY = SelectSSE(hitWall, wallY, _mm_add_ps(ballY, _mm_mul_ps(velocityY, hitTime)));
+
+			// The ball is checked against the player it's flying towards
+			__m128 paddle = SelectSSE(towardsPlayer2, paddle2, paddle1);
+
+			__m128 missed = _mm_or_ps(
+				_mm_cmpgt_ps(_mm_sub_ps(impactY, ballSize), _mm_add_ps(paddle, halfPlayer)),
+				_mm_cmplt_ps(_mm_add_ps(impactY, ballSize), _mm_sub_ps(paddle, halfPlayer))
+			);
+
+			__m128 goal = _mm_andnot_ps(hitWall, _mm_and_ps(impacted, missed));
+			__m128 bounced = _mm_andnot_ps(goal, impacted);
+
+			// Only lanes that bounce consume a random number, but most blocks don't bounce at all
+			__m128 offset = zero;
+
+			if (_mm_movemask_ps(bounced))
+			{
+				__m128i* randomPositions = (__m128i*)&batch.RandomPositions[i];
+				__m128i positions = _mm_loadu_si128(randomPositions);
+				__m128i streams = _mm_loadu_si128((const __m128i*)&batch.RandomStreams[i]);
+
+				offset = _mm_sub_ps(_mm_mul_ps(PhiloxFloatSSE(positions, streams, batch.Seed), _mm_set1_ps(0.1f)), _mm_set1_ps(0.05f));
+				_mm_storeu_si128(randomPositions, _mm_sub_epi32(positions, _mm_castps_si128(bounced)));
+			}
+
+			// Bounce(): reflect off (offset, 1) for walls and (1 + offset, 0) for players
+			__m128 normalX = SelectSSE(hitWall, _mm_add_ps(zero, offset), _mm_add_ps(one, offset));
+			__m128 normalY = SelectSSE(hitWall, _mm_add_ps(one, zero), _mm_add_ps(zero, zero));
+
+			__m128 dot = _mm_add_ps(_mm_mul_ps(normalX, directionX), _mm_mul_ps(normalY, directionY));
+			__m128 reflectedX = _mm_sub_ps(directionX, _mm_mul_ps(_mm_mul_ps(normalX, dot), two));
+			__m128 reflectedY = _mm_sub_ps(directionY, _mm_mul_ps(_mm_mul_ps(normalY, dot), two));
+
+			__m128 clampedX = _mm_max_ps(AbsSSE(reflectedX), minDirectionX);
+			clampedX = _mm_or_ps(
+				_mm_and_ps(_mm_cmpgt_ps(reflectedX, zero), clampedX),
+				_mm_and_ps(_mm_cmplt_ps(reflectedX, zero), _mm_sub_ps(zero, clampedX))
+			);
+
+			__m128 serveX = SelectSSE(towardsPlayer2, _mm_set1_ps(rightServe.x), _mm_set1_ps(leftServe.x));
+			__m128 serveY = SelectSSE(towardsPlayer2, _mm_set1_ps(rightServe.y), _mm_set1_ps(leftServe.y));
+
+			directionX = SelectSSE(goal, serveX, SelectSSE(bounced, clampedX, directionX));
+			directionY = SelectSSE(goal, serveY, SelectSSE(bounced, reflectedY, directionY));
+
+			ballX = SelectSSE(flying, flyX, _mm_andnot_ps(goal, SelectSSE(bounced, impactX, ballX)));
+			ballY = SelectSSE(flying, flyY, _mm_andnot_ps(goal, SelectSSE(bounced, impactY, ballY)));
+
+			// Missing on the right means player 1 scored
+			__m128i goalMask = _mm_castps_si128(goal);
+			player1Scored = _mm_or_si128(player1Scored, _mm_and_si128(goalMask, _mm_castps_si128(towardsPlayer2)));
+			player2Scored = _mm_or_si128(player2Scored, _mm_andnot_si128(_mm_castps_si128(towardsPlayer2), goalMask));
+
+			active = bounced;
+		}
+
+		_mm_storeu_ps(&batch.BallX[i], ballX);
+		_mm_storeu_ps(&batch.BallY[i], ballY);
+		_mm_storeu_ps(&batch.DirectionX[i], directionX);
+		_mm_storeu_ps(&batch.DirectionY[i], directionY);
+
+		__m128i* scores1 = (__m128i*)&batch.Scores1[i];
+		__m128i* scores2 = (__m128i*)&batch.Scores2[i];
+		_mm_storeu_si128(scores1, _mm_sub_epi32(_mm_loadu_si128(scores1), player1Scored));
+		_mm_storeu_si128(scores2, _mm_sub_epi32(_mm_loadu_si128(scores2), player2Scored));
+
+		__m128i scoringPlayer = _mm_or_si128(_mm_and_si128(player1Scored, _mm_set1_epi32(1)), _mm_and_si128(player2Scored, _mm_set1_epi32(2)));
+		_mm_storeu_si128((__m128i*)&batch.ScoringPlayers[i], scoringPlayer);
+	}
+
+	StepBatchScalar(batch, inputs, i, end);
+}
+
+TARGET_AVX2 static inline __m256 SelectAVX2(__m256 mask, __m256 a, __m256 b)
+{
+	return _mm256_blendv_ps(b, a, mask);
+}
+
+TARGET_AVX2 static inline __m256 AbsAVX2(__m256 v)
+{
+	return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v);
+}
+
+TARGET_AVX2 static inline __m256 MovePlayerAVX2(__m256 position, __m256 pressed, float amount)
+{
+	const __m256 extent = _mm256_set1_ps(PLAYER_HEIGHT / 2.0f + PADDING);
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	__m256 newPosition = _mm256_add_ps(position, _mm256_set1_ps(amount));
+
+	__m256 blocked = _mm256_or_ps(
+		_mm256_cmp_ps(AbsAVX2(_mm256_sub_ps(newPosition, extent)), one, _CMP_GE_OQ),
+		_mm256_cmp_ps(AbsAVX2(_mm256_add_ps(newPosition, extent)), one, _CMP_GE_OQ)
+	);
+
+	return SelectAVX2(_mm256_andnot_ps(blocked, pressed), newPosition, position);
+}
+
+TARGET_AVX2 static inline __m256 InputMaskAVX2(__m256i inputs, int flag)
+{
+	__m256i bit = _mm256_set1_epi32(flag);
+	return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(inputs, bit), bit));
+}
+
+TARGET_AVX2 void StepBatchAVX2(BatchSim& batch, const uint8_t* inputs, uint32_t begin, uint32_t end)
+{
+	const float playerAmount = MOVEMENT_SPEED * batch.TimeScale;
+
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	const __m256 ballSize = _mm256_set1_ps(BALL_SIZE);
+	const __m256 halfPlayer = _mm256_set1_ps(PLAYER_HEIGHT / 2.0f);
+	const __m256 limitX = _mm256_set1_ps(BALL_LIMIT_X);
+	const __m256 negativeLimitX = _mm256_set1_ps(-BALL_LIMIT_X);
+	const __m256 limitY = _mm256_set1_ps(BALL_LIMIT_Y);
+	const __m256 negativeLimitY = _mm256_set1_ps(-BALL_LIMIT_Y);
+	const __m256 infinity = _mm256_set1_ps(INFINITY);
+	const __m256 maxSpeed = _mm256_set1_ps(MAX_BALL_SPEED);
+	const __m256 minSpeed = _mm256_set1_ps(MIN_BALL_SPEED);
+	const __m256 pi = _mm256_set1_ps(glm::pi<float>());
+	const __m256 timeScale = _mm256_set1_ps(batch.TimeScale);
+	const __m256 minDirectionX = _mm256_set1_ps(0.5f);
+
+	const glm::vec2 leftServe = glm::normalize(glm::vec2(1.0f, 1.0f));
+	const glm::vec2 rightServe = glm::normalize(glm::vec2(-1.0f, 1.0f));
+
+	uint32_t i = begin;
+
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256i laneInputs = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(inputs + i)));
+
+		__m256 paddle1 = _mm256_loadu_ps(&batch.Paddle1Y[i]);
+		__m256 paddle2 = _mm256_loadu_ps(&batch.Paddle2Y[i]);
+
+		paddle1 = MovePlayerAVX2(paddle1, InputMaskAVX2(laneInputs, INPUT_PLAYER1_UP), -playerAmount);
+		paddle1 = MovePlayerAVX2(paddle1, InputMaskAVX2(laneInputs, INPUT_PLAYER1_DOWN), playerAmount);
+		paddle2 = MovePlayerAVX2(paddle2, InputMaskAVX2(laneInputs, INPUT_PLAYER2_UP), -playerAmount);
+		paddle2 = MovePlayerAVX2(paddle2, InputMaskAVX2(laneInputs, INPUT_PLAYER2_DOWN), playerAmount);
+
+		_mm256_storeu_ps(&batch.Paddle1Y[i], paddle1);
+		_mm256_storeu_ps(&batch.Paddle2Y[i], paddle2);
+
+		__m256 ballX = _mm256_loadu_ps(&batch.BallX[i]);
+		__m256 ballY = _mm256_loadu_ps(&batch.BallY[i]);
+		__m256 directionX = _mm256_loadu_ps(&batch.DirectionX[i]);
+		__m256 directionY = _mm256_loadu_ps(&batch.DirectionY[i]);
+
+		__m256 remaining = timeScale;
+		__m256 active = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+		__m256i player1Scored = _mm256_setzero_si256();
+		__m256i player2Scored = _mm256_setzero_si256();
+
+		for (int impact = 0; impact < MAX_BALL_IMPACTS && _mm256_movemask_ps(active); impact++)
+		{
+			__m256 speed = _mm256_div_ps(_mm256_mul_ps(maxSpeed, AbsAVX2(directionY)), pi);
+			speed = _mm256_max_ps(speed, minSpeed);
+
+			__m256 velocityX = _mm256_mul_ps(directionX, speed);
+			__m256 velocityY = _mm256_mul_ps(directionY, speed);
+
+			__m256 wallY = SelectAVX2(_mm256_cmp_ps(velocityY, zero, _CMP_GT_OQ), limitY, negativeLimitY);
+			__m256 wallTime = SelectAVX2(_mm256_cmp_ps(velocityY, zero, _CMP_NEQ_UQ), _mm256_div_ps(_mm256_sub_ps(wallY, ballY), velocityY), infinity);
+
+			__m256 towardsPlayer2 = _mm256_cmp_ps(velocityX, zero, _CMP_GT_OQ);
+			__m256 paddleX = SelectAVX2(towardsPlayer2, limitX, negativeLimitX);
+			__m256 paddleTime = _mm256_div_ps(_mm256_sub_ps(paddleX, ballX), velocityX);
+
+			__m256 hitWall = _mm256_cmp_ps(wallTime, paddleTime, _CMP_LE_OQ);
+			__m256 hitTime = SelectAVX2(hitWall, wallTime, paddleTime);
+
+			__m256 flying = _mm256_and_ps(active, _mm256_cmp_ps(hitTime, remaining, _CMP_NLT_UQ));
+			__m256 impacted = _mm256_andnot_ps(flying, active);
+
+			__m256 flyX = _mm256_add_ps(ballX, _mm256_mul_ps(velocityX, remaining));
+			__m256 flyY = _mm256_add_ps(ballY, _mm256_mul_ps(velocityY, remaining));
+
+			hitTime = _mm256_max_ps(hitTime, zero);
+			remaining = SelectAVX2(impacted, _mm256_sub_ps(remaining, hitTime), remaining);
+
+			__m256 impactX = SelectAVX2(hitWall, _mm256_add_ps(ballX, _mm256_mul_ps(velocityX, hitTime)), paddleX);
+			__m256 impactY = SelectAVX2(hitWall, wallY, _mm256_add_ps(ballY, _mm256_mul_ps(velocityY, hitTime)));
+
+			__m256 paddle = SelectAVX2(towardsPlayer2, paddle2, paddle1);
+
+			__m256 missed = _mm256_or_ps(
+				_mm256_cmp_ps(_mm256_sub_ps(impactY, ballSize), _mm256_add_ps(paddle, halfPlayer), _CMP_GT_OQ),
+				_mm256_cmp_ps(_mm256_add_ps(impactY, ballSize), _mm256_sub_ps(paddle, halfPlayer), _CMP_LT_OQ)
+			);
+
+			__m256 goal = _mm256_andnot_ps(hitWall, _mm256_and_ps(impacted, missed));
+			__m256 bounced = _mm256_andnot_ps(goal, impacted);
+
+			__m256 offset = zero;
+
+			if (_mm256_movemask_ps(bounced))
+			{
+				__m256i* randomPositions = (__m256i*)&batch.RandomPositions[i];
+				__m256i positions = _mm256_loadu_si256(randomPositions);
+				__m256i streams = _mm256_loadu_si256((const __m256i*)&batch.RandomStreams[i]);
+
+				offset = _mm256_sub_ps(_mm256_mul_ps(PhiloxFloatAVX2(positions, streams, batch.Seed), _mm256_set1_ps(0.1f)), _mm256_set1_ps(0.05f));
+				_mm256_storeu_si256(randomPositions, _mm256_sub_epi32(positions, _mm256_castps_si256(bounced)));
+			}
+
+			__m256 normalX = SelectAVX2(hitWall, _mm256_add_ps(zero, offset), _mm256_add_ps(one, offset));
+			__m256 normalY = SelectAVX2(hitWall, _mm256_add_ps(one, zero), _mm256_add_ps(zero, zero));
+
+			__m256 dot = _mm256_add_ps(_mm256_mul_ps(normalX, directionX), _mm256_mul_ps(normalY, directionY));
+			__m256 reflectedX = _mm256_sub_ps(directionX, _mm256_mul_ps(_mm256_mul_ps(normalX, dot), two));
+			__m256 reflectedY = _mm256_sub_ps(directionY, _mm256_mul_ps(_mm256_mul_ps(normalY, dot), two));
+
+			__m256 clampedX = _mm256_max_ps(AbsAVX2(reflectedX), minDirectionX);
+			clampedX = _mm256_or_ps(
+				_mm256_and_ps(_mm256_cmp_ps(reflectedX, zero, _CMP_GT_OQ), clampedX),
+				_mm256_and_ps(_mm256_cmp_ps(reflectedX, zero, _CMP_LT_OQ), _mm256_sub_ps(zero, clampedX))
+			);
+
+			__m256 serveX = SelectAVX2(towardsPlayer2, _mm256_set1_ps(rightServe.x), _mm256_set1_ps(leftServe.x));
+			__m256 serveY = SelectAVX2(towardsPlayer2, _mm256_set1_ps(rightServe.y), _mm256_set1_ps(leftServe.y));
+
+			directionX = SelectAVX2(goal, serveX, SelectAVX2(bounced, clampedX, directionX));
+			directionY = SelectAVX2(goal, serveY, SelectAVX2(bounced, reflectedY, directionY));
+
+			ballX = SelectAVX2(flying, flyX, _mm256_andnot_ps(goal, SelectAVX2(bounced, impactX, ballX)));
+			ballY = SelectAVX2(flying, flyY, _mm256_andnot_ps(goal, SelectAVX2(bounced, impactY, ballY)));
+
+			__m256i goalMask = _mm256_castps_si256(goal);
+			player1Scored = _mm256_or_si256(player1Scored, _mm256_and_si256(goalMask, _mm256_castps_si256(towardsPlayer2)));
+			player2Scored = _mm256_or_si256(player2Scored, _mm256_andnot_si256(_mm256_castps_si256(towardsPlayer2), goalMask));
+
+			active = bounced;
+		}
+
+		_mm256_storeu_ps(&batch.BallX[i], ballX);
+		_mm256_storeu_ps(&batch.BallY[i], ballY);
+		_mm256_storeu_ps(&batch.DirectionX[i], directionX);
+		_mm256_storeu_ps(&batch.DirectionY[i], directionY);
+
+		__m256i* scores1 = (__m256i*)&batch.Scores1[i];
+		__m256i* scores2 = (__m256i*)&batch.Scores2[i];
+		_mm256_storeu_si256(scores1, _mm256_sub_epi32(_mm256_loadu_si256(scores1), player1Scored));
+		_mm256_storeu_si256(scores2, _mm256_sub_epi32(_mm256_loadu_si256(scores2), player2Scored));
+
+		__m256i scoringPlayer = _mm256_or_si256(_mm256_and_si256(player1Scored, _mm256_set1_epi32(1)), _mm256_and_si256(player2Scored, _mm256_set1_epi32(2)));
+		_mm256_storeu_si256((__m256i*)&batch.ScoringPlayers[i], scoringPlayer);
+	}
+
+	StepBatchSSE(batch, inputs, i, end);
+}
+
+void VectorEnv::Init(uint32_t matchCount, uint64_t seed /* = DEFAULT_SEED */, bool autoReset /* = true */)
+{
+	AutoReset = autoReset;
+	MatchCount = matchCount;
+
+	Batch.Reset(matchCount, seed);
+
+	Seeds.assign(matchCount, 0);
+	Episodes.assign(matchCount, 0);
+	StepCounts.assign(matchCount, 0);
+}
+
+void VectorEnv::Bind(float* observations, float* rewards, uint8_t* dones)
+{
+	Observations = observations;
+	Rewards = rewards;
+	Dones = dones;
+}
+
+void VectorEnv::Reset(const uint32_t* seeds /* = nullptr */)
+{
+	ASSERT(Observations && Rewards && Dones, "Bind() the environment's buffers before resetting it.");
+
+	for (uint32_t match = 0; match < MatchCount; match++)
+	{
+		Seeds[match] = seeds ? seeds[match] : match;
+		Episodes[match] = 0;
+		StepCounts[match] = 0;
+
+		Batch.ResetMatch(match, Seeds[match]);
+
+		Rewards[match] = 0.0f;
+		Rewards[MatchCount + match] = 0.0f;
+		Dones[match] = 0;
+	}
+
+	WriteObservations();
+}
+
+void VectorEnv::Step(const uint8_t* actions)
+{
+	// All the physics happens in here, with the best SIMD kernel there is
+	Batch.Step(actions);
+
+	// Then one pass over the matches that only reads what the step just wrote, with a kernel of the same level so it stays
+	// small next to the physics
+	bool anyDone;
+
+	switch (Batch.Level)
+	{
+		case SIMD_AVX2: anyDone = WriteEnvResultsAVX2(*this, 0, MatchCount); break;
+		case SIMD_SSE: anyDone = WriteEnvResultsSSE(*this, 0, MatchCount); break;
+		default: anyDone = WriteEnvResultsScalar(*this, 0, MatchCount); break;
+	}
+
+	// Rare enough to get its own pass, so the kernels have no branches
+	if (AutoReset && anyDone)
+	{
+		for (uint32_t match = 0; match < MatchCount; match++)
+		{
+			if (Dones[match])
+			{
+				Episodes[match]++;
+				StepCounts[match] = 0;
+
+				Batch.ResetMatch(match, Seeds[match] + Episodes[match] * ENV_EPISODE_STREAM_STRIDE);
+			}
+		}
+	}
+
+	WriteObservations();
+}
+
+bool WriteEnvResultsScalar(VectorEnv& env, uint32_t begin, uint32_t end)
+{
+	bool anyDone = false;
+
+	for (uint32_t match = begin; match < end; match++)
+	{
+		// ScoringPlayers is 0, 1 or 2
+		int32_t scoringPlayer = env.Batch.ScoringPlayers[match];
+		float reward = (float)(scoringPlayer == 1) - (float)(scoringPlayer == 2);
+
+		env.Rewards[match] = reward;
+		// Not -reward, that would be -0 after a step without a goal where the SIMD kernels write +0
+		env.Rewards[env.MatchCount + match] = 0.0f - reward;
+
+		// Same rules as PongSim::IsOver()
+		uint32_t stepCount = ++env.StepCounts[match];
+		bool done = env.Batch.Scores1[match] >= WINNING_SCORE || env.Batch.Scores2[match] >= WINNING_SCORE || stepCount >= MAX_MATCH_STEPS;
+
+		env.Dones[match] = done;
+		anyDone |= done;
+	}
+
+	return anyDone;
+}
+
+bool WriteEnvResultsSSE(VectorEnv& env, uint32_t begin, uint32_t end)
+{
+	// Scores and step counts are nowhere near 2^31, so the signed compares are fine
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128i two = _mm_set1_epi32(2);
+	const __m128i lastScore = _mm_set1_epi32(WINNING_SCORE - 1);
+	const __m128i lastStep = _mm_set1_epi32((int32_t)MAX_MATCH_STEPS - 1);
+	const __m128 oneFloat = _mm_set1_ps(1.0f);
+
+	const int32_t* scoringPlayers = env.Batch.ScoringPlayers.data();
+	const uint32_t* scores1 = env.Batch.Scores1.data();
+	const uint32_t* scores2 = env.Batch.Scores2.data();
+	uint32_t* stepCounts = env.StepCounts.data();
+
+	float* rewards1 = env.Rewards;
+	float* rewards2 = env.Rewards + env.MatchCount;
+
+	int doneMask = 0;
+	uint32_t i = begin;
+
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128i scoringPlayer = _mm_loadu_si128((const __m128i*)(scoringPlayers + i));
+
+		__m128 scored = _mm_and_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(scoringPlayer, one)), oneFloat);
+		__m128 conceded = _mm_and_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(scoringPlayer, two)), oneFloat);
+		__m128 reward = _mm_sub_ps(scored, conceded);
+
+		_mm_storeu_ps(rewards1 + i, reward);
+		_mm_storeu_ps(rewards2 + i, _mm_sub_ps(_mm_setzero_ps(), reward));
+
+		__m128i stepCount = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(stepCounts + i)), one);
+		_mm_storeu_si128((__m128i*)(stepCounts + i), stepCount);
+
+		__m128i done = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)(scores1 + i)), lastScore);
+		done = _mm_or_si128(done, _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)(scores2 + i)), lastScore));
+		done = _mm_or_si128(done, _mm_cmpgt_epi32(stepCount, lastStep));
+
+		doneMask |= _mm_movemask_ps(_mm_castsi128_ps(done));
+
+		// All ones or zeros per lane, packed down to a 0 or 1 byte each
+		__m128i bytes = _mm_packs_epi16(_mm_packs_epi32(done, done), _mm_setzero_si128());
+		int32_t flags = _mm_cvtsi128_si32(_mm_and_si128(bytes, _mm_set1_epi8(1)));
+
+		memcpy(env.Dones + i, &flags, sizeof(flags));
+	}
+
+	return WriteEnvResultsScalar(env, i, end) || doneMask != 0;
+}
+
+TARGET_AVX2 bool WriteEnvResultsAVX2(VectorEnv& env, uint32_t begin, uint32_t end)
+{
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i two = _mm256_set1_epi32(2);
+	const __m256i lastScore = _mm256_set1_epi32(WINNING_SCORE - 1);
+	const __m256i lastStep = _mm256_set1_epi32((int32_t)MAX_MATCH_STEPS - 1);
+	const __m256 oneFloat = _mm256_set1_ps(1.0f);
+
+	const int32_t* scoringPlayers = env.Batch.ScoringPlayers.data();
+	const uint32_t* scores1 = env.Batch.Scores1.data();
+	const uint32_t* scores2 = env.Batch.Scores2.data();
+	uint32_t* stepCounts = env.StepCounts.data();
+
+	float* rewards1 = env.Rewards;
+	float* rewards2 = env.Rewards + env.MatchCount;
+
+	int doneMask = 0;
+	uint32_t i = begin;
+
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256i scoringPlayer = _mm256_loadu_si256((const __m256i*)(scoringPlayers + i));
+
+		__m256 scored = _mm256_and_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(scoringPlayer, one)), oneFloat);
+		__m256 conceded = _mm256_and_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(scoringPlayer, two)), oneFloat);
+		__m256 reward = _mm256_sub_ps(scored, conceded);
+
+		_mm256_storeu_ps(rewards1 + i, reward);
+		_mm256_storeu_ps(rewards2 + i, _mm256_sub_ps(_mm256_setzero_ps(), reward));
+
+		__m256i stepCount = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(stepCounts + i)), one);
+		_mm256_storeu_si256((__m256i*)(stepCounts + i), stepCount);
+
+		__m256i done = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)(scores1 + i)), lastScore);
+		done = _mm256_or_si256(done, _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)(scores2 + i)), lastScore));
+		done = _mm256_or_si256(done, _mm256_cmpgt_epi32(stepCount, lastStep));
+
+		doneMask |= _mm256_movemask_ps(_mm256_castsi256_ps(done));
+
+		// AVX2 packs only within each 128 bit half, so the halves get packed together with the SSE ones instead
+		__m128i words = _mm_packs_epi32(_mm256_castsi256_si128(done), _mm256_extracti128_si256(done, 1));
+		__m128i bytes = _mm_and_si128(_mm_packs_epi16(words, words), _mm_set1_epi8(1));
+
+		_mm_storel_epi64((__m128i*)(env.Dones + i), bytes);
+	}
+
+	return WriteEnvResultsSSE(env, i, end) || doneMask != 0;
+}
+
+void VectorEnv::WriteObservations()
+{
+	// Same layout as the sim, so it's a straight copy of each field instead of gathering every match's fields together
+	const std::vector<float>* fields[ENV_OBSERVATION_SIZE] = { &Batch.Paddle1Y, &Batch.Paddle2Y, &Batch.BallX, &Batch.BallY, &Batch.DirectionX, &Batch.DirectionY };
+
+	for (uint32_t field = 0; field < ENV_OBSERVATION_SIZE; field++)
+	{
+		memcpy(Observations + (size_t)field * MatchCount, fields[field]->data(), MatchCount * sizeof(float));
+	}
+}
+
+void* PongEnvCreate(uint32_t matchCount, uint64_t seed, int autoReset)
+{
+	VectorEnv* env = new VectorEnv();
+	env->Init(matchCount, seed, autoReset != 0);
+
+	return env;
+}
+
+void PongEnvBind(void* env, float* observations, float* rewards, uint8_t* dones)
+{
+	((VectorEnv*)env)->Bind(observations, rewards, dones);
+}
+
+void PongEnvReset(void* env, const uint32_t* seeds)
+{
+	((VectorEnv*)env)->Reset(seeds);
+}
+
+void PongEnvStep(void* env, const uint8_t* actions)
+{
+	((VectorEnv*)env)->Step(actions);
+}
+
+void PongEnvDestroy(void* env)
+{
+	delete (VectorEnv*)env;
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+// The game rules on their own: PongSim, the SIMD BatchSim and the VectorEnv on top of it
+// Needs nothing but glm, so it also builds into the PongEnv library for training code
+
+#include <cstdint>
+#include <array>
+#include <vector>
+
+#include <immintrin.h>
+#ifdef _MSC_VER
+	#include <intrin.h>
+
+	// MSVC lets you use any intrinsic without changing the target architecture
+	#define TARGET_AVX2
+#else
+	#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#include <glm/glm.hpp>
+
+#include "PongEnv.h"
+
+// The field goes from -ASPECT_RATIO to ASPECT_RATIO in x and from -1 to 1 in y, the shape of the default window
+constexpr float ASPECT_RATIO = 1280.0f / 720.0f;
+
+constexpr float PLAYER_WIDTH = 0.1f;
+constexpr float PLAYER_HEIGHT = 0.6f;
+constexpr float PLAYER_POSITION = 0.1f;
+constexpr float PADDING = 0.005f;
+constexpr float MOVEMENT_SPEED = 0.05f;
+
+constexpr float BALL_SIZE = 0.1f;
+constexpr float MIN_BALL_SPEED = 0.05f;
+constexpr float MAX_BALL_SPEED = 0.15f;
+
+// Where the ball's center touches the ceiling/floor and the line the paddles sit on
+constexpr float BALL_LIMIT_X = ASPECT_RATIO - PLAYER_POSITION - BALL_SIZE / 2.0f;
+constexpr float BALL_LIMIT_Y = 1.0f - BALL_SIZE / 2.0f;
+
+// Bounces resolved within a single step, only a ball stuck in a corner at a huge time scale can run out
+constexpr int MAX_BALL_IMPACTS = 8;
+
+// MOVEMENT_SPEED and the ball speeds are distances per tick at this rate
+constexpr double REFERENCE_TICK_RATE = 60.0;
+
+// Only used to decide when a headless match is over, the windowed game runs until you quit
+constexpr unsigned int WINNING_SCORE = 5;
+constexpr uint64_t MAX_MATCH_STEPS = 100000;
+
+// Used whenever nobody asks for a specific seed, so runs are reproducible by default
+constexpr uint64_t DEFAULT_SEED = 0x5EED5EED5EED5EEDull;
+
+// Philox4x32-10 constants (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3")
+constexpr uint32_t PHILOX_M0 = 0xD2511F53;
+constexpr uint32_t PHILOX_M1 = 0xCD9E8D57;
+constexpr uint32_t PHILOX_W0 = 0x9E3779B9;
+constexpr uint32_t PHILOX_W1 = 0xBB67AE85;
+constexpr int PHILOX_ROUNDS = 10;
+
+// Floats per match in a VectorEnv's observations: both paddles' y, the ball's position and its direction
+constexpr uint32_t ENV_OBSERVATION_SIZE = 6;
+
+// Episode e of a VectorEnv match seeded with s plays Philox stream s + e * this, so auto resets stay reproducible
+constexpr uint32_t ENV_EPISODE_STREAM_STRIDE = 0x9E3779B9;
+
+// One bit per key, so a whole tick of input fits into a single byte
+enum InputFlags : uint8_t
+{
+	INPUT_NONE = 0,
+	INPUT_PLAYER1_UP = 1 << 0,
+	INPUT_PLAYER1_DOWN = 1 << 1,
+	INPUT_PLAYER2_UP = 1 << 2,
+	INPUT_PLAYER2_DOWN = 1 << 3,
+};
+
+// Counter based random numbers: draw n of a stream is just Philox(key = seed, counter = { n, stream })
+// No hidden state, so every match gets its own stream and skipping ahead is free
+struct PhiloxStream
+{
+	uint64_t Seed = DEFAULT_SEED;
+	uint32_t Stream = 0;
+	uint32_t Position = 0;
+
+	// Uniform in [0, 1)
+	float NextFloat();
+
+	void Skip(uint32_t count) { Position += count; }
+};
+
+enum ImpactKind
+{
+	IMPACT_WALL,
+	IMPACT_PADDLE,
+	IMPACT_GOAL,
+};
+
+// Where the ball hit something during a step, the normal points back into the field
+struct BallImpact
+{
+	glm::vec2 Position;
+	glm::vec2 Normal;
+	ImpactKind Kind;
+};
+
+// Every impact is one loop iteration in MoveBall, so there can't be more than MAX_BALL_IMPACTS
+struct ImpactList
+{
+	std::array<BallImpact, MAX_BALL_IMPACTS> Impacts;
+	uint32_t Count = 0;
+
+	void Add(const glm::vec2& position, const glm::vec2& normal, ImpactKind kind) { Impacts[Count++] = { position, normal, kind }; }
+};
+
+// Everything the game rules need, no window or GPU required
+struct PongSim
+{
+	std::array<glm::vec2, 3> Positions;
+	glm::vec2 BallDirection;
+	unsigned int Scores[2];
+	uint64_t StepCount;
+
+	PhiloxStream Random;
+
+	// Tick duration relative to REFERENCE_TICK_RATE, not touched by Reset()
+	float TimeScale = 1.0f;
+
+	// What the ball hit during the last step, only there for effects
+	ImpactList Impacts;
+
+	PongSim() { Reset(); }
+
+	// The same seed and stream always play out the same way for the same inputs
+	void Reset(uint64_t seed = DEFAULT_SEED, uint32_t stream = 0);
+
+	// Returns the player that scored during this step (1 or 2), 0 otherwise
+	int Step(uint8_t inputs);
+
+	bool IsOver() const;
+};
+
+enum SimdLevel
+{
+	SIMD_SCALAR,
+	SIMD_SSE,
+	SIMD_AVX2,
+};
+
+// Structure of arrays version of PongSim, steps lots of matches at once with SIMD
+struct BatchSim
+{
+	SimdLevel Level;
+	float TimeScale = 1.0f;
+
+	uint64_t Seed = DEFAULT_SEED;
+
+	uint32_t MatchCount = 0;
+	uint64_t StepCount = 0;
+
+	std::vector<float> BallX;
+	std::vector<float> BallY;
+	std::vector<float> DirectionX;
+	std::vector<float> DirectionY;
+	std::vector<float> Paddle1Y;
+	std::vector<float> Paddle2Y;
+
+	std::vector<uint32_t> Scores1;
+	std::vector<uint32_t> Scores2;
+
+	// PhiloxStream::Stream and ::Position of every match
+	std::vector<uint32_t> RandomStreams;
+	std::vector<uint32_t> RandomPositions;
+
+	// Result of the last step for every match, same meaning as the return value of MoveBall
+	std::vector<int32_t> ScoringPlayers;
+
+	// Uses the best kernel the CPU supports
+	BatchSim();
+
+	// Match i uses random stream i, so it plays out exactly like PongSim::Reset(seed, i)
+	void Reset(uint32_t matchCount, uint64_t seed = DEFAULT_SEED);
+	void ResetMatch(uint32_t match, uint32_t stream);
+
+	// One input byte per match
+	void Step(const uint8_t* inputs);
+	void StepRange(const uint8_t* inputs, uint32_t begin, uint32_t end);
+};
+
+// Reinforcement learning environment over a whole BatchSim: observations, rewards and done flags go straight into buffers
+// the caller owns, and nothing gets allocated after Init()
+// Everything is laid out like the sim, one row of MatchCount values per field, so a transposed view gets [match][field]:
+// ENV_OBSERVATION_SIZE rows of floats for the observations (paddle 1 y, paddle 2 y, ball x, ball y, direction x, direction y),
+// two rows of floats for the rewards (player 1's, then player 2's: +1 for scoring, -1 for being scored on) and a row of bytes
+// for the done flags
+struct VectorEnv
+{
+	BatchSim Batch;
+
+	// A finished match starts over right away, its done flag and reward are for the last step of the old episode but the
+	// observation is already the first one of the new episode
+	// Without it a finished match keeps playing and stays done until the next Reset()
+	bool AutoReset = true;
+
+	uint32_t MatchCount = 0;
+
+	// Per match, the seed it was reset with, how many episodes it has finished and how many steps into this one it is
+	std::vector<uint32_t> Seeds;
+	std::vector<uint32_t> Episodes;
+	std::vector<uint32_t> StepCounts;
+
+	float* Observations = nullptr;
+	float* Rewards = nullptr;
+	uint8_t* Dones = nullptr;
+
+	// The only place anything gets allocated
+	void Init(uint32_t matchCount, uint64_t seed = DEFAULT_SEED, bool autoReset = true);
+
+	// Has to be called before Reset(), the buffers need room for MatchCount matches
+	void Bind(float* observations, float* rewards, uint8_t* dones);
+
+	// Match i with seed s plays out like PongSim::Reset(seed, s), no seeds means seed i
+	void Reset(const uint32_t* seeds = nullptr);
+
+	// One action byte per match, with the InputFlags of both paddles in it
+	void Step(const uint8_t* actions);
+
+	void WriteObservations();
+};
+
+void MovePlayer(float& position, float amount);
+int MoveBall(std::array<glm::vec2, 3>& positions, glm::vec2& direction, PhiloxStream& random, float timeScale = 1.0f, ImpactList* impacts = nullptr);
+void Bounce(const glm::vec2& surfaceNormal, glm::vec2& direction, PhiloxStream& random);
+float RandomBounceOffset(PhiloxStream& random);
+
+std::array<uint32_t, 4> Philox4x32(std::array<uint32_t, 4> counter, uint64_t key);
+__m128 PhiloxFloatSSE(__m128i positions, __m128i streams, uint64_t seed);
+TARGET_AVX2 __m256 PhiloxFloatAVX2(__m256i positions, __m256i streams, uint64_t seed);
+
+SimdLevel DetectSimdLevel();
+const char* GetSimdLevelName(SimdLevel level);
+
+void StepBatchScalar(BatchSim& batch, const uint8_t* inputs, uint32_t begin, uint32_t end);
+void StepBatchSSE(BatchSim& batch, const uint8_t* inputs, uint32_t begin, uint32_t end);
+TARGET_AVX2 void StepBatchAVX2(BatchSim& batch, const uint8_t* inputs, uint32_t begin, uint32_t end);
+
+// Rewards, step counts and done flags of a VectorEnv after its batch stepped, returns whether any match is done
+bool WriteEnvResultsScalar(VectorEnv& env, uint32_t begin, uint32_t end);
+bool WriteEnvResultsSSE(VectorEnv& env, uint32_t begin, uint32_t end);
+TARGET_AVX2 bool WriteEnvResultsAVX2(VectorEnv& env, uint32_t begin, uint32_t end);
@@ -2,22 +2,84 @@
 
 #include "CustomAssert.h"
 
+#include "PongSim.h"
+
 constexpr uint32_t WIDTH = 1280;
 constexpr uint32_t HEIGHT = 720;
 
-constexpr float ASPECT_RATIO = (float)WIDTH / HEIGHT;
+// Per frame resources are made for MAX_FRAMES_IN_FLIGHT, --frames-in-flight picks how many of them are used
+constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+constexpr uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+
+// --verify-scheduler plays this many frames per setup, the fake GPU takes SCHEDULER_GPU_FRAME_TIME for each of them
+constexpr uint32_t SCHEDULER_VERIFY_FRAMES = 200;
+constexpr auto SCHEDULER_GPU_FRAME_TIME = std::chrono::milliseconds(2);
+
+// Dynamic GPU data (instances, uniforms, streamed vertices) per frame in flight, 4 MiB is 87381 quad instances
+constexpr VkDeviceSize FRAME_RING_BUFFER_SIZE = 4 << 20;
+
+// GPU memory is allocated in blocks of 1 << GPU_MEMORY_BLOCK_ORDER bytes (32 MiB) and split by a buddy allocator
+// down to 1 << GPU_MEMORY_MIN_ORDER bytes (256), bigger resources get a dedicated allocation of just their size
+constexpr uint32_t GPU_MEMORY_BLOCK_ORDER = 25;
+constexpr uint32_t GPU_MEMORY_MIN_ORDER = 8;
+
+// Long hitches (dragging the window, breakpoints, ...) would otherwise make the sim try to catch up for ages
+constexpr double MAX_FRAME_TIME = 0.25;
+
+// "PREC" when read as bytes
+constexpr uint32_t RECORDING_MAGIC = 0x43455250;
+constexpr uint32_t RECORDING_VERSION = 2;
+
+// Seeking restores the keyframe before the tick and steps from there, so this is the most steps a seek ever takes
+constexpr uint32_t KEYFRAME_INTERVAL = 1024;
+
+// Matches per work item in the match farm, small enough to balance well and big enough that stealing stays rare
+constexpr uint32_t FARM_CHUNK_SIZE = 16;
+
+// How often --hot-reload looks at the shader files
+constexpr auto SHADER_POLL_INTERVAL = std::chrono::milliseconds(250);
+
+// Default for --particles, the compute shader simulates every one of them every frame
+constexpr uint32_t DEFAULT_PARTICLE_COUNT = 1 << 20;
+
+// The CPU fallback copies its particles into the frame ring buffer, so it only gets three quarters of what fits in there
+constexpr uint32_t MAX_CPU_PARTICLES = 65536;
+
+// Bursts spawned per frame, more impacts than that in a single frame just don't get any
+constexpr uint32_t MAX_PARTICLE_EMITTERS = 32;
+
+// Has to match local_size_x in particles.comp
+constexpr uint32_t PARTICLE_WORKGROUP_SIZE = 256;
+
+// Field units per second squared (down) and the fraction of speed lost per second
+constexpr float PARTICLE_GRAVITY = 1.5f;
+constexpr float PARTICLE_DRAG = 1.0f;
+
+// Embers live this long on average, so the lava spawns capacity / LAVA_AVERAGE_LIFE of them per second to keep the buffer full
+constexpr float LAVA_AVERAGE_LIFE = 1.5f;
+
+// Share of the field the balls cover in multi-ball mode, the radius shrinks as the count goes up
+constexpr float MULTIBALL_COVERAGE = 0.1f;
 
-constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+// What --bench-multiball goes up to unless --multiball says otherwise
+constexpr uint32_t MULTIBALL_BENCHMARK_COUNT = 100000;
 
-constexpr float PLAYER_WIDTH = 0.1f;
-constexpr float PLAYER_HEIGHT = 0.6f;
-constexpr float PLAYER_POSITION = 0.1f;
-constexpr float PADDING = 0.005f;
-constexpr float MOVEMENT_SPEED = 0.05f;
+// Bots draw from the match seed xor this, so they never share a Philox stream with a match
+constexpr uint64_t AI_SEED_SALT = 0xB07B07B07B07B07Bull;
 
-constexpr float BALL_SIZE = 0.1f;
-constexpr float MIN_BALL_SPEED = 0.05f;
-constexpr float MAX_BALL_SPEED = 0.15f;
+// How far PredictBallYBySteps() looks ahead before it gives up, a ball crosses the field in well under 100 ticks
+constexpr uint32_t MAX_LOOKAHEAD_STEPS = 1000;
+
+// Everything the quad pipeline draws comes out of one texture this big, see CreateSpriteAtlas()
+constexpr uint32_t SPRITE_ATLAS_SIZE = 256;
+
+// 5x7 pixel font, every font pixel is FONT_TEXEL_SCALE texels wide so linear filtering only softens the glyph edges a bit
+constexpr uint32_t FONT_GLYPH_WIDTH = 5;
+constexpr uint32_t FONT_GLYPH_HEIGHT = 7;
+constexpr uint32_t FONT_TEXEL_SCALE = 4;
+
+// The profiler keeps the last this many timer events (power of 2), at 5-10 per frame that's a couple of minutes
+constexpr uint32_t PROFILER_EVENT_CAPACITY = 1 << 16;
 
 struct QueueFamilyIndices
 {
@@ -27,6 +89,10 @@ struct QueueFamilyIndices
 	uint32_t PresentFamily;
 	bool HasPresentFamily = false;
 
+	// Same as GraphicsFamily unless the GPU has a family that only does transfers (a separate copy engine)
+	uint32_t TransferFamily;
+	bool HasDedicatedTransferFamily = false;
+
 	bool IsComplete()
 	{
 		return HasGraphicsFamily && HasPresentFamily;
@@ -102,1617 +168,8783 @@ struct Vertex
 	}
 };
 
-struct SyncObjects
+// Per instance data for the quad pipeline, one of these per paddle/ball/... instead of a push constant and a draw each
+struct QuadInstance
 {
-	std::vector<VkSemaphore> ImageAvailableSemaphores;
-	std::vector<VkSemaphore> RenderingFinishedSemaphores;
-	std::vector<VkFence> InFlightFences;
-	std::vector<VkFence> ImagesInFlight;
+	glm::vec2 Position;
+	glm::vec2 Size;
+	glm::vec4 Color;
+
+	// Top left and bottom right corner in the sprite atlas, all zeros is its white texel so plain quads can leave it out
+	glm::vec4 UV = glm::vec4(0.0f);
+
+	static std::vector<VkVertexInputBindingDescription> GetBindingDescriptions()
+	{
+		std::vector<VkVertexInputBindingDescription> bindingDescriptions(1);
+
+		// Binding 0 is the quad itself (Vertex)
+		bindingDescriptions[0].binding = 1;
+		bindingDescriptions[0].stride = sizeof(QuadInstance);
+		bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+		return bindingDescriptions;
+	}
+
+	static std::vector<VkVertexInputAttributeDescription> GetAttributeDescriptions()
+	{
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions(4);
+
+		attributeDescriptions[0].binding = 1;
+		attributeDescriptions[0].location = 2;
+		attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+		attributeDescriptions[0].offset = offsetof(QuadInstance, Position);
+
+		attributeDescriptions[1].binding = 1;
+		attributeDescriptions[1].location = 3;
+		attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
+		attributeDescriptions[1].offset = offsetof(QuadInstance, Size);
+
+		attributeDescriptions[2].binding = 1;
+		attributeDescriptions[2].location = 4;
+		attributeDescriptions[2].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[2].offset = offsetof(QuadInstance, Color);
+
+		attributeDescriptions[3].binding = 1;
+		attributeDescriptions[3].location = 5;
+		attributeDescriptions[3].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[3].offset = offsetof(QuadInstance, UV);
+
+		return attributeDescriptions;
+	}
 };
 
-struct ShaderMatrices
+struct GpuAllocation
 {
-	glm::mat4 Projection;
-	glm::mat4 Transform;
+	VkDeviceMemory Memory = VK_NULL_HANDLE;
+	VkDeviceSize Offset = 0;
+
+	// What was asked for, the allocation itself is 1 << Order bytes (or Size rounded up to the granularity when it's dedicated)
+	VkDeviceSize Size = 0;
+
+	// Only set for HOST_VISIBLE memory, blocks stay mapped for their whole lifetime
+	uint8_t* Mapped = nullptr;
+
+	uint32_t Block = 0;
+	uint32_t Order = 0;
+
+	// Too big for a block, Memory belongs to this allocation alone and Block and Order mean nothing
+	bool Dedicated = false;
 };
 
-GLFWwindow* CreateGlfwWindow();
+struct GpuMemoryBlock
+{
+	VkDeviceMemory Memory = VK_NULL_HANDLE;
+	uint32_t MemoryType = 0;
 
-VkDebugUtilsMessengerCreateInfoEXT GetDebugMessengerInfo();
-static VKAPI_ATTR VkBool32 VKAPI_CALL VulkanDebugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType, const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData);
+	// The block is 1 << Order bytes
+	uint32_t Order = 0;
 
-VkInstance CreateInstance(bool enableValidationLayers, const std::vector<const char*>& validationLayers);
-bool CheckValidationLayerSupport(const std::vector<const char*>& validationLayers);
+	uint8_t* Mapped = nullptr;
 
-VkDebugUtilsMessengerEXT SetupDebugMessenger(VkInstance instance);
-VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger);
-void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT debugMessenger, const VkAllocationCallbacks* pAllocator);
+	// FreeLists[i] holds the offsets of the free ranges of 1 << (GPU_MEMORY_MIN_ORDER + i) bytes
+	std::vector<std::set<VkDeviceSize>> FreeLists;
 
-VkSurfaceKHR CreateSurface(VkInstance instance, GLFWwindow* window);
+	VkDeviceSize UsedBytes = 0;
+	uint32_t AllocationCount = 0;
+};
 
-VkPhysicalDevice ChoosePhysicalDevice(VkInstance instance, VkSurfaceKHR surface, const std::vector<const char*>& deviceExtensions);
-QueueFamilyIndices GetQueueFamilies(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface);
-bool SupportsRequiredExtensions(const VkPhysicalDevice& device, const std::vector<const char*>& deviceExtensions);
-SwapChainSupportDetails QuerySwapChainSupport(const VkPhysicalDevice& device, const VkSurfaceKHR& surface);
-bool SupportsAnisotropicSampling(const VkPhysicalDevice& device);
-bool IsDeviceSuitable(const VkPhysicalDevice& device, const VkSurfaceKHR& surface, const std::vector<const char*>& deviceExtensions);
+// Drivers can cap the number of vkAllocateMemory() calls at maxMemoryAllocationCount (4096 on lots of them) and every
+// call is slow, so buffers and images get carved out of a few big blocks per memory type instead
+struct GpuAllocator
+{
+	VkDevice Device = VK_NULL_HANDLE;
+	VkPhysicalDevice PhysicalDevice = VK_NULL_HANDLE;
 
-uint32_t FindMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
+	VkPhysicalDeviceMemoryProperties MemoryProperties{};
 
-VkDevice ChooseLogicalDevice(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, const QueueFamilyIndices& indices, const std::vector<const char*>& deviceExtensions);
+	// Buffers and optimally tiled images closer than this can alias on some GPUs, so everything is rounded to it
+	VkDeviceSize Granularity = 1;
 
-VkQueue GetQueue(VkDevice device, uint32_t queueFamily, uint32_t queueIndex = 0);
+	// Blocks that got freed keep their slot (with a null Memory) so GpuAllocation::Block stays valid
+	std::vector<GpuMemoryBlock> Blocks;
 
-VkCommandPool CreateCommandPool(VkDevice device, uint32_t queueFamilyIndex);
+	VkDeviceSize RequestedBytes = 0;
+	uint32_t AllocationCount = 0;
+	uint32_t DeviceAllocationCount = 0;
 
-VkSurfaceFormatKHR ChooseSwapChainSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
-VkPresentModeKHR ChoosePresentMode(const std::vector<VkPresentModeKHR>& availableModes);
-VkExtent2D ChooseExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabilities);
+	// Part of the counts above too
+	VkDeviceSize DedicatedBytes = 0;
+	uint32_t DedicatedCount = 0;
 
-VkSwapchainKHR CreateSwapChain(VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, VkSurfaceCapabilitiesKHR capabilities, VkExtent2D extent, VkSurfaceFormatKHR surfaceFormat, VkPresentModeKHR presentMode, const QueueFamilyIndices& queueIndices);
+	GpuAllocation Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties);
+	void Free(GpuAllocation& allocation);
 
-void GetSwapChainImages(VkDevice device, VkSwapchainKHR swapChain, std::vector<VkImage>& images);
-void CreateImageViews(VkDevice device, const std::vector<VkImage>& swapChainImages, VkFormat imageFormat, std::vector<VkImageView>& imageViews);
+	VkBuffer CreateBuffer(const VkBufferCreateInfo& bufferInfo, VkMemoryPropertyFlags properties, GpuAllocation& allocation);
+	void DestroyBuffer(VkBuffer buffer, GpuAllocation& allocation);
 
-VkFormat FindSupportedDepthFormat(VkPhysicalDevice physicalDevice);
+	VkImage CreateImage(const VkImageCreateInfo& imageInfo, VkMemoryPropertyFlags properties, GpuAllocation& allocation);
+	void DestroyImage(VkImage image, GpuAllocation& allocation);
 
-void CreateDepthResources(VkDevice device, VkPhysicalDevice physicalDevice, VkMemoryPropertyFlags properties, VkFormat depthFormat, VkExtent2D swapChainExtent, uint32_t imageCount, std::vector<VkImage>& depthImages, std::vector<VkDeviceMemory>& depthMemory, std::vector<VkImageView>& depthImageViews);
+	void PrintStats();
+};
 
-VkRenderPass CreateRenderPass(VkDevice device, VkPhysicalDevice physicalDevice, VkFormat imageFormat, VkFormat depthFormat);
+struct RingAllocation
+{
+	VkBuffer Buffer = VK_NULL_HANDLE;
+	VkDeviceSize Offset = 0;
+	void* Data = nullptr;
+};
 
-void CreateFramebuffers(VkDevice device, VkRenderPass renderPass, VkExtent2D swapChainExtent, uint32_t imageCount, const std::vector<VkImageView>& colorImageViews, const std::vector<VkImageView>& depthImageViews, std::vector<VkFramebuffer>& framebuffers);
+// One host visible buffer split into MAX_FRAMES_IN_FLIGHT partitions and mapped for its whole lifetime
+// Frame i bump allocates from partition i, which is only reset by BeginFrame(i) after InFlightFences[i] has been waited on,
+// so the GPU never reads what the CPU is writing and there are no map calls or allocations per frame
+struct FrameRingBuffer
+{
+	VkBuffer Buffer = VK_NULL_HANDLE;
+	GpuAllocation Allocation;
+	uint8_t* Mapped = nullptr;
 
-void CreateSyncObjects(VkDevice device, uint32_t imageCount, SyncObjects& syncObjects);
+	VkDeviceSize PartitionSize = 0;
 
-VkPipelineLayout CreatePipelineLayout(VkDevice device);
+	// Offsets of uniform buffer bindings have to be a multiple of this
+	VkDeviceSize UniformAlignment = 1;
 
-VkPipeline CreatePipeline(VkDevice device, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, const fs::path& vertexShaderPath, const fs::path& fragmentShaderPath);
-std::string ReadFile(const fs::path& filePath);
-VkShaderModule CreateShaderModule(VkDevice device, const std::string& shaderSource);
+	uint32_t Frame = 0;
+	VkDeviceSize Offset = 0;
 
-VkBuffer CreateVertexBuffers(VkDevice device, VkPhysicalDevice physicalDevice, const std::vector<Vertex>& vertices, VkDeviceMemory& deviceMemory);
+	// Bytes used by each partition the last time it was filled, and the most any frame ever used
+	std::array<VkDeviceSize, MAX_FRAMES_IN_FLIGHT> FrameBytes{};
+	VkDeviceSize HighWaterMark = 0;
 
-void CreateCommandBuffers(VkDevice device, VkCommandPool commandPool, uint32_t imageCount, std::vector<VkCommandBuffer>& commandBuffers);
+	// Allocations that didn't fit into their partition, those come back with Data == nullptr
+	uint32_t Overflows = 0;
 
-void RecordCommandBuffer(const std::array<glm::mat4, 3> transforms, VkCommandBuffer commandBuffer, VkFramebuffer framebuffer, VkExtent2D swapChainExtent, VkRenderPass renderPass, VkPipeline pipeline, VkPipelineLayout layout, VkBuffer vertexBuffer, uint32_t vertexCount);
+	void BeginFrame(uint32_t frame);
 
-void DrawFrame(VkDevice device, VkSwapchainKHR swapChain, VkQueue graphicsQueue, VkQueue presentQueue, const std::vector<VkCommandBuffer>& commandBuffers, SyncObjects& syncObjects, const std::array<glm::mat4, 3>& transforms, const std::vector<VkFramebuffer>& framebuffers, VkExtent2D swapChainExtent, VkRenderPass renderPass, VkPipeline pipeline, VkPipelineLayout pipelineLayout, VkBuffer vertexBuffer, uint32_t verticesSize);
-uint32_t AquireNextImage(VkDevice device, VkSwapchainKHR swapChain, SyncObjects& syncObjects, uint32_t currentFrame);
-void SubmitCommandBuffers(VkDevice device, VkSwapchainKHR swapChain, VkQueue graphicsQueue, VkQueue presentQueue, VkCommandBuffer commandBuffer, SyncObjects& syncObjects, uint32_t imageIndex, uint32_t currentFrame);
+	// Data is nullptr if the partition is full, the caller has to skip what it wanted to write
+	RingAllocation Allocate(VkDeviceSize size, VkDeviceSize alignment = 16);
+};
 
-std::array<glm::mat4, 3> CalculateTransforms(const std::array<glm::vec2, 3>& positions);
-void MovePlayer(float& position, float amount);
-int MoveBall(std::array<glm::vec2, 3>& positions, glm::vec2& direction);
-void Bounce(const glm::vec2& surfaceNormal, glm::vec2& direction);
+struct PendingCopy
+{
+	VkDeviceSize StagingOffset;
+	VkBuffer Destination;
+	VkDeviceSize Size;
+};
 
-int main()
+struct PendingImageCopy
 {
-	ASSERT(glfwInit(), "Failed to initialize GLFW.");
+	VkDeviceSize StagingOffset;
+	VkImage Destination;
+	VkExtent2D Extent;
+};
 
-	GLFWwindow* window = CreateGlfwWindow();
+// Static data goes into DEVICE_LOCAL buffers: CreateBuffer() queues a copy, Submit() stages everything queued in one
+// host visible buffer and copies it over in a single submission on the transfer queue
+struct StagingUploader
+{
+	VkDevice Device = VK_NULL_HANDLE;
+	GpuAllocator* Allocator = nullptr;
 
-	#ifdef CONFIGURATION_DEBUG
-		const bool enableValidationLayers = true;
-	#else
-		const bool enableValidationLayers = false;
-	#endif
+	VkQueue TransferQueue = VK_NULL_HANDLE;
 
-	std::vector<const char*> validationLayers(1);
-	validationLayers[0] = "VK_LAYER_KHRONOS_validation";
+	// Buffers are shared between these two when they're different, so no queue ownership transfers are needed
+	uint32_t TransferFamily = 0;
+	uint32_t GraphicsFamily = 0;
 
-	VkInstance instance = CreateInstance(enableValidationLayers, validationLayers);
+	VkCommandPool CommandPool = VK_NULL_HANDLE;
+	VkCommandBuffer CommandBuffer = VK_NULL_HANDLE;
 
-	VkDebugUtilsMessengerEXT debugMessenger;
-	if (enableValidationLayers)
-	{
-		debugMessenger = SetupDebugMessenger(instance);
-	}
+	// Timeline of the transfer queue, every Submit() signals the next value when its copies are done
+	VkSemaphore Timeline = VK_NULL_HANDLE;
+	uint64_t SubmittedValue = 0;
 
-	// TODO describe
-	VkSurfaceKHR surface = CreateSurface(instance, window);
+	std::vector<uint8_t> StagingData;
+	std::vector<PendingCopy> Copies;
+	std::vector<PendingImageCopy> ImageCopies;
 
-	std::vector<const char*> deviceExtensions(1);
-	deviceExtensions[0] = "VK_KHR_swapchain";
+	VkBuffer StagingBuffer = VK_NULL_HANDLE;
+	GpuAllocation StagingAllocation;
 
-	VkPhysicalDevice physicalDevice = ChoosePhysicalDevice(instance, surface, deviceExtensions);
+	uint64_t UploadedBytes = 0;
 
-	VkPhysicalDeviceProperties physicalDeviceProperties;
-	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+	VkBuffer CreateBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, GpuAllocation& allocation);
 
-	std::cout << "Using GPU: " << physicalDeviceProperties.deviceName << "\n";
+	// A single 2D mip, tightly packed texels, ends up in SHADER_READ_ONLY_OPTIMAL
+	VkImage CreateImage(const void* data, VkExtent2D extent, VkFormat format, uint32_t texelSize, VkImageUsageFlags usage, GpuAllocation& allocation);
 
-	QueueFamilyIndices queueIndices = GetQueueFamilies(physicalDevice, surface);
+	// Returns the value of Timeline that has to be waited on before using the buffers, 0 if there was nothing to upload
+	uint64_t Submit();
 
-	VkDevice logicalDevice = ChooseLogicalDevice(physicalDevice, surface, queueIndices, deviceExtensions);
+	// Frees the staging buffer once the GPU is done with it
+	void Reclaim(bool wait = false);
+};
 
-	VkQueue graphicsQueue = GetQueue(logicalDevice, queueIndices.GraphicsFamily);
-	VkQueue presentQueue = GetQueue(logicalDevice, queueIndices.PresentFamily);
+enum ProfileTrack : uint32_t
+{
+	PROFILE_TRACK_CPU = 0,
+	PROFILE_TRACK_GPU = 1,
 
-	VkCommandPool commandPool = CreateCommandPool(logicalDevice, queueIndices.GraphicsFamily);
+	// Input sampled until the frame was handed to present
+	PROFILE_TRACK_LATENCY = 2,
+};
 
-	SwapChainSupportDetails supportDetails = QuerySwapChainSupport(physicalDevice, surface);
+struct ProfileEvent
+{
+	const char* Name;
 
-	VkExtent2D swapChainExtent = ChooseExtent(supportDetails.Capabilities);
-	VkSurfaceFormatKHR swapChainSurfaceFormat = ChooseSwapChainSurfaceFormat(supportDetails.SurfaceFormats);
-	VkPresentModeKHR swapChainPresentMode = ChoosePresentMode(supportDetails.PresentModes);
+	// Nanoseconds since the profiler was created
+	uint64_t Start;
+	uint64_t Duration;
 
-	VkSwapchainKHR swapChain = CreateSwapChain(logicalDevice, physicalDevice, surface, supportDetails.Capabilities, swapChainExtent, swapChainSurfaceFormat, swapChainPresentMode, queueIndices);
+	// See ProfileTrack
+	uint32_t Track;
+};
 
-	std::vector<VkImage> swapChainImages;
-	GetSwapChainImages(logicalDevice, swapChain, swapChainImages);
+// Scoped CPU timers and GPU timestamps around the render pass, all in one ring of events that any thread can append to
+// with a single atomic add, old events just get overwritten. Only read once nothing is recording anymore
+struct FrameProfiler
+{
+	std::vector<ProfileEvent> Events;
+	std::atomic<uint64_t> EventCount{ 0 };
 
-	uint32_t swapChainImageCount = swapChainImages.size();
+	std::chrono::steady_clock::time_point StartTime;
 
-	std::vector<VkImageView> swapChainImageViews;
-	CreateImageViews(logicalDevice, swapChainImages, swapChainSurfaceFormat.format, swapChainImageViews);
+	VkDevice Device = VK_NULL_HANDLE;
 
-	VkFormat depthFormat = FindSupportedDepthFormat(physicalDevice);
+	// Two timestamps per frame in flight, null if the GPU can't write timestamps on the graphics queue
+	VkQueryPool QueryPool = VK_NULL_HANDLE;
+	double TimestampPeriod = 1.0;
 
-	std::vector<VkImage> depthImages;
-	std::vector<VkDeviceMemory> depthMemory;
-	std::vector<VkImageView> depthImageViews;
-	CreateDepthResources(logicalDevice, physicalDevice, NULL, depthFormat, swapChainExtent, swapChainImageCount, depthImages, depthMemory, depthImageViews);
+	// When each frame in flight was submitted, and if its timestamps haven't been read yet
+	std::array<uint64_t, MAX_FRAMES_IN_FLIGHT> SubmitTimes{};
+	std::array<bool, MAX_FRAMES_IN_FLIGHT> QueriesPending{};
 
-	VkRenderPass renderPass = CreateRenderPass(logicalDevice, physicalDevice, swapChainSurfaceFormat.format, depthFormat);
+	// GPU time + GpuOffset = our time, lined up so the first GPU frame starts when it was submitted
+	bool HasGpuOffset = false;
+	double GpuOffset = 0.0;
 
-	std::vector<VkFramebuffer> framebuffers;
-	CreateFramebuffers(logicalDevice, renderPass, swapChainExtent, swapChainImageCount, swapChainImageViews, depthImageViews, framebuffers);
+	uint64_t Now() const;
+	void Record(const char* name, uint64_t start, uint64_t end, uint32_t track = PROFILE_TRACK_CPU);
 
-	SyncObjects syncObjects;
-	CreateSyncObjects(logicalDevice, swapChainImageCount, syncObjects);
+	void MarkSubmitted(uint32_t frame);
 
-	VkPipelineLayout pipelineLayout = CreatePipelineLayout(logicalDevice);
+	// Only once the fence of that frame has been waited on
+	void CollectGpuTimes(uint32_t frame);
 
-	fs::path vertexShaderPath = "shaders/pong.vert.spv";
-	fs::path fragmentShaderPath = "shaders/pong.frag.spv";
-	VkPipeline pipeline = CreatePipeline(logicalDevice, renderPass, pipelineLayout, vertexShaderPath, fragmentShaderPath);
+	void WriteChromeTrace(const fs::path& path);
+	void PrintSummary();
 
-	static std::vector<Vertex> vertices = {
-		{ { -0.5f,  0.5f }, { 1.0f, 1.0f, 1.0f } },
-		{ {  0.5f,  0.5f }, { 1.0f, 1.0f, 1.0f } },
-		{ {  0.5f, -0.5f }, { 1.0f, 1.0f, 1.0f } },
-		{ {  0.5f, -0.5f }, { 1.0f, 1.0f, 1.0f } },
-		{ { -0.5f, -0.5f }, { 1.0f, 1.0f, 1.0f } },
-		{ { -0.5f,  0.5f }, { 1.0f, 1.0f, 1.0f } },
-	};
+	// p50 of the events with that name still in the ring, 0 if there are none
+	uint64_t MedianDuration(uint32_t track, const char* name) const;
+};
 
-	VkDeviceMemory vertexBufferMemory;
-	VkBuffer vertexBuffer = CreateVertexBuffers(logicalDevice, physicalDevice, vertices, vertexBufferMemory);
+// Records the time between construction and destruction, does nothing without a profiler
+struct ProfileScope
+{
+	FrameProfiler* Profiler;
+	const char* Name;
+	uint64_t Start;
 
-	std::vector<VkCommandBuffer> commandBuffers;
-	CreateCommandBuffers(logicalDevice, commandPool, swapChainImageCount, commandBuffers);
+	ProfileScope(FrameProfiler* profiler, const char* name);
+	~ProfileScope();
+};
 
-	std::array<glm::vec2, 3> positions = { {
-		{ -ASPECT_RATIO + PLAYER_POSITION, 0.0f},
-		{  ASPECT_RATIO - PLAYER_POSITION, 0.0f },
-		{  0.0f, 0.0f },
-	} };
+// Frame N (counting from 1) signals N on a timeline semaphore of the graphics queue once the GPU is done with it, so
+// waiting for a free slot is waiting for N - FramesInFlight and the exact GPU progress is a single counter read
+struct FrameScheduler
+{
+	VkDevice Device = VK_NULL_HANDLE;
+	VkSemaphore Timeline = VK_NULL_HANDLE;
 
-	glm::vec2 ballDirection = { 1.0f, 1.0f };
-	ballDirection = glm::normalize(ballDirection);
+	// How many of the MAX_FRAMES_IN_FLIGHT slots are cycled through
+	uint32_t FramesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
 
-	unsigned int scores[2] = { 0 };
+	// The swap chain only works with binary semaphores, so there's still a pair per slot
+	std::array<VkSemaphore, MAX_FRAMES_IN_FLIGHT> ImageAvailableSemaphores{};
+	std::array<VkSemaphore, MAX_FRAMES_IN_FLIGHT> RenderingFinishedSemaphores{};
 
-	bool shouldQuit = false;
+	// The last frame that was submitted, and the one WaitForSlot() was last called for
+	uint64_t SubmittedFrame = 0;
+	uint64_t WaitedFrame = 0;
 
-	while (!glfwWindowShouldClose(window) && !shouldQuit)
-	{
-		if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-		{
-			MovePlayer(positions[0].y, -MOVEMENT_SPEED);
-		}
+	// Every frame waits on this value of the transfer queue's timeline before reading vertices, costs nothing once it's reached
+	VkSemaphore UploadTimeline = VK_NULL_HANDLE;
+	uint64_t UploadValue = 0;
 
-		if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-		{
-			MovePlayer(positions[0].y, MOVEMENT_SPEED);
-		}
+	// How many older frames were still on the GPU when a frame started, can't ever reach FramesInFlight
+	std::array<uint64_t, MAX_FRAMES_IN_FLIGHT> OverlapCounts{};
+	uint64_t MaxOverlap = 0;
 
-		if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
-		{
-			MovePlayer(positions[1].y, -MOVEMENT_SPEED);
-		}
+	// Slot of the frame that gets submitted next
+	uint32_t CurrentSlot() const;
 
-		if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
-		{
-			MovePlayer(positions[1].y, MOVEMENT_SPEED);
-		}
+	uint64_t CompletedFrame() const;
+	void WaitForFrame(uint64_t frame) const;
 
-		int scoringPlayer = MoveBall(positions, ballDirection);
+	// Blocks until the GPU is done with the frame that used the current slot last
+	void WaitForSlot(FrameProfiler* profiler = nullptr);
 
-		if (scoringPlayer)
-		{
-			scores[scoringPlayer - 1]++;
+	void PrintOverlap() const;
+};
 
-			std::cout << "\n";
-			std::cout << "Player " << scoringPlayer << " scored a goal!\n";
-			std::cout << "Score: " << scores[0] << " - " << scores[1] << "\n";
-		}
+// Everything that depends on the window size, rebuilt by RecreateSwapChain() without waiting for the device
+struct SwapChainResources
+{
+	VkSwapchainKHR SwapChain = VK_NULL_HANDLE;
+	VkExtent2D Extent{};
 
-		std::array<glm::mat4, 3> transforms = CalculateTransforms(positions);
+	std::vector<VkImage> Images;
+	std::vector<VkImageView> ImageViews;
 
-		glfwPollEvents();
-		DrawFrame(logicalDevice, swapChain, graphicsQueue, presentQueue, commandBuffers, syncObjects, transforms, framebuffers, swapChainExtent, renderPass, pipeline, pipelineLayout, vertexBuffer, vertices.size());
+	// Empty without depth, otherwise a single image shared by all framebuffers
+	std::vector<VkImage> DepthImages;
+	std::vector<GpuAllocation> DepthMemory;
+	std::vector<VkImageView> DepthImageViews;
 
-		if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
-		{
-			shouldQuit = true;
+	std::vector<VkFramebuffer> Framebuffers;
 
-			std::cout << "\n";
-			std::cout << "The game is over\n";
-			std::cout << "Score: " << scores[0] << " - " << scores[1] << "\n";
-		}
-	}
+	// Once replaced, destroyed when the GPU finished this frame
+	uint64_t RetireFrame = 0;
+};
 
-	// Clean up
+// Everything per object lives in QuadInstance now
+struct ShaderMatrices
+{
+	glm::mat4 Projection;
+};
 
-	vkQueueWaitIdle(graphicsQueue);
-	vkQueueWaitIdle(presentQueue);
+// Two balls closer than a diameter, A < B
+struct BallContact
+{
+	uint32_t A;
+	uint32_t B;
+};
 
-	vkFreeCommandBuffers(logicalDevice, commandPool, commandBuffers.size(), commandBuffers.data());
+// Any number of balls on one field, bouncing off the walls, the paddles and each other
+// The pairs to test come from a spatial hash that's rebuilt with a counting sort every step, so a step is O(n) instead of O(n^2)
+// as long as the balls don't all pile up. They all share the radius, so a cell is one diameter wide and only the 3x3 cells
+// around a ball can hold anything that touches it
+struct MultiBallSim
+{
+	float Radius = BALL_SIZE / 2.0f;
+	float CellSize = BALL_SIZE;
 
-	vkDestroyBuffer(logicalDevice, vertexBuffer, nullptr);
-	vkFreeMemory(logicalDevice, vertexBufferMemory, nullptr);
+	float TimeScale = 1.0f;
 
-	for (auto imageView : swapChainImageViews)
-	{
-		vkDestroyImageView(logicalDevice, imageView, nullptr);
-	}
+	uint32_t BallCount = 0;
+	uint64_t StepCount = 0;
 
-	vkDestroySwapchainKHR(logicalDevice, swapChain, nullptr);
+	// Only the y, the paddles never move sideways
+	float Paddles[2];
+	unsigned int Scores[2];
 
-	for (uint32_t i = 0; i < depthImages.size(); i++)
-	{
-		vkDestroyImage(logicalDevice, depthImages[i], nullptr);
-		vkFreeMemory(logicalDevice, depthMemory[i], nullptr);
-		vkDestroyImageView(logicalDevice, depthImageViews[i], nullptr);
-	}
+	std::vector<float> PositionX;
+	std::vector<float> PositionY;
+	std::vector<float> VelocityX;
+	std::vector<float> VelocityY;
 
-	for (auto framebuffer : framebuffers)
-	{
-		vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
-	}
+	PhiloxStream Random;
 
-	vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
+	// A power of two number of buckets, at least one per ball, minus one
+	uint32_t CellMask = 0;
 
-	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
-	{
-		vkDestroySemaphore(logicalDevice, syncObjects.ImageAvailableSemaphores[i], nullptr);
-		vkDestroySemaphore(logicalDevice, syncObjects.RenderingFinishedSemaphores[i], nullptr);
-		vkDestroyFence(logicalDevice, syncObjects.InFlightFences[i], nullptr);
-	}
+	// Bucket b holds CellBalls[CellStarts[b]] up to CellBalls[CellStarts[b + 1]], in ball order
+	std::vector<uint32_t> CellStarts;
+	std::vector<uint32_t> CellBalls;
+	std::vector<uint32_t> BallCells;
 
-	vkDestroySurfaceKHR(instance, surface, nullptr);
+	// Found during the last step, before they got pushed apart
+	std::vector<BallContact> Contacts;
 
-	glfwDestroyWindow(window);
-	glfwTerminate();
+	// The speeds scale with the radius, a ball never moves far enough in a tick to skip past another one
+	void Reset(uint32_t ballCount, float radius, uint64_t seed = DEFAULT_SEED);
 
-	if (enableValidationLayers)
-	{
-		DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
-	}
-}
+	// Same inputs as PongSim, the scores go up by one for every ball that gets past a paddle
+	void Step(uint8_t inputs);
 
-GLFWwindow* CreateGlfwWindow()
-{
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+	void MoveBalls();
+	void BuildGrid();
+	void FindContacts();
+	void ResolveContacts();
 
-	GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Volcanic Pong", nullptr, nullptr);
-	ASSERT(window, "Failed to create GLFW window.");
+	uint32_t HashCell(int32_t x, int32_t y) const;
 
-	return window;
-}
+	// Sends the ball off from a random spot on the center line
+	void Serve(uint32_t ball);
 
-VkDebugUtilsMessengerCreateInfoEXT GetDebugMessengerInfo()
+	// Appends a quad per ball, uv is the ball's rect in the sprite atlas
+	void WriteInstances(std::vector<QuadInstance>& instances, const glm::vec4& uv) const;
+};
+
+// How well a bot plays
+struct AiDifficulty
 {
-	static VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo{};
-	debugCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+	// Ticks between looks at the ball, it keeps going for the spot it picked last until then
+	uint32_t ReactionTicks = 8;
 
-	// Call the callback for messages of any severity and any type
-	debugCreateInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
-		VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |
-		VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
-		VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+	// Aims up to this far (in field units) above or below where the ball is going to be, a new miss every look
+	float AimError = 0.2f;
+};
 
-	debugCreateInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
-		VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
-		VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT |
-		VK_DEBUG_UTILS_MESSAGE_TYPE_DEVICE_ADDRESS_BINDING_BIT_EXT;
+// A bot for one paddle of a PongSim, only ever looks at the current state and never steps the sim ahead
+struct AiPlayer
+{
+	int Player = 0;
+	AiDifficulty Difficulty;
 
-	debugCreateInfo.pfnUserCallback = VulkanDebugCallback;
+	// Where the paddle is going, and how many ticks until it looks again
+	float Target = 0.0f;
+	uint32_t Timer = 0;
 
-	return debugCreateInfo;
-}
+	PhiloxStream Random;
 
-static VKAPI_ATTR VkBool32 VKAPI_CALL VulkanDebugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType, const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData)
-{
-	if (messageSeverity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT)
-	{
-		std::cout << pCallbackData->pMessage << "\n";
-	}
+	// Player is 0 for the left paddle, 1 for the right one
+	void Reset(int player, const AiDifficulty& difficulty, uint64_t seed = DEFAULT_SEED);
 
-	return VK_FALSE;
-}
+	// Only the INPUT_PLAYERn_UP/DOWN bits of its own paddle
+	uint8_t Update(const PongSim& sim);
 
-VkInstance CreateInstance(bool enableValidationLayers, const std::vector<const char*>& validationLayers)
+	// Same for multi-ball, it goes for whichever ball gets to its paddle line first
+	uint8_t Update(const MultiBallSim& sim);
+};
+
+// The same bots for both paddles of every match in a BatchSim, structure of arrays like the sim
+struct BatchAi
 {
-	ASSERT(enableValidationLayers <= CheckValidationLayerSupport(validationLayers), "Validation layers requested but not available");
+	AiDifficulty Difficulty;
+	uint64_t Seed = DEFAULT_SEED;
 
-	VkApplicationInfo appInfo{};
-	appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-	appInfo.pApplicationName = "VolcanicSnake";
-	appInfo.applicationVersion = VK_MAKE_API_VERSION(0, 1, 0, 0);
-	appInfo.pEngineName = "No engine";
-	appInfo.engineVersion = NULL;
-	appInfo.apiVersion = VK_API_VERSION_1_0;
+	uint32_t MatchCount = 0;
 
-	VkInstanceCreateInfo instanceCreateInfo{};
-	instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-	instanceCreateInfo.pApplicationInfo = &appInfo;
+	// Two per match, the left paddle's first
+	std::vector<float> Targets;
+	std::vector<uint32_t> Timers;
 
-	uint32_t glfwExtensionCount;
-	const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	// PhiloxStream::Position of every bot, the stream is its index
+	std::vector<uint32_t> RandomPositions;
 
-	if (enableValidationLayers)
-	{
-		extensions.push_back("VK_EXT_debug_utils");
-	}
+	void Reset(uint32_t matchCount, const AiDifficulty& difficulty, uint64_t seed = DEFAULT_SEED);
 
-	instanceCreateInfo.enabledExtensionCount = extensions.size();;
-	instanceCreateInfo.ppEnabledExtensionNames = extensions.data();
+	// Overwrites one input byte per match, with both paddles in it
+	void Decide(const BatchSim& batch, uint8_t* inputs);
+};
 
-	if (enableValidationLayers)
-	{
-		instanceCreateInfo.enabledLayerCount = (uint32_t)(validationLayers.size());
-		instanceCreateInfo.ppEnabledLayerNames = validationLayers.data();
-		
+enum StealResult
+{
+	STEAL_SUCCESS,
+	STEAL_EMPTY,
+	STEAL_RETRY,
+};
+
+// Fixed size Chase-Lev deque of task indices, Push/Pop from the owning thread only, Steal from anywhere
+struct WorkStealingDeque
+{
+	std::atomic<int64_t> Top{ 0 };
+	std::atomic<int64_t> Bottom{ 0 };
+
+	std::vector<std::atomic<uint32_t>> Tasks;
+	uint32_t Mask = 0;
+
+	void Init(uint32_t capacity);
+
+	void Push(uint32_t task);
+	bool Pop(uint32_t& task);
+	StealResult Steal(uint32_t& task);
+};
+
+struct MatchResult
+{
+	uint32_t Scores[2];
+	uint32_t StepCount;
+	uint32_t Rallies;
+	uint32_t PaddleHits;
+	uint32_t LongestRally;
+};
+
+// Padded to a cache line so the workers don't fight over each other's counters
+struct alignas(64) FarmWorkerStats
+{
+	uint64_t Matches = 0;
+	uint64_t Steps = 0;
+	uint64_t Steals = 0;
+	uint64_t StealAttempts = 0;
+	double Seconds = 0.0;
+};
+
+// Recording file layout, little endian and naturally aligned so everything can be used straight from the mapped file:
+// RecordingHeader, then for every match its Keyframes followed by its input runs, then one MatchRecord per match at IndexOffset
+struct RecordingHeader
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t MatchCount;
+	uint32_t KeyframeInterval;
+	uint64_t IndexOffset;
+};
+
+struct MatchRecord
+{
+	uint64_t Seed;
+	uint64_t KeyframeOffset;
+	uint64_t InputOffset;
+	uint32_t Stream;
+	uint32_t TickCount;
+	uint32_t KeyframeCount;
+	uint32_t InputSize;
+	float TimeScale;
+
+	// Final score, so jobs that only care about results never have to touch the match data
+	uint32_t Scores[2];
+	uint32_t Padding;
+};
+
+// Full PongSim state before tick (index * KeyframeInterval)
+struct Keyframe
+{
+	float Positions[6];
+	float BallDirection[2];
+	uint32_t Scores[2];
+	uint32_t RandomPosition;
+
+	// Input runs never cross a keyframe, so decoding can start right here
+	uint32_t InputOffset;
+};
+
+// Collects the inputs of one match at a time and appends finished matches to the file
+// Inputs are stored as runs, one varint per run: (run length - 1) << 4 | input flags
+struct RecordingWriter
+{
+	std::ofstream File;
+	uint64_t FileSize = 0;
+	std::vector<MatchRecord> Index;
+
+	MatchRecord Match;
+	std::vector<Keyframe> Keyframes;
+	std::vector<uint8_t> Inputs;
+	uint8_t RunInputs = 0;
+	uint32_t RunLength = 0;
+
+	void Open(const fs::path& path);
+	void Close();
+
+	void BeginMatch(const PongSim& sim);
+	// Has to be called right before sim.Step(inputs)
+	void RecordTick(const PongSim& sim, uint8_t inputs);
+	void EndMatch(const PongSim& sim);
+
+	void FlushRun();
+};
+
+// Read only view of a whole file, the OS pages it in as it gets touched
+struct MappedFile
+{
+	const uint8_t* Data = nullptr;
+	size_t Size = 0;
+};
+
+struct RecordingReader
+{
+	MappedFile File;
+	const RecordingHeader* Header = nullptr;
+	const MatchRecord* Matches = nullptr;
+
+	// Checks every offset and count in the file before handing anything out, returns false for a bad file
+	bool Open(const fs::path& path);
+	void Close();
+};
+
+// Plays back one recorded match through a PongSim
+struct MatchReplay
+{
+	const MatchRecord* Record = nullptr;
+	const Keyframe* Keyframes = nullptr;
+	const uint8_t* Inputs = nullptr;
+	const uint8_t* InputsEnd = nullptr;
+	uint32_t KeyframeInterval = 0;
+
+	const uint8_t* Cursor = nullptr;
+	uint8_t RunInputs = 0;
+	uint32_t RunRemaining = 0;
+
+	// Set when the input runs point outside the match, the replay just stops there
+	bool Corrupt = false;
+
+	PongSim Sim;
+
+	void Begin(const RecordingReader& reader, uint32_t match);
+
+	// Restores the closest keyframe and steps the rest of the way, so never more than KeyframeInterval - 1 steps
+	void Seek(uint32_t tick);
+
+	// Same as PongSim::Step with the recorded inputs
+	int Step();
+	bool IsOver() const;
+};
+
+// Per particle state, it only ever lives on the GPU, see Particle in particles.comp
+struct GpuParticle
+{
+	glm::vec2 Position;
+	glm::vec2 Velocity;
+	glm::vec4 Color;
+
+	float Life;
+	float MaxLife;
+	float Size;
+	float Buoyancy;
+};
+
+// Spawns Count particles into the slots starting at First, see Emitter in particles.comp
+struct ParticleEmitter
+{
+	glm::vec2 Position;
+
+	// Half the size of the box the particles spawn in
+	glm::vec2 Area;
+
+	glm::vec2 Direction;
+
+	// Radians around Direction
+	float Spread;
+	float Speed;
+
+	glm::vec4 Color;
+
+	float Life;
+	float Size;
+
+	// Scales the gravity, negative rises
+	float Buoyancy;
+
+	uint32_t First;
+	uint32_t Count;
+
+	uint32_t Padding[3];
+};
+
+static_assert(sizeof(GpuParticle) == 48 && sizeof(ParticleEmitter) == 80, "Has to match the std430 layout in particles.comp.");
+
+struct ParticlePush
+{
+	uint32_t Capacity;
+	uint32_t EmitterCount;
+	float DeltaTime;
+	uint32_t Seed;
+
+	glm::vec2 Gravity;
+	float Drag;
+	float Padding;
+};
+
+// What the ball impacts and the lava want to spawn, shared by the GPU system and the CPU fallback
+// Slots are handed out round robin, so once the buffer is full new particles replace the oldest ones
+struct ParticleEmitterQueue
+{
+	uint32_t Capacity = 0;
+
+	std::vector<ParticleEmitter> Emitters;
+
+	uint32_t Cursor = 0;
+	float LavaCarry = 0.0f;
+
+	// Seeds the spawn randomness, one per AssignSlots()
+	uint32_t FrameCount = 0;
+
+	void AddImpacts(const ImpactList& impacts);
+	void AddLava(float deltaTime);
+
+	// Once per frame, right before spawning
+	void AssignSlots();
+};
+
+// Particles simulated by a compute shader that also writes the draw: living particles end up as quad instances and their
+// count goes straight into an indirect draw, so per frame only the emitters are sent over
+struct ParticleSystem
+{
+	VkDevice Device = VK_NULL_HANDLE;
+
+	uint32_t Capacity = 0;
+	uint32_t IndexCount = 0;
+
+	VkBuffer ParticleBuffer = VK_NULL_HANDLE;
+	GpuAllocation ParticleMemory;
+
+	// Drawn with the quad pipeline like everything else
+	VkBuffer InstanceBuffer = VK_NULL_HANDLE;
+	GpuAllocation InstanceMemory;
+
+	// A VkDrawIndexedIndirectCommand, the shader counts the instances
+	VkBuffer DrawBuffer = VK_NULL_HANDLE;
+	GpuAllocation DrawMemory;
+
+	VkBuffer EmitterBuffer = VK_NULL_HANDLE;
+	GpuAllocation EmitterMemory;
+
+	VkDescriptorSetLayout SetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool DescriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet DescriptorSet = VK_NULL_HANDLE;
+
+	VkPipelineLayout PipelineLayout = VK_NULL_HANDLE;
+	VkPipeline Pipeline = VK_NULL_HANDLE;
+
+	ParticleEmitterQueue Queue;
+
+	// Set before every frame is recorded
+	float DeltaTime = 0.0f;
+
+	// The buffer starts out as garbage, the first frame zeroes it
+	bool Cleared = false;
+
+	// Outside of a render pass, before the draw
+	void RecordSimulation(VkCommandBuffer commandBuffer);
+
+	// Inside the render pass, with the quad pipeline, vertex and index buffer bound
+	void RecordDraw(VkCommandBuffer commandBuffer) const;
+};
+
+// The same simulation on the CPU, to compare against and for when there's no compute shader
+// Structure of arrays so the SIMD kernels only stream through the fields they need
+struct CpuParticleSystem
+{
+	SimdLevel Level;
+	uint32_t Capacity = 0;
+
+	std::vector<float> PositionX;
+	std::vector<float> PositionY;
+	std::vector<float> VelocityX;
+	std::vector<float> VelocityY;
+
+	std::vector<float> Life;
+	std::vector<float> MaxLife;
+	std::vector<float> Size;
+	std::vector<float> Buoyancy;
+
+	std::vector<float> ColorR;
+	std::vector<float> ColorG;
+	std::vector<float> ColorB;
+
+	ParticleEmitterQueue Queue;
+
+	// Uses the best kernel the CPU supports
+	CpuParticleSystem();
+
+	void Init(uint32_t capacity);
+
+	void Step(float deltaTime);
+	void Spawn(uint32_t index, const ParticleEmitter& emitter, uint32_t seed);
+	void Integrate(uint32_t begin, uint32_t end, float deltaTime);
+
+	uint32_t CountAlive() const;
+
+	// Appends the living particles, same look as particles.comp
+	void WriteInstances(std::vector<QuadInstance>& instances) const;
+};
+
+// Layers are drawn back to front
+enum SpriteLayer : uint32_t
+{
+	SPRITE_LAYER_BACKGROUND = 0,
+	SPRITE_LAYER_GAME = 1,
+	SPRITE_LAYER_PARTICLES = 2,
+	SPRITE_LAYER_HUD = 3,
+};
+
+// One texture for everything the quad pipeline draws, generated at startup by CreateSpriteAtlas()
+struct SpriteAtlas
+{
+	VkDevice Device = VK_NULL_HANDLE;
+
+	VkImage Image = VK_NULL_HANDLE;
+	GpuAllocation Memory;
+
+	VkImageView ImageView = VK_NULL_HANDLE;
+	VkSampler Sampler = VK_NULL_HANDLE;
+
+	VkDescriptorPool DescriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet DescriptorSet = VK_NULL_HANDLE;
+
+	// For QuadInstance::UV
+	glm::vec4 White;
+	glm::vec4 Background;
+	glm::vec4 Ball;
+
+	// By ASCII code, characters without a glyph (like a space) have an empty rect and only move the text along
+	std::array<glm::vec4, 128> Glyphs;
+};
+
+// Quads with the same layer, pipeline and texture that were added one after the other
+struct SpriteSpan
+{
+	SpriteLayer Layer;
+	VkPipeline Pipeline;
+	VkDescriptorSet Texture;
+
+	uint32_t FirstInstance;
+	uint32_t InstanceCount;
+};
+
+// One vkCmdDrawIndexed, FirstInstance is into the sorted instances
+struct SpriteDraw
+{
+	VkPipeline Pipeline;
+	VkDescriptorSet Texture;
+
+	uint32_t FirstInstance;
+	uint32_t InstanceCount;
+};
+
+// Collects a frame's quads from anywhere in any order. End() sorts the spans by layer, pipeline and texture and merges the
+// neighbours that share a pipeline and texture, so a layer is one draw no matter how many quads or glyphs are in it
+// The sort is stable, quads with the same state are drawn in the order they were added
+struct SpriteBatch
+{
+	// What Add() uses, set by Begin()
+	VkPipeline Pipeline = VK_NULL_HANDLE;
+	VkDescriptorSet Texture = VK_NULL_HANDLE;
+
+	// In the order they were added, only Spans gets sorted
+	std::vector<QuadInstance> Instances;
+	std::vector<SpriteSpan> Spans;
+
+	std::vector<SpriteDraw> Draws;
+
+	void Begin(VkPipeline pipeline, VkDescriptorSet texture);
+
+	void Add(SpriteLayer layer, const QuadInstance& instance);
+	void Add(SpriteLayer layer, const QuadInstance* instances, uint32_t count);
+
+	// position is the top left corner, anchor moves the text left by that fraction of its width (0.5 centers it)
+	void AddText(const SpriteAtlas& atlas, SpriteLayer layer, const char* text, glm::vec2 position, float height, const glm::vec4& color, float anchor = 0.0f);
+
+	void End();
+
+	// Copies the instances over in the order Draws expects them
+	void WriteSorted(QuadInstance* destination) const;
+};
+
+// Everything a thread needs to record its share of a frame's draws
+struct RecordJob
+{
+	uint32_t Slot;
+
+	VkRenderPass RenderPass;
+	VkFramebuffer Framebuffer;
+	VkExtent2D Extent;
+
+	VkPipeline Pipeline;
+	VkPipelineLayout Layout;
+	VkDescriptorSet TextureSet;
+
+	VkBuffer VertexBuffer;
+	VkBuffer IndexBuffer;
+	uint32_t IndexCount;
+
+	RingAllocation Instances;
+	uint32_t InstanceCount;
+
+	// 0 draws all of a thread's instances at once, otherwise one vkCmdDrawIndexed per this many (scenes that can't instance)
+	uint32_t InstancesPerDraw;
+
+	// Drawn by the last thread, on top of everything else
+	ParticleSystem* Particles;
+
+	// Pipeline and texture changes, every thread clips them to its range of instances
+	const std::vector<SpriteDraw>* Draws;
+};
+
+// Splits the draws of a frame over ThreadCount threads (the main thread being one of them), each records a secondary
+// command buffer from its own pool per frame in flight. A pool is only touched by its thread and reset as a whole once
+// the slot comes around again, the primary just executes the secondaries in thread order
+struct ParallelRecorder
+{
+	VkDevice Device = VK_NULL_HANDLE;
+	uint32_t ThreadCount = 0;
+
+	// [slot * ThreadCount + thread]
+	std::vector<VkCommandPool> CommandPools;
+	std::vector<VkCommandBuffer> CommandBuffers;
+
+	std::vector<std::thread> Workers;
+
+	// Workers sleep until Generation changes, the main thread until Remaining hits 0
+	std::mutex Mutex;
+	std::condition_variable WorkReady;
+	std::condition_variable WorkDone;
+	uint64_t Generation = 0;
+	uint32_t Remaining = 0;
+	bool Running = false;
+
+	RecordJob Job;
+
+	// Returns once all secondaries for job.Slot are recorded
+	void Record(const RecordJob& job);
+
+	void RecordShare(uint32_t thread);
+	void Run(uint32_t thread);
+};
+
+struct RetiredPipeline
+{
+	VkPipeline Pipeline;
+
+	// Last frame submitted with it, safe to destroy once the timeline reaches it
+	uint64_t RetireFrame;
+};
+
+// Watches the shaders and builds new pipelines on its own thread, the render loop only ever picks up finished ones
+// GLSL sources newer than their SPIR-V get recompiled first if glslc can be found
+struct ShaderHotReload
+{
+	VkDevice Device = VK_NULL_HANDLE;
+	VkPipelineCache PipelineCache = VK_NULL_HANDLE;
+	VkRenderPass RenderPass = VK_NULL_HANDLE;
+	VkPipelineLayout PipelineLayout = VK_NULL_HANDLE;
+
+	fs::path VertexShaderPath;
+	fs::path FragmentShaderPath;
+
+	// Empty if there's no shader compiler around, then only SPIR-V changes are picked up
+	std::string Compiler;
+
+	std::thread Worker;
+	std::atomic<bool> Running{ false };
+
+	// Written by the worker, taken by the render loop
+	std::mutex Mutex;
+	VkPipeline ReadyPipeline = VK_NULL_HANDLE;
+
+	// Render loop only
+	std::vector<RetiredPipeline> Retired;
+
+	void Start(VkDevice device, VkPipelineCache pipelineCache, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, const fs::path& vertexShaderPath, const fs::path& fragmentShaderPath);
+	void Stop();
+
+	// Call between frames, swaps in a finished pipeline and destroys old ones the GPU is done with
+	void Update(VkPipeline& pipeline, const FrameScheduler& scheduler);
+
+	void Run();
+};
+
+struct LaunchOptions
+{
+	bool Headless = false;
+	uint32_t MatchCount = 1000;
+	double TickRate = REFERENCE_TICK_RATE;
+
+	bool VerifyBatch = false;
+	bool BenchmarkBatch = false;
+	bool VerifyScheduler = false;
+	uint32_t StepCount = 10000;
+
+	bool Farm = false;
+	uint32_t ThreadCount = 0;
+
+	bool BenchmarkDraw = false;
+
+	uint64_t Seed = DEFAULT_SEED;
+
+	// Empty if not recording / replaying
+	fs::path RecordPath;
+	fs::path ReplayPath;
+
+	// Empty disables the on-disk pipeline cache
+	fs::path PipelineCachePath = "pipeline.cache";
+
+	bool HotReload = false;
+
+	// Renders this many frames without a window when > 0, and writes them to OutputPath if that isn't empty
+	uint32_t OffscreenFrameCount = 0;
+	fs::path OutputPath;
+
+	// Empty if no Chrome trace should be written
+	fs::path TracePath;
+
+	// Records the frame's draws on this many threads when > 0, inline on the main thread otherwise
+	uint32_t RecordThreadCount = 0;
+	bool BenchmarkRecord = false;
+
+	// Everything is flat, so there's no depth attachment unless asked for
+	bool Depth = false;
+
+	// 0 turns the particles off, --cpu-particles simulates them on the CPU (capped at MAX_CPU_PARTICLES)
+	uint32_t ParticleCount = DEFAULT_PARTICLE_COUNT;
+	bool CpuParticles = false;
+	bool BenchmarkParticles = false;
+
+	// Waits for the frame's fence before sampling input and stepping the sim, instead of after
+	bool LowLatency = false;
+	uint32_t FramesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+
+	// Falls back to FIFO if the surface doesn't support it
+	VkPresentModeKHR PresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+
+	// Plays with this many balls instead of one when > 0
+	uint32_t MultiBallCount = 0;
+	bool BenchmarkMultiBall = false;
+
+	// Bit 0 puts a bot on the left paddle, bit 1 on the right one, it takes over from the keys of that side
+	uint8_t AiPlayers = 0;
+	AiDifficulty Difficulty;
+	bool BenchmarkAi = false;
+
+	bool BenchmarkEnv = false;
+};
+
+GLFWwindow* CreateGlfwWindow();
+
+VkDebugUtilsMessengerCreateInfoEXT GetDebugMessengerInfo();
+static VKAPI_ATTR VkBool32 VKAPI_CALL VulkanDebugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType, const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData);
+
+VkInstance CreateInstance(bool enableValidationLayers, const std::vector<const char*>& validationLayers, bool surfaceExtensions = true);
+bool CheckValidationLayerSupport(const std::vector<const char*>& validationLayers);
+
+VkDebugUtilsMessengerEXT SetupDebugMessenger(VkInstance instance);
+VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger);
+void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT debugMessenger, const VkAllocationCallbacks* pAllocator);
+
+VkSurfaceKHR CreateSurface(VkInstance instance, GLFWwindow* window);
+
+VkPhysicalDevice ChoosePhysicalDevice(VkInstance instance, VkSurfaceKHR surface, const std::vector<const char*>& deviceExtensions);
+QueueFamilyIndices GetQueueFamilies(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface);
+bool SupportsRequiredExtensions(const VkPhysicalDevice& device, const std::vector<const char*>& deviceExtensions);
+SwapChainSupportDetails QuerySwapChainSupport(const VkPhysicalDevice& device, const VkSurfaceKHR& surface);
+bool SupportsAnisotropicSampling(const VkPhysicalDevice& device);
+bool SupportsTimelineSemaphores(const VkPhysicalDevice& device);
+bool IsDeviceSuitable(const VkPhysicalDevice& device, const VkSurfaceKHR& surface, const std::vector<const char*>& deviceExtensions);
+
+uint32_t FindMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties);
+
+void CreateGpuAllocator(VkDevice device, VkPhysicalDevice physicalDevice, GpuAllocator& allocator);
+void DestroyGpuAllocator(GpuAllocator& allocator);
+
+VkDevice ChooseLogicalDevice(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, const QueueFamilyIndices& indices, const std::vector<const char*>& deviceExtensions);
+
+VkQueue GetQueue(VkDevice device, uint32_t queueFamily, uint32_t queueIndex = 0);
+
+VkCommandPool CreateCommandPool(VkDevice device, uint32_t queueFamilyIndex);
+
+VkSurfaceFormatKHR ChooseSwapChainSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
+VkPresentModeKHR ChoosePresentMode(const std::vector<VkPresentModeKHR>& availableModes, VkPresentModeKHR preferredMode = VK_PRESENT_MODE_MAILBOX_KHR);
+const char* GetPresentModeName(VkPresentModeKHR presentMode);
+VkExtent2D ChooseExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabilities, GLFWwindow* window);
+
+VkSwapchainKHR CreateSwapChain(VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, VkSurfaceCapabilitiesKHR capabilities, VkExtent2D extent, VkSurfaceFormatKHR surfaceFormat, VkPresentModeKHR presentMode, const QueueFamilyIndices& queueIndices, VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE);
+
+void GetSwapChainImages(VkDevice device, VkSwapchainKHR swapChain, std::vector<VkImage>& images);
+void CreateImageViews(VkDevice device, const std::vector<VkImage>& swapChainImages, VkFormat imageFormat, std::vector<VkImageView>& imageViews);
+
+VkFormat FindSupportedDepthFormat(VkPhysicalDevice physicalDevice);
+VkDeviceSize GetDepthFormatSize(VkFormat depthFormat);
+VkMemoryPropertyFlags ChooseTransientMemoryProperties(const GpuAllocator& allocator);
+void PrintAttachmentReport(VkPhysicalDevice physicalDevice, const GpuAllocator& allocator, VkExtent2D extent, uint32_t imageCount, VkFormat depthFormat);
+
+void CreateDepthResources(VkDevice device, GpuAllocator& allocator, VkMemoryPropertyFlags properties, VkFormat depthFormat, VkExtent2D swapChainExtent, uint32_t imageCount, std::vector<VkImage>& depthImages, std::vector<GpuAllocation>& depthMemory, std::vector<VkImageView>& depthImageViews);
+
+VkRenderPass CreateRenderPass(VkDevice device, VkPhysicalDevice physicalDevice, VkFormat imageFormat, VkFormat depthFormat, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+void CreateFramebuffers(VkDevice device, VkRenderPass renderPass, VkExtent2D swapChainExtent, uint32_t imageCount, const std::vector<VkImageView>& colorImageViews, const std::vector<VkImageView>& depthImageViews, std::vector<VkFramebuffer>& framebuffers);
+
+bool CreateSwapChainResources(VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, GLFWwindow* window, GpuAllocator& allocator, const QueueFamilyIndices& queueIndices, VkSurfaceFormatKHR surfaceFormat, VkPresentModeKHR presentMode, VkFormat depthFormat, VkRenderPass renderPass, VkSwapchainKHR oldSwapChain, SwapChainResources& resources);
+void DestroySwapChainResources(VkDevice device, GpuAllocator& allocator, SwapChainResources& resources);
+bool RecreateSwapChain(VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, GLFWwindow* window, GpuAllocator& allocator, const QueueFamilyIndices& queueIndices, VkSurfaceFormatKHR surfaceFormat, VkPresentModeKHR presentMode, VkFormat depthFormat, VkRenderPass renderPass, const FrameScheduler& scheduler, SwapChainResources& resources, std::vector<SwapChainResources>& retired);
+void DestroyRetiredSwapChains(VkDevice device, GpuAllocator& allocator, const FrameScheduler& scheduler, std::vector<SwapChainResources>& retired);
+
+VkSemaphore CreateTimelineSemaphore(VkDevice device, uint64_t initialValue = 0);
+void CreateFrameScheduler(VkDevice device, uint32_t framesInFlight, FrameScheduler& scheduler);
+void DestroyFrameScheduler(FrameScheduler& scheduler);
+
+// Drives a FrameScheduler with a fake GPU for every frames in flight setting and checks the overlap it measures
+bool VerifyFrameScheduler();
+void PlayFakeGpuFrames(FrameScheduler& scheduler, uint32_t frameCount, bool gpuBound);
+
+VkDescriptorSetLayout CreateTextureSetLayout(VkDevice device);
+VkPipelineLayout CreatePipelineLayout(VkDevice device, VkDescriptorSetLayout textureSetLayout);
+
+VkPipelineCache LoadPipelineCache(VkDevice device, VkPhysicalDevice physicalDevice, const fs::path& path, bool& warm);
+void SavePipelineCache(VkDevice device, VkPipelineCache pipelineCache, const fs::path& path);
+
+VkPipeline CreatePipeline(VkDevice device, VkPipelineCache pipelineCache, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, const fs::path& vertexShaderPath, const fs::path& fragmentShaderPath);
+// Returns VK_NULL_HANDLE instead of asserting when the driver rejects the shaders, so the hot reload can keep going
+VkPipeline CreatePipelineFromSpirv(VkDevice device, VkPipelineCache pipelineCache, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, const std::string& vertexSpirv, const std::string& fragmentSpirv);
+std::string ReadFile(const fs::path& filePath);
+VkShaderModule CreateShaderModule(VkDevice device, const std::string& shaderSource);
+
+void CreateStagingUploader(VkDevice device, GpuAllocator& allocator, const QueueFamilyIndices& queueIndices, StagingUploader& uploader);
+void DestroyStagingUploader(StagingUploader& uploader);
+
+VkBuffer CreateVertexBuffers(StagingUploader& uploader, const std::vector<Vertex>& vertices, GpuAllocation& allocation);
+VkBuffer CreateIndexBuffer(StagingUploader& uploader, const std::vector<uint16_t>& indices, GpuAllocation& allocation);
+void CreateFrameRingBuffer(GpuAllocator& allocator, VkDeviceSize partitionSize, FrameRingBuffer& ringBuffer);
+void DestroyFrameRingBuffer(GpuAllocator& allocator, FrameRingBuffer& ringBuffer);
+
+void CreateFrameProfiler(VkDevice device, VkPhysicalDevice physicalDevice, FrameProfiler& profiler);
+void DestroyFrameProfiler(FrameProfiler& profiler);
+
+void CreateCommandBuffers(VkDevice device, VkCommandPool commandPool, uint32_t imageCount, std::vector<VkCommandBuffer>& commandBuffers);
+
+void RecordCommandBuffer(VkCommandBuffer commandBuffer, VkFramebuffer framebuffer, VkExtent2D swapChainExtent, VkRenderPass renderPass, VkPipeline pipeline, VkPipelineLayout layout, VkDescriptorSet textureSet, VkBuffer vertexBuffer, VkBuffer indexBuffer, uint32_t indexCount, const RingAllocation& instances, uint32_t instanceCount, VkQueryPool queryPool = VK_NULL_HANDLE, uint32_t firstQuery = 0, ParallelRecorder* recorder = nullptr, uint32_t slot = 0, uint32_t instancesPerDraw = 0, ParticleSystem* particles = nullptr, const std::vector<SpriteDraw>* draws = nullptr);
+void RecordDraws(VkCommandBuffer commandBuffer, VkExtent2D extent, VkPipeline pipeline, VkPipelineLayout layout, VkDescriptorSet textureSet, VkBuffer vertexBuffer, VkBuffer indexBuffer, uint32_t indexCount, const RingAllocation& instances, uint32_t firstInstance, uint32_t instanceCount, uint32_t instancesPerDraw, const ParticleSystem* particles = nullptr, const std::vector<SpriteDraw>* draws = nullptr);
+
+void CreateParallelRecorder(VkDevice device, uint32_t queueFamily, uint32_t threadCount, ParallelRecorder& recorder);
+void DestroyParallelRecorder(ParallelRecorder& recorder);
+
+bool DrawFrame(VkDevice device, const SwapChainResources& swapChain, VkQueue graphicsQueue, VkQueue presentQueue, const std::vector<VkCommandBuffer>& commandBuffers, FrameScheduler& scheduler, FrameRingBuffer& ringBuffer, const SpriteBatch& sprites, VkRenderPass renderPass, VkPipeline pipeline, VkPipelineLayout pipelineLayout, VkDescriptorSet textureSet, VkBuffer vertexBuffer, VkBuffer indexBuffer, uint32_t indexCount, FrameProfiler& profiler, uint64_t inputTime, ParallelRecorder* recorder, ParticleSystem* particles);
+VkResult AquireNextImage(VkDevice device, VkSwapchainKHR swapChain, FrameScheduler& scheduler, uint32_t& imageIndex, FrameProfiler* profiler = nullptr);
+VkResult SubmitCommandBuffers(VkSwapchainKHR swapChain, VkQueue graphicsQueue, VkQueue presentQueue, VkCommandBuffer commandBuffer, FrameScheduler& scheduler, uint32_t imageIndex);
+
+std::array<QuadInstance, 3> CalculateInstances(const std::array<glm::vec2, 3>& previousPositions, const std::array<glm::vec2, 3>& positions, float alpha);
+
+void CreateSpriteAtlas(VkDevice device, StagingUploader& uploader, VkDescriptorSetLayout textureSetLayout, SpriteAtlas& atlas);
+void DestroySpriteAtlas(GpuAllocator& allocator, SpriteAtlas& atlas);
+
+// The field, the paddles and ball (from CalculateInstances()) and the score
+void AddGameSprites(SpriteBatch& sprites, const SpriteAtlas& atlas, const std::array<QuadInstance, 3>& instances, const PongSim& sim);
+void AddMultiBallSprites(SpriteBatch& sprites, const SpriteAtlas& atlas, const MultiBallSim& sim, std::vector<QuadInstance>& ballInstances);
+void AddFieldSprites(SpriteBatch& sprites, const SpriteAtlas& atlas, const unsigned int scores[2]);
+
+void BenchmarkDrawSubmission(VkDevice device, GpuAllocator& allocator, VkSwapchainKHR swapChain, VkQueue graphicsQueue, VkQueue presentQueue, const std::vector<VkCommandBuffer>& commandBuffers, FrameScheduler& scheduler, const std::vector<VkFramebuffer>& framebuffers, VkExtent2D swapChainExtent, VkRenderPass renderPass, VkPipeline pipeline, VkPipelineLayout pipelineLayout, VkDescriptorSet textureSet, VkBuffer vertexBuffer, VkBuffer indexBuffer, uint32_t indexCount);
+void BenchmarkParallelRecording(VkDevice device, GpuAllocator& allocator, uint32_t queueFamily, const std::vector<VkCommandBuffer>& commandBuffers, VkFramebuffer framebuffer, VkExtent2D swapChainExtent, VkRenderPass renderPass, VkPipeline pipeline, VkPipelineLayout pipelineLayout, VkDescriptorSet textureSet, VkBuffer vertexBuffer, VkBuffer indexBuffer, uint32_t indexCount);
+
+void RenderOffscreen(uint32_t frameCount, const fs::path& outputPath, uint64_t seed, float timeScale, bool depth, uint32_t particleCount);
+void RecordReadback(VkCommandBuffer commandBuffer, VkImage image, VkBuffer buffer, VkExtent2D extent);
+void WritePpm(const fs::path& path, uint32_t width, uint32_t height, const uint8_t* pixels);
+bool VerifyBatchSim(uint32_t matchCount, uint32_t stepCount, uint64_t seed, float timeScale);
+void BenchmarkBatchSim(uint32_t matchCount, uint32_t stepCount, float timeScale);
+
+float GetMultiBallRadius(uint32_t ballCount);
+void BenchmarkMultiBall(uint32_t maxBallCount, uint64_t seed);
+
+std::string FindShaderCompiler();
+bool CompileShaderIfStale(const fs::path& spirvPath);
+
+bool CreateParticleSystem(VkDevice device, GpuAllocator& allocator, VkPipelineCache pipelineCache, uint32_t capacity, uint32_t indexCount, const fs::path& shaderPath, ParticleSystem& particles);
+void DestroyParticleSystem(GpuAllocator& allocator, ParticleSystem& particles);
+
+uint32_t HashParticle(uint32_t x);
+float RandomParticleFloat(uint32_t& state);
+
+void IntegrateParticlesScalar(CpuParticleSystem& particles, uint32_t begin, uint32_t end, float deltaTime);
+void IntegrateParticlesSSE(CpuParticleSystem& particles, uint32_t begin, uint32_t end, float deltaTime);
+TARGET_AVX2 void IntegrateParticlesAVX2(CpuParticleSystem& particles, uint32_t begin, uint32_t end, float deltaTime);
+
+// Exit code 1 if the compute shader couldn't run, the CPU numbers alone don't say much
+bool BenchmarkParticles(uint32_t capacity);
+
+void PlayFarmMatch(uint32_t match, uint64_t seed, MatchResult& result);
+void RunFarmWorker(uint32_t workerIndex, std::vector<WorkStealingDeque>& deques, uint32_t matchCount, uint64_t seed, std::vector<MatchResult>& results, FarmWorkerStats& stats);
+void RunMatchFarm(uint32_t matchCount, uint32_t threadCount, uint64_t seed);
+
+LaunchOptions ParseCommandLine(int argc, char** argv);
+
+uint8_t PollInputs(GLFWwindow* window);
+uint8_t GetBotInputs(const PongSim& sim);
+
+// Where the ball crosses x = paddleX if it keeps going in direction, with the reflections off the walls unfolded. O(1)
+float PredictBallY(glm::vec2 position, glm::vec2 direction, float paddleX);
+float PredictBallYBySteps(const PongSim& sim);
+
+// One tick of a bot, target and timer are all it remembers between ticks
+uint8_t DecideAiInputs(const AiDifficulty& difficulty, int player, glm::vec2 ball, glm::vec2 direction, float paddleY, PhiloxStream& random, float& target, uint32_t& timer);
+
+void BenchmarkAi(uint32_t matchCount, uint32_t stepCount, uint64_t seed, float timeScale, const AiDifficulty& difficulty);
+
+// Exit code 1 if any SIMD level disagrees with the scalar kernel or match 0 doesn't play out like a PongSim
+bool BenchmarkVectorEnv(uint32_t matchCount, uint32_t stepCount, uint64_t seed, float timeScale);
+
+void RunHeadless(uint32_t matchCount, uint64_t seed, const fs::path& recordPath);
+
+MappedFile MapFile(const fs::path& path);
+void UnmapFile(MappedFile& file);
+
+void WriteVarint(std::vector<uint8_t>& bytes, uint32_t value);
+bool ReadVarint(const uint8_t*& cursor, const uint8_t* end, uint32_t& value);
+
+bool ReplayRecording(const fs::path& path);
+
+int main(int argc, char** argv)
+{
+	LaunchOptions options = ParseCommandLine(argc, argv);
+
+	float timeScale = (float)(REFERENCE_TICK_RATE / options.TickRate);
+
+	if (options.VerifyBatch)
+	{
+		return VerifyBatchSim(options.MatchCount, options.StepCount, options.Seed, timeScale) ? 0 : 1;
+	}
+
+	if (options.BenchmarkBatch)
+	{
+		BenchmarkBatchSim(options.MatchCount, options.StepCount, timeScale);
+		return 0;
+	}
+
+	if (options.VerifyScheduler)
+	{
+		return VerifyFrameScheduler() ? 0 : 1;
+	}
+
+	if (options.Farm)
+	{
+		RunMatchFarm(options.MatchCount, options.ThreadCount, options.Seed);
+		return 0;
+	}
+
+	if (!options.ReplayPath.empty())
+	{
+		return ReplayRecording(options.ReplayPath) ? 0 : 1;
+	}
+
+	if (options.Headless)
+	{
+		RunHeadless(options.MatchCount, options.Seed, options.RecordPath);
+		return 0;
+	}
+
+	if (options.OffscreenFrameCount > 0)
+	{
+		RenderOffscreen(options.OffscreenFrameCount, options.OutputPath, options.Seed, timeScale, options.Depth, options.ParticleCount);
+		return 0;
+	}
+
+	if (options.BenchmarkParticles)
+	{
+		return BenchmarkParticles(options.ParticleCount) ? 0 : 1;
+	}
+
+	if (options.BenchmarkEnv)
+	{
+		return BenchmarkVectorEnv(options.MatchCount, options.StepCount, options.Seed, timeScale) ? 0 : 1;
+	}
+
+	if (options.BenchmarkAi)
+	{
+		BenchmarkAi(options.MatchCount, options.StepCount, options.Seed, timeScale, options.Difficulty);
+		return 0;
+	}
+
+	if (options.BenchmarkMultiBall)
+	{
+		BenchmarkMultiBall(options.MultiBallCount > 0 ? options.MultiBallCount : MULTIBALL_BENCHMARK_COUNT, options.Seed);
+		return 0;
+	}
+
+	// Everything up to the first frame being submitted counts as startup
+	auto startupStart = std::chrono::high_resolution_clock::now();
+
+	ASSERT(glfwInit(), "Failed to initialize GLFW.");
+
+	GLFWwindow* window = CreateGlfwWindow();
+
+	#ifdef CONFIGURATION_DEBUG
+		const bool enableValidationLayers = true;
+	#else
+		const bool enableValidationLayers = false;
+	#endif
+
+	std::vector<const char*> validationLayers(1);
+	validationLayers[0] = "VK_LAYER_KHRONOS_validation";
+
+	VkInstance instance = CreateInstance(enableValidationLayers, validationLayers);
+
+	VkDebugUtilsMessengerEXT debugMessenger;
+	if (enableValidationLayers)
+	{
+		debugMessenger = SetupDebugMessenger(instance);
+	}
+
+	// TODO describe
+	VkSurfaceKHR surface = CreateSurface(instance, window);
+
+	std::vector<const char*> deviceExtensions(1);
+	deviceExtensions[0] = "VK_KHR_swapchain";
+
+	VkPhysicalDevice physicalDevice = ChoosePhysicalDevice(instance, surface, deviceExtensions);
+
+	VkPhysicalDeviceProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+	std::cout << "Using GPU: " << physicalDeviceProperties.deviceName << "\n";
+
+	QueueFamilyIndices queueIndices = GetQueueFamilies(physicalDevice, surface);
+
+	VkDevice logicalDevice = ChooseLogicalDevice(physicalDevice, surface, queueIndices, deviceExtensions);
+
+	VkQueue graphicsQueue = GetQueue(logicalDevice, queueIndices.GraphicsFamily);
+	VkQueue presentQueue = GetQueue(logicalDevice, queueIndices.PresentFamily);
+
+	GpuAllocator allocator;
+	CreateGpuAllocator(logicalDevice, physicalDevice, allocator);
+
+	std::cout << "Uploading on queue family " << queueIndices.TransferFamily << (queueIndices.HasDedicatedTransferFamily ? " (dedicated transfer)\n" : " (graphics)\n");
+
+	VkCommandPool commandPool = CreateCommandPool(logicalDevice, queueIndices.GraphicsFamily);
+
+	SwapChainSupportDetails supportDetails = QuerySwapChainSupport(physicalDevice, surface);
+
+	VkSurfaceFormatKHR swapChainSurfaceFormat = ChooseSwapChainSurfaceFormat(supportDetails.SurfaceFormats);
+	VkPresentModeKHR swapChainPresentMode = ChoosePresentMode(supportDetails.PresentModes, options.PresentMode);
+
+	if (swapChainPresentMode != options.PresentMode)
+	{
+		std::cout << "Present mode " << GetPresentModeName(options.PresentMode) << " isn't supported, using fifo\n";
+	}
+
+	// VK_FORMAT_UNDEFINED leaves the depth attachment out of the render pass and the framebuffers
+	VkFormat depthFormat = options.Depth ? FindSupportedDepthFormat(physicalDevice) : VK_FORMAT_UNDEFINED;
+
+	// Only depends on the formats, so it survives swap chain recreation
+	VkRenderPass renderPass = CreateRenderPass(logicalDevice, physicalDevice, swapChainSurfaceFormat.format, depthFormat);
+
+	SwapChainResources swapChain;
+	bool created = CreateSwapChainResources(logicalDevice, physicalDevice, surface, window, allocator, queueIndices, swapChainSurfaceFormat, swapChainPresentMode, depthFormat, renderPass, VK_NULL_HANDLE, swapChain);
+	ASSERT(created, "The window has no size.");
+
+	PrintAttachmentReport(physicalDevice, allocator, swapChain.Extent, swapChain.Images.size(), depthFormat);
+
+	// Swap chains that were replaced but may still be in use by frames in flight
+	std::vector<SwapChainResources> retiredSwapChains;
+
+	FrameScheduler scheduler;
+	CreateFrameScheduler(logicalDevice, options.FramesInFlight, scheduler);
+
+	VkDescriptorSetLayout textureSetLayout = CreateTextureSetLayout(logicalDevice);
+	VkPipelineLayout pipelineLayout = CreatePipelineLayout(logicalDevice, textureSetLayout);
+
+	bool warmPipelineCache = false;
+	VkPipelineCache pipelineCache = LoadPipelineCache(logicalDevice, physicalDevice, options.PipelineCachePath, warmPipelineCache);
+
+	fs::path vertexShaderPath = "shaders/pong.vert.spv";
+	fs::path fragmentShaderPath = "shaders/pong.frag.spv";
+
+	// Stale SPIR-V would be missing inputs the pipeline expects
+	CompileShaderIfStale(vertexShaderPath);
+	CompileShaderIfStale(fragmentShaderPath);
+
+	auto pipelineStart = std::chrono::high_resolution_clock::now();
+	VkPipeline pipeline = CreatePipeline(logicalDevice, pipelineCache, renderPass, pipelineLayout, vertexShaderPath, fragmentShaderPath);
+	double pipelineSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - pipelineStart).count();
+
+	ShaderHotReload hotReload;
+
+	if (options.HotReload)
+	{
+		hotReload.Start(logicalDevice, pipelineCache, renderPass, pipelineLayout, vertexShaderPath, fragmentShaderPath);
+	}
+
+	uint64_t frameCount = 0;
+
+	FrameProfiler profiler;
+	CreateFrameProfiler(logicalDevice, physicalDevice, profiler);
+
+	// Every quad is an instance of this one, see QuadInstance
+	static std::vector<Vertex> vertices = {
+		{ { -0.5f,  0.5f }, { 1.0f, 1.0f, 1.0f } },
+		{ {  0.5f,  0.5f }, { 1.0f, 1.0f, 1.0f } },
+		{ {  0.5f, -0.5f }, { 1.0f, 1.0f, 1.0f } },
+		{ { -0.5f, -0.5f }, { 1.0f, 1.0f, 1.0f } },
+	};
+
+	static std::vector<uint16_t> indices = { 0, 1, 2, 2, 3, 0 };
+
+	StagingUploader uploader;
+	CreateStagingUploader(logicalDevice, allocator, queueIndices, uploader);
+
+	GpuAllocation vertexBufferMemory;
+	VkBuffer vertexBuffer = CreateVertexBuffers(uploader, vertices, vertexBufferMemory);
+
+	GpuAllocation indexBufferMemory;
+	VkBuffer indexBuffer = CreateIndexBuffer(uploader, indices, indexBufferMemory);
+
+	SpriteAtlas atlas;
+	CreateSpriteAtlas(logicalDevice, uploader, textureSetLayout, atlas);
+
+	// Nothing waits on the CPU, the frames wait on the GPU instead
+	scheduler.UploadTimeline = uploader.Timeline;
+	scheduler.UploadValue = uploader.Submit();
+
+	// Every ball is a quad in multi-ball mode, the rest of the frame still has to fit next to them
+	FrameRingBuffer ringBuffer;
+	CreateFrameRingBuffer(allocator, FRAME_RING_BUFFER_SIZE + (VkDeviceSize)options.MultiBallCount * sizeof(QuadInstance), ringBuffer);
+
+	// One per frame in flight instead of per swap chain image, so they don't care about recreation
+	std::vector<VkCommandBuffer> commandBuffers;
+	CreateCommandBuffers(logicalDevice, commandPool, MAX_FRAMES_IN_FLIGHT, commandBuffers);
+
+	// Lava embers and sparks, on the GPU unless there's no compute shader or the CPU was asked for
+	ParticleSystem particles;
+	CpuParticleSystem cpuParticles;
+
+	bool gpuParticles = options.ParticleCount > 0 && !options.CpuParticles && CreateParticleSystem(logicalDevice, allocator, pipelineCache, options.ParticleCount, indices.size(), "shaders/particles.comp.spv", particles);
+
+	if (options.ParticleCount > 0 && !gpuParticles)
+	{
+		cpuParticles.Init(std::min(options.ParticleCount, MAX_CPU_PARTICLES));
+		std::cout << "Simulating " << cpuParticles.Capacity << " particles on the CPU (" << GetSimdLevelName(cpuParticles.Level) << ")\n";
+	}
+
+	ParticleEmitterQueue* particleQueue = gpuParticles ? &particles.Queue : options.ParticleCount > 0 ? &cpuParticles.Queue : nullptr;
+
+	// Everything that's drawn with the quad pipeline, the GPU particles never show up here
+	SpriteBatch sprites;
+	std::vector<QuadInstance> particleInstances;
+
+	// Smoothed for the HUD, so the number can be read
+	float averageFrameTime = 0.0f;
+
+	PongSim sim;
+	sim.TimeScale = timeScale;
+	sim.Reset(options.Seed);
+
+	// Takes over from sim, nothing gets recorded and the balls don't make particles
+	MultiBallSim multiBall;
+	std::vector<QuadInstance> ballInstances;
+
+	if (options.MultiBallCount > 0)
+	{
+		multiBall.TimeScale = timeScale;
+		multiBall.Reset(options.MultiBallCount, GetMultiBallRadius(options.MultiBallCount), options.Seed);
+
+		std::cout << "Playing with " << multiBall.BallCount << " balls\n";
+	}
+
+	// Only the ones in options.AiPlayers get to play
+	std::array<AiPlayer, 2> aiPlayers;
+
+	for (int player = 0; player < 2; player++)
+	{
+		aiPlayers[player].Reset(player, options.Difficulty, options.Seed);
+	}
+
+	RecordingWriter recorder;
+	bool recording = !options.RecordPath.empty();
+
+	// Recordings only know the single ball sim, there'd be nothing in them but an empty match
+	if (recording && options.MultiBallCount > 0)
+	{
+		std::cout << "Recording isn't supported with --multiball, not writing \"" << options.RecordPath.string() << "\"\n";
+		recording = false;
+	}
+
+	if (recording)
+	{
+		recorder.Open(options.RecordPath);
+		recorder.BeginMatch(sim);
+	}
+
+	// The sim runs at a fixed rate no matter how fast we render, frames show a blend of the last two ticks
+	const double tickDuration = 1.0 / options.TickRate;
+	double accumulator = 0.0;
+	double previousTime = glfwGetTime();
+
+	std::array<glm::vec2, 3> previousPositions = sim.Positions;
+
+	bool shouldQuit = false;
+
+	if (options.BenchmarkDraw)
+	{
+		BenchmarkDrawSubmission(logicalDevice, allocator, swapChain.SwapChain, graphicsQueue, presentQueue, commandBuffers, scheduler, swapChain.Framebuffers, swapChain.Extent, renderPass, pipeline, pipelineLayout, atlas.DescriptorSet, vertexBuffer, indexBuffer, indices.size());
+		shouldQuit = true;
+	}
+
+	if (options.BenchmarkRecord)
+	{
+		BenchmarkParallelRecording(logicalDevice, allocator, queueIndices.GraphicsFamily, commandBuffers, swapChain.Framebuffers[0], swapChain.Extent, renderPass, pipeline, pipelineLayout, atlas.DescriptorSet, vertexBuffer, indexBuffer, indices.size());
+		shouldQuit = true;
+	}
+
+	ParallelRecorder parallelRecorder;
+
+	if (options.RecordThreadCount > 0)
+	{
+		CreateParallelRecorder(logicalDevice, queueIndices.GraphicsFamily, options.RecordThreadCount, parallelRecorder);
+	}
+
+	// Set when the swap chain doesn't match the window anymore, polling the size catches resizes that don't make it out of date
+	bool recreateSwapChain = false;
+
+	int windowWidth, windowHeight;
+	glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+
+	while (!glfwWindowShouldClose(window) && !shouldQuit)
+	{
+		ProfileScope frameScope(&profiler, "Frame");
+
+		int width, height;
+		glfwGetFramebufferSize(window, &width, &height);
+
+		if (width != windowWidth || height != windowHeight)
+		{
+			windowWidth = width;
+			windowHeight = height;
+			recreateSwapChain = true;
+		}
+
+		if (recreateSwapChain)
+		{
+			ProfileScope scope(&profiler, "RecreateSwapChain");
+
+			// False while minimized, the game just pauses until there's something to draw to again
+			if (!RecreateSwapChain(logicalDevice, physicalDevice, surface, window, allocator, queueIndices, swapChainSurfaceFormat, swapChainPresentMode, depthFormat, renderPass, scheduler, swapChain, retiredSwapChains))
+			{
+				glfwWaitEvents();
+				previousTime = glfwGetTime();
+				continue;
+			}
+
+			recreateSwapChain = false;
+		}
+
+		// Normally the fence wait is in DrawFrame(), after the input was sampled, and that whole wait adds to the latency
+		if (options.LowLatency)
+		{
+			scheduler.WaitForSlot(&profiler);
+			glfwPollEvents();
+		}
+
+		double currentTime = glfwGetTime();
+		float frameTime = (float)std::min(currentTime - previousTime, MAX_FRAME_TIME);
+		accumulator += frameTime;
+		previousTime = currentTime;
+
+		uint8_t inputs = PollInputs(window);
+		uint64_t inputTime = profiler.Now();
+
+		uint64_t simulationStart = inputTime;
+
+		while (accumulator >= tickDuration)
+		{
+			// The bots decide every tick, not every frame, so they play the same at any frame rate
+			uint8_t tickInputs = inputs;
+
+			for (int player = 0; player < 2; player++)
+			{
+				if (options.AiPlayers & (1 << player))
+				{
+					uint8_t playerInputs = player == 0 ? INPUT_PLAYER1_UP | INPUT_PLAYER1_DOWN : INPUT_PLAYER2_UP | INPUT_PLAYER2_DOWN;
+					uint8_t aiInputs = options.MultiBallCount > 0 ? aiPlayers[player].Update(multiBall) : aiPlayers[player].Update(sim);
+
+					tickInputs = (tickInputs & ~playerInputs) | aiInputs;
+				}
+			}
+
+			if (options.MultiBallCount > 0)
+			{
+				multiBall.Step(tickInputs);
+				accumulator -= tickDuration;
+				continue;
+			}
+
+			previousPositions = sim.Positions;
+
+			if (recording)
+			{
+				recorder.RecordTick(sim, tickInputs);
+			}
+
+			int scoringPlayer = sim.Step(tickInputs);
+
+			if (particleQueue)
+			{
+				particleQueue->AddImpacts(sim.Impacts);
+			}
+
+			// Don't smear the ball across the field when it gets reset, the new score is on the HUD
+			if (scoringPlayer)
+			{
+				previousPositions = sim.Positions;
+			}
+
+			accumulator -= tickDuration;
+		}
+
+		float alpha = (float)(accumulator / tickDuration);
+		std::array<QuadInstance, 3> instances = CalculateInstances(previousPositions, sim.Positions, alpha);
+
+		profiler.Record("Simulation", simulationStart, profiler.Now());
+
+		// The pipeline might have been swapped by the hot reload, so it's picked up here instead of at startup
+		hotReload.Update(pipeline, scheduler);
+
+		sprites.Begin(pipeline, atlas.DescriptorSet);
+
+		if (options.MultiBallCount > 0)
+		{
+			ProfileScope scope(&profiler, "Balls");
+			AddMultiBallSprites(sprites, atlas, multiBall, ballInstances);
+		}
+		else
+		{
+			AddGameSprites(sprites, atlas, instances, sim);
+		}
+
+		averageFrameTime += (frameTime - averageFrameTime) * 0.05f;
+
+		char frameTimeText[32];
+		snprintf(frameTimeText, sizeof(frameTimeText), "%.1f MS", averageFrameTime * 1e3f);
+		sprites.AddText(atlas, SPRITE_LAYER_HUD, frameTimeText, { -ASPECT_RATIO + 0.03f, -0.97f }, 0.04f, { 1.0f, 1.0f, 1.0f, 0.5f });
+
+		if (particleQueue)
+		{
+			particleQueue->AddLava(frameTime);
+		}
+
+		if (gpuParticles)
+		{
+			particles.DeltaTime = frameTime;
+		}
+		else if (particleQueue)
+		{
+			ProfileScope scope(&profiler, "Particles");
+
+			cpuParticles.Step(frameTime);
+
+			particleInstances.clear();
+			cpuParticles.WriteInstances(particleInstances);
+
+			sprites.Add(SPRITE_LAYER_PARTICLES, particleInstances.data(), particleInstances.size());
+		}
+
+		sprites.End();
+
+		if (!options.LowLatency)
+		{
+			glfwPollEvents();
+		}
+
+		recreateSwapChain = DrawFrame(logicalDevice, swapChain, graphicsQueue, presentQueue, commandBuffers, scheduler, ringBuffer, sprites, renderPass, pipeline, pipelineLayout, atlas.DescriptorSet, vertexBuffer, indexBuffer, indices.size(), profiler, inputTime, options.RecordThreadCount > 0 ? &parallelRecorder : nullptr, gpuParticles ? &particles : nullptr);
+		DestroyRetiredSwapChains(logicalDevice, allocator, scheduler, retiredSwapChains);
+		uploader.Reclaim();
+		frameCount++;
+
+		if (startupStart != std::chrono::high_resolution_clock::time_point{})
+		{
+			double startupSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startupStart).count();
+			startupStart = {};
+
+			std::cout << "Time to first frame: " << startupSeconds * 1e3 << " ms, " << pipelineSeconds * 1e3 << " ms of it creating the pipeline (" << (warmPipelineCache ? "warm" : "cold") << " pipeline cache)\n";
+		}
+
+		if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
+		{
+			shouldQuit = true;
+
+			std::cout << "\n";
+			const unsigned int* scores = options.MultiBallCount > 0 ? multiBall.Scores : sim.Scores;
+
+			std::cout << "The game is over\n";
+			std::cout << "Score: " << scores[0] << " - " << scores[1] << "\n";
+		}
+	}
+
+	if (recording)
+	{
+		recorder.EndMatch(sim);
+		recorder.Close();
+	}
+
+	// Clean up
+
+	vkQueueWaitIdle(graphicsQueue);
+	vkQueueWaitIdle(presentQueue);
+
+	vkFreeCommandBuffers(logicalDevice, commandPool, commandBuffers.size(), commandBuffers.data());
+
+	if (options.RecordThreadCount > 0)
+	{
+		DestroyParallelRecorder(parallelRecorder);
+	}
+
+	// Everything's idle, so the last frames' timestamps are there too
+	for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
+	{
+		profiler.CollectGpuTimes(frame);
+	}
+
+	std::cout << "\n";
+	std::cout << (options.LowLatency ? "Low latency" : "Default latency") << " mode, " << scheduler.FramesInFlight << " frames in flight, " << GetPresentModeName(swapChainPresentMode) << " present mode\n";
+
+	scheduler.PrintOverlap();
+	profiler.PrintSummary();
+
+	if (!options.TracePath.empty())
+	{
+		profiler.WriteChromeTrace(options.TracePath);
+	}
+
+	DestroyFrameProfiler(profiler);
+
+	hotReload.Stop();
+
+	SavePipelineCache(logicalDevice, pipelineCache, options.PipelineCachePath);
+	vkDestroyPipelineCache(logicalDevice, pipelineCache, nullptr);
+
+	DestroyStagingUploader(uploader);
+
+	std::cout << "\n";
+	std::cout << "Frame ring buffer: " << ringBuffer.HighWaterMark << " of " << ringBuffer.PartitionSize << " bytes per frame at most\n";
+
+	if (ringBuffer.Overflows > 0)
+	{
+		std::cout << "Frame ring buffer: " << ringBuffer.Overflows << " allocations didn't fit and weren't drawn\n";
+	}
+
+	allocator.PrintStats();
+
+	allocator.DestroyBuffer(vertexBuffer, vertexBufferMemory);
+	allocator.DestroyBuffer(indexBuffer, indexBufferMemory);
+
+	DestroySpriteAtlas(allocator, atlas);
+
+	DestroyFrameRingBuffer(allocator, ringBuffer);
+
+	if (gpuParticles)
+	{
+		DestroyParticleSystem(allocator, particles);
+	}
+
+	// The queues are idle, so every retired swap chain is done too
+	for (SwapChainResources& retired : retiredSwapChains)
+	{
+		DestroySwapChainResources(logicalDevice, allocator, retired);
+	}
+
+	DestroySwapChainResources(logicalDevice, allocator, swapChain);
+
+	DestroyGpuAllocator(allocator);
+
+	vkDestroyDescriptorSetLayout(logicalDevice, textureSetLayout, nullptr);
+	vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
+
+	DestroyFrameScheduler(scheduler);
+
+	vkDestroySurfaceKHR(instance, surface, nullptr);
+
+	glfwDestroyWindow(window);
+	glfwTerminate();
+
+	if (enableValidationLayers)
+	{
+		DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+	}
+}
+
+GLFWwindow* CreateGlfwWindow()
+{
+	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+
+	GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Volcanic Pong", nullptr, nullptr);
+	ASSERT(window, "Failed to create GLFW window.");
+
+	return window;
+}
+
+VkDebugUtilsMessengerCreateInfoEXT GetDebugMessengerInfo()
+{
+	static VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo{};
+	debugCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+
+	// Call the callback for messages of any severity and any type
+	debugCreateInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
+		VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |
+		VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
+		VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+
+	debugCreateInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+		VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+		VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT |
+		VK_DEBUG_UTILS_MESSAGE_TYPE_DEVICE_ADDRESS_BINDING_BIT_EXT;
+
+	debugCreateInfo.pfnUserCallback = VulkanDebugCallback;
+
+	return debugCreateInfo;
+}
+
+static VKAPI_ATTR VkBool32 VKAPI_CALL VulkanDebugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType, const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData)
+{
+	if (messageSeverity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT)
+	{
+		std::cout << pCallbackData->pMessage << "\n";
+	}
+
+	return VK_FALSE;
+}
+
+VkInstance CreateInstance(bool enableValidationLayers, const std::vector<const char*>& validationLayers, bool surfaceExtensions /* = true */)
+{
+	ASSERT(enableValidationLayers <= CheckValidationLayerSupport(validationLayers), "Validation layers requested but not available");
+
+	VkApplicationInfo appInfo{};
+	appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+	appInfo.pApplicationName = "VolcanicSnake";
+	appInfo.applicationVersion = VK_MAKE_API_VERSION(0, 1, 0, 0);
+	appInfo.pEngineName = "No engine";
+	appInfo.engineVersion = NULL;
+	// 1.2 for timeline semaphores
+	appInfo.apiVersion = VK_API_VERSION_1_2;
+
+	VkInstanceCreateInfo instanceCreateInfo{};
+	instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	instanceCreateInfo.pApplicationInfo = &appInfo;
+
+	std::vector<const char*> extensions;
+
+	// Offscreen rendering doesn't need GLFW (or a display) at all
+	if (surfaceExtensions)
+	{
+		uint32_t glfwExtensionCount;
+		const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	}
+
+	if (enableValidationLayers)
+	{
+		extensions.push_back("VK_EXT_debug_utils");
+	}
+
+	instanceCreateInfo.enabledExtensionCount = extensions.size();;
+	instanceCreateInfo.ppEnabledExtensionNames = extensions.data();
+
+	if (enableValidationLayers)
+	{
+		instanceCreateInfo.enabledLayerCount = (uint32_t)(validationLayers.size());
+		instanceCreateInfo.ppEnabledLayerNames = validationLayers.data();
+		
 		VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo = GetDebugMessengerInfo();
 		instanceCreateInfo.pNext = &debugCreateInfo;
 	}
-	else
+	else
+	{
+		instanceCreateInfo.enabledLayerCount = 0;
+	}
+
+	VkInstance instance;
+	VkResult result = vkCreateInstance(&instanceCreateInfo, nullptr, &instance);
+
+	ASSERT(result == VK_SUCCESS, "Failed to create the vulkan instance.");
+
+	return instance;
+}
+
+bool CheckValidationLayerSupport(const std::vector<const char*>& validationLayers)
+{
+	uint32_t propertyCount;
+	vkEnumerateInstanceLayerProperties(&propertyCount, nullptr);
+
+	std::vector<VkLayerProperties> availableLayers(propertyCount);
+	vkEnumerateInstanceLayerProperties(&propertyCount, availableLayers.data());
+
+	for (const char* requestedLayerName : validationLayers)
+	{
+		bool layerAvailable = false;
+
+		for (const VkLayerProperties& properties : availableLayers)
+		{
+			if (strcmp(properties.layerName, requestedLayerName) == 0)
+			{
+				layerAvailable = true;
+			}
+		}
+
+		if (!layerAvailable)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+VkDebugUtilsMessengerEXT SetupDebugMessenger(VkInstance instance)
+{
+	VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo = GetDebugMessengerInfo();
+
+	VkDebugUtilsMessengerEXT debugMessenger;
+	VkResult result = CreateDebugUtilsMessengerEXT(instance, &debugCreateInfo, nullptr, &debugMessenger);
+
+	ASSERT(result == VK_SUCCESS, "Failed to create the debug messenger");
+
+	return debugMessenger;
+}
+
+VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger)
+{
+	auto func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
+
+	if (func == nullptr)
+	{
+		return VK_ERROR_EXTENSION_NOT_PRESENT;
+	}
+
+	return func(instance, pCreateInfo, pAllocator, pDebugMessenger);
+}
+
+void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT debugMessenger, const VkAllocationCallbacks* pAllocator)
+{
+	auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
+
+	if (func != nullptr)
+	{
+		func(instance, debugMessenger, pAllocator);
+	}
+}
+
+VkSurfaceKHR CreateSurface(VkInstance instance, GLFWwindow* window)
+{
+	VkSurfaceKHR surface;
+	VkResult result = glfwCreateWindowSurface(instance, window, NULL, &surface);
+	
+	return surface;
+}
+
+VkPhysicalDevice ChoosePhysicalDevice(VkInstance instance, VkSurfaceKHR surface, const std::vector<const char*>& deviceExtensions)
+{
+	// Get number of devices first
+	uint32_t physicalDeviceCount;
+	vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, nullptr);
+
+	// Then create & fill the buffer
+	std::vector<VkPhysicalDevice> physicalDevices(physicalDeviceCount);
+	vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, physicalDevices.data());
+
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	QueueFamilyIndices queueFamilyIndices;
+
+	for (const VkPhysicalDevice& device : physicalDevices)
+	{
+		queueFamilyIndices = GetQueueFamilies(device, surface);
+
+		// Check if required extensions, present modes, surface formats... are supported
+		if (queueFamilyIndices.IsComplete() && IsDeviceSuitable(device, surface, deviceExtensions))
+		{
+			physicalDevice = device;
+			break;
+		}
+	}
+
+	ASSERT(physicalDevice != VK_NULL_HANDLE, "Couldn't find a suitable GPU.");
+
+	return physicalDevice;
+}
+
+QueueFamilyIndices GetQueueFamilies(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface)
+{
+	// Really good queue (family) explaination lol: https://stackoverflow.com/questions/55272626/what-is-actually-a-queue-family-in-vulkan
+
+	QueueFamilyIndices indices;
+
+	uint32_t queueFamilyCount;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	for (int i = 0; i < queueFamilies.size(); i++)
+	{
+		const VkQueueFamilyProperties& queueFamily = queueFamilies[i];
+
+		if (queueFamily.queueCount <= 0)
+		{
+			continue;
+		}
+
+		// We need at least of queue family that can do graphic operations (amongst others)
+		if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		{
+			indices.GraphicsFamily = i;
+			indices.HasGraphicsFamily = true;
+		}
+
+		VkBool32 presentSupport = false;
+
+		// Nothing gets presented without a surface, so any family is fine
+		if (surface == VK_NULL_HANDLE)
+		{
+			presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+		}
+		else
+		{
+			vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &presentSupport);
+		}
+
+		if (presentSupport)
+		{
+			indices.PresentFamily = i;
+			indices.HasPresentFamily = true;
+		}
+
+		if (indices.IsComplete())
+		{
+			break;
+		}
+	}
+
+	indices.TransferFamily = indices.GraphicsFamily;
+
+	// Graphics and compute families can always transfer too, one that only transfers is the DMA engine
+	for (int i = 0; i < queueFamilies.size(); i++)
+	{
+		const VkQueueFamilyProperties& queueFamily = queueFamilies[i];
+
+		if (queueFamily.queueCount > 0 && (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+		{
+			indices.TransferFamily = i;
+			indices.HasDedicatedTransferFamily = true;
+
+			break;
+		}
+	}
+
+	return indices;
+}
+
+bool SupportsRequiredExtensions(const VkPhysicalDevice& device, const std::vector<const char*>& deviceExtensions)
+{
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+	// Every one of them has to be there, the headless modes ask for none at all
+	for (const char* required : deviceExtensions)
+	{
+		bool found = false;
+
+		for (const VkExtensionProperties& extension : availableExtensions)
+		{
+			if (strcmp(extension.extensionName, required) == 0)
+			{
+				found = true;
+				break;
+			}
+		}
+
+		if (!found)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+SwapChainSupportDetails QuerySwapChainSupport(const VkPhysicalDevice& device, const VkSurfaceKHR& surface)
+{
+	SwapChainSupportDetails details{};
+
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.Capabilities);
+
+	// VK_FORMAT_R32G32B32A32_SFLOAT and VK_COLOR_SPACE_SRGB_NONLINEAR_KHR for example
+	uint32_t surfaceFormatCount;
+	vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &surfaceFormatCount, nullptr);
+
+	if (surfaceFormatCount != 0)
+	{
+		details.SurfaceFormats.resize(surfaceFormatCount);
+		vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &surfaceFormatCount, details.SurfaceFormats.data());
+	}
+
+	// Mailbox, Fifo, ...
+	uint32_t presentModesCount;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModesCount, nullptr);
+
+	if (presentModesCount != 0)
+	{
+		details.PresentModes.resize(presentModesCount);
+		vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModesCount, details.PresentModes.data());
+	}
+
+	return details;
+}
+
+bool SupportsAnisotropicSampling(const VkPhysicalDevice& device)
+{
+	VkPhysicalDeviceFeatures features;
+	vkGetPhysicalDeviceFeatures(device, &features);
+
+	return features.samplerAnisotropy;
+}
+
+bool SupportsTimelineSemaphores(const VkPhysicalDevice& device)
+{
+	// Core since 1.2, the frame scheduler and the uploader are built on them
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(device, &properties);
+
+	if (properties.apiVersion < VK_API_VERSION_1_2)
+	{
+		return false;
+	}
+
+	VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+	timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+
+	VkPhysicalDeviceFeatures2 features{};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	features.pNext = &timelineFeatures;
+
+	vkGetPhysicalDeviceFeatures2(device, &features);
+
+	return timelineFeatures.timelineSemaphore;
+}
+
+bool IsDeviceSuitable(const VkPhysicalDevice& device, const VkSurfaceKHR& surface, const std::vector<const char*>& deviceExtensions)
+{
+	if (surface == VK_NULL_HANDLE)
+	{
+		return SupportsRequiredExtensions(device, deviceExtensions) && SupportsAnisotropicSampling(device) && SupportsTimelineSemaphores(device);
+	}
+
+	SwapChainSupportDetails swapChainDetails = QuerySwapChainSupport(device, surface);
+	return SupportsRequiredExtensions(device, deviceExtensions) && swapChainDetails.IsComplete() && SupportsAnisotropicSampling(device) && SupportsTimelineSemaphores(device);
+}
+
+uint32_t FindMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties)
+{
+	VkPhysicalDeviceMemoryProperties memoryProperties{};
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+	{
+		if ((typeFilter) & (1 << i) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+
+	ASSERT(false, "Failed to find a supported memory type.");
+}
+
+void CreateGpuAllocator(VkDevice device, VkPhysicalDevice physicalDevice, GpuAllocator& allocator)
+{
+	allocator.Device = device;
+	allocator.PhysicalDevice = physicalDevice;
+
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &allocator.MemoryProperties);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	allocator.Granularity = std::max(properties.limits.bufferImageGranularity, (VkDeviceSize)1);
+}
+
+void DestroyGpuAllocator(GpuAllocator& allocator)
+{
+	ASSERT(allocator.AllocationCount == 0, "GPU memory is still in use.");
+
+	for (GpuMemoryBlock& block : allocator.Blocks)
+	{
+		if (block.Memory == VK_NULL_HANDLE)
+		{
+			continue;
+		}
+
+		if (block.Mapped)
+		{
+			vkUnmapMemory(allocator.Device, block.Memory);
+		}
+
+		vkFreeMemory(allocator.Device, block.Memory, nullptr);
+	}
+
+	allocator = {};
+}
+
+GpuAllocation GpuAllocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties)
+{
+	uint32_t memoryType = FindMemoryType(PhysicalDevice, requirements.memoryTypeBits, properties);
+
+	// Buddies of 1 << order bytes always start at a multiple of 1 << order, so that covers the alignment too
+	VkDeviceSize size = (requirements.size + Granularity - 1) / Granularity * Granularity;
+	VkDeviceSize minimumSize = std::max(size, std::max(requirements.alignment, Granularity));
+
+	// Rounding these up to a power of 2 could waste almost as much as they need, and they'd never share a block anyway
+	if (minimumSize > ((VkDeviceSize)1 << GPU_MEMORY_BLOCK_ORDER))
+	{
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+
+		allocInfo.allocationSize = size;
+		allocInfo.memoryTypeIndex = memoryType;
+
+		GpuAllocation allocation;
+		VkResult result = vkAllocateMemory(Device, &allocInfo, nullptr, &allocation.Memory);
+		ASSERT(result == VK_SUCCESS, "Failed to allocate dedicated GPU memory.");
+
+		if (MemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		{
+			void* data;
+			vkMapMemory(Device, allocation.Memory, 0, VK_WHOLE_SIZE, NULL, &data);
+			allocation.Mapped = (uint8_t*)data;
+		}
+
+		allocation.Size = requirements.size;
+		allocation.Dedicated = true;
+
+		DeviceAllocationCount++;
+		DedicatedBytes += size;
+		DedicatedCount++;
+
+		RequestedBytes += requirements.size;
+		AllocationCount++;
+
+		return allocation;
+	}
+
+	uint32_t order = GPU_MEMORY_MIN_ORDER;
+
+	while (((VkDeviceSize)1 << order) < minimumSize)
+	{
+		order++;
+	}
+
+	uint32_t blockIndex = Blocks.size();
+	uint32_t freeOrder = 0;
+
+	// First block with a free range that's big enough, and the smallest such range in it
+	for (uint32_t i = 0; i < Blocks.size() && blockIndex == Blocks.size(); i++)
+	{
+		const GpuMemoryBlock& block = Blocks[i];
+
+		if (block.Memory == VK_NULL_HANDLE || block.MemoryType != memoryType)
+		{
+			continue;
+		}
+
+		for (uint32_t j = order; j <= block.Order; j++)
+		{
+			if (!block.FreeLists[j - GPU_MEMORY_MIN_ORDER].empty())
+			{
+				blockIndex = i;
+				freeOrder = j;
+
+				break;
+			}
+		}
+	}
+
+	if (blockIndex == Blocks.size())
+	{
+		// Reuse the slot of a freed block if there is one
+		for (uint32_t i = 0; i < Blocks.size(); i++)
+		{
+			if (Blocks[i].Memory == VK_NULL_HANDLE)
+			{
+				blockIndex = i;
+				break;
+			}
+		}
+
+		if (blockIndex == Blocks.size())
+		{
+			Blocks.emplace_back();
+		}
+
+		GpuMemoryBlock& block = Blocks[blockIndex];
+		block = {};
+
+		block.MemoryType = memoryType;
+		block.Order = GPU_MEMORY_BLOCK_ORDER;
+
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+
+		allocInfo.allocationSize = (VkDeviceSize)1 << block.Order;
+		allocInfo.memoryTypeIndex = memoryType;
+
+		VkResult result = vkAllocateMemory(Device, &allocInfo, nullptr, &block.Memory);
+		ASSERT(result == VK_SUCCESS, "Failed to allocate a GPU memory block.");
+
+		DeviceAllocationCount++;
+
+		// Mapped once for good, mapping the same memory twice isn't allowed anyway
+		if (MemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		{
+			void* data;
+			vkMapMemory(Device, block.Memory, 0, VK_WHOLE_SIZE, NULL, &data);
+			block.Mapped = (uint8_t*)data;
+		}
+
+		block.FreeLists.resize(block.Order - GPU_MEMORY_MIN_ORDER + 1);
+		block.FreeLists.back().insert(0);
+
+		freeOrder = block.Order;
+	}
+
+	GpuMemoryBlock& block = Blocks[blockIndex];
+
+	std::set<VkDeviceSize>& freeList = block.FreeLists[freeOrder - GPU_MEMORY_MIN_ORDER];
+	VkDeviceSize offset = *freeList.begin();
+	freeList.erase(freeList.begin());
+
+	// Split until it fits, the upper halves become free buddies
+	while (freeOrder > order)
+	{
+		freeOrder--;
+		block.FreeLists[freeOrder - GPU_MEMORY_MIN_ORDER].insert(offset + ((VkDeviceSize)1 << freeOrder));
+	}
+
+	block.UsedBytes += (VkDeviceSize)1 << order;
+	block.AllocationCount++;
+
+	RequestedBytes += requirements.size;
+	AllocationCount++;
+
+	GpuAllocation allocation;
+	allocation.Memory = block.Memory;
+	allocation.Offset = offset;
+	allocation.Size = requirements.size;
+	allocation.Mapped = block.Mapped ? block.Mapped + offset : nullptr;
+	allocation.Block = blockIndex;
+	allocation.Order = order;
+
+	return allocation;
+}
+
+void GpuAllocator::Free(GpuAllocation& allocation)
+{
+	if (allocation.Memory == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	if (allocation.Dedicated)
+	{
+		if (allocation.Mapped)
+		{
+			vkUnmapMemory(Device, allocation.Memory);
+		}
+
+		vkFreeMemory(Device, allocation.Memory, nullptr);
+
+		DedicatedBytes -= (allocation.Size + Granularity - 1) / Granularity * Granularity;
+		DedicatedCount--;
+
+		RequestedBytes -= allocation.Size;
+		AllocationCount--;
+
+		allocation = {};
+		return;
+	}
+
+	GpuMemoryBlock& block = Blocks[allocation.Block];
+	ASSERT(block.Memory == allocation.Memory, "Freeing GPU memory that isn't from this allocator.");
+
+	block.UsedBytes -= (VkDeviceSize)1 << allocation.Order;
+	block.AllocationCount--;
+
+	RequestedBytes -= allocation.Size;
+	AllocationCount--;
+
+	VkDeviceSize offset = allocation.Offset;
+	uint32_t order = allocation.Order;
+
+	// Merge with the buddy for as long as it's free too
+	while (order < block.Order)
+	{
+		std::set<VkDeviceSize>& freeList = block.FreeLists[order - GPU_MEMORY_MIN_ORDER];
+		auto buddy = freeList.find(offset ^ ((VkDeviceSize)1 << order));
+
+		if (buddy == freeList.end())
+		{
+			break;
+		}
+
+		offset = std::min(offset, *buddy);
+		freeList.erase(buddy);
+
+		order++;
+	}
+
+	block.FreeLists[order - GPU_MEMORY_MIN_ORDER].insert(offset);
+
+	allocation = {};
+
+	if (block.AllocationCount > 0)
+	{
+		return;
+	}
+
+	// Keep one empty block per memory type around so allocating and freeing in a loop doesn't hit the driver every time
+	for (const GpuMemoryBlock& other : Blocks)
+	{
+		if (&other != &block && other.Memory != VK_NULL_HANDLE && other.MemoryType == block.MemoryType)
+		{
+			if (block.Mapped)
+			{
+				vkUnmapMemory(Device, block.Memory);
+			}
+
+			vkFreeMemory(Device, block.Memory, nullptr);
+			block = {};
+
+			break;
+		}
+	}
+}
+
+VkBuffer GpuAllocator::CreateBuffer(const VkBufferCreateInfo& bufferInfo, VkMemoryPropertyFlags properties, GpuAllocation& allocation)
+{
+	VkBuffer buffer;
+	VkResult result = vkCreateBuffer(Device, &bufferInfo, nullptr, &buffer);
+
+	ASSERT(result == VK_SUCCESS, "Failed to create a buffer.");
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetBufferMemoryRequirements(Device, buffer, &memoryRequirements);
+
+	allocation = Allocate(memoryRequirements, properties);
+
+	result = vkBindBufferMemory(Device, buffer, allocation.Memory, allocation.Offset);
+	ASSERT(result == VK_SUCCESS, "Failed to bind the buffer memory.");
+
+	return buffer;
+}
+
+void GpuAllocator::DestroyBuffer(VkBuffer buffer, GpuAllocation& allocation)
+{
+	vkDestroyBuffer(Device, buffer, nullptr);
+	Free(allocation);
+}
+
+VkImage GpuAllocator::CreateImage(const VkImageCreateInfo& imageInfo, VkMemoryPropertyFlags properties, GpuAllocation& allocation)
+{
+	VkImage image;
+	VkResult result = vkCreateImage(Device, &imageInfo, nullptr, &image);
+
+	ASSERT(result == VK_SUCCESS, "Failed to create an image.");
+
+	VkMemoryRequirements memoryRequirements{};
+	vkGetImageMemoryRequirements(Device, image, &memoryRequirements);
+
+	allocation = Allocate(memoryRequirements, properties);
+
+	result = vkBindImageMemory(Device, image, allocation.Memory, allocation.Offset);
+	ASSERT(result == VK_SUCCESS, "Failed to bind the image memory.");
+
+	return image;
+}
+
+void GpuAllocator::DestroyImage(VkImage image, GpuAllocation& allocation)
+{
+	vkDestroyImage(Device, image, nullptr);
+	Free(allocation);
+}
+
+void GpuAllocator::PrintStats()
+{
+	uint32_t blockCount = 0;
+	VkDeviceSize blockBytes = 0;
+	VkDeviceSize usedBytes = 0;
+	VkDeviceSize freeBytes = 0;
+	VkDeviceSize largestFreeBytes = 0;
+
+	for (const GpuMemoryBlock& block : Blocks)
+	{
+		if (block.Memory == VK_NULL_HANDLE)
+		{
+			continue;
+		}
+
+		blockCount++;
+		blockBytes += (VkDeviceSize)1 << block.Order;
+		usedBytes += block.UsedBytes;
+
+		for (uint32_t i = 0; i < block.FreeLists.size(); i++)
+		{
+			VkDeviceSize rangeSize = (VkDeviceSize)1 << (GPU_MEMORY_MIN_ORDER + i);
+
+			freeBytes += block.FreeLists[i].size() * rangeSize;
+
+			if (!block.FreeLists[i].empty())
+			{
+				largestFreeBytes = std::max(largestFreeBytes, rangeSize);
+			}
+		}
+	}
+
+	// 0% when all the free memory is one range, close to 100% when it's all crumbs
+	double fragmentation = freeBytes ? 100.0 * (1.0 - (double)largestFreeBytes / freeBytes) : 0.0;
+
+	std::cout << "\n";
+	std::cout << "GPU memory: " << AllocationCount << " allocations in " << blockCount << " blocks and " << DedicatedCount << " dedicated allocations, " << DeviceAllocationCount << " vkAllocateMemory calls in total\n";
+	std::cout << "Used: " << usedBytes + DedicatedBytes << " of " << blockBytes + DedicatedBytes << " bytes (" << DedicatedBytes << " dedicated), " << usedBytes + DedicatedBytes - RequestedBytes << " of them lost to rounding\n";
+	std::cout << "Free: " << freeBytes << " bytes, largest range " << largestFreeBytes << " bytes, " << fragmentation << "% fragmented\n";
+}
+
+VkDevice ChooseLogicalDevice(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, const QueueFamilyIndices& indices, const std::vector<const char*>& deviceExtensions)
+{
+	// Create up to 3 queues, a present queue, a graphics queue and a transfer queue
+	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+
+	std::set<uint32_t> uniqueQueueFamilies = { indices.GraphicsFamily, indices.PresentFamily, indices.TransferFamily };
+
+	for (uint32_t queueFamilyIndex : uniqueQueueFamilies)
+	{
+		VkDeviceQueueCreateInfo queueCreateInfo{};
+		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+
+		// Create one queue from the family ???
+		queueCreateInfo.queueCount = 1;
+		queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
+
+		static constexpr float queuePriority = 1.0f;
+		queueCreateInfo.pQueuePriorities = &queuePriority;
+
+		queueCreateInfos.push_back(queueCreateInfo);
+	}
+
+	VkDeviceCreateInfo deviceCreateInfo{};
+	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+
+	// TODO: only set ansitorepoa filtering to true
+	VkPhysicalDeviceFeatures physicalDeviceFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &physicalDeviceFeatures);
+	deviceCreateInfo.pEnabledFeatures = &physicalDeviceFeatures;
+
+	VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+	timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+	timelineFeatures.timelineSemaphore = VK_TRUE;
+
+	deviceCreateInfo.pNext = &timelineFeatures;
+
+	deviceCreateInfo.queueCreateInfoCount = queueCreateInfos.size();
+	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
+
+	deviceCreateInfo.enabledExtensionCount = deviceExtensions.size();
+	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+
+	// Debug layer ???
+	deviceCreateInfo.enabledLayerCount = 0;
+	// deviceCreateInfo.ppEnabledLayerNames = nullptr;
+
+	VkDevice device;
+	VkResult result = vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device);
+
+	ASSERT(result == VK_SUCCESS, "Failed to create the logical device.");
+	
+	return device;
+}
+
+VkQueue GetQueue(VkDevice device, uint32_t queueFamily, uint32_t queueIndex /* = 0 */)
+{
+	VkQueue queue;
+	vkGetDeviceQueue(device, queueFamily, queueIndex, &queue);
+
+	return queue;
+}
+
+VkCommandPool CreateCommandPool(VkDevice device, uint32_t queueFamilyIndex)
+{
+	VkCommandPoolCreateInfo poolCreateInfo{};
+	poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+
+	// https://registry.khronos.org/vulkan/specs/1.3-extensions/man/html/VkCommandPoolCreateFlagBits.html
+	poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	poolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+
+	VkCommandPool commandPool;
+	vkCreateCommandPool(device, &poolCreateInfo, nullptr, &commandPool);
+
+	return commandPool;
+}
+
+VkSurfaceFormatKHR ChooseSwapChainSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
+{
+	// Choose SRGB if available, else just default to the first format in the vector
+
+	for (const auto& availableFormat : availableFormats)
+	{
+		if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+		{
+			return availableFormat;
+		}
+	}
+
+	return availableFormats[0];
+}
+
+VkPresentModeKHR ChoosePresentMode(const std::vector<VkPresentModeKHR>& availableModes, VkPresentModeKHR preferredMode /* = VK_PRESENT_MODE_MAILBOX_KHR */)
+{
+	// Choose the preferred mode if available, else just default to Fifo which is always there
+
+	for (const auto& presentMode : availableModes)
+	{
+		if (presentMode == preferredMode)
+		{
+			return presentMode;
+		}
+	}
+
+	return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+const char* GetPresentModeName(VkPresentModeKHR presentMode)
+{
+	switch (presentMode)
+	{
+		case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+		case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+		case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+		default: break;
+	}
+
+	return "other";
+}
+
+VkExtent2D ChooseExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabilities, GLFWwindow* window)
+{
+	if (surfaceCapabilities.currentExtent.height != UINT32_MAX)
+	{
+		return surfaceCapabilities.currentExtent;
+	}
+
+	// The surface takes whatever size the swap chain has (Wayland f.e.), so go by the window, in pixels not screen coordinates
+	int width, height;
+	glfwGetFramebufferSize(window, &width, &height);
+
+	VkExtent2D extent;
+	extent.width = std::clamp((uint32_t)width, surfaceCapabilities.minImageExtent.width, surfaceCapabilities.maxImageExtent.width);
+	extent.height = std::clamp((uint32_t)height, surfaceCapabilities.minImageExtent.height, surfaceCapabilities.maxImageExtent.height);
+
+	return extent;
+}
+
+VkSwapchainKHR CreateSwapChain(VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, VkSurfaceCapabilitiesKHR capabilities, VkExtent2D extent, VkSurfaceFormatKHR surfaceFormat, VkPresentModeKHR presentMode, const QueueFamilyIndices& queueIndices, VkSwapchainKHR oldSwapChain /* = VK_NULL_HANDLE */)
+{
+	uint32_t imageCount = capabilities.minImageCount + 1;
+
+	// == 0 -> no limit
+	uint32_t maxImageCount = capabilities.maxImageCount;
+	if (maxImageCount != 0 && imageCount > maxImageCount)
+	{
+		imageCount = maxImageCount;
+	}
+
+	VkSwapchainCreateInfoKHR createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+
+	createInfo.imageExtent = extent;
+	createInfo.surface = surface;
+	createInfo.presentMode = presentMode;
+
+	createInfo.minImageCount = imageCount;
+	createInfo.imageColorSpace = surfaceFormat.colorSpace;
+	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+	createInfo.imageFormat = surfaceFormat.format;
+
+	// Would be 6 for cubemap (I think???)
+	createInfo.imageArrayLayers = 1;
+
+	uint32_t queueFamilyIndices[2] = { queueIndices.GraphicsFamily, queueIndices.PresentFamily };
+
+	if (queueIndices.GraphicsFamily == queueIndices.PresentFamily)
+	{
+		createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		createInfo.queueFamilyIndexCount = 0;
+		createInfo.pQueueFamilyIndices = nullptr;
+	}
+	else
+	{
+		createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+		createInfo.queueFamilyIndexCount = 2;
+		createInfo.pQueueFamilyIndices = queueFamilyIndices;
+	}
+
+	// Depending on the physical device, Vulkan might apply a rotation/mirror transform
+	createInfo.preTransform = capabilities.currentTransform;
+
+	// No blending
+	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+
+	// Side effect: The image might not own all of its pixels, f.e. if the window is obscured by another window
+	createInfo.clipped = VK_TRUE;
+
+	// Lets the driver hand resources over from the swap chain being replaced, it's retired but still has to be destroyed
+	createInfo.oldSwapchain = oldSwapChain;
+
+	VkSwapchainKHR swapChain;
+	VkResult result = vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain);
+
+	ASSERT(result == VK_SUCCESS, "Failed to create the swap chain.");
+
+	return swapChain;
+}
+
+void GetSwapChainImages(VkDevice device, VkSwapchainKHR swapChain, std::vector<VkImage>& images)
+{
+	// We've only specified a minimum number of swap chain images, the implementation is allowed to create more
+
+	uint32_t imageCount;
+	vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
+
+	images.resize(imageCount);
+	vkGetSwapchainImagesKHR(device, swapChain, &imageCount, images.data());
+}
+
+void CreateImageViews(VkDevice device, const std::vector<VkImage>& swapChainImages, VkFormat imageFormat, std::vector<VkImageView>& imageViews)
+{
+	uint32_t imageCount = swapChainImages.size();
+	imageViews.resize(imageCount);
+
+	for (uint32_t i = 0; i < imageCount; i++)
+	{
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+
+		viewInfo.image = swapChainImages[i];
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = imageFormat;
+
+		// Which part of the image should be accessed (multiple layers, color or depth, ...)?
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = 1;
+
+		VkResult result = vkCreateImageView(device, &viewInfo, nullptr, &imageViews[i]);
+		
+		ASSERT(result == VK_SUCCESS, "Failed to create a swap chain image view.");
+	}
+}
+
+VkFormat FindSupportedDepthFormat(VkPhysicalDevice physicalDevice)
+{
+	// VK_FORMAT_D32_SFLOAT ... 32 bit for depth
+	// VK_FORMAT_D32_SFLOAT_S8_UINT ... 32 bit for depth, 8 bit for stencil
+	// VK_FORMAT_D24_UNORM_S8_UINT ... 24 bit for depth, 8 bit for stencil
+	VkFormat depthFormats[3] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT };
+
+	// VK_IMAGE_TILING_LINEAR ... texels are laid out as row-major
+	// VK_IMAGE_TILING_OPTIMAL ... implementation dependent, used most optimal layout
+	VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL;
+
+	// Needs to be set so that image can be used as a depth/stencil attachment
+	VkFormatFeatureFlags formatFeatures = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT;
+
+	for (auto format : depthFormats)
+	{
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+
+		if (formatProperties.optimalTilingFeatures & formatFeatures)
+		{
+			return format;
+		}
+	}
+
+	ASSERT(false, "Failed to find an appropiate depth format.");
+}
+
+void CreateDepthResources(VkDevice device, GpuAllocator& allocator, VkMemoryPropertyFlags properties, VkFormat depthFormat, VkExtent2D swapChainExtent, uint32_t imageCount, std::vector<VkImage>& depthImages, std::vector<GpuAllocation>& depthMemory, std::vector<VkImageView>& depthImageViews)
+{
+	depthImages.resize(imageCount);
+	depthMemory.resize(imageCount);
+	depthImageViews.resize(imageCount);
+
+	for (uint32_t i = 0; i < imageCount; i++)
+	{
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = depthFormat;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		// Never stored or sampled, so it can live in tile memory on GPUs that have it
+		imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		imageInfo.extent.width = swapChainExtent.width;
+		imageInfo.extent.height = swapChainExtent.height;
+		imageInfo.extent.depth = 1;
+
+		imageInfo.arrayLayers = 1;
+		imageInfo.mipLevels = 1;
+
+		depthImages[i] = allocator.CreateImage(imageInfo, properties, depthMemory[i]);
+
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+
+		viewInfo.image = depthImages[i];
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = depthFormat;
+
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+
+		VkResult result = vkCreateImageView(device, &viewInfo, nullptr, &depthImageViews[i]);
+		ASSERT(result == VK_SUCCESS, "Failed to create a depth image view.");
+	}
+}
+
+VkDeviceSize GetDepthFormatSize(VkFormat depthFormat)
+{
+	switch (depthFormat)
+	{
+	case VK_FORMAT_UNDEFINED: return 0;
+	case VK_FORMAT_D32_SFLOAT_S8_UINT: return 8;
+	default: return 4;
+	}
+}
+
+VkMemoryPropertyFlags ChooseTransientMemoryProperties(const GpuAllocator& allocator)
+{
+	// Tilers have memory that only gets backed when something actually leaves tile memory, which a depth buffer never does
+	for (uint32_t i = 0; i < allocator.MemoryProperties.memoryTypeCount; i++)
+	{
+		if (allocator.MemoryProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+		{
+			return VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+		}
+	}
+
+	return VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+}
+
+void PrintAttachmentReport(VkPhysicalDevice physicalDevice, const GpuAllocator& allocator, VkExtent2D extent, uint32_t imageCount, VkFormat depthFormat)
+{
+	VkDeviceSize pixelCount = (VkDeviceSize)extent.width * extent.height;
+
+	// What it used to be: a depth image per swap chain image
+	VkDeviceSize perImageBytes = pixelCount * GetDepthFormatSize(FindSupportedDepthFormat(physicalDevice));
+	VkDeviceSize oldBytes = perImageBytes * imageCount;
+
+	VkDeviceSize depthBytes = pixelCount * GetDepthFormatSize(depthFormat);
+	bool lazy = ChooseTransientMemoryProperties(allocator) & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+
+	if (depthFormat == VK_FORMAT_UNDEFINED)
+	{
+		printf("Depth attachment: none, saves %.2f MB over one per image (%u images)\n", oldBytes / 1e6, imageCount);
+	}
+	else
+	{
+		printf("Depth attachment: one shared %s image, %.2f MB instead of %.2f MB\n", lazy ? "lazily allocated" : "transient", (lazy ? 0 : depthBytes) / 1e6, oldBytes / 1e6);
+	}
+
+	// Color is cleared instead of loaded and stored for presenting, depth is cleared and never stored
+	// A tiler only writes the stored color out, an immediate mode GPU also writes the depth clear and the depth tests
+	printf("Attachment traffic per frame: %.2f MB color stored, %.2f MB depth cleared (none on tilers)\n", pixelCount * 4 / 1e6, depthBytes / 1e6);
+}
+
+VkRenderPass CreateRenderPass(VkDevice device, VkPhysicalDevice physicalDevice, VkFormat imageFormat, VkFormat depthFormat, VkImageLayout finalLayout /* = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR */)
+{
+	bool hasDepth = depthFormat != VK_FORMAT_UNDEFINED;
+
+	VkAttachmentDescription colorAttachment{};
+	colorAttachment.format = imageFormat;
+	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+
+	// Every pixel gets cleared, so the old contents never have to be read in
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+
+	// Has to be kept around to be presented or read back
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	// VK_IMAGE_LAYOUT_PRESENT_SRC_KHR can only be used for presenting an image to the screen
+	colorAttachment.finalLayout = finalLayout;
+
+	VkAttachmentReference colorReference{};
+	colorReference.attachment = 0;
+	colorReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentDescription depthAttachment{};
+	depthAttachment.format = depthFormat;
+
+	// One sample per pixel
+	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+
+	// Clear depth attachment at beginning of subpass
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+
+	// Contents of the buffer may be discareded after rendering to it
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference depthReference{};
+	depthReference.attachment = 1;
+	depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkSubpassDescription subpassDescription{};
+
+	// The pipeline bound to VK_PIPELINE_BIND_POINT_GRAPHICS controls the behavior of all drawing commands
+	subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+
+	subpassDescription.colorAttachmentCount = 1;
+	subpassDescription.pColorAttachments = &colorReference;
+	subpassDescription.pDepthStencilAttachment = hasDepth ? &depthReference : nullptr;
+
+	// Awesome explanation: https://www.reddit.com/r/vulkan/comments/s80reu/comment/hth2uj9/?utm_source=share&utm_medium=web2x&context=3
+	// https://stackoverflow.com/questions/53984863/what-exactly-is-vk-subpass-external
+	VkSubpassDependency subpassDependency{};
+
+	subpassDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependency.dstSubpass = 0;
+
+	subpassDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependency.srcAccessMask = NULL;
+
+	subpassDependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	if (hasDepth)
+	{
+		// There's one depth image for all frames in flight, so the last frame's depth tests have to be done before this one clears it
+		subpassDependency.srcStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		subpassDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+		subpassDependency.dstStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		subpassDependency.dstAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	}
+
+	std::vector<VkAttachmentDescription> attachments = { colorAttachment };
+
+	if (hasDepth)
+	{
+		attachments.push_back(depthAttachment);
+	}
+
+	VkRenderPassCreateInfo renderPassInfo{};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+
+	renderPassInfo.attachmentCount = attachments.size();
+	renderPassInfo.pAttachments = attachments.data();
+
+	renderPassInfo.dependencyCount = 1;
+	renderPassInfo.pDependencies = &subpassDependency;
+
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpassDescription;
+
+	VkRenderPass renderPass;
+	VkResult result = vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass);
+
+	ASSERT(result == VK_SUCCESS, "Failed to create the render pass.");
+
+	return renderPass;
+}
+
+void CreateFramebuffers(VkDevice device, VkRenderPass renderPass, VkExtent2D swapChainExtent, uint32_t imageCount, const std::vector<VkImageView>& colorImageViews, const std::vector<VkImageView>& depthImageViews, std::vector<VkFramebuffer>& framebuffers)
+{
+	framebuffers.resize(imageCount);
+
+	for (uint32_t i = 0; i < imageCount; i++)
+	{
+		std::vector<VkImageView> attachments = { colorImageViews[i] };
+
+		// No depth at all, or one image that all framebuffers share
+		if (!depthImageViews.empty())
+		{
+			attachments.push_back(depthImageViews[std::min<size_t>(i, depthImageViews.size() - 1)]);
+		}
+
+		VkFramebufferCreateInfo framebufferInfo{};
+		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+
+		framebufferInfo.attachmentCount = attachments.size();
+		framebufferInfo.pAttachments = attachments.data();
+
+		framebufferInfo.renderPass = renderPass;
+
+		framebufferInfo.width = swapChainExtent.width;
+		framebufferInfo.height = swapChainExtent.height;
+		framebufferInfo.layers = 1;
+
+		VkResult result = vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffers[i]);
+		ASSERT(result == VK_SUCCESS, "Failed to create a framebuffer.");
+	}
+}
+
+bool CreateSwapChainResources(VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, GLFWwindow* window, GpuAllocator& allocator, const QueueFamilyIndices& queueIndices, VkSurfaceFormatKHR surfaceFormat, VkPresentModeKHR presentMode, VkFormat depthFormat, VkRenderPass renderPass, VkSwapchainKHR oldSwapChain, SwapChainResources& resources)
+{
+	VkSurfaceCapabilitiesKHR capabilities;
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &capabilities);
+
+	VkExtent2D extent = ChooseExtent(capabilities, window);
+
+	// Minimized, there's nothing to draw to
+	if (extent.width == 0 || extent.height == 0)
+	{
+		return false;
+	}
+
+	resources.Extent = extent;
+	resources.SwapChain = CreateSwapChain(device, physicalDevice, surface, capabilities, extent, surfaceFormat, presentMode, queueIndices, oldSwapChain);
+
+	GetSwapChainImages(device, resources.SwapChain, resources.Images);
+	uint32_t imageCount = resources.Images.size();
+
+	CreateImageViews(device, resources.Images, surfaceFormat.format, resources.ImageViews);
+
+	// Only one frame is between its depth clear and its last depth test at a time, so one image is enough for all of them
+	if (depthFormat != VK_FORMAT_UNDEFINED)
+	{
+		CreateDepthResources(device, allocator, ChooseTransientMemoryProperties(allocator), depthFormat, extent, 1, resources.DepthImages, resources.DepthMemory, resources.DepthImageViews);
+	}
+
+	CreateFramebuffers(device, renderPass, extent, imageCount, resources.ImageViews, resources.DepthImageViews, resources.Framebuffers);
+
+	return true;
+}
+
+void DestroySwapChainResources(VkDevice device, GpuAllocator& allocator, SwapChainResources& resources)
+{
+	for (auto framebuffer : resources.Framebuffers)
+	{
+		vkDestroyFramebuffer(device, framebuffer, nullptr);
+	}
+
+	for (uint32_t i = 0; i < resources.DepthImages.size(); i++)
+	{
+		vkDestroyImageView(device, resources.DepthImageViews[i], nullptr);
+		allocator.DestroyImage(resources.DepthImages[i], resources.DepthMemory[i]);
+	}
+
+	for (auto imageView : resources.ImageViews)
+	{
+		vkDestroyImageView(device, imageView, nullptr);
+	}
+
+	vkDestroySwapchainKHR(device, resources.SwapChain, nullptr);
+
+	resources = {};
+}
+
+bool RecreateSwapChain(VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, GLFWwindow* window, GpuAllocator& allocator, const QueueFamilyIndices& queueIndices, VkSurfaceFormatKHR surfaceFormat, VkPresentModeKHR presentMode, VkFormat depthFormat, VkRenderPass renderPass, const FrameScheduler& scheduler, SwapChainResources& resources, std::vector<SwapChainResources>& retired)
+{
+	SwapChainResources newResources;
+
+	if (!CreateSwapChainResources(device, physicalDevice, surface, window, allocator, queueIndices, surfaceFormat, presentMode, depthFormat, renderPass, resources.SwapChain, newResources))
+	{
+		return false;
+	}
+
+	// No vkDeviceWaitIdle(), frames that are still in flight keep using the old objects until the timeline says they're done
+	resources.RetireFrame = scheduler.SubmittedFrame;
+	retired.push_back(std::move(resources));
+
+	resources = std::move(newResources);
+
+	return true;
+}
+
+void DestroyRetiredSwapChains(VkDevice device, GpuAllocator& allocator, const FrameScheduler& scheduler, std::vector<SwapChainResources>& retired)
+{
+	if (retired.empty())
+	{
+		return;
+	}
+
+	uint64_t completedFrame = scheduler.CompletedFrame();
+
+	// Retired in order, so the oldest ones are done first
+	while (!retired.empty() && retired.front().RetireFrame <= completedFrame)
+	{
+		DestroySwapChainResources(device, allocator, retired.front());
+		retired.erase(retired.begin());
+	}
+}
+
+VkSemaphore CreateTimelineSemaphore(VkDevice device, uint64_t initialValue /* = 0 */)
+{
+	VkSemaphoreTypeCreateInfo typeInfo{};
+	typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeInfo.initialValue = initialValue;
+
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = &typeInfo;
+
+	VkSemaphore semaphore;
+	VkResult result = vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore);
+	ASSERT(result == VK_SUCCESS, "Failed to create a timeline semaphore.");
+
+	return semaphore;
+}
+
+void CreateFrameScheduler(VkDevice device, uint32_t framesInFlight, FrameScheduler& scheduler)
+{
+	scheduler.Device = device;
+	scheduler.FramesInFlight = framesInFlight;
+
+	// Starts at 0, frame 1 signals 1
+	scheduler.Timeline = CreateTimelineSemaphore(device);
+
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		VkResult result = (VkResult)(
+			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &scheduler.ImageAvailableSemaphores[i]) +
+			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &scheduler.RenderingFinishedSemaphores[i])
+		);
+
+		ASSERT(result == VK_SUCCESS, "Failed to create the synchronization objects.");
+	}
+}
+
+void DestroyFrameScheduler(FrameScheduler& scheduler)
+{
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		vkDestroySemaphore(scheduler.Device, scheduler.ImageAvailableSemaphores[i], nullptr);
+		vkDestroySemaphore(scheduler.Device, scheduler.RenderingFinishedSemaphores[i], nullptr);
+	}
+
+	vkDestroySemaphore(scheduler.Device, scheduler.Timeline, nullptr);
+
+	scheduler = {};
+}
+
+uint32_t FrameScheduler::CurrentSlot() const
+{
+	return (SubmittedFrame + 1) % FramesInFlight;
+}
+
+uint64_t FrameScheduler::CompletedFrame() const
+{
+	uint64_t value;
+	vkGetSemaphoreCounterValue(Device, Timeline, &value);
+
+	return value;
+}
+
+void FrameScheduler::WaitForFrame(uint64_t frame) const
+{
+	VkSemaphoreWaitInfo waitInfo{};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &Timeline;
+	waitInfo.pValues = &frame;
+
+	vkWaitSemaphores(Device, &waitInfo, UINT64_MAX);
+}
+
+void FrameScheduler::WaitForSlot(FrameProfiler* profiler /* = nullptr */)
+{
+	uint64_t frame = SubmittedFrame + 1;
+
+	// Low latency mode waits before sampling input, then again in AquireNextImage()
+	if (WaitedFrame == frame)
+	{
+		return;
+	}
+
+	WaitedFrame = frame;
+
+	{
+		ProfileScope scope(profiler, "WaitForSlot");
+
+		if (frame > FramesInFlight)
+		{
+			WaitForFrame(frame - FramesInFlight);
+		}
+	}
+
+	// Anything between the one just waited for and this one can still be running, that's the CPU/GPU overlap
+	uint64_t overlap = SubmittedFrame - std::min(CompletedFrame(), SubmittedFrame);
+	ASSERT(overlap < FramesInFlight, "More frames are in flight than there are slots.");
+
+	// Kept in bounds for release builds, --verify-scheduler looks at MaxOverlap
+	OverlapCounts[std::min<uint64_t>(overlap, MAX_FRAMES_IN_FLIGHT - 1)]++;
+	MaxOverlap = std::max(MaxOverlap, overlap);
+}
+
+void FrameScheduler::PrintOverlap() const
+{
+	uint64_t frameCount = 0;
+
+	for (uint64_t count : OverlapCounts)
+	{
+		frameCount += count;
+	}
+
+	if (frameCount == 0)
+	{
+		return;
+	}
+
+	// GPU bound it's FramesInFlight - 1 most of the time, CPU bound it's mostly 0
+	std::cout << "Frames still on the GPU when the next one started:";
+
+	for (uint32_t i = 0; i < FramesInFlight; i++)
+	{
+		std::cout << " " << i << ": " << OverlapCounts[i] * 100.0 / frameCount << "%";
+	}
+
+	std::cout << "\n";
+}
+
+bool VerifyFrameScheduler()
+{
+	// Only needs a device for the timeline semaphore, the frames themselves are faked
+	std::vector<const char*> validationLayers;
+	VkInstance instance = CreateInstance(false, validationLayers, false);
+
+	std::vector<const char*> deviceExtensions;
+	VkPhysicalDevice physicalDevice = ChoosePhysicalDevice(instance, VK_NULL_HANDLE, deviceExtensions);
+
+	VkPhysicalDeviceProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+	std::cout << "Using GPU: " << physicalDeviceProperties.deviceName << "\n";
+
+	QueueFamilyIndices queueIndices = GetQueueFamilies(physicalDevice, VK_NULL_HANDLE);
+	VkDevice device = ChooseLogicalDevice(physicalDevice, VK_NULL_HANDLE, queueIndices, deviceExtensions);
+
+	bool passed = true;
+
+	for (uint32_t framesInFlight = 1; framesInFlight <= MAX_FRAMES_IN_FLIGHT; framesInFlight++)
+	{
+		for (bool gpuBound : { true, false })
+		{
+			FrameScheduler scheduler;
+			CreateFrameScheduler(device, framesInFlight, scheduler);
+
+			PlayFakeGpuFrames(scheduler, SCHEDULER_VERIFY_FRAMES, gpuBound);
+
+			// GPU bound every slot should be busy by the time a frame starts (bar the first few frames and a frame finishing
+			// right between the wait and the counter read), with the CPU waiting on every frame nothing is ever left running
+			uint64_t expectedOverlap = gpuBound ? framesInFlight - 1 : 0;
+			double expectedShare = scheduler.OverlapCounts[expectedOverlap] / (double)SCHEDULER_VERIFY_FRAMES;
+
+			bool ok = scheduler.MaxOverlap < framesInFlight && (gpuBound ? expectedShare >= 0.9 : scheduler.MaxOverlap == 0);
+			passed = passed && ok;
+
+			std::cout << framesInFlight << " frames in flight, " << (gpuBound ? "GPU bound" : "CPU waits") << ": " << expectedShare * 100.0 << "% of frames started with " << expectedOverlap << " still on the GPU, at most " << scheduler.MaxOverlap << (ok ? "" : " FAILED") << "\n";
+
+			DestroyFrameScheduler(scheduler);
+		}
+	}
+
+	vkDestroyDevice(device, nullptr);
+	vkDestroyInstance(instance, nullptr);
+
+	return passed;
+}
+
+void PlayFakeGpuFrames(FrameScheduler& scheduler, uint32_t frameCount, bool gpuBound)
+{
+	// The "GPU" is a thread that finishes the submitted frames in order and signals the timeline from the host,
+	// the CPU side submits for free, so the scheduler is the only thing that holds it back
+	std::atomic<uint64_t> submitted{ 0 };
+
+	std::thread gpu([&]()
+	{
+		for (uint64_t frame = 1; frame <= frameCount; frame++)
+		{
+			while (submitted.load() < frame)
+			{
+				std::this_thread::yield();
+			}
+
+			std::this_thread::sleep_for(SCHEDULER_GPU_FRAME_TIME);
+
+			VkSemaphoreSignalInfo signalInfo{};
+			signalInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO;
+
+			signalInfo.semaphore = scheduler.Timeline;
+			signalInfo.value = frame;
+
+			vkSignalSemaphore(scheduler.Device, &signalInfo);
+		}
+	});
+
+	for (uint64_t frame = 1; frame <= frameCount; frame++)
+	{
+		scheduler.WaitForSlot();
+
+		scheduler.SubmittedFrame = frame;
+		submitted.store(frame);
+
+		if (!gpuBound)
+		{
+			scheduler.WaitForFrame(frame);
+		}
+	}
+
+	gpu.join();
+}
+
+VkDescriptorSetLayout CreateTextureSetLayout(VkDevice device)
+{
+	// Just the sprite atlas
+	VkDescriptorSetLayoutBinding binding{};
+	binding.binding = 0;
+	binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	binding.descriptorCount = 1;
+	binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+
+	layoutInfo.bindingCount = 1;
+	layoutInfo.pBindings = &binding;
+
+	VkDescriptorSetLayout setLayout;
+	VkResult result = vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout);
+
+	ASSERT(result == VK_SUCCESS, "Failed to create the texture descriptor set layout.");
+
+	return setLayout;
+}
+
+VkPipelineLayout CreatePipelineLayout(VkDevice device, VkDescriptorSetLayout textureSetLayout)
+{
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(ShaderMatrices);
+
+	VkPipelineLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &textureSetLayout;
+	layoutInfo.pushConstantRangeCount = 1;
+	layoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	VkPipelineLayout pipelineLayout;
+	VkResult result = vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout);
+
+	ASSERT(result == VK_SUCCESS, "Failed to create the pipeline layout.");
+
+	return pipelineLayout;
+}
+
+VkPipelineCache LoadPipelineCache(VkDevice device, VkPhysicalDevice physicalDevice, const fs::path& path, bool& warm)
+{
+	std::string data;
+	warm = false;
+
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+
+	if (!path.empty() && file.is_open())
+	{
+		data.resize((size_t)file.tellg());
+		file.seekg(0);
+		file.read(&data[0], data.size());
+	}
+
+	// Drivers should reject a cache from another GPU or driver version on their own, but plenty of them just crash
+	if (data.size() >= sizeof(VkPipelineCacheHeaderVersionOne))
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+		VkPipelineCacheHeaderVersionOne header;
+		memcpy(&header, data.data(), sizeof(header));
+
+		warm = header.headerSize >= sizeof(header) && header.headerSize <= data.size() &&
+			header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+			header.vendorID == properties.vendorID &&
+			header.deviceID == properties.deviceID &&
+			memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	}
+
+	if (!warm && !data.empty())
+	{
+		std::cout << "Ignoring pipeline cache \"" << path.string() << "\", it's from another GPU or driver\n";
+	}
+
+	VkPipelineCacheCreateInfo cacheInfo{};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+
+	cacheInfo.initialDataSize = warm ? data.size() : 0;
+	cacheInfo.pInitialData = warm ? data.data() : nullptr;
+
+	VkPipelineCache pipelineCache;
+	VkResult result = vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache);
+
+	ASSERT(result == VK_SUCCESS, "Failed to create the pipeline cache.");
+
+	return pipelineCache;
+}
+
+void SavePipelineCache(VkDevice device, VkPipelineCache pipelineCache, const fs::path& path)
+{
+	if (path.empty())
+	{
+		return;
+	}
+
+	size_t size = 0;
+	vkGetPipelineCacheData(device, pipelineCache, &size, nullptr);
+
+	std::string data(size, '\0');
+	VkResult result = vkGetPipelineCacheData(device, pipelineCache, &size, &data[0]);
+
+	if (result != VK_SUCCESS)
+	{
+		return;
+	}
+
+	// Written next to it and renamed, so quitting halfway through never leaves a broken cache behind
+	fs::path temporaryPath = path;
+	temporaryPath += ".tmp";
+
+	std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+	file.write(data.data(), size);
+	file.close();
+
+	std::error_code error;
+	fs::rename(temporaryPath, path, error);
+}
+
+VkPipeline CreatePipeline(VkDevice device, VkPipelineCache pipelineCache, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, const fs::path& vertexShaderPath, const fs::path& fragmentShaderPath)
+{
+	VkPipeline pipeline = CreatePipelineFromSpirv(device, pipelineCache, renderPass, pipelineLayout, ReadFile(vertexShaderPath), ReadFile(fragmentShaderPath));
+	ASSERT(pipeline != VK_NULL_HANDLE, "Failed to create the pipeline.");
+
+	return pipeline;
+}
+
+VkPipeline CreatePipelineFromSpirv(VkDevice device, VkPipelineCache pipelineCache, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, const std::string& vertexSpirv, const std::string& fragmentSpirv)
+{
+	// The render pass would usually be member of the custom swap chain class
+	// ASSERT(swapChain != VK_NULL_HANDLE, "You need a valid swap chain before creating a pipeline.");
+
+	ASSERT(renderPass != VK_NULL_HANDLE, "You need a valid render pass before creating a pipeline.");
+	ASSERT(pipelineLayout != VK_NULL_HANDLE, "You need a valid pipeline layout when creating a pipeline.");
+
+	PipelineConfig config{};
+	config.UseDefaults();
+
+	config.RenderPass = renderPass;
+	config.PipelineLayout = pipelineLayout;
+
+	// Glyphs and the ball have transparent edges, everything's drawn back to front so plain alpha blending is enough
+	config.ColorBlendAttachment.blendEnable = VK_TRUE;
+	config.ColorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	config.ColorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+
+	// Painter ordered for the same reason, every quad sits at z = 0 and a depth test would let the field background hide the rest
+	config.DepthStencilInfo.depthTestEnable = VK_FALSE;
+	config.DepthStencilInfo.depthWriteEnable = VK_FALSE;
+
+	const std::string* spirv[2] = { &vertexSpirv, &fragmentSpirv };
+	VkShaderModule modules[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+
+	for (int i = 0; i < 2; i++)
+	{
+		VkShaderModuleCreateInfo moduleInfo{};
+		moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+
+		moduleInfo.codeSize = spirv[i]->size();
+		moduleInfo.pCode = (const uint32_t*)spirv[i]->c_str();
+
+		if (vkCreateShaderModule(device, &moduleInfo, nullptr, &modules[i]) != VK_SUCCESS)
+		{
+			modules[i] = VK_NULL_HANDLE;
+		}
+	}
+
+	if (modules[0] == VK_NULL_HANDLE || modules[1] == VK_NULL_HANDLE)
+	{
+		vkDestroyShaderModule(device, modules[0], nullptr);
+		vkDestroyShaderModule(device, modules[1], nullptr);
+		return VK_NULL_HANDLE;
+	}
+
+	VkShaderModule vertexModule = modules[0];
+	VkShaderModule fragmentModule = modules[1];
+
+	VkPipelineShaderStageCreateInfo shaderStageInfos[2]{};
+
+	for (int i = 0; i < 2; i++)
+	{
+		shaderStageInfos[i].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStageInfos[i].pName = "main";
+	}
+
+	shaderStageInfos[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shaderStageInfos[0].module = vertexModule;
+
+	shaderStageInfos[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	shaderStageInfos[1].module = fragmentModule;
+
+	std::vector<VkVertexInputBindingDescription> bindingDescriptions = Vertex::GetBindingDescriptions();
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions = Vertex::GetAttributeDescriptions();
+
+	std::vector<VkVertexInputBindingDescription> instanceBindingDescriptions = QuadInstance::GetBindingDescriptions();
+	std::vector<VkVertexInputAttributeDescription> instanceAttributeDescriptions = QuadInstance::GetAttributeDescriptions();
+
+	bindingDescriptions.insert(bindingDescriptions.end(), instanceBindingDescriptions.begin(), instanceBindingDescriptions.end());
+	attributeDescriptions.insert(attributeDescriptions.end(), instanceAttributeDescriptions.begin(), instanceAttributeDescriptions.end());
+
+	VkPipelineVertexInputStateCreateInfo vertexStateInfo{};
+	vertexStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+	vertexStateInfo.vertexBindingDescriptionCount = bindingDescriptions.size();
+	vertexStateInfo.pVertexBindingDescriptions = bindingDescriptions.data();
+
+	vertexStateInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
+	vertexStateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+	VkGraphicsPipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = shaderStageInfos;
+	pipelineInfo.pVertexInputState = &vertexStateInfo;
+
+	pipelineInfo.pViewportState = &config.ViewportInfo;
+	pipelineInfo.pInputAssemblyState = &config.InputAssemblyInfo;
+	pipelineInfo.pRasterizationState = &config.RasterizationInfo;
+	pipelineInfo.pMultisampleState = &config.MultisampleInfo;
+	pipelineInfo.pColorBlendState = &config.ColorBlendInfo;
+	pipelineInfo.pDepthStencilState = &config.DepthStencilInfo;
+	pipelineInfo.pDynamicState = &config.DynamicStateInfo;
+
+	// These don't have default values!
+	pipelineInfo.layout = config.PipelineLayout;
+	pipelineInfo.renderPass = config.RenderPass;
+	pipelineInfo.subpass = config.Subpass;
+
+	// Optional performance optimizations
+	pipelineInfo.basePipelineIndex = -1;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+	VkPipeline pipeline;
+	VkResult result = vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline);
+
+	// The pipeline keeps what it needs
+	vkDestroyShaderModule(device, vertexModule, nullptr);
+	vkDestroyShaderModule(device, fragmentModule, nullptr);
+
+	return result == VK_SUCCESS ? pipeline : VK_NULL_HANDLE;
+}
+
+void PipelineConfig::UseDefaults()
+{
+	{
+		ViewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+
+		ViewportInfo.viewportCount = 1;
+		ViewportInfo.pViewports = nullptr;
+
+		ViewportInfo.scissorCount = 1;
+		ViewportInfo.pScissors = nullptr;
+	}
+
+	{
+		InputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+
+		// Vertices: a, b, c, d, e, f
+		// Triangle list: triangles (a, b), (b, c), (e, f)
+		// Triangle strip: triangles (a, b), (b, c), (c, d), (d, e), (e, f)
+		// Could alse be point/list/...
+		InputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+		InputAssemblyInfo.primitiveRestartEnable = VK_FALSE;
+	}
+
+	{
+		RasterizationInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+
+		// If enabled: clamp(gl_Position.z, 0.0, 1.0)
+		// Doesn't make sense for most applications because if the z value is < 0, it's behind the camera
+		// > 1: Vertex is outside of the view frustum
+		RasterizationInfo.depthClampEnable = VK_FALSE;
+
+		// Discard all fragments immediately
+		RasterizationInfo.rasterizerDiscardEnable = VK_FALSE;
+
+		RasterizationInfo.polygonMode = VK_POLYGON_MODE_FILL;
+		RasterizationInfo.lineWidth = 1.0f;
+		RasterizationInfo.cullMode = VK_CULL_MODE_NONE;
+		RasterizationInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+		// The depth values of all fragments are generated by the rasterization of a polygon
+		// Can be offset by a single value that is computed for that polygon
+		RasterizationInfo.depthBiasEnable = VK_FALSE;
+		RasterizationInfo.depthBiasConstantFactor = 0.0f;
+		RasterizationInfo.depthBiasClamp = 0.0f;
+		RasterizationInfo.depthBiasSlopeFactor = 0.0f;
+	}
+
+	{
+		// Multisampling is used to prevent aliasing
+		// No multisampling: if fragments's center is contained in triangle: fragment is "fully" in triangle
+		// Results in jagged lines
+		// Multisampling: Multiple samples (VK_SAMPLE_COUNT_4_BIT or 8_BIT etc.); determines how much of a pixel
+		// contained in the triangle
+		// MSAA ... Multisample Anti Aliasing
+		MultisampleInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		MultisampleInfo.sampleShadingEnable = VK_FALSE;
+		MultisampleInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+		MultisampleInfo.minSampleShading = 1.0f;
+		MultisampleInfo.pSampleMask = nullptr;
+		MultisampleInfo.alphaToCoverageEnable = VK_FALSE;
+		MultisampleInfo.alphaToOneEnable = VK_FALSE;
+	}
+
+	{
+		ColorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+		ColorBlendAttachment.blendEnable = VK_FALSE;
+
+		ColorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		ColorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+		ColorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+
+		ColorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		ColorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		ColorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+	}
+
+	{
+		ColorBlendInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+
+		// Logical op: &, |, ^, ...
+		// Copy(a, b) = a
+		// Is performed on all color values before writing them into the framebuffer
+		// Only for signed-, unsigned- and normalized integer framebuffers
+		// Not for floating point or SRGB framebuffers
+		ColorBlendInfo.logicOpEnable = VK_FALSE;
+		ColorBlendInfo.logicOp = VK_LOGIC_OP_COPY;
+
+		ColorBlendInfo.attachmentCount = 1;
+		ColorBlendInfo.pAttachments = &ColorBlendAttachment;
+		ColorBlendInfo.blendConstants[0] = 0.0f;
+		ColorBlendInfo.blendConstants[1] = 0.0f;
+		ColorBlendInfo.blendConstants[2] = 0.0f;
+		ColorBlendInfo.blendConstants[3] = 0.0f;
+	}
+
+	{
+		DepthStencilInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		DepthStencilInfo.depthTestEnable = VK_TRUE;
+		DepthStencilInfo.depthWriteEnable = VK_TRUE;
+		DepthStencilInfo.depthCompareOp = VK_COMPARE_OP_LESS;
+
+		// Depth Bounds Test: discard fragments if their depth isn't in the specified range			
+		DepthStencilInfo.depthBoundsTestEnable = VK_FALSE;
+		DepthStencilInfo.minDepthBounds = 0.0f;
+		DepthStencilInfo.maxDepthBounds = 1.0f;
+
+		DepthStencilInfo.stencilTestEnable = VK_FALSE;
+		DepthStencilInfo.front = {};
+		DepthStencilInfo.back = {};
+	}
+
+	{
+		DynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+		DynamicStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		DynamicStateInfo.pDynamicStates = DynamicStateEnables.data();
+		DynamicStateInfo.dynamicStateCount = DynamicStateEnables.size();
+		DynamicStateInfo.flags = NULL;
+	}
+}
+
+std::string ReadFile(const fs::path& filePath)
+{
+	// ate ... put cursor at the end
+	std::ifstream file(filePath, std::ios::ate | std::ios::binary);
+
+	ASSERT(file.is_open(), "Failed to open file \"" + filePath.string() + "\"");
+
+	size_t size = (size_t)file.tellg();
+
+	std::string content(size, ' ');
+	file.seekg(0);
+	file.read(&content[0], size);
+
+	return content;
+}
+
+VkShaderModule CreateShaderModule(VkDevice device, const std::string& shaderSource)
+{
+	VkShaderModuleCreateInfo moduleInfo{};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+
+	moduleInfo.codeSize = shaderSource.size();
+	moduleInfo.pCode = (const uint32_t*)shaderSource.c_str();
+
+	VkShaderModule module;
+	VkResult result = vkCreateShaderModule(device, &moduleInfo, nullptr, &module);
+
+	ASSERT(result == VK_SUCCESS, "Failed to create a shader module.");
+
+	return module;
+}
+
+void ShaderHotReload::Start(VkDevice device, VkPipelineCache pipelineCache, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, const fs::path& vertexShaderPath, const fs::path& fragmentShaderPath)
+{
+	Device = device;
+	PipelineCache = pipelineCache;
+	RenderPass = renderPass;
+	PipelineLayout = pipelineLayout;
+
+	VertexShaderPath = vertexShaderPath;
+	FragmentShaderPath = fragmentShaderPath;
+
+	Compiler = FindShaderCompiler();
+
+	std::cout << "Watching the shaders for changes" << (Compiler.empty() ? " (SPIR-V only, couldn't find glslc)\n" : "\n");
+
+	Running = true;
+	Worker = std::thread(&ShaderHotReload::Run, this);
+}
+
+void ShaderHotReload::Stop()
+{
+	if (!Running)
+	{
+		return;
+	}
+
+	Running = false;
+	Worker.join();
+
+	// Only called once the GPU is idle
+	if (ReadyPipeline != VK_NULL_HANDLE)
+	{
+		vkDestroyPipeline(Device, ReadyPipeline, nullptr);
+		ReadyPipeline = VK_NULL_HANDLE;
+	}
+
+	for (const RetiredPipeline& retired : Retired)
+	{
+		vkDestroyPipeline(Device, retired.Pipeline, nullptr);
+	}
+
+	Retired.clear();
+}
+
+void ShaderHotReload::Update(VkPipeline& pipeline, const FrameScheduler& scheduler)
+{
+	if (!Running)
+	{
+		return;
+	}
+
+	uint64_t completedFrame = scheduler.CompletedFrame();
+
+	// Same as DestroyRetiredSwapChains(), retired in order so the oldest ones are done first
+	while (!Retired.empty() && Retired.front().RetireFrame <= completedFrame)
+	{
+		vkDestroyPipeline(Device, Retired.front().Pipeline, nullptr);
+		Retired.erase(Retired.begin());
+	}
+
+	VkPipeline readyPipeline;
+
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+
+		readyPipeline = ReadyPipeline;
+		ReadyPipeline = VK_NULL_HANDLE;
+	}
+
+	if (readyPipeline != VK_NULL_HANDLE)
+	{
+		// Every frame submitted so far might still be drawing with the old one
+		Retired.push_back({ pipeline, scheduler.SubmittedFrame });
+		pipeline = readyPipeline;
+
+		std::cout << "Reloaded the shaders\n";
+	}
+}
+
+void ShaderHotReload::Run()
+{
+	const fs::path spirvPaths[2] = { VertexShaderPath, FragmentShaderPath };
+
+	// shaders/pong.vert.spv is compiled from shaders/pong.vert
+	fs::path sourcePaths[2];
+	fs::file_time_type sourceTimes[2];
+	fs::file_time_type spirvTimes[2];
+
+	std::error_code error;
+
+	for (int i = 0; i < 2; i++)
+	{
+		sourcePaths[i] = spirvPaths[i];
+		sourcePaths[i].replace_extension();
+
+		sourceTimes[i] = fs::last_write_time(sourcePaths[i], error);
+		spirvTimes[i] = fs::last_write_time(spirvPaths[i], error);
+	}
+
+	while (Running)
+	{
+		std::this_thread::sleep_for(SHADER_POLL_INTERVAL);
+
+		for (int i = 0; i < 2 && !Compiler.empty(); i++)
+		{
+			fs::file_time_type sourceTime = fs::last_write_time(sourcePaths[i], error);
+
+			if (error || sourceTime == sourceTimes[i])
+			{
+				continue;
+			}
+
+			// Remembered even if compiling fails, no point in retrying until it's saved again
+			sourceTimes[i] = sourceTime;
+
+			std::string command = "\"" + Compiler + "\" \"" + sourcePaths[i].string() + "\" -o \"" + spirvPaths[i].string() + "\"";
+
+			if (system(command.c_str()) != 0)
+			{
+				std::cout << "Failed to compile \"" << sourcePaths[i].string() << "\", keeping the old shaders\n";
+			}
+		}
+
+		bool changed = false;
+
+		for (int i = 0; i < 2; i++)
+		{
+			fs::file_time_type spirvTime = fs::last_write_time(spirvPaths[i], error);
+
+			if (!error && spirvTime != spirvTimes[i])
+			{
+				spirvTimes[i] = spirvTime;
+				changed = true;
+			}
+		}
+
+		if (!changed)
+		{
+			continue;
+		}
+
+		// Files that are still being written (or a compiler that gave up halfway) would take the whole game down
+		std::string spirv[2];
+		bool valid = true;
+
+		for (int i = 0; i < 2; i++)
+		{
+			std::ifstream file(spirvPaths[i], std::ios::binary);
+			spirv[i].assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+			uint32_t magic = 0;
+			memcpy(&magic, spirv[i].data(), std::min(spirv[i].size(), sizeof(magic)));
+
+			valid = valid && file.good() && magic == 0x07230203 && spirv[i].size() % 4 == 0;
+		}
+
+		if (!valid)
+		{
+			// Try again next time around
+			spirvTimes[0] = spirvTimes[1] = {};
+			continue;
+		}
+
+		// Pipeline creation is the slow part, and it's fine on any thread (the pipeline cache is internally synchronized)
+		VkPipeline pipeline = CreatePipelineFromSpirv(Device, PipelineCache, RenderPass, PipelineLayout, spirv[0], spirv[1]);
+
+		if (pipeline == VK_NULL_HANDLE)
+		{
+			std::cout << "Failed to create a pipeline from the new shaders, keeping the old one\n";
+			continue;
+		}
+
+		std::lock_guard<std::mutex> lock(Mutex);
+
+		// The render loop hasn't even picked up the last one yet
+		if (ReadyPipeline != VK_NULL_HANDLE)
+		{
+			vkDestroyPipeline(Device, ReadyPipeline, nullptr);
+		}
+
+		ReadyPipeline = pipeline;
+	}
+}
+
+void CreateStagingUploader(VkDevice device, GpuAllocator& allocator, const QueueFamilyIndices& queueIndices, StagingUploader& uploader)
+{
+	uploader.Device = device;
+	uploader.Allocator = &allocator;
+
+	uploader.TransferFamily = queueIndices.TransferFamily;
+	uploader.GraphicsFamily = queueIndices.GraphicsFamily;
+	uploader.TransferQueue = GetQueue(device, queueIndices.TransferFamily);
+
+	uploader.CommandPool = CreateCommandPool(device, queueIndices.TransferFamily);
+
+	std::vector<VkCommandBuffer> commandBuffers;
+	CreateCommandBuffers(device, uploader.CommandPool, 1, commandBuffers);
+	uploader.CommandBuffer = commandBuffers[0];
+
+	uploader.Timeline = CreateTimelineSemaphore(device);
+}
+
+void DestroyStagingUploader(StagingUploader& uploader)
+{
+	uploader.Reclaim(true);
+
+	vkDestroySemaphore(uploader.Device, uploader.Timeline, nullptr);
+	vkDestroyCommandPool(uploader.Device, uploader.CommandPool, nullptr);
+
+	uploader = {};
+}
+
+VkBuffer StagingUploader::CreateBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, GpuAllocation& allocation)
+{
+	uint32_t queueFamilyIndices[2] = { GraphicsFamily, TransferFamily };
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+
+	bufferInfo.size = size;
+	bufferInfo.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	if (GraphicsFamily == TransferFamily)
+	{
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	}
+	else
+	{
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = 2;
+		bufferInfo.pQueueFamilyIndices = queueFamilyIndices;
+	}
+
+	// Fastest for the GPU to read, but (usually) not visible to the CPU at all
+	VkBuffer buffer = Allocator->CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, allocation);
+
+	// vkCmdCopyBuffer doesn't need any alignment, 16 bytes just keeps the copies on the fast path
+	VkDeviceSize stagingOffset = (StagingData.size() + 15) & ~(VkDeviceSize)15;
+	StagingData.resize(stagingOffset + size);
+	memcpy(StagingData.data() + stagingOffset, data, size);
+
+	Copies.push_back({ stagingOffset, buffer, size });
+
+	return buffer;
+}
+
+VkImage StagingUploader::CreateImage(const void* data, VkExtent2D extent, VkFormat format, uint32_t texelSize, VkImageUsageFlags usage, GpuAllocation& allocation)
+{
+	uint32_t queueFamilyIndices[2] = { GraphicsFamily, TransferFamily };
+
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = format;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.usage = usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+	imageInfo.extent.width = extent.width;
+	imageInfo.extent.height = extent.height;
+	imageInfo.extent.depth = 1;
+
+	imageInfo.arrayLayers = 1;
+	imageInfo.mipLevels = 1;
+
+	// Same as the buffers, concurrent so the transfer queue can hand it over without an ownership transfer
+	if (GraphicsFamily == TransferFamily)
+	{
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	}
+	else
+	{
+		imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		imageInfo.queueFamilyIndexCount = 2;
+		imageInfo.pQueueFamilyIndices = queueFamilyIndices;
+	}
+
+	VkImage image = Allocator->CreateImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, allocation);
+
+	// bufferOffset has to be a multiple of the texel size, 16 covers every format used here
+	VkDeviceSize size = (VkDeviceSize)extent.width * extent.height * texelSize;
+	VkDeviceSize stagingOffset = (StagingData.size() + 15) & ~(VkDeviceSize)15;
+
+	StagingData.resize(stagingOffset + size);
+	memcpy(StagingData.data() + stagingOffset, data, size);
+
+	ImageCopies.push_back({ stagingOffset, image, extent });
+
+	return image;
+}
+
+uint64_t StagingUploader::Submit()
+{
+	if (Copies.empty() && ImageCopies.empty())
+	{
+		return 0;
+	}
+
+	// Only one batch in flight at a time, it's all load time uploads anyway
+	Reclaim(true);
+
+	VkDeviceSize stagingSize = StagingData.size();
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+
+	bufferInfo.size = stagingSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	StagingBuffer = Allocator->CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, StagingAllocation);
+	memcpy(StagingAllocation.Mapped, StagingData.data(), stagingSize);
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	VkResult result = vkBeginCommandBuffer(CommandBuffer, &beginInfo);
+	ASSERT(result == VK_SUCCESS, "Failed to begin the upload command buffer.");
+
+	for (const PendingCopy& copy : Copies)
+	{
+		VkBufferCopy region{};
+		region.srcOffset = copy.StagingOffset;
+		region.dstOffset = 0;
+		region.size = copy.Size;
+
+		vkCmdCopyBuffer(CommandBuffer, StagingBuffer, copy.Destination, 1, &region);
+	}
+
+	for (const PendingImageCopy& copy : ImageCopies)
+	{
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = copy.Destination;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		vkCmdPipelineBarrier(CommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		VkBufferImageCopy region{};
+		region.bufferOffset = copy.StagingOffset;
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		region.imageExtent = { copy.Extent.width, copy.Extent.height, 1 };
+
+		vkCmdCopyBufferToImage(CommandBuffer, StagingBuffer, copy.Destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+		// The layout change happens here too, the graphics queue only waits on the timeline before reading it
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+
+		vkCmdPipelineBarrier(CommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	result = vkEndCommandBuffer(CommandBuffer);
+	ASSERT(result == VK_SUCCESS, "Failed to record the upload command buffer.");
+
+	uint64_t value = SubmittedValue + 1;
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo{};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &value;
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
+
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &CommandBuffer;
+
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &Timeline;
+
+	result = vkQueueSubmit(TransferQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	ASSERT(result == VK_SUCCESS, "Failed to submit the uploads.");
+
+	SubmittedValue = value;
+	UploadedBytes += stagingSize;
+
+	StagingData.clear();
+	Copies.clear();
+	ImageCopies.clear();
+
+	return value;
+}
+
+void StagingUploader::Reclaim(bool wait /* = false */)
+{
+	if (StagingBuffer == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	if (wait)
+	{
+		VkSemaphoreWaitInfo waitInfo{};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &Timeline;
+		waitInfo.pValues = &SubmittedValue;
+
+		vkWaitSemaphores(Device, &waitInfo, UINT64_MAX);
+	}
+	else
+	{
+		uint64_t value;
+		vkGetSemaphoreCounterValue(Device, Timeline, &value);
+
+		if (value < SubmittedValue)
+		{
+			return;
+		}
+	}
+
+	Allocator->DestroyBuffer(StagingBuffer, StagingAllocation);
+	StagingBuffer = VK_NULL_HANDLE;
+}
+
+VkBuffer CreateVertexBuffers(StagingUploader& uploader, const std::vector<Vertex>& vertices, GpuAllocation& allocation)
+{
+	uint32_t vertexCount = vertices.size();
+	ASSERT(vertexCount >= 3, "There must be more than 3 vertices.");
+
+	return uploader.CreateBuffer(vertices.data(), vertexCount * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, allocation);
+}
+
+VkBuffer CreateIndexBuffer(StagingUploader& uploader, const std::vector<uint16_t>& indices, GpuAllocation& allocation)
+{
+	ASSERT(!indices.empty(), "There must be at least one index.");
+
+	return uploader.CreateBuffer(indices.data(), indices.size() * sizeof(uint16_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, allocation);
+}
+
+void CreateFrameRingBuffer(GpuAllocator& allocator, VkDeviceSize partitionSize, FrameRingBuffer& ringBuffer)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(allocator.PhysicalDevice, &properties);
+
+	ringBuffer.UniformAlignment = properties.limits.minUniformBufferOffsetAlignment;
+
+	// Every partition starts at an offset that's fine for anything
+	ringBuffer.PartitionSize = (partitionSize + ringBuffer.UniformAlignment - 1) / ringBuffer.UniformAlignment * ringBuffer.UniformAlignment;
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+
+	bufferInfo.size = ringBuffer.PartitionSize * MAX_FRAMES_IN_FLIGHT;
+	bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	// Host visible blocks stay mapped in the allocator, coherent memory so no flushes either
+	ringBuffer.Buffer = allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, ringBuffer.Allocation);
+	ringBuffer.Mapped = ringBuffer.Allocation.Mapped;
+}
+
+void DestroyFrameRingBuffer(GpuAllocator& allocator, FrameRingBuffer& ringBuffer)
+{
+	allocator.DestroyBuffer(ringBuffer.Buffer, ringBuffer.Allocation);
+
+	ringBuffer = {};
+}
+
+void FrameRingBuffer::BeginFrame(uint32_t frame)
+{
+	FrameBytes[Frame] = Offset;
+
+	Frame = frame;
+	Offset = 0;
+}
+
+RingAllocation FrameRingBuffer::Allocate(VkDeviceSize size, VkDeviceSize alignment /* = 16 */)
+{
+	VkDeviceSize offset = (Offset + alignment - 1) / alignment * alignment;
+
+	RingAllocation allocation;
+	allocation.Buffer = Buffer;
+
+	// Not an ASSERT, those are gone in release builds and this would write into the next frame's partition
+	if (offset + size > PartitionSize)
+	{
+		if (Overflows++ == 0)
+		{
+			std::cout << "The frame ring buffer is full, raise FRAME_RING_BUFFER_SIZE. Whatever doesn't fit isn't drawn.\n";
+		}
+
+		// Still a valid buffer and offset to bind, just nothing to write to
+		allocation.Offset = Frame * PartitionSize;
+		return allocation;
+	}
+
+	Offset = offset + size;
+	HighWaterMark = std::max(HighWaterMark, Offset);
+
+	allocation.Offset = Frame * PartitionSize + offset;
+	allocation.Data = Mapped + allocation.Offset;
+
+	return allocation;
+}
+
+void CreateFrameProfiler(VkDevice device, VkPhysicalDevice physicalDevice, FrameProfiler& profiler)
+{
+	profiler.Events.resize(PROFILER_EVENT_CAPACITY);
+	profiler.StartTime = std::chrono::steady_clock::now();
+	profiler.Device = device;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	// Without this some graphics queues can't write timestamps, just do the CPU side then
+	if (!properties.limits.timestampComputeAndGraphics)
+	{
+		std::cout << "Timestamps aren't supported on the graphics queue, only profiling the CPU\n";
+		return;
+	}
+
+	profiler.TimestampPeriod = properties.limits.timestampPeriod;
+
+	VkQueryPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+
+	poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	poolInfo.queryCount = 2 * MAX_FRAMES_IN_FLIGHT;
+
+	VkResult result = vkCreateQueryPool(device, &poolInfo, nullptr, &profiler.QueryPool);
+	ASSERT(result == VK_SUCCESS, "Failed to create the timestamp query pool.");
+}
+
+void DestroyFrameProfiler(FrameProfiler& profiler)
+{
+	if (profiler.QueryPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(profiler.Device, profiler.QueryPool, nullptr);
+		profiler.QueryPool = VK_NULL_HANDLE;
+	}
+
+	profiler.Events.clear();
+}
+
+uint64_t FrameProfiler::Now() const
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - StartTime).count();
+}
+
+void FrameProfiler::Record(const char* name, uint64_t start, uint64_t end, uint32_t track /* = PROFILE_TRACK_CPU */)
+{
+	// Claiming the slot is the only shared write, the ring just wraps around
+	uint64_t index = EventCount.fetch_add(1, std::memory_order_relaxed);
+
+	ProfileEvent& event = Events[index & (PROFILER_EVENT_CAPACITY - 1)];
+	event.Name = name;
+	event.Start = start;
+	event.Duration = end > start ? end - start : 0;
+	event.Track = track;
+}
+
+void FrameProfiler::MarkSubmitted(uint32_t frame)
+{
+	SubmitTimes[frame] = Now();
+	QueriesPending[frame] = QueryPool != VK_NULL_HANDLE;
+}
+
+void FrameProfiler::CollectGpuTimes(uint32_t frame)
+{
+	if (!QueriesPending[frame])
+	{
+		return;
+	}
+
+	QueriesPending[frame] = false;
+
+	// The fence was already waited on, so no need to wait for the results
+	std::array<uint64_t, 2> timestamps;
+	VkResult result = vkGetQueryPoolResults(Device, QueryPool, frame * 2, 2, sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+	if (result != VK_SUCCESS)
+	{
+		return;
+	}
+
+	double start = timestamps[0] * TimestampPeriod;
+	double end = timestamps[1] * TimestampPeriod;
+
+	// The GPU has its own clock, pretend the first frame started right when it was submitted
+	if (!HasGpuOffset)
+	{
+		GpuOffset = SubmitTimes[frame] - start;
+		HasGpuOffset = true;
+	}
+
+	start = std::max(start + GpuOffset, 0.0);
+	end = std::max(end + GpuOffset, start);
+
+	Record("RenderPass", (uint64_t)start, (uint64_t)end, PROFILE_TRACK_GPU);
+}
+
+void FrameProfiler::WriteChromeTrace(const fs::path& path)
+{
+	std::ofstream file(path, std::ios::trunc);
+	ASSERT(file.is_open(), "Failed to open the trace file.");
+
+	// Can be opened with chrome://tracing or ui.perfetto.dev
+	file << "{\"traceEvents\":[\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"Main\"}},\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"GPU\"}},\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":2,\"args\":{\"name\":\"Latency\"}}";
+
+	uint64_t count = EventCount.load();
+	uint64_t first = count > PROFILER_EVENT_CAPACITY ? count - PROFILER_EVENT_CAPACITY : 0;
+
+	char line[256];
+
+	for (uint64_t i = first; i < count; i++)
+	{
+		const ProfileEvent& event = Events[i & (PROFILER_EVENT_CAPACITY - 1)];
+
+		// Timestamps are in microseconds
+		snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", event.Name, event.Track, event.Start / 1e3, event.Duration / 1e3);
+		file << line;
+	}
+
+	file << "\n]}\n";
+
+	std::cout << "Wrote " << count - first << " profiler events to " << path.string() << "\n";
+}
+
+void FrameProfiler::PrintSummary()
+{
+	uint64_t count = EventCount.load();
+	uint64_t first = count > PROFILER_EVENT_CAPACITY ? count - PROFILER_EVENT_CAPACITY : 0;
+
+	// Only the events still in the ring, so this is over the last couple of minutes at most
+	std::map<std::pair<uint32_t, std::string>, std::vector<uint64_t>> durations;
+
+	for (uint64_t i = first; i < count; i++)
+	{
+		const ProfileEvent& event = Events[i & (PROFILER_EVENT_CAPACITY - 1)];
+		durations[{ event.Track, event.Name }].push_back(event.Duration);
+	}
+
+	if (durations.empty())
+	{
+		return;
+	}
+
+	std::cout << "\n";
+	const char* trackNames[] = { "CPU", "GPU", "Latency" };
+
+	printf("%-7s  %-14s  %7s  %9s  %9s\n", "Side", "Stage", "Count", "p50 (ms)", "p99 (ms)");
+
+	for (auto& [key, stageDurations] : durations)
+	{
+		std::sort(stageDurations.begin(), stageDurations.end());
+
+		size_t last = stageDurations.size() - 1;
+		double p50 = stageDurations[last / 2] / 1e6;
+		double p99 = stageDurations[last * 99 / 100] / 1e6;
+
+		printf("%-7s  %-14s  %7zu  %9.3f  %9.3f\n", trackNames[key.first], key.second.c_str(), stageDurations.size(), p50, p99);
+	}
+}
+
+uint64_t FrameProfiler::MedianDuration(uint32_t track, const char* name) const
+{
+	uint64_t count = EventCount.load();
+	uint64_t first = count > PROFILER_EVENT_CAPACITY ? count - PROFILER_EVENT_CAPACITY : 0;
+
+	std::vector<uint64_t> durations;
+
+	for (uint64_t i = first; i < count; i++)
+	{
+		const ProfileEvent& event = Events[i & (PROFILER_EVENT_CAPACITY - 1)];
+
+		if (event.Track == track && strcmp(event.Name, name) == 0)
+		{
+			durations.push_back(event.Duration);
+		}
+	}
+
+	if (durations.empty())
+	{
+		return 0;
+	}
+
+	std::nth_element(durations.begin(), durations.begin() + (durations.size() - 1) / 2, durations.end());
+	return durations[(durations.size() - 1) / 2];
+}
+
+ProfileScope::ProfileScope(FrameProfiler* profiler, const char* name)
+	: Profiler(profiler), Name(name), Start(profiler ? profiler->Now() : 0)
+{
+}
+
+ProfileScope::~ProfileScope()
+{
+	if (Profiler)
+	{
+		Profiler->Record(Name, Start, Profiler->Now());
+	}
+}
+
+void CreateCommandBuffers(VkDevice device, VkCommandPool commandPool, uint32_t imageCount, std::vector<VkCommandBuffer>& commandBuffers)
+{
+	commandBuffers.resize(imageCount);
+
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+
+	allocInfo.commandBufferCount = commandBuffers.size();
+
+	// All of the command buffers will be created in the command pool
+	// This avoids having to search for new, free memory when allocating a new command buffer
+	allocInfo.commandPool = commandPool;
+
+	// Primary command buffers: can be queued for execution, but can't be called by other command buffers
+	// Secondary command buffers: can be called by other command buffers, but be can't queued for execution
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+	VkResult result = vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data());
+
+	ASSERT(result == VK_SUCCESS, "Failed to allocate the command buffers.");
+}
+
+void RecordCommandBuffer(VkCommandBuffer commandBuffer, VkFramebuffer framebuffer, VkExtent2D swapChainExtent, VkRenderPass renderPass, VkPipeline pipeline, VkPipelineLayout layout, VkDescriptorSet textureSet, VkBuffer vertexBuffer, VkBuffer indexBuffer, uint32_t indexCount, const RingAllocation& instances, uint32_t instanceCount, VkQueryPool queryPool /* = VK_NULL_HANDLE */, uint32_t firstQuery /* = 0 */, ParallelRecorder* recorder /* = nullptr */, uint32_t slot /* = 0 */, uint32_t instancesPerDraw /* = 0 */, ParticleSystem* particles /* = nullptr */, const std::vector<SpriteDraw>* draws /* = nullptr */)
+{
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+	VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	ASSERT(result == VK_SUCCESS, "Failed to start recording a command buffer.");
+
+	std::array<VkClearValue, 2> clearValues = { {
+		{ 0.01, 0.01f, 0.01f, 1.0f },
+		{ 1.0f, 0 }
+	} };
+
+	VkRenderPassBeginInfo renderPassInfo{};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+
+	renderPassInfo.framebuffer = framebuffer;
+	renderPassInfo.renderPass = renderPass;
+
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = swapChainExtent;
+
+	renderPassInfo.clearValueCount = clearValues.size();
+	renderPassInfo.pClearValues = clearValues.data();
+
+	// Dispatches can't be inside a render pass
+	if (particles)
+	{
+		particles->RecordSimulation(commandBuffer);
+	}
+
+	// Timestamps around the whole render pass, queries have to be reset outside of it
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(commandBuffer, queryPool, firstQuery, 2);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, firstQuery);
+	}
+
+	if (recorder)
+	{
+		// VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS: the subpass can only execute secondaries, no draws of its own
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+		RecordJob job{ slot, renderPass, framebuffer, swapChainExtent, pipeline, layout, textureSet, vertexBuffer, indexBuffer, indexCount, instances, instanceCount, instancesPerDraw, particles, draws };
+		recorder->Record(job);
+
+		vkCmdExecuteCommands(commandBuffer, recorder->ThreadCount, &recorder->CommandBuffers[slot * recorder->ThreadCount]);
+	}
+	else
+	{
+		// VK_SUBPASS_CONTENTS_INLINE: everything is recorded right here
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+		RecordDraws(commandBuffer, swapChainExtent, pipeline, layout, textureSet, vertexBuffer, indexBuffer, indexCount, instances, 0, instanceCount, instancesPerDraw, particles, draws);
+	}
+
+	vkCmdEndRenderPass(commandBuffer);
+
+	if (queryPool != VK_NULL_HANDLE)
+	{
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, firstQuery + 1);
+	}
+
+	result = vkEndCommandBuffer(commandBuffer);
+	ASSERT(result == VK_SUCCESS, "Failed to record a command buffer.");
+}
+
+void RecordDraws(VkCommandBuffer commandBuffer, VkExtent2D swapChainExtent, VkPipeline pipeline, VkPipelineLayout layout, VkDescriptorSet textureSet, VkBuffer vertexBuffer, VkBuffer indexBuffer, uint32_t indexCount, const RingAllocation& instances, uint32_t firstInstance, uint32_t instanceCount, uint32_t instancesPerDraw, const ParticleSystem* particles /* = nullptr */, const std::vector<SpriteDraw>* draws /* = nullptr */)
+{
+	if (instanceCount == 0 && !particles)
+	{
+		return;
+	}
+
+	VkViewport viewport{};
+
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = swapChainExtent.width;
+	viewport.height = swapChainExtent.height;
+
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	VkRect2D scissor{};
+
+	scissor.offset = { 0, 0 };
+	scissor.extent = swapChainExtent;
+
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	// VK_PIPELINE_BIND_POINT_GRAPHICS ... graphics pipeline
+	// VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR ... raytracing pipeline
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &textureSet, 0, nullptr);
+
+	// Binding 0: the quad, binding 1: one QuadInstance per quad
+	VkBuffer buffers[] = { vertexBuffer, instances.Buffer };
+	VkDeviceSize offsets[] = { 0, instances.Offset };
+	vkCmdBindVertexBuffers(commandBuffer, 0, 2, buffers, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+
+	// Always fit the whole field into the window, whatever shape it was resized to
+	float windowAspectRatio = (float)swapChainExtent.width / swapChainExtent.height;
+	float scale = std::max(windowAspectRatio / ASPECT_RATIO, 1.0f);
+
+	ShaderMatrices matrices;
+	matrices.Projection = glm::ortho(-ASPECT_RATIO * scale, ASPECT_RATIO * scale, -ASPECT_RATIO * scale / windowAspectRatio, ASPECT_RATIO * scale / windowAspectRatio);
+
+	vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(ShaderMatrices), &matrices);
+
+	// Without a sprite batch it's all one draw with the pipeline and texture that were passed in
+	SpriteDraw allInstances{ pipeline, textureSet, 0, UINT32_MAX };
+
+	const SpriteDraw* firstDraw = draws ? draws->data() : &allInstances;
+	const SpriteDraw* lastDraw = draws ? firstDraw + draws->size() : firstDraw + 1;
+
+	VkPipeline boundPipeline = pipeline;
+	VkDescriptorSet boundTexture = textureSet;
+
+	auto bind = [&](VkPipeline drawPipeline, VkDescriptorSet drawTexture)
+	{
+		// The push constants stay, every pipeline here uses the same layout
+		if (drawPipeline != boundPipeline)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawPipeline);
+			boundPipeline = drawPipeline;
+		}
+
+		if (drawTexture != boundTexture)
+		{
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &drawTexture, 0, nullptr);
+			boundTexture = drawTexture;
+		}
+	};
+
+	// The same handful of commands no matter how many quads there are, only the part of each draw in this range gets recorded
+	for (const SpriteDraw* draw = firstDraw; draw != lastDraw; draw++)
+	{
+		uint32_t first = std::max(draw->FirstInstance, firstInstance);
+		uint32_t last = std::min((uint64_t)draw->FirstInstance + draw->InstanceCount, (uint64_t)firstInstance + instanceCount);
+
+		if (first >= last)
+		{
+			continue;
+		}
+
+		bind(draw->Pipeline, draw->Texture);
+
+		if (instancesPerDraw == 0)
+		{
+			vkCmdDrawIndexed(commandBuffer, indexCount, last - first, 0, 0, first);
+		}
+
+		for (; instancesPerDraw > 0 && first < last; first += instancesPerDraw)
+		{
+			vkCmdDrawIndexed(commandBuffer, indexCount, std::min(instancesPerDraw, last - first), 0, 0, first);
+		}
+	}
+
+	if (particles)
+	{
+		bind(pipeline, textureSet);
+		particles->RecordDraw(commandBuffer);
+	}
+}
+
+void CreateParallelRecorder(VkDevice device, uint32_t queueFamily, uint32_t threadCount, ParallelRecorder& recorder)
+{
+	recorder.Device = device;
+	recorder.ThreadCount = threadCount;
+
+	recorder.CommandPools.resize(MAX_FRAMES_IN_FLIGHT * threadCount);
+	recorder.CommandBuffers.resize(MAX_FRAMES_IN_FLIGHT * threadCount);
+
+	for (uint32_t i = 0; i < recorder.CommandPools.size(); i++)
+	{
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+
+		// No RESET_COMMAND_BUFFER_BIT, the whole pool gets reset at once
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		poolInfo.queueFamilyIndex = queueFamily;
+
+		VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &recorder.CommandPools[i]);
+		ASSERT(result == VK_SUCCESS, "Failed to create a recording thread's command pool.");
+
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+
+		allocInfo.commandPool = recorder.CommandPools[i];
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = 1;
+
+		result = vkAllocateCommandBuffers(device, &allocInfo, &recorder.CommandBuffers[i]);
+		ASSERT(result == VK_SUCCESS, "Failed to allocate a secondary command buffer.");
+	}
+
+	recorder.Running = true;
+
+	// Thread 0 is whoever calls Record()
+	for (uint32_t thread = 1; thread < threadCount; thread++)
+	{
+		recorder.Workers.emplace_back(&ParallelRecorder::Run, &recorder, thread);
+	}
+}
+
+void DestroyParallelRecorder(ParallelRecorder& recorder)
+{
+	{
+		std::lock_guard<std::mutex> lock(recorder.Mutex);
+		recorder.Running = false;
+	}
+
+	recorder.WorkReady.notify_all();
+
+	for (std::thread& worker : recorder.Workers)
+	{
+		worker.join();
+	}
+
+	recorder.Workers.clear();
+
+	// Freeing the pools frees their command buffers too
+	for (VkCommandPool commandPool : recorder.CommandPools)
+	{
+		vkDestroyCommandPool(recorder.Device, commandPool, nullptr);
+	}
+
+	recorder.CommandPools.clear();
+	recorder.CommandBuffers.clear();
+}
+
+void ParallelRecorder::Record(const RecordJob& job)
+{
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+
+		Job = job;
+		Remaining = ThreadCount - 1;
+		Generation++;
+	}
+
+	WorkReady.notify_all();
+
+	RecordShare(0);
+
+	std::unique_lock<std::mutex> lock(Mutex);
+	WorkDone.wait(lock, [this] { return Remaining == 0; });
+}
+
+void ParallelRecorder::RecordShare(uint32_t thread)
+{
+	uint32_t index = Job.Slot * ThreadCount + thread;
+	VkCommandBuffer commandBuffer = CommandBuffers[index];
+
+	// The slot's last frame is done on the GPU, so everything recorded from this pool back then can go at once
+	vkResetCommandPool(Device, CommandPools[index], 0);
+
+	VkCommandBufferInheritanceInfo inheritanceInfo{};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+
+	inheritanceInfo.renderPass = Job.RenderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = Job.Framebuffer;
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	ASSERT(result == VK_SUCCESS, "Failed to start recording a secondary command buffer.");
+
+	// Contiguous ranges, so the draws end up in the same order as with a single thread
+	uint32_t first = (uint64_t)Job.InstanceCount * thread / ThreadCount;
+	uint32_t last = (uint64_t)Job.InstanceCount * (thread + 1) / ThreadCount;
+
+	// Secondaries don't inherit any state from the primary, so every one of them sets it all up again
+	RecordDraws(commandBuffer, Job.Extent, Job.Pipeline, Job.Layout, Job.TextureSet, Job.VertexBuffer, Job.IndexBuffer, Job.IndexCount, Job.Instances, first, last - first, Job.InstancesPerDraw, thread == ThreadCount - 1 ? Job.Particles : nullptr, Job.Draws);
+
+	result = vkEndCommandBuffer(commandBuffer);
+	ASSERT(result == VK_SUCCESS, "Failed to record a secondary command buffer.");
+}
+
+void ParallelRecorder::Run(uint32_t thread)
+{
+	uint64_t generation = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			WorkReady.wait(lock, [&] { return Generation != generation || !Running; });
+
+			if (!Running)
+			{
+				return;
+			}
+
+			generation = Generation;
+		}
+
+		RecordShare(thread);
+
+		bool last;
+
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			last = --Remaining == 0;
+		}
+
+		if (last)
+		{
+			WorkDone.notify_one();
+		}
+	}
+}
+
+bool DrawFrame(VkDevice device, const SwapChainResources& swapChain, VkQueue graphicsQueue, VkQueue presentQueue, const std::vector<VkCommandBuffer>& commandBuffers, FrameScheduler& scheduler, FrameRingBuffer& ringBuffer, const SpriteBatch& sprites, VkRenderPass renderPass, VkPipeline pipeline, VkPipelineLayout pipelineLayout, VkDescriptorSet textureSet, VkBuffer vertexBuffer, VkBuffer indexBuffer, uint32_t indexCount, FrameProfiler& profiler, uint64_t inputTime, ParallelRecorder* recorder, ParticleSystem* particles)
+{
+	uint32_t currentFrame = scheduler.CurrentSlot();
+
+	uint32_t imageIndex;
+	VkResult acquireResult = AquireNextImage(device, swapChain.SwapChain, scheduler, imageIndex, &profiler);
+
+	// Nothing was submitted, the same frame is just tried again with a new swap chain
+	if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		return true;
+	}
+
+	// AquireNextImage() waited until the slot was free, so the GPU is done with this slot's part of the ring buffer and its timestamps
+	profiler.CollectGpuTimes(currentFrame);
+	ringBuffer.BeginFrame(currentFrame);
+
+	uint32_t instanceCount = sprites.Instances.size();
+	RingAllocation instanceAllocation;
+
+	{
+		ProfileScope scope(&profiler, "Upload");
+
+		instanceAllocation = ringBuffer.Allocate(instanceCount * sizeof(QuadInstance));
+
+		// Didn't fit, the frame goes out without its quads
+		if (instanceAllocation.Data)
+		{
+			sprites.WriteSorted((QuadInstance*)instanceAllocation.Data);
+		}
+		else
+		{
+			instanceCount = 0;
+		}
+	}
+
+	// Not inside Upload, that one would count the recording time too
+	{
+		ProfileScope scope(&profiler, "Record");
+		RecordCommandBuffer(commandBuffers[currentFrame], swapChain.Framebuffers[imageIndex], swapChain.Extent, renderPass, pipeline, pipelineLayout, textureSet, vertexBuffer, indexBuffer, indexCount, instanceAllocation, instanceCount, profiler.QueryPool, currentFrame * 2, recorder, currentFrame, 0, particles, &sprites.Draws);
+	}
+
+	VkResult presentResult;
+
+	{
+		ProfileScope scope(&profiler, "Submit");
+		presentResult = SubmitCommandBuffers(swapChain.SwapChain, graphicsQueue, presentQueue, commandBuffers[currentFrame], scheduler, imageIndex);
+	}
+
+	profiler.MarkSubmitted(currentFrame);
+
+	// Only when the present call returned, what happens after that is up to the driver and the present mode
+	profiler.Record("InputToPresent", inputTime, profiler.Now(), PROFILE_TRACK_LATENCY);
+
+	// Suboptimal still presented fine, but the swap chain should be recreated before the next frame
+	return acquireResult == VK_SUBOPTIMAL_KHR || presentResult != VK_SUCCESS;
+}
+
+VkResult AquireNextImage(VkDevice device, VkSwapchainKHR swapChain, FrameScheduler& scheduler, uint32_t& imageIndex, FrameProfiler* profiler /* = nullptr */)
+{
+	scheduler.WaitForSlot(profiler);
+
+	ProfileScope scope(profiler, "Acquire");
+	
+	VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, scheduler.ImageAvailableSemaphores[scheduler.CurrentSlot()], VK_NULL_HANDLE, &imageIndex);
+
+	// Out of date: the window changed and this swap chain can't be presented to anymore, suboptimal: it still can
+	ASSERT(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR || result == VK_ERROR_OUT_OF_DATE_KHR, "Failed to aquire a swap chain image.");
+
+	return result;
+}
+
+VkResult SubmitCommandBuffers(VkSwapchainKHR swapChain, VkQueue graphicsQueue, VkQueue presentQueue, VkCommandBuffer commandBuffer, FrameScheduler& scheduler, uint32_t imageIndex)
+{
+	uint32_t slot = scheduler.CurrentSlot();
+	uint64_t frame = scheduler.SubmittedFrame + 1;
+
+	// Static buffers and the atlas can't be read before their copies are done, a value that's already reached is free to wait on
+	uint32_t waitCount = scheduler.UploadValue > 0 ? 2 : 1;
+
+	VkSemaphore waitSemaphores[2] = { scheduler.ImageAvailableSemaphores[slot], scheduler.UploadTimeline };
+	VkPipelineStageFlags waitMasks[2] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT };
+	uint64_t waitValues[2] = { 0, scheduler.UploadValue };
+
+	// The binary semaphore for present and the frame's value on the timeline
+	VkSemaphore signalSemaphores[2] = { scheduler.RenderingFinishedSemaphores[slot], scheduler.Timeline };
+	uint64_t signalValues[2] = { 0, frame };
+
+	// Values for binary semaphores are just ignored
+	VkTimelineSemaphoreSubmitInfo timelineInfo{};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+
+	timelineInfo.waitSemaphoreValueCount = waitCount;
+	timelineInfo.pWaitSemaphoreValues = waitValues;
+	timelineInfo.signalSemaphoreValueCount = 2;
+	timelineInfo.pSignalSemaphoreValues = signalValues;
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
+
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	submitInfo.waitSemaphoreCount = waitCount;
+	submitInfo.pWaitSemaphores = waitSemaphores;
+	submitInfo.pWaitDstStageMask = waitMasks;
+
+	submitInfo.signalSemaphoreCount = 2;
+	submitInfo.pSignalSemaphores = signalSemaphores;
+
+	// No fence, the timeline tells when this frame is done
+	VkResult result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	ASSERT(result == VK_SUCCESS, "Failed to submit a command buffer to the queue.");
+
+	scheduler.SubmittedFrame = frame;
+
+	VkPresentInfoKHR presentInfo{};
+	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+
+	presentInfo.swapchainCount = 1;
+	presentInfo.pSwapchains = &swapChain;
+
+	presentInfo.waitSemaphoreCount = 1;
+	presentInfo.pWaitSemaphores = &scheduler.RenderingFinishedSemaphores[slot];
+
+	presentInfo.pImageIndices = &imageIndex;
+
+	result = vkQueuePresentKHR(presentQueue, &presentInfo);
+	ASSERT(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR || result == VK_ERROR_OUT_OF_DATE_KHR, "Failed to present a swap chain image.");
+
+	return result;
+}
+
+std::array<QuadInstance, 3> CalculateInstances(const std::array<glm::vec2, 3>& previousPositions, const std::array<glm::vec2, 3>& currentPositions, float alpha)
+{
+	std::array<glm::vec2, 3> positions;
+
+	for (int i = 0; i < 3; i++)
+	{
+		positions[i] = glm::mix(previousPositions[i], currentPositions[i], alpha);
+	}
+
+	const glm::vec4 white = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	std::array<QuadInstance, 3> instances = { {
+		{ positions[0], { PLAYER_WIDTH, PLAYER_HEIGHT }, white },
+		{ positions[1], { PLAYER_WIDTH, PLAYER_HEIGHT }, white },
+		{ positions[2], { BALL_SIZE, BALL_SIZE }, white },
+	} };
+
+	return instances;
+}
+
+void CreateSpriteAtlas(VkDevice device, StagingUploader& uploader, VkDescriptorSetLayout textureSetLayout, SpriteAtlas& atlas)
+{
+	// Generated instead of loaded, it's all simple shapes. White with the shape in alpha, so QuadInstance::Color tints it
+	// In texels: white at 0,0 (8x8), the background at 8,0 (8x64), the ball at 64,0 (64x64), glyphs from 0,64 in 24x32 cells
+
+	struct FontGlyph
+	{
+		char Character;
+		const char* Rows[FONT_GLYPH_HEIGHT];
+	};
+
+	static const FontGlyph font[] = {
+		{ '0', { ".###.", "#...#", "#..##", "#.#.#", "##..#", "#...#", ".###." } },
+		{ '1', { "..#..", ".##..", "..#..", "..#..", "..#..", "..#..", ".###." } },
+		{ '2', { ".###.", "#...#", "....#", "...#.", "..#..", ".#...", "#####" } },
+		{ '3', { "#####", "...#.", "..#..", "...#.", "....#", "#...#", ".###." } },
+		{ '4', { "...#.", "..##.", ".#.#.", "#..#.", "#####", "...#.", "...#." } },
+		{ '5', { "#####", "#....", "####.", "....#", "....#", "#...#", ".###." } },
+		{ '6', { "..##.", ".#...", "#....", "####.", "#...#", "#...#", ".###." } },
+		{ '7', { "#####", "....#", "...#.", "..#..", ".#...", ".#...", ".#..." } },
+		{ '8', { ".###.", "#...#", "#...#", ".###.", "#...#", "#...#", ".###." } },
+		{ '9', { ".###.", "#...#", "#...#", ".####", "....#", "...#.", ".##.." } },
+		{ 'A', { ".###.", "#...#", "#...#", "#####", "#...#", "#...#", "#...#" } },
+		{ 'B', { "####.", "#...#", "#...#", "####.", "#...#", "#...#", "####." } },
+		{ 'C', { ".###.", "#...#", "#....", "#....", "#....", "#...#", ".###." } },
+		{ 'D', { "###..", "#..#.", "#...#", "#...#", "#...#", "#..#.", "###.." } },
+		{ 'E', { "#####", "#....", "#....", "####.", "#....", "#....", "#####" } },
+		{ 'F', { "#####", "#....", "#....", "####.", "#....", "#....", "#...." } },
+		{ 'G', { ".###.", "#...#", "#....", "#.###", "#...#", "#...#", ".####" } },
+		{ 'H', { "#...#", "#...#", "#...#", "#####", "#...#", "#...#", "#...#" } },
+		{ 'I', { ".###.", "..#..", "..#..", "..#..", "..#..", "..#..", ".###." } },
+		{ 'J', { "..###", "...#.", "...#.", "...#.", "...#.", "#..#.", ".##.." } },
+		{ 'K', { "#...#", "#..#.", "#.#..", "##...", "#.#..", "#..#.", "#...#" } },
+		{ 'L', { "#....", "#....", "#....", "#....", "#....", "#....", "#####" } },
+		{ 'M', { "#...#", "##.##", "#.#.#", "#.#.#", "#...#", "#...#", "#...#" } },
+		{ 'N', { "#...#", "#...#", "##..#", "#.#.#", "#..##", "#...#", "#...#" } },
+		{ 'O', { ".###.", "#...#", "#...#", "#...#", "#...#", "#...#", ".###." } },
+		{ 'P', { "####.", "#...#", "#...#", "####.", "#....", "#....", "#...." } },
+		{ 'Q', { ".###.", "#...#", "#...#", "#...#", "#.#.#", "#..#.", ".##.#" } },
+		{ 'R', { "####.", "#...#", "#...#", "####.", "#.#..", "#..#.", "#...#" } },
+		{ 'S', { ".####", "#....", "#....", ".###.", "....#", "....#", "####." } },
+		{ 'T', { "#####", "..#..", "..#..", "..#..", "..#..", "..#..", "..#.." } },
+		{ 'U', { "#...#", "#...#", "#...#", "#...#", "#...#", "#...#", ".###." } },
+		{ 'V', { "#...#", "#...#", "#...#", "#...#", "#...#", ".#.#.", "..#.." } },
+		{ 'W', { "#...#", "#...#", "#...#", "#.#.#", "#.#.#", "#.#.#", ".#.#." } },
+		{ 'X', { "#...#", "#...#", ".#.#.", "..#..", ".#.#.", "#...#", "#...#" } },
+		{ 'Y', { "#...#", "#...#", ".#.#.", "..#..", "..#..", "..#..", "..#.." } },
+		{ 'Z', { "#####", "....#", "...#.", "..#..", ".#...", "#....", "#####" } },
+		{ '-', { ".....", ".....", ".....", "#####", ".....", ".....", "....." } },
+		{ ':', { ".....", "..#..", "..#..", ".....", "..#..", "..#..", "....." } },
+		{ '.', { ".....", ".....", ".....", ".....", ".....", ".##..", ".##.." } },
+		{ '/', { ".....", "....#", "...#.", "..#..", ".#...", "#....", "....." } },
+	};
+
+	constexpr uint32_t size = SPRITE_ATLAS_SIZE;
+
+	// RGBA8, transparent white everywhere else so filtering at the edges doesn't pull in any black
+	std::vector<uint8_t> pixels(size * size * 4, 255);
+
+	for (uint32_t i = 0; i < size * size; i++)
+	{
+		pixels[i * 4 + 3] = 0;
+	}
+
+	auto setTexel = [&](uint32_t x, uint32_t y, const glm::vec4& color)
+	{
+		for (int channel = 0; channel < 4; channel++)
+		{
+			pixels[(y * size + x) * 4 + channel] = (uint8_t)(glm::clamp(color[channel], 0.0f, 1.0f) * 255.0f + 0.5f);
+		}
+	};
+
+	auto rect = [&](float x, float y, float width, float height)
+	{
+		return glm::vec4(x, y, x + width, y + height) / (float)size;
+	};
+
+	// QuadInstance::UV defaults to 0, so plain quads sample the corner of this block
+	for (uint32_t y = 0; y < 8; y++)
+	{
+		for (uint32_t x = 0; x < 8; x++)
+		{
+			setTexel(x, y, { 1.0f, 1.0f, 1.0f, 1.0f });
+		}
+	}
+
+	atlas.White = glm::vec4(0.0f);
+
+	// Dark at the top and glowing towards the lava at the bottom, stretched over the whole field
+	for (uint32_t y = 0; y < 64; y++)
+	{
+		float glow = (y + 0.5f) / 64.0f;
+		glow *= glow * glow;
+
+		for (uint32_t x = 8; x < 16; x++)
+		{
+			setTexel(x, y, glm::vec4(glm::mix(glm::vec3(0.02f, 0.01f, 0.02f), glm::vec3(0.35f, 0.06f, 0.0f), glow), 1.0f));
+		}
+	}
+
+	// From the center of the first texel to the center of the last, so the ends are exactly the end colors
+	atlas.Background = rect(12.0f, 0.5f, 0.0f, 63.0f);
+
+	// A disc with a one texel wide soft edge
+	for (uint32_t y = 0; y < 64; y++)
+	{
+		for (uint32_t x = 0; x < 64; x++)
+		{
+			float distance = glm::length(glm::vec2(x + 0.5f, y + 0.5f) - 32.0f);
+			setTexel(64 + x, y, { 1.0f, 1.0f, 1.0f, glm::clamp(32.0f - distance, 0.0f, 1.0f) });
+		}
+	}
+
+	atlas.Ball = rect(64.0f, 0.0f, 64.0f, 64.0f);
+
+	// Empty rects for everything, see AddText()
+	atlas.Glyphs.fill(glm::vec4(0.0f));
+
+	constexpr uint32_t cellWidth = FONT_GLYPH_WIDTH * FONT_TEXEL_SCALE + 4;
+	constexpr uint32_t cellHeight = FONT_GLYPH_HEIGHT * FONT_TEXEL_SCALE + 4;
+	constexpr uint32_t cellsPerRow = size / cellWidth;
+
+	static_assert(64 + (sizeof(font) / sizeof(font[0]) + cellsPerRow - 1) / cellsPerRow * cellHeight <= size, "The font doesn't fit into the sprite atlas.");
+
+	for (uint32_t i = 0; i < sizeof(font) / sizeof(font[0]); i++)
+	{
+		// Two transparent texels around every glyph keep the neighbours out of the filtering
+		uint32_t left = i % cellsPerRow * cellWidth + 2;
+		uint32_t top = 64 + i / cellsPerRow * cellHeight + 2;
+
+		for (uint32_t y = 0; y < FONT_GLYPH_HEIGHT * FONT_TEXEL_SCALE; y++)
+		{
+			for (uint32_t x = 0; x < FONT_GLYPH_WIDTH * FONT_TEXEL_SCALE; x++)
+			{
+				if (font[i].Rows[y / FONT_TEXEL_SCALE][x / FONT_TEXEL_SCALE] == '#')
+				{
+					setTexel(left + x, top + y, { 1.0f, 1.0f, 1.0f, 1.0f });
+				}
+			}
+		}
+
+		atlas.Glyphs[font[i].Character] = rect(left, top, FONT_GLYPH_WIDTH * FONT_TEXEL_SCALE, FONT_GLYPH_HEIGHT * FONT_TEXEL_SCALE);
+	}
+
+	atlas.Device = device;
+
+	// UNORM, the colors are multiplied with the instance colors and the sRGB swap chain does the conversion at the end
+	atlas.Image = uploader.CreateImage(pixels.data(), { size, size }, VK_FORMAT_R8G8B8A8_UNORM, 4, VK_IMAGE_USAGE_SAMPLED_BIT, atlas.Memory);
+
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+
+	viewInfo.image = atlas.Image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	VkResult result = vkCreateImageView(device, &viewInfo, nullptr, &atlas.ImageView);
+	ASSERT(result == VK_SUCCESS, "Failed to create the sprite atlas image view.");
+
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+	samplerInfo.maxLod = 0.0f;
+
+	result = vkCreateSampler(device, &samplerInfo, nullptr, &atlas.Sampler);
+	ASSERT(result == VK_SUCCESS, "Failed to create the sprite atlas sampler.");
+
+	VkDescriptorPoolSize poolSize{};
+	poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSize.descriptorCount = 1;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+
+	result = vkCreateDescriptorPool(device, &poolInfo, nullptr, &atlas.DescriptorPool);
+	ASSERT(result == VK_SUCCESS, "Failed to create the sprite atlas descriptor pool.");
+
+	VkDescriptorSetAllocateInfo setInfo{};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+
+	setInfo.descriptorPool = atlas.DescriptorPool;
+	setInfo.descriptorSetCount = 1;
+	setInfo.pSetLayouts = &textureSetLayout;
+
+	result = vkAllocateDescriptorSets(device, &setInfo, &atlas.DescriptorSet);
+	ASSERT(result == VK_SUCCESS, "Failed to allocate the sprite atlas descriptor set.");
+
+	VkDescriptorImageInfo imageInfo{};
+	imageInfo.sampler = atlas.Sampler;
+	imageInfo.imageView = atlas.ImageView;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+
+	write.dstSet = atlas.DescriptorSet;
+	write.dstBinding = 0;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.descriptorCount = 1;
+	write.pImageInfo = &imageInfo;
+
+	vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+void DestroySpriteAtlas(GpuAllocator& allocator, SpriteAtlas& atlas)
+{
+	// Freeing the pool frees the set too
+	vkDestroyDescriptorPool(atlas.Device, atlas.DescriptorPool, nullptr);
+	vkDestroySampler(atlas.Device, atlas.Sampler, nullptr);
+	vkDestroyImageView(atlas.Device, atlas.ImageView, nullptr);
+
+	allocator.DestroyImage(atlas.Image, atlas.Memory);
+
+	atlas = {};
+}
+
+void SpriteBatch::Begin(VkPipeline pipeline, VkDescriptorSet texture)
+{
+	Pipeline = pipeline;
+	Texture = texture;
+
+	// The vectors keep their capacity, so after the first few frames nothing gets allocated anymore
+	Instances.clear();
+	Spans.clear();
+	Draws.clear();
+}
+
+void SpriteBatch::Add(SpriteLayer layer, const QuadInstance& instance)
+{
+	Add(layer, &instance, 1);
+}
+
+void SpriteBatch::Add(SpriteLayer layer, const QuadInstance* instances, uint32_t count)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	uint32_t first = Instances.size();
+	Instances.insert(Instances.end(), instances, instances + count);
+
+	// Quads added one after the other with the same state (all glyphs of a text, ...) just grow the last span
+	if (!Spans.empty() && Spans.back().Layer == layer && Spans.back().Pipeline == Pipeline && Spans.back().Texture == Texture)
+	{
+		Spans.back().InstanceCount += count;
+		return;
+	}
+
+	Spans.push_back({ layer, Pipeline, Texture, first, count });
+}
+
+void SpriteBatch::AddText(const SpriteAtlas& atlas, SpriteLayer layer, const char* text, glm::vec2 position, float height, const glm::vec4& color, float anchor /* = 0.0f */)
+{
+	uint32_t length = strlen(text);
+
+	if (length == 0)
+	{
+		return;
+	}
+
+	// Glyphs are FONT_GLYPH_WIDTH font pixels wide with one pixel between them
+	float pixel = height / FONT_GLYPH_HEIGHT;
+	float advance = pixel * (FONT_GLYPH_WIDTH + 1);
+	float width = length * advance - pixel;
+
+	glm::vec2 size = { pixel * FONT_GLYPH_WIDTH, height };
+	glm::vec2 center = position + glm::vec2(size.x / 2.0f - width * anchor, height / 2.0f);
+
+	for (uint32_t i = 0; i < length; i++, center.x += advance)
+	{
+		uint8_t character = text[i];
+
+		// The font only has capitals
+		if (character >= 'a' && character <= 'z')
+		{
+			character -= 'a' - 'A';
+		}
+
+		if (character >= atlas.Glyphs.size() || atlas.Glyphs[character].x == atlas.Glyphs[character].z)
+		{
+			continue;
+		}
+
+		Add(layer, { center, size, color, atlas.Glyphs[character] });
+	}
+}
+
+void SpriteBatch::End()
+{
+	std::stable_sort(Spans.begin(), Spans.end(), [](const SpriteSpan& a, const SpriteSpan& b)
+	{
+		if (a.Layer != b.Layer)
+		{
+			return a.Layer < b.Layer;
+		}
+
+		// Any order is fine here, as long as the same pipelines and textures end up next to each other
+		if (a.Pipeline != b.Pipeline)
+		{
+			return (uint64_t)a.Pipeline < (uint64_t)b.Pipeline;
+		}
+
+		return (uint64_t)a.Texture < (uint64_t)b.Texture;
+	});
+
+	uint32_t first = 0;
+
+	for (const SpriteSpan& span : Spans)
+	{
+		// Merges across layers too, the layers are still drawn in order within the draw
+		if (!Draws.empty() && Draws.back().Pipeline == span.Pipeline && Draws.back().Texture == span.Texture)
+		{
+			Draws.back().InstanceCount += span.InstanceCount;
+		}
+		else
+		{
+			Draws.push_back({ span.Pipeline, span.Texture, first, span.InstanceCount });
+		}
+
+		first += span.InstanceCount;
+	}
+}
+
+void SpriteBatch::WriteSorted(QuadInstance* destination) const
+{
+	for (const SpriteSpan& span : Spans)
+	{
+		memcpy(destination, &Instances[span.FirstInstance], span.InstanceCount * sizeof(QuadInstance));
+		destination += span.InstanceCount;
+	}
+}
+
+void AddGameSprites(SpriteBatch& sprites, const SpriteAtlas& atlas, const std::array<QuadInstance, 3>& instances, const PongSim& sim)
+{
+	AddFieldSprites(sprites, atlas, sim.Scores);
+
+	sprites.Add(SPRITE_LAYER_GAME, instances[0]);
+	sprites.Add(SPRITE_LAYER_GAME, instances[1]);
+
+	QuadInstance ball = instances[2];
+	ball.UV = atlas.Ball;
+
+	sprites.Add(SPRITE_LAYER_GAME, ball);
+}
+
+void AddMultiBallSprites(SpriteBatch& sprites, const SpriteAtlas& atlas, const MultiBallSim& sim, std::vector<QuadInstance>& ballInstances)
+{
+	AddFieldSprites(sprites, atlas, sim.Scores);
+
+	const glm::vec4 white = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	// No blending between ticks here, with this many balls nobody can tell
+	sprites.Add(SPRITE_LAYER_GAME, { { -ASPECT_RATIO + PLAYER_POSITION, sim.Paddles[0] }, { PLAYER_WIDTH, PLAYER_HEIGHT }, white });
+	sprites.Add(SPRITE_LAYER_GAME, { {  ASPECT_RATIO - PLAYER_POSITION, sim.Paddles[1] }, { PLAYER_WIDTH, PLAYER_HEIGHT }, white });
+
+	ballInstances.clear();
+	sim.WriteInstances(ballInstances, atlas.Ball);
+
+	sprites.Add(SPRITE_LAYER_GAME, ballInstances.data(), ballInstances.size());
+}
+
+void AddFieldSprites(SpriteBatch& sprites, const SpriteAtlas& atlas, const unsigned int scores[2])
+{
+	const glm::vec4 white = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	// The clear color only shows around the field when the window has a different shape
+	sprites.Add(SPRITE_LAYER_BACKGROUND, { { 0.0f, 0.0f }, { ASPECT_RATIO * 2.0f, 2.0f }, white, atlas.Background });
+
+	constexpr int dashCount = 15;
+
+	for (int i = 0; i < dashCount; i++)
+	{
+		float y = -1.0f + (i + 0.5f) * 2.0f / dashCount;
+		sprites.Add(SPRITE_LAYER_BACKGROUND, { { 0.0f, y }, { 0.01f, 1.0f / dashCount }, { 1.0f, 1.0f, 1.0f, 0.15f }, atlas.White });
+	}
+
+	// Each score over its player's half of the field
+	char text[32];
+
+	for (int player = 0; player < 2; player++)
+	{
+		snprintf(text, sizeof(text), "%u", scores[player]);
+		sprites.AddText(atlas, SPRITE_LAYER_HUD, text, { (player == 0 ? -0.5f : 0.5f) * ASPECT_RATIO, -0.92f }, 0.2f, { 1.0f, 1.0f, 1.0f, 0.6f }, 0.5f);
+	}
+}
+
+LaunchOptions ParseCommandLine(int argc, char** argv)
+{
+	LaunchOptions options{};
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--headless") == 0)
+		{
+			options.Headless = true;
+		}
+		else if (strcmp(argv[i], "--matches") == 0 && i + 1 < argc)
+		{
+			options.MatchCount = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc)
+		{
+			options.TickRate = std::max(1.0, strtod(argv[++i], nullptr));
+		}
+		else if (strcmp(argv[i], "--verify-batch") == 0)
+		{
+			options.VerifyBatch = true;
+		}
+		else if (strcmp(argv[i], "--verify-scheduler") == 0)
+		{
+			options.VerifyScheduler = true;
+		}
+		else if (strcmp(argv[i], "--bench-batch") == 0)
+		{
+			options.BenchmarkBatch = true;
+		}
+		else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc)
+		{
+			options.StepCount = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "--farm") == 0)
+		{
+			options.Farm = true;
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			options.ThreadCount = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			options.Seed = strtoull(argv[++i], nullptr, 0);
+		}
+		else if (strcmp(argv[i], "--bench-draw") == 0)
+		{
+			options.BenchmarkDraw = true;
+		}
+		else if (strcmp(argv[i], "--bench-record") == 0)
+		{
+			options.BenchmarkRecord = true;
+		}
+		else if (strcmp(argv[i], "--record-threads") == 0 && i + 1 < argc)
+		{
+			options.RecordThreadCount = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+		{
+			options.RecordPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+		{
+			options.ReplayPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--pipeline-cache") == 0 && i + 1 < argc)
+		{
+			options.PipelineCachePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--no-pipeline-cache") == 0)
+		{
+			options.PipelineCachePath.clear();
+		}
+		else if (strcmp(argv[i], "--hot-reload") == 0)
+		{
+			options.HotReload = true;
+		}
+		else if (strcmp(argv[i], "--offscreen") == 0 && i + 1 < argc)
+		{
+			options.OffscreenFrameCount = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+		{
+			options.OutputPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+		{
+			options.TracePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--low-latency") == 0)
+		{
+			options.LowLatency = true;
+		}
+		else if (strcmp(argv[i], "--depth") == 0)
+		{
+			options.Depth = true;
+		}
+		else if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc)
+		{
+			options.ParticleCount = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "--cpu-particles") == 0)
+		{
+			options.CpuParticles = true;
+		}
+		else if (strcmp(argv[i], "--bench-particles") == 0)
+		{
+			options.BenchmarkParticles = true;
+		}
+		else if (strcmp(argv[i], "--multiball") == 0 && i + 1 < argc)
+		{
+			options.MultiBallCount = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "--bench-multiball") == 0)
+		{
+			options.BenchmarkMultiBall = true;
+		}
+		else if (strcmp(argv[i], "--ai") == 0 && i + 1 < argc)
+		{
+			const char* side = argv[++i];
+
+			if (strcmp(side, "left") == 0)
+			{
+				options.AiPlayers = 1;
+			}
+			else if (strcmp(side, "right") == 0)
+			{
+				options.AiPlayers = 2;
+			}
+			else if (strcmp(side, "both") == 0)
+			{
+				options.AiPlayers = 3;
+			}
+			else
+			{
+				std::cout << "Unknown side \"" << side << "\", use left, right or both\n";
+			}
+		}
+		else if (strcmp(argv[i], "--ai-reaction") == 0 && i + 1 < argc)
+		{
+			options.Difficulty.ReactionTicks = std::max(1u, (uint32_t)strtoul(argv[++i], nullptr, 10));
+		}
+		else if (strcmp(argv[i], "--ai-error") == 0 && i + 1 < argc)
+		{
+			options.Difficulty.AimError = std::max(0.0f, strtof(argv[++i], nullptr));
+		}
+		else if (strcmp(argv[i], "--bench-ai") == 0)
+		{
+			options.BenchmarkAi = true;
+		}
+		else if (strcmp(argv[i], "--bench-env") == 0)
+		{
+			options.BenchmarkEnv = true;
+		}
+		else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+		{
+			options.FramesInFlight = std::clamp((uint32_t)strtoul(argv[++i], nullptr, 10), 1u, MAX_FRAMES_IN_FLIGHT);
+		}
+		else if (strcmp(argv[i], "--present-mode") == 0 && i + 1 < argc)
+		{
+			const char* mode = argv[++i];
+
+			if (strcmp(mode, "fifo") == 0)
+			{
+				options.PresentMode = VK_PRESENT_MODE_FIFO_KHR;
+			}
+			else if (strcmp(mode, "mailbox") == 0)
+			{
+				options.PresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+			}
+			else if (strcmp(mode, "immediate") == 0)
+			{
+				options.PresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+			}
+			else
+			{
+				std::cout << "Unknown present mode \"" << mode << "\", use fifo, mailbox or immediate\n";
+			}
+		}
+		else
+		{
+			std::cout << "Ignoring unknown argument \"" << argv[i] << "\"\n";
+		}
+	}
+
+	return options;
+}
+
+uint8_t PollInputs(GLFWwindow* window)
+{
+	uint8_t inputs = INPUT_NONE;
+
+	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+	{
+		inputs |= INPUT_PLAYER1_UP;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+	{
+		inputs |= INPUT_PLAYER1_DOWN;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
+	{
+		inputs |= INPUT_PLAYER2_UP;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
+	{
+		inputs |= INPUT_PLAYER2_DOWN;
+	}
+
+	return inputs;
+}
+
+uint8_t GetBotInputs(const PongSim& sim)
+{
+	// Both bots just chase the ball, but only once it's heading their way and in their half
+	// Otherwise they'd never miss because the paddles are as fast as the ball
+
+	uint8_t inputs = INPUT_NONE;
+
+	const glm::vec2& ball = sim.Positions[2];
+	int approachedPlayer = sim.BallDirection.x < 0.0f ? 0 : 1;
+
+	if ((ball.x < 0.0f) != (approachedPlayer == 0))
+	{
+		return inputs;
+	}
+
+	float offset = ball.y - sim.Positions[approachedPlayer].y;
+
+	if (abs(offset) < PLAYER_HEIGHT / 4.0f)
+	{
+		return inputs;
+	}
+
+	if (approachedPlayer == 0)
+	{
+		inputs |= offset < 0.0f ? INPUT_PLAYER1_UP : INPUT_PLAYER1_DOWN;
+	}
+	else
+	{
+		inputs |= offset < 0.0f ? INPUT_PLAYER2_UP : INPUT_PLAYER2_DOWN;
+	}
+
+	return inputs;
+}
+
+float PredictBallY(glm::vec2 position, glm::vec2 direction, float paddleX)
+{
+	// Mirror the field at every wall and the ball flies in a straight line, so the crossing is one multiply away
+	// Folding that back into the field is a triangle wave with a period of two field heights
+	// The speed doesn't change the path, and the random kick of every wall bounce (see Bounce()) is ignored, that's what
+	// PredictBallYBySteps() is for
+
+	if (direction.x == 0.0f)
+	{
+		return position.y;
+	}
+
+	float y = position.y + direction.y * (paddleX - position.x) / direction.x;
+
+	float height = 2.0f * BALL_LIMIT_Y;
+	float folded = fmodf(y + BALL_LIMIT_Y, 2.0f * height);
+
+	if (folded < 0.0f)
+	{
+		folded += 2.0f * height;
+	}
+
+	return folded <= height ? folded - BALL_LIMIT_Y : 3.0f * BALL_LIMIT_Y - folded;
+}
+
+float PredictBallYBySteps(const PongSim& sim)
+{
+	// The brute force version: plays the ball forward on a copy until it gets to a paddle line
+	// Exact, random bounces and all, because the copy draws the same numbers from the same Philox stream
+
+	std::array<glm::vec2, 3> positions = sim.Positions;
+	glm::vec2 direction = sim.BallDirection;
+	PhiloxStream random = sim.Random;
+
+	ImpactList impacts;
+
+	for (uint32_t step = 0; step < MAX_LOOKAHEAD_STEPS; step++)
+	{
+		impacts.Count = 0;
+		MoveBall(positions, direction, random, sim.TimeScale, &impacts);
+
+		for (uint32_t i = 0; i < impacts.Count; i++)
+		{
+			if (impacts.Impacts[i].Kind != IMPACT_WALL)
+			{
+				return impacts.Impacts[i].Position.y;
+			}
+		}
+	}
+
+	return positions[2].y;
+}
+
+uint8_t DecideAiInputs(const AiDifficulty& difficulty, int player, glm::vec2 ball, glm::vec2 direction, float paddleY, PhiloxStream& random, float& target, uint32_t& timer)
+{
+	if (timer == 0)
+	{
+		timer = std::max(difficulty.ReactionTicks, 1u);
+
+		bool approaching = (direction.x < 0.0f) == (player == 0);
+
+		if (approaching)
+		{
+			float paddleX = player == 0 ? -BALL_LIMIT_X : BALL_LIMIT_X;
+			target = PredictBallY(ball, direction, paddleX) + (random.NextFloat() * 2.0f - 1.0f) * difficulty.AimError;
+		}
+		else
+		{
+			// The middle is the shortest way to wherever the ball comes back to
+			target = 0.0f;
+		}
+	}
+
+	timer--;
+
+	// Within half a move is close enough, otherwise it'd jitter around the target
+	float offset = target - paddleY;
+
+	if (abs(offset) < MOVEMENT_SPEED / 2.0f)
+	{
+		return INPUT_NONE;
+	}
+
+	if (player == 0)
+	{
+		return offset < 0.0f ? INPUT_PLAYER1_UP : INPUT_PLAYER1_DOWN;
+	}
+
+	return offset < 0.0f ? INPUT_PLAYER2_UP : INPUT_PLAYER2_DOWN;
+}
+
+void AiPlayer::Reset(int player, const AiDifficulty& difficulty, uint64_t seed /* = DEFAULT_SEED */)
+{
+	Player = player;
+	Difficulty = difficulty;
+
+	Target = 0.0f;
+	Timer = 0;
+
+	Random.Seed = seed ^ AI_SEED_SALT;
+	Random.Stream = player;
+	Random.Position = 0;
+}
+
+uint8_t AiPlayer::Update(const PongSim& sim)
+{
+	return DecideAiInputs(Difficulty, Player, sim.Positions[2], sim.BallDirection, sim.Positions[Player].y, Random, Target, Timer);
+}
+
+uint8_t AiPlayer::Update(const MultiBallSim& sim)
+{
+	float paddleX = Player == 0 ? -BALL_LIMIT_X : BALL_LIMIT_X;
+
+	// Nothing coming means heading back to the middle, a ball going the other way does that
+	glm::vec2 ball = { 0.0f, 0.0f };
+	glm::vec2 direction = { Player == 0 ? 1.0f : -1.0f, 0.0f };
+	float earliest = INFINITY;
+
+	for (uint32_t i = 0; i < sim.BallCount; i++)
+	{
+		float velocityX = sim.VelocityX[i];
+
+		if (velocityX == 0.0f || (velocityX < 0.0f) != (Player == 0))
+		{
+			continue;
+		}
+
+		float ticks = (paddleX - sim.PositionX[i]) / velocityX;
+
+		if (ticks < earliest)
+		{
+			earliest = ticks;
+			ball = { sim.PositionX[i], sim.PositionY[i] };
+			direction = { velocityX, sim.VelocityY[i] };
+		}
+	}
+
+	return DecideAiInputs(Difficulty, Player, ball, direction, sim.Paddles[Player], Random, Target, Timer);
+}
+
+void BatchAi::Reset(uint32_t matchCount, const AiDifficulty& difficulty, uint64_t seed /* = DEFAULT_SEED */)
+{
+	Difficulty = difficulty;
+	Seed = seed ^ AI_SEED_SALT;
+
+	MatchCount = matchCount;
+
+	Targets.assign(matchCount * 2, 0.0f);
+	Timers.assign(matchCount * 2, 0);
+	RandomPositions.assign(matchCount * 2, 0);
+}
+
+void BatchAi::Decide(const BatchSim& batch, uint8_t* inputs)
+{
+	PhiloxStream random;
+	random.Seed = Seed;
+
+	for (uint32_t match = 0; match < MatchCount; match++)
+	{
+		glm::vec2 ball = { batch.BallX[match], batch.BallY[match] };
+		glm::vec2 direction = { batch.DirectionX[match], batch.DirectionY[match] };
+
+		uint8_t matchInputs = INPUT_NONE;
+
+		for (int player = 0; player < 2; player++)
+		{
+			uint32_t bot = match * 2 + player;
+
+			random.Stream = bot;
+			random.Position = RandomPositions[bot];
+
+			float paddleY = player == 0 ? batch.Paddle1Y[match] : batch.Paddle2Y[match];
+			matchInputs |= DecideAiInputs(Difficulty, player, ball, direction, paddleY, random, Targets[bot], Timers[bot]);
+
+			RandomPositions[bot] = random.Position;
+		}
+
+		inputs[match] = matchInputs;
+	}
+}
+
+void BenchmarkAi(uint32_t matchCount, uint32_t stepCount, uint64_t seed, float timeScale, const AiDifficulty& difficulty)
+{
+	// Predictions for random balls, analytic against playing the ball forward, then the bots running a whole batch and
+	// playing against the old GetBotInputs() bot
+
+	constexpr uint32_t stateCount = 100000;
+	constexpr uint32_t analyticRepeats = 20;
+	constexpr uint32_t versusMatchCount = 200;
+
+	std::vector<PongSim> states(stateCount);
+	std::vector<float> analytic(stateCount);
+	std::vector<float> bruteForce(stateCount);
+
+	for (uint32_t i = 0; i < stateCount; i++)
+	{
+		PongSim& sim = states[i];
+		sim.TimeScale = timeScale;
+		sim.Reset(seed, i);
+
+		// Anywhere on the field, in any direction the ball can actually have (Bounce() keeps x at 0.5 or more)
+		sim.Positions[2] = { (sim.Random.NextFloat() * 2.0f - 1.0f) * BALL_LIMIT_X, (sim.Random.NextFloat() * 2.0f - 1.0f) * BALL_LIMIT_Y };
+
+		float angle = (sim.Random.NextFloat() * 2.0f - 1.0f) * glm::pi<float>() / 3.0f;
+		float side = sim.Random.NextFloat() < 0.5f ? -1.0f : 1.0f;
+
+		sim.BallDirection = { cosf(angle) * side, sinf(angle) };
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t repeat = 0; repeat < analyticRepeats; repeat++)
+	{
+		for (uint32_t i = 0; i < stateCount; i++)
+		{
+			const PongSim& sim = states[i];
+			analytic[i] = PredictBallY(sim.Positions[2], sim.BallDirection, sim.BallDirection.x < 0.0f ? -BALL_LIMIT_X : BALL_LIMIT_X);
+		}
+	}
+
+	double analyticSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / analyticRepeats;
+
+	start = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t i = 0; i < stateCount; i++)
+	{
+		bruteForce[i] = PredictBallYBySteps(states[i]);
+	}
+
+	double bruteForceSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	double totalError = 0.0;
+	float maxError = 0.0f;
+	uint32_t catchable = 0;
+
+	for (uint32_t i = 0; i < stateCount; i++)
+	{
+		float error = abs(analytic[i] - bruteForce[i]);
+
+		totalError += error;
+		maxError = std::max(maxError, error);
+
+		// Still on the paddle if it's centered on the prediction
+		catchable += error < PLAYER_HEIGHT / 2.0f;
+	}
+
+	std::cout << "Predicting where " << stateCount << " random balls cross the paddle line\n";
+	std::cout << "\n";
+	std::cout << "Prediction   Predictions/sec  Speedup\n";
+	printf("%-11s  %15.0f  %6.1fx\n", "Analytic", stateCount / analyticSeconds, bruteForceSeconds / analyticSeconds);
+	printf("%-11s  %15.0f  %6.1fx\n", "Look-ahead", stateCount / bruteForceSeconds, 1.0);
+	std::cout << "\n";
+	printf("Analytic error from the random wall bounces: %.4f on average, %.4f at most, %.2f%% within half a paddle\n", totalError / stateCount, maxError, 100.0 * catchable / stateCount);
+
+	// Both paddles of every match, the batch gets stepped in between but isn't part of the time
+	BatchSim batch;
+	batch.TimeScale = timeScale;
+	batch.Reset(matchCount, seed);
+
+	BatchAi ai;
+	ai.Reset(matchCount, difficulty, seed);
+
+	std::vector<uint8_t> inputs(matchCount);
+	double decideSeconds = 0.0;
+
+	for (uint32_t step = 0; step < stepCount; step++)
+	{
+		start = std::chrono::high_resolution_clock::now();
+		ai.Decide(batch, inputs.data());
+		decideSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		batch.Step(inputs.data());
+	}
+
+	uint64_t goalCount = 0;
+
+	for (uint32_t match = 0; match < matchCount; match++)
+	{
+		goalCount += batch.Scores1[match] + batch.Scores2[match];
+	}
+
+	std::cout << "\n";
+	std::cout << "Bots on both paddles of " << matchCount << " matches for " << stepCount << " steps (" << difficulty.ReactionTicks << " reaction ticks, " << difficulty.AimError << " aim error)\n";
+	printf("%.0f decisions/sec, a goal every %.0f ticks\n", 2.0 * matchCount * stepCount / decideSeconds, goalCount > 0 ? (double)matchCount * stepCount / goalCount : INFINITY);
+
+	// The bot on the left, the one that chases the ball on the right
+	uint32_t wins[2] = {};
+
+	for (uint32_t match = 0; match < versusMatchCount; match++)
+	{
+		PongSim sim;
+		sim.TimeScale = timeScale;
+		sim.Reset(seed, match);
+
+		AiPlayer bot;
+		bot.Reset(0, difficulty, seed + match);
+
+		while (!sim.IsOver())
+		{
+			uint8_t chaser = GetBotInputs(sim) & (INPUT_PLAYER2_UP | INPUT_PLAYER2_DOWN);
+			sim.Step(bot.Update(sim) | chaser);
+		}
+
+		if (sim.Scores[0] != sim.Scores[1])
+		{
+			wins[sim.Scores[0] > sim.Scores[1] ? 0 : 1]++;
+		}
+	}
+
+	std::cout << "Against the chasing bot: " << wins[0] << " won, " << wins[1] << " lost, " << versusMatchCount - wins[0] - wins[1] << " drawn\n";
+}
+
+void RunHeadless(uint32_t matchCount, uint64_t seed, const fs::path& recordPath)
+{
+	std::cout << "Running " << matchCount << " headless matches...\n";
+
+	PongSim sim;
+
+	RecordingWriter recorder;
+	bool recording = !recordPath.empty();
+
+	if (recording)
+	{
+		recorder.Open(recordPath);
+	}
+
+	uint64_t totalSteps = 0;
+	uint32_t wins[2] = { 0 };
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t i = 0; i < matchCount; i++)
+	{
+		sim.Reset(seed, i);
+
+		if (recording)
+		{
+			recorder.BeginMatch(sim);
+		}
+
+		while (!sim.IsOver())
+		{
+			uint8_t inputs = GetBotInputs(sim);
+
+			if (recording)
+			{
+				recorder.RecordTick(sim, inputs);
+			}
+
+			sim.Step(inputs);
+		}
+
+		if (recording)
+		{
+			recorder.EndMatch(sim);
+		}
+
+		totalSteps += sim.StepCount;
+
+		if (sim.Scores[0] != sim.Scores[1])
+		{
+			wins[sim.Scores[0] > sim.Scores[1] ? 0 : 1]++;
+		}
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+
+	if (recording)
+	{
+		recorder.Close();
+		std::cout << "Recorded to " << recordPath << ": " << recorder.FileSize << " bytes, " << (double)recorder.FileSize / matchCount << " bytes/match\n";
+	}
+
+	std::cout << "Wins: " << wins[0] << " - " << wins[1] << "\n";
+	std::cout << "Took " << seconds << "s\n";
+	std::cout << "Matches/sec: " << matchCount / seconds << "\n";
+	std::cout << "Steps/sec: " << totalSteps / seconds << "\n";
+}
+
+static uint32_t NextTestRandom(uint32_t& state)
+{
+	// xorshift32, only used to make up inputs
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+
+	return state;
+}
+
+bool VerifyBatchSim(uint32_t matchCount, uint32_t stepCount, uint64_t seed, float timeScale)
+{
+	// Runs the same matches (same inputs, same random streams) through PongSim and every batch kernel and compares the bits
+
+	std::vector<uint8_t> inputs(matchCount);
+	uint32_t inputState = 0x9E3779B9;
+
+	std::vector<PongSim> sims(matchCount);
+
+	for (uint32_t i = 0; i < matchCount; i++)
+	{
+		sims[i].TimeScale = timeScale;
+		sims[i].Reset(seed, i);
+	}
+
+	for (uint32_t step = 0; step < stepCount; step++)
+	{
+		for (uint32_t i = 0; i < matchCount; i++)
+		{
+			inputs[i] = NextTestRandom(inputState) & 0xF;
+		}
+
+		for (uint32_t i = 0; i < matchCount; i++)
+		{
+			sims[i].Step(inputs[i]);
+		}
+	}
+
+	uint64_t totalGoals = 0;
+	for (const PongSim& sim : sims)
+	{
+		totalGoals += sim.Scores[0] + sim.Scores[1];
+	}
+
+	std::cout << "Reference: " << matchCount << " matches, " << stepCount << " steps, " << totalGoals << " goals\n";
+
+	bool allMatch = true;
+	SimdLevel supportedLevel = DetectSimdLevel();
+
+	for (int level = SIMD_SCALAR; level <= supportedLevel; level++)
+	{
+		BatchSim batch;
+		batch.Level = (SimdLevel)level;
+		batch.TimeScale = timeScale;
+		batch.Reset(matchCount, seed);
+
+		inputState = 0x9E3779B9;
+
+		for (uint32_t step = 0; step < stepCount; step++)
+		{
+			for (uint32_t i = 0; i < matchCount; i++)
+			{
+				inputs[i] = NextTestRandom(inputState) & 0xF;
+			}
+
+			batch.Step(inputs.data());
+		}
+
+		uint32_t mismatches = 0;
+
+		for (uint32_t i = 0; i < matchCount; i++)
+		{
+			const PongSim& sim = sims[i];
+
+			float expected[6] = { sim.Positions[0].y, sim.Positions[1].y, sim.Positions[2].x, sim.Positions[2].y, sim.BallDirection.x, sim.BallDirection.y };
+			float actual[6] = { batch.Paddle1Y[i], batch.Paddle2Y[i], batch.BallX[i], batch.BallY[i], batch.DirectionX[i], batch.DirectionY[i] };
+
+			bool sameState = memcmp(expected, actual, sizeof(expected)) == 0;
+			bool sameScores = sim.Scores[0] == batch.Scores1[i] && sim.Scores[1] == batch.Scores2[i] && sim.Random.Position == batch.RandomPositions[i];
+
+			if (!sameState || !sameScores)
+			{
+				mismatches++;
+			}
+		}
+
+		std::cout << GetSimdLevelName((SimdLevel)level) << ": " << (mismatches == 0 ? "matches MoveBall" : "MISMATCH") << " (" << mismatches << " differing matches)\n";
+		allMatch = allMatch && mismatches == 0;
+	}
+
+	return allMatch;
+}
+
+void BenchmarkBatchSim(uint32_t matchCount, uint32_t stepCount, float timeScale)
+{
+	// Inputs are cycled from a small table so generating them doesn't show up in the numbers
+	constexpr uint32_t inputTableSteps = 64;
+
+	std::vector<uint8_t> inputTable((size_t)inputTableSteps * matchCount);
+	uint32_t inputState = 0x9E3779B9;
+
+	for (uint8_t& input : inputTable)
+	{
+		input = NextTestRandom(inputState) & 0xF;
+	}
+
+	SimdLevel supportedLevel = DetectSimdLevel();
+	double scalarStepsPerSecond = 0.0;
+
+	std::cout << "Stepping " << matchCount << " matches " << stepCount << " times\n";
+
+	for (int level = SIMD_SCALAR; level <= supportedLevel; level++)
+	{
+		BatchSim batch;
+		batch.Level = (SimdLevel)level;
+		batch.TimeScale = timeScale;
+		batch.Reset(matchCount);
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for (uint32_t step = 0; step < stepCount; step++)
+		{
+			batch.Step(&inputTable[(size_t)(step % inputTableSteps) * matchCount]);
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count();
+		double stepsPerSecond = (double)matchCount * stepCount / seconds;
+
+		if (level == SIMD_SCALAR)
+		{
+			scalarStepsPerSecond = stepsPerSecond;
+		}
+
+		std::cout << GetSimdLevelName((SimdLevel)level) << ": " << stepsPerSecond << " match steps/sec (" << stepsPerSecond / scalarStepsPerSecond << "x scalar)\n";
+	}
+}
+
+bool BenchmarkVectorEnv(uint32_t matchCount, uint32_t stepCount, uint64_t seed, float timeScale)
+{
+	// The same random actions through a bare BatchSim and through the environment for every SIMD level, the difference is
+	// what the environment costs on top of the physics. Every level is also stepped next to the scalar kernel to check the
+	// rewards, done flags and step counts, and match 0 gets played again with a PongSim to check the observations
+
+	constexpr uint32_t inputTableSteps = 64;
+
+	std::vector<uint8_t> inputTable((size_t)inputTableSteps * matchCount);
+	uint32_t inputState = 0x9E3779B9;
+
+	for (uint8_t& input : inputTable)
+	{
+		input = NextTestRandom(inputState) & 0xF;
+	}
+
+	// Caller owned, allocated once
+	std::vector<float> observations((size_t)matchCount * ENV_OBSERVATION_SIZE);
+	std::vector<float> rewards((size_t)2 * matchCount);
+	std::vector<uint8_t> dones(matchCount);
+
+	std::vector<float> scalarObservations(observations.size());
+	std::vector<float> scalarRewards(rewards.size());
+	std::vector<uint8_t> scalarDones(dones.size());
+
+	std::cout << "Stepping " << matchCount << " matches " << stepCount << " times with random actions\n";
+	std::cout << "\n";
+
+	SimdLevel supportedLevel = DetectSimdLevel();
+	bool allMatch = true;
+	uint64_t doneCount = 0;
+
+	for (int level = SIMD_SCALAR; level <= supportedLevel; level++)
+	{
+		BatchSim batch;
+		batch.Level = (SimdLevel)level;
+		batch.TimeScale = timeScale;
+		batch.Reset(matchCount, seed);
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for (uint32_t step = 0; step < stepCount; step++)
+		{
+			batch.Step(&inputTable[(size_t)(step % inputTableSteps) * matchCount]);
+		}
+
+		double batchSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		VectorEnv env;
+		env.Batch.Level = (SimdLevel)level;
+		env.Batch.TimeScale = timeScale;
+		env.Init(matchCount, seed);
+		env.Bind(observations.data(), rewards.data(), dones.data());
+		env.Reset();
+
+		start = std::chrono::high_resolution_clock::now();
+
+		for (uint32_t step = 0; step < stepCount; step++)
+		{
+			env.Step(&inputTable[(size_t)(step % inputTableSteps) * matchCount]);
+		}
+
+		double envSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		if (level == SIMD_SCALAR)
+		{
+			for (uint32_t match = 0; match < matchCount; match++)
+			{
+				doneCount += env.Episodes[match];
+			}
+		}
+
+		// Again from the start, next to the scalar kernel, and compare everything the caller gets to see after every step
+		uint32_t differingSteps = 0;
+
+		if (level != SIMD_SCALAR)
+		{
+			VectorEnv scalarEnv;
+			scalarEnv.Batch.Level = SIMD_SCALAR;
+			scalarEnv.Batch.TimeScale = timeScale;
+			scalarEnv.Init(matchCount, seed);
+			scalarEnv.Bind(scalarObservations.data(), scalarRewards.data(), scalarDones.data());
+			scalarEnv.Reset();
+
+			env.Reset();
+
+			for (uint32_t step = 0; step < stepCount; step++)
+			{
+				const uint8_t* actions = &inputTable[(size_t)(step % inputTableSteps) * matchCount];
+
+				env.Step(actions);
+				scalarEnv.Step(actions);
+
+				bool same =
+					memcmp(rewards.data(), scalarRewards.data(), rewards.size() * sizeof(float)) == 0 &&
+					memcmp(dones.data(), scalarDones.data(), dones.size()) == 0 &&
+					memcmp(observations.data(), scalarObservations.data(), observations.size() * sizeof(float)) == 0 &&
+					env.StepCounts == scalarEnv.StepCounts &&
+					env.Episodes == scalarEnv.Episodes;
+
+				differingSteps += same ? 0 : 1;
+			}
+		}
+
+		allMatch &= differingSteps == 0;
+
+		printf("%-8s BatchSim %7.2f ns/match step, VectorEnv %7.2f ns/match step (%.1f%% on top)", GetSimdLevelName((SimdLevel)level), batchSeconds / ((double)matchCount * stepCount) * 1e9, envSeconds / ((double)matchCount * stepCount) * 1e9, (envSeconds / batchSeconds - 1.0) * 100.0);
+
+		if (level != SIMD_SCALAR)
+		{
+			printf(", %u steps %s from scalar", differingSteps, differingSteps ? "DIFFER" : "differ");
+		}
+
+		printf("\n");
+	}
+
+	// Match 0's first episode again, step by step next to a PongSim
+	VectorEnv env;
+	env.Batch.TimeScale = timeScale;
+	env.Init(matchCount, seed);
+	env.Bind(observations.data(), rewards.data(), dones.data());
+	env.Reset();
+
+	PongSim reference;
+	reference.TimeScale = timeScale;
+	reference.Reset(seed, 0);
+
+	bool observationsMatch = true;
+
+	for (uint32_t step = 0; step < stepCount && !reference.IsOver(); step++)
+	{
+		const uint8_t* actions = &inputTable[(size_t)(step % inputTableSteps) * matchCount];
+
+		env.Step(actions);
+		reference.Step(actions[0]);
+
+		// The env already started the next episode on the last step
+		if (reference.IsOver())
+		{
+			observationsMatch &= dones[0] == 1;
+			break;
+		}
+
+		const float expected[ENV_OBSERVATION_SIZE] = { reference.Positions[0].y, reference.Positions[1].y, reference.Positions[2].x, reference.Positions[2].y, reference.BallDirection.x, reference.BallDirection.y };
+
+		for (uint32_t field = 0; field < ENV_OBSERVATION_SIZE; field++)
+		{
+			observationsMatch &= observations[(size_t)field * matchCount] == expected[field];
+		}
+
+		observationsMatch &= dones[0] == 0;
+	}
+
+	std::cout << "\n";
+	std::cout << doneCount << " episodes finished and got reset, match 0 " << (observationsMatch ? "matches" : "DOES NOT match") << " PongSim (" << GetSimdLevelName(env.Batch.Level) << ")\n";
+
+	return allMatch && observationsMatch;
+}
+
+float GetMultiBallRadius(uint32_t ballCount)
+{
+	// Keeps the covered area the same no matter the count, but never bigger than the normal ball
+	float fieldArea = ASPECT_RATIO * 2.0f * 2.0f;
+	float radius = sqrtf(MULTIBALL_COVERAGE * fieldArea / (std::max(ballCount, 1u) * glm::pi<float>()));
+
+	return std::min(radius, BALL_SIZE / 2.0f);
+}
+
+void MultiBallSim::Reset(uint32_t ballCount, float radius, uint64_t seed /* = DEFAULT_SEED */)
+{
+	Radius = radius;
+	CellSize = radius * 2.0f;
+
+	BallCount = ballCount;
+	StepCount = 0;
+
+	Paddles[0] = 0.0f;
+	Paddles[1] = 0.0f;
+
+	Scores[0] = 0;
+	Scores[1] = 0;
+
+	Random.Seed = seed;
+	Random.Stream = 0;
+	Random.Position = 0;
+
+	PositionX.resize(ballCount);
+	PositionY.resize(ballCount);
+	VelocityX.resize(ballCount);
+	VelocityY.resize(ballCount);
+
+	// Twice as many buckets as balls would mean fewer shared buckets, but also twice the prefix sum for little gain
+	uint32_t bucketCount = 16;
+
+	while (bucketCount < ballCount)
+	{
+		bucketCount *= 2;
+	}
+
+	CellMask = bucketCount - 1;
+
+	CellStarts.resize(bucketCount + 1);
+	CellBalls.resize(ballCount);
+	BallCells.resize(ballCount);
+
+	Contacts.clear();
+
+	// Spread out over the whole field, the first few steps push apart whatever overlaps
+	float limitX = ASPECT_RATIO - PLAYER_POSITION - PLAYER_WIDTH / 2.0f - Radius;
+	float limitY = 1.0f - Radius;
+
+	for (uint32_t ball = 0; ball < ballCount; ball++)
+	{
+		Serve(ball);
+
+		PositionX[ball] = (Random.NextFloat() * 2.0f - 1.0f) * limitX;
+		PositionY[ball] = (Random.NextFloat() * 2.0f - 1.0f) * limitY;
+	}
+}
+
+void MultiBallSim::Step(uint8_t inputs)
+{
+	if (inputs & INPUT_PLAYER1_UP)
+	{
+		MovePlayer(Paddles[0], -MOVEMENT_SPEED * TimeScale);
+	}
+
+	if (inputs & INPUT_PLAYER1_DOWN)
+	{
+		MovePlayer(Paddles[0], MOVEMENT_SPEED * TimeScale);
+	}
+
+	if (inputs & INPUT_PLAYER2_UP)
+	{
+		MovePlayer(Paddles[1], -MOVEMENT_SPEED * TimeScale);
+	}
+
+	if (inputs & INPUT_PLAYER2_DOWN)
+	{
+		MovePlayer(Paddles[1], MOVEMENT_SPEED * TimeScale);
+	}
+
+	MoveBalls();
+
+	BuildGrid();
+	FindContacts();
+	ResolveContacts();
+
+	StepCount++;
+}
+
+void MultiBallSim::MoveBalls()
+{
+	float limitX = ASPECT_RATIO - PLAYER_POSITION - PLAYER_WIDTH / 2.0f - Radius;
+	float limitY = 1.0f - Radius;
+
+	for (uint32_t ball = 0; ball < BallCount; ball++)
+	{
+		float x = PositionX[ball] + VelocityX[ball] * TimeScale;
+		float y = PositionY[ball] + VelocityY[ball] * TimeScale;
+
+		// Mirrored back into the field instead of a swept test, a ball only moves a fraction of its radius per tick
+		if (y > limitY)
+		{
+			y = 2.0f * limitY - y;
+			VelocityY[ball] = -abs(VelocityY[ball]);
+		}
+		else if (y < -limitY)
+		{
+			y = -2.0f * limitY - y;
+			VelocityY[ball] = abs(VelocityY[ball]);
+		}
+
+		// Only when crossing the paddle's line this step, a ball that already got past doesn't get caught from behind
+		int player = VelocityX[ball] > 0.0f ? 1 : 0;
+
+		if (abs(x) > limitX && abs(PositionX[ball]) <= limitX && abs(y - Paddles[player]) <= PLAYER_HEIGHT / 2.0f + Radius)
+		{
+			float paddleX = player == 1 ? limitX : -limitX;
+
+			x = 2.0f * paddleX - x;
+			VelocityX[ball] = -VelocityX[ball];
+		}
+
+		PositionX[ball] = x;
+		PositionY[ball] = y;
+
+		// Off the screen, the player on the other side scores and the ball comes back
+		if (abs(x) > ASPECT_RATIO + Radius)
+		{
+			Scores[x > 0.0f ? 0 : 1]++;
+			Serve(ball);
+		}
+	}
+}
+
+void MultiBallSim::BuildGrid()
+{
+	// Counting sort by bucket: count, prefix sum, scatter. No allocations and no comparisons
+	std::fill(CellStarts.begin(), CellStarts.end(), 0);
+
+	for (uint32_t ball = 0; ball < BallCount; ball++)
+	{
+		uint32_t bucket = HashCell((int32_t)floorf(PositionX[ball] / CellSize), (int32_t)floorf(PositionY[ball] / CellSize));
+
+		BallCells[ball] = bucket;
+		CellStarts[bucket]++;
+	}
+
+	// Inclusive, so for now CellStarts[b] is where bucket b ends. The last entry is never counted into and ends up as BallCount
+	for (uint32_t bucket = 1; bucket < CellStarts.size(); bucket++)
+	{
+		CellStarts[bucket] += CellStarts[bucket - 1];
+	}
+
+	// Backwards, so every end gets moved down to where its bucket starts and the balls in a bucket stay in order
+	for (uint32_t ball = BallCount; ball-- > 0;)
+	{
+		CellBalls[--CellStarts[BallCells[ball]]] = ball;
+	}
+}
+
+void MultiBallSim::FindContacts()
+{
+	Contacts.clear();
+
+	float diameterSquared = CellSize * CellSize;
+
+	for (uint32_t a = 0; a < BallCount; a++)
+	{
+		int32_t cellX = (int32_t)floorf(PositionX[a] / CellSize);
+		int32_t cellY = (int32_t)floorf(PositionY[a] / CellSize);
+
+		// Neighboring cells can share a bucket, it must only be searched once or the same pair shows up twice
+		uint32_t buckets[9];
+		uint32_t bucketCount = 0;
+
+		for (int32_t y = cellY - 1; y <= cellY + 1; y++)
+		{
+			for (int32_t x = cellX - 1; x <= cellX + 1; x++)
+			{
+				uint32_t bucket = HashCell(x, y);
+
+				if (std::find(buckets, buckets + bucketCount, bucket) == buckets + bucketCount)
+				{
+					buckets[bucketCount++] = bucket;
+				}
+			}
+		}
+
+		for (uint32_t i = 0; i < bucketCount; i++)
+		{
+			// Buckets are sorted by ball, so walking down from the end stops at the first one that was already handled as a
+			uint32_t start = CellStarts[buckets[i]];
+
+			for (uint32_t k = CellStarts[buckets[i] + 1]; k > start && CellBalls[k - 1] > a; k--)
+			{
+				uint32_t b = CellBalls[k - 1];
+
+				float dx = PositionX[b] - PositionX[a];
+				float dy = PositionY[b] - PositionY[a];
+
+				if (dx * dx + dy * dy < diameterSquared)
+				{
+					Contacts.push_back({ a, b });
+				}
+			}
+		}
+	}
+}
+
+void MultiBallSim::ResolveContacts()
+{
+	float diameter = Radius * 2.0f;
+
+	for (const BallContact& contact : Contacts)
+	{
+		uint32_t a = contact.A;
+		uint32_t b = contact.B;
+
+		// From the current positions, earlier contacts this step might have moved them already
+		float dx = PositionX[b] - PositionX[a];
+		float dy = PositionY[b] - PositionY[a];
+		float distance = sqrtf(dx * dx + dy * dy);
+
+		if (distance >= diameter)
+		{
+			continue;
+		}
+
+		// Exactly on top of each other, any direction will do
+		float normalX = 1.0f;
+		float normalY = 0.0f;
+
+		if (distance > 0.0f)
+		{
+			normalX = dx / distance;
+			normalY = dy / distance;
+		}
+
+		// Same mass, so a bounce just swaps the velocities along the normal, but only while they're still getting closer
+		float closing = (VelocityX[a] - VelocityX[b]) * normalX + (VelocityY[a] - VelocityY[b]) * normalY;
+
+		if (closing > 0.0f)
+		{
+			VelocityX[a] -= closing * normalX;
+			VelocityY[a] -= closing * normalY;
+			VelocityX[b] += closing * normalX;
+			VelocityY[b] += closing * normalY;
+		}
+
+		// Half the overlap each, otherwise they'd stick together
+		float push = (diameter - distance) * 0.5f;
+
+		PositionX[a] -= normalX * push;
+		PositionY[a] -= normalY * push;
+		PositionX[b] += normalX * push;
+		PositionY[b] += normalY * push;
+	}
+}
+
+uint32_t MultiBallSim::HashCell(int32_t x, int32_t y) const
+{
+	return ((uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u) & CellMask;
+}
+
+void MultiBallSim::Serve(uint32_t ball)
+{
+	float limitY = 1.0f - Radius;
+
+	// Up to 45 degrees off to either side, at a quarter to half a radius per tick
+	float angle = (Random.NextFloat() - 0.5f) * glm::half_pi<float>();
+	float speed = Radius * (0.25f + 0.25f * Random.NextFloat());
+	float side = Random.NextFloat() < 0.5f ? -1.0f : 1.0f;
+
+	PositionX[ball] = 0.0f;
+	PositionY[ball] = (Random.NextFloat() * 2.0f - 1.0f) * limitY;
+
+	VelocityX[ball] = cosf(angle) * speed * side;
+	VelocityY[ball] = sinf(angle) * speed;
+}
+
+void MultiBallSim::WriteInstances(std::vector<QuadInstance>& instances, const glm::vec4& uv) const
+{
+	const glm::vec4 white = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	for (uint32_t ball = 0; ball < BallCount; ball++)
+	{
+		instances.push_back({ { PositionX[ball], PositionY[ball] }, { Radius * 2.0f, Radius * 2.0f }, white, uv });
+	}
+}
+
+void BenchmarkMultiBall(uint32_t maxBallCount, uint64_t seed)
+{
+	// The coverage stays the same at every count, so the balls per cell and contacts per ball do too and the time per ball
+	// should stay flat. Up to 10k the broadphase gets checked against testing every pair first
+
+	constexpr uint32_t settleSteps = 60;
+	constexpr uint32_t maxBruteForceCount = 10000;
+
+	// Roughly the same amount of work for every count
+	constexpr uint64_t ballSteps = 20000000;
+
+	std::cout << "Stepping multi-ball fields at " << MULTIBALL_COVERAGE * 100.0f << "% coverage\n";
+	std::cout << "\n";
+	std::cout << "   Balls   Radius   Steps  Step ms  ns/ball  Contacts  Brute force\n";
+
+	// Powers of ten up to the count that was asked for
+	std::vector<uint32_t> ballCounts;
+
+	for (uint32_t ballCount = 1000; ballCount < maxBallCount; ballCount *= 10)
+	{
+		ballCounts.push_back(ballCount);
+	}
+
+	ballCounts.push_back(maxBallCount);
+
+	for (uint32_t ballCount : ballCounts)
+	{
+		MultiBallSim sim;
+		sim.Reset(ballCount, GetMultiBallRadius(ballCount), seed);
+
+		for (uint32_t step = 0; step < settleSteps; step++)
+		{
+			sim.Step(INPUT_NONE);
+		}
+
+		const char* bruteForce = "skipped";
+
+		if (ballCount <= maxBruteForceCount)
+		{
+			sim.BuildGrid();
+			sim.FindContacts();
+
+			std::vector<BallContact> expected;
+			float diameterSquared = sim.CellSize * sim.CellSize;
+
+			for (uint32_t a = 0; a < ballCount; a++)
+			{
+				for (uint32_t b = a + 1; b < ballCount; b++)
+				{
+					float dx = sim.PositionX[b] - sim.PositionX[a];
+					float dy = sim.PositionY[b] - sim.PositionY[a];
+
+					if (dx * dx + dy * dy < diameterSquared)
+					{
+						expected.push_back({ a, b });
+					}
+				}
+			}
+
+			// The grid finds them in bucket order, the brute force in ball order
+			auto byBalls = [](const BallContact& x, const BallContact& y) { return x.A != y.A ? x.A < y.A : x.B < y.B; };
+
+			std::vector<BallContact> found = sim.Contacts;
+			std::sort(found.begin(), found.end(), byBalls);
+
+			bool match = found.size() == expected.size() && std::equal(found.begin(), found.end(), expected.begin(), [](const BallContact& x, const BallContact& y) { return x.A == y.A && x.B == y.B; });
+			bruteForce = match ? "match" : "MISMATCH";
+		}
+
+		uint32_t stepCount = (uint32_t)std::max<uint64_t>(ballSteps / ballCount, 10);
+		uint64_t contactCount = 0;
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for (uint32_t step = 0; step < stepCount; step++)
+		{
+			sim.Step(INPUT_NONE);
+			contactCount += sim.Contacts.size();
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		printf("%8u  %7.4f  %6u  %7.3f  %7.1f  %8.1f  %s\n", ballCount, sim.Radius, stepCount, seconds / stepCount * 1e3, seconds / stepCount / ballCount * 1e9, (double)contactCount / stepCount, bruteForce);
+	}
+}
+
+void WorkStealingDeque::Init(uint32_t capacity)
+{
+	// Capacity has to be a power of two so indices can wrap with a mask
+	uint32_t size = 1;
+	while (size < capacity)
+	{
+		size <<= 1;
+	}
+
+	Tasks = std::vector<std::atomic<uint32_t>>(size);
+	Mask = size - 1;
+
+	Top.store(0);
+	Bottom.store(0);
+}
+
+void WorkStealingDeque::Push(uint32_t task)
+{
+	int64_t bottom = Bottom.load(std::memory_order_relaxed);
+	int64_t top = Top.load(std::memory_order_acquire);
+	ASSERT(bottom - top <= (int64_t)Mask, "Work stealing deque is full.");
+
+	Tasks[bottom & Mask].store(task, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	Bottom.store(bottom + 1, std::memory_order_relaxed);
+}
+
+bool WorkStealingDeque::Pop(uint32_t& task)
+{
+	// Chase-Lev deque: the owner works on the bottom, thieves take from the top
+	// Only the last element needs a CAS because that's the only one both sides can race for
+
+	int64_t bottom = Bottom.load(std::memory_order_relaxed) - 1;
+	Bottom.store(bottom, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t top = Top.load(std::memory_order_relaxed);
+
+	if (top > bottom)
+	{
+		Bottom.store(bottom + 1, std::memory_order_relaxed);
+		return false;
+	}
+
+	task = Tasks[bottom & Mask].load(std::memory_order_relaxed);
+
+	if (top == bottom)
+	{
+		bool won = Top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		Bottom.store(bottom + 1, std::memory_order_relaxed);
+
+		return won;
+	}
+
+	return true;
+}
+
+StealResult WorkStealingDeque::Steal(uint32_t& task)
+{
+	int64_t top = Top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t bottom = Bottom.load(std::memory_order_acquire);
+
+	if (top >= bottom)
+	{
+		return STEAL_EMPTY;
+	}
+
+	task = Tasks[top & Mask].load(std::memory_order_relaxed);
+
+	if (!Top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+	{
+		// Somebody else got it first, there might still be more work though
+		return STEAL_RETRY;
+	}
+
+	return STEAL_SUCCESS;
+}
+
+void PlayFarmMatch(uint32_t match, uint64_t seed, MatchResult& result)
+{
+	// Every match has its own random stream, so the results don't depend on which thread plays it
+	PongSim sim;
+	sim.Reset(seed, match);
+
+	uint32_t rallyHits = 0;
+
+	result = MatchResult{};
+
+	while (!sim.IsOver())
+	{
+		float previousDirectionX = sim.BallDirection.x;
+
+		int scoringPlayer = sim.Step(GetBotInputs(sim));
+
+		if (scoringPlayer)
+		{
+			result.Rallies++;
+			result.LongestRally = std::max(result.LongestRally, rallyHits);
+			rallyHits = 0;
+		}
+		else if ((previousDirectionX < 0.0f) != (sim.BallDirection.x < 0.0f))
+		{
+			// Walls never flip the horizontal direction, so this was a paddle
+			result.PaddleHits++;
+			rallyHits++;
+		}
+	}
+
+	result.Scores[0] = sim.Scores[0];
+	result.Scores[1] = sim.Scores[1];
+	result.StepCount = (uint32_t)sim.StepCount;
+}
+
+void RunFarmWorker(uint32_t workerIndex, std::vector<WorkStealingDeque>& deques, uint32_t matchCount, uint64_t seed, std::vector<MatchResult>& results, FarmWorkerStats& stats)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	uint32_t workerCount = (uint32_t)deques.size();
+	WorkStealingDeque& ownDeque = deques[workerIndex];
+
+	uint32_t victimState = 0x9E3779B9 ^ (workerIndex * 0x85EBCA6B + 1);
+
+	while (true)
+	{
+		uint32_t task;
+		bool hasTask = ownDeque.Pop(task);
+
+		// Out of work, go through the other workers starting at a random one
+		// We can only quit once every deque was seen empty, a lost race doesn't mean there's nothing left
+		while (!hasTask)
+		{
+			bool sawWork = false;
+
+			victimState ^= victimState << 13;
+			victimState ^= victimState >> 17;
+			victimState ^= victimState << 5;
+
+			for (uint32_t i = 0; i < workerCount && !hasTask; i++)
+			{
+				uint32_t victim = (victimState + i) % workerCount;
+
+				if (victim == workerIndex)
+				{
+					continue;
+				}
+
+				stats.StealAttempts++;
+				StealResult result = deques[victim].Steal(task);
+
+				if (result == STEAL_SUCCESS)
+				{
+					stats.Steals++;
+					hasTask = true;
+				}
+				else if (result == STEAL_RETRY)
+				{
+					sawWork = true;
+				}
+			}
+
+			if (!hasTask && !sawWork)
+			{
+				break;
+			}
+		}
+
+		if (!hasTask)
+		{
+			break;
+		}
+
+		uint32_t begin = task * FARM_CHUNK_SIZE;
+		uint32_t end = std::min(begin + FARM_CHUNK_SIZE, matchCount);
+
+		for (uint32_t match = begin; match < end; match++)
+		{
+			// Every match has its own slot, so nothing has to be locked
+			PlayFarmMatch(match, seed, results[match]);
+
+			stats.Matches++;
+			stats.Steps += results[match].StepCount;
+		}
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	stats.Seconds = std::chrono::duration<double>(end - start).count();
+}
+
+void RunMatchFarm(uint32_t matchCount, uint32_t threadCount, uint64_t seed)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	uint32_t chunkCount = (matchCount + FARM_CHUNK_SIZE - 1) / FARM_CHUNK_SIZE;
+
+	std::cout << "Farming " << matchCount << " matches on " << threadCount << " threads (" << chunkCount << " chunks of " << FARM_CHUNK_SIZE << ")\n";
+
+	// Hand out contiguous blocks of chunks, stealing evens out whatever imbalance is left
+	std::vector<WorkStealingDeque> deques(threadCount);
+
+	for (uint32_t worker = 0; worker < threadCount; worker++)
+	{
+		uint32_t first = (uint64_t)chunkCount * worker / threadCount;
+		uint32_t last = (uint64_t)chunkCount * (worker + 1) / threadCount;
+
+		deques[worker].Init(std::max(1u, last - first));
+
+		// Pushed in reverse so the owner pops them front to back
+		for (uint32_t chunk = last; chunk > first; chunk--)
+		{
+			deques[worker].Push(chunk - 1);
+		}
+	}
+
+	std::vector<MatchResult> results(matchCount);
+	std::vector<FarmWorkerStats> stats(threadCount);
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount);
+
+	for (uint32_t worker = 0; worker < threadCount; worker++)
+	{
+		threads.emplace_back(RunFarmWorker, worker, std::ref(deques), matchCount, seed, std::ref(results), std::ref(stats[worker]));
+	}
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+
+	uint64_t totalSteps = 0;
+	uint64_t totalRallies = 0;
+	uint64_t totalHits = 0;
+	uint32_t longestRally = 0;
+	uint32_t wins[2] = { 0 };
+
+	// FNV-1a over all results, the same seed has to give the same checksum no matter how many threads ran
+	uint64_t checksum = 0xCBF29CE484222325ull;
+
+	for (const MatchResult& result : results)
+	{
+		const uint8_t* bytes = (const uint8_t*)&result;
+
+		for (size_t i = 0; i < sizeof(MatchResult); i++)
+		{
+			checksum = (checksum ^ bytes[i]) * 0x100000001B3ull;
+		}
+
+		totalSteps += result.StepCount;
+		totalRallies += result.Rallies;
+		totalHits += result.PaddleHits;
+		longestRally = std::max(longestRally, result.LongestRally);
+
+		if (result.Scores[0] != result.Scores[1])
+		{
+			wins[result.Scores[0] > result.Scores[1] ? 0 : 1]++;
+		}
+	}
+
+	std::cout << "\n";
+	std::cout << "Thread  Matches  Steps/sec      Steals  Attempts\n";
+
+	for (uint32_t worker = 0; worker < threadCount; worker++)
+	{
+		const FarmWorkerStats& workerStats = stats[worker];
+
+		printf("%6u  %7llu  %13.4g  %6llu  %8llu\n", worker, (unsigned long long)workerStats.Matches, workerStats.Steps / workerStats.Seconds, (unsigned long long)workerStats.Steals, (unsigned long long)workerStats.StealAttempts);
+	}
+
+	std::cout << "\n";
+	std::cout << "Wins: " << wins[0] << " - " << wins[1] << "\n";
+	std::cout << "Average rally: " << (totalRallies ? (double)totalHits / totalRallies : 0.0) << " hits, longest: " << longestRally << " hits\n";
+	std::cout << "Results checksum: " << std::hex << checksum << std::dec << "\n";
+	std::cout << "Took " << seconds << "s\n";
+	std::cout << "Matches/sec: " << matchCount / seconds << "\n";
+	std::cout << "Steps/sec: " << totalSteps / seconds << "\n";
+}
+
+void RecordingWriter::Open(const fs::path& path)
+{
+	File.open(path, std::ios::binary | std::ios::trunc);
+	ASSERT(File.is_open(), "Failed to create the recording file.");
+
+	// The real header gets written by Close() once the index offset is known
+	RecordingHeader header{};
+	File.write((const char*)&header, sizeof(header));
+
+	FileSize = sizeof(header);
+	Index.clear();
+}
+
+void RecordingWriter::Close()
+{
+	RecordingHeader header{};
+	header.Magic = RECORDING_MAGIC;
+	header.Version = RECORDING_VERSION;
+	header.MatchCount = (uint32_t)Index.size();
+	header.KeyframeInterval = KEYFRAME_INTERVAL;
+	header.IndexOffset = FileSize;
+
+	File.write((const char*)Index.data(), Index.size() * sizeof(MatchRecord));
+	FileSize += Index.size() * sizeof(MatchRecord);
+
+	File.seekp(0);
+	File.write((const char*)&header, sizeof(header));
+
+	File.close();
+	ASSERT(!File.fail(), "Failed to write the recording file.");
+}
+
+void RecordingWriter::BeginMatch(const PongSim& sim)
+{
+	Match = {};
+	Match.Seed = sim.Random.Seed;
+	Match.Stream = sim.Random.Stream;
+	Match.TimeScale = sim.TimeScale;
+
+	Keyframes.clear();
+	Inputs.clear();
+	RunLength = 0;
+}
+
+void RecordingWriter::RecordTick(const PongSim& sim, uint8_t inputs)
+{
+	if (Match.TickCount % KEYFRAME_INTERVAL == 0)
+	{
+		FlushRun();
+
+		Keyframe keyframe;
+		memcpy(keyframe.Positions, sim.Positions.data(), sizeof(keyframe.Positions));
+		keyframe.BallDirection[0] = sim.BallDirection.x;
+		keyframe.BallDirection[1] = sim.BallDirection.y;
+		keyframe.Scores[0] = sim.Scores[0];
+		keyframe.Scores[1] = sim.Scores[1];
+		keyframe.RandomPosition = sim.Random.Position;
+		keyframe.InputOffset = (uint32_t)Inputs.size();
+
+		Keyframes.push_back(keyframe);
+	}
+
+	if (RunLength > 0 && inputs != RunInputs)
+	{
+		FlushRun();
+	}
+
+	RunInputs = inputs;
+	RunLength++;
+
+	Match.TickCount++;
+}
+
+void RecordingWriter::EndMatch(const PongSim& sim)
+{
+	FlushRun();
+
+	Match.Scores[0] = sim.Scores[0];
+	Match.Scores[1] = sim.Scores[1];
+
+	Match.KeyframeCount = (uint32_t)Keyframes.size();
+	Match.KeyframeOffset = FileSize;
+	Match.InputOffset = FileSize + Keyframes.size() * sizeof(Keyframe);
+	Match.InputSize = (uint32_t)Inputs.size();
+
+	// Pad so the next match's keyframes (and the index) stay aligned
+	Inputs.resize((Inputs.size() + 7) & ~(size_t)7, 0);
+
+	File.write((const char*)Keyframes.data(), Keyframes.size() * sizeof(Keyframe));
+	File.write((const char*)Inputs.data(), Inputs.size());
+	FileSize += Keyframes.size() * sizeof(Keyframe) + Inputs.size();
+
+	Index.push_back(Match);
+}
+
+void RecordingWriter::FlushRun()
+{
+	if (RunLength == 0)
+	{
+		return;
+	}
+
+	// Inputs only have 4 bits, so a run of up to 8 ticks fits in one byte
+	WriteVarint(Inputs, (RunLength - 1) << 4 | RunInputs);
+	RunLength = 0;
+}
+
+void WriteVarint(std::vector<uint8_t>& bytes, uint32_t value)
+{
+	// LEB128: 7 bits per byte, high bit set on all but the last byte
+	while (value >= 0x80)
 	{
-		instanceCreateInfo.enabledLayerCount = 0;
+		bytes.push_back((uint8_t)(value | 0x80));
+		value >>= 7;
 	}
 
-	VkInstance instance;
-	VkResult result = vkCreateInstance(&instanceCreateInfo, nullptr, &instance);
+	bytes.push_back((uint8_t)value);
+}
 
-	ASSERT(result == VK_SUCCESS, "Failed to create the vulkan instance.");
+bool ReadVarint(const uint8_t*& cursor, const uint8_t* end, uint32_t& value)
+{
+	value = 0;
 
-	return instance;
+	// 5 bytes is all a uint32_t can take
+	for (int shift = 0; shift < 35 && cursor < end; shift += 7)
+	{
+		uint8_t byte = *cursor++;
+		value |= (uint32_t)(byte & 0x7F) << shift;
+
+		if (!(byte & 0x80))
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
-bool CheckValidationLayerSupport(const std::vector<const char*>& validationLayers)
+MappedFile MapFile(const fs::path& path)
 {
-	uint32_t propertyCount;
-	vkEnumerateInstanceLayerProperties(&propertyCount, nullptr);
+	MappedFile file;
 
-	std::vector<VkLayerProperties> availableLayers(propertyCount);
-	vkEnumerateInstanceLayerProperties(&propertyCount, availableLayers.data());
+	// Missing, empty or unmappable files all come back with no data
+	#ifdef _WIN32
+		HANDLE fileHandle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (fileHandle == INVALID_HANDLE_VALUE)
+		{
+			return file;
+		}
 
-	for (const char* requestedLayerName : validationLayers)
-	{
-		bool layerAvailable = false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(fileHandle, &size) || size.QuadPart == 0)
+		{
+			CloseHandle(fileHandle);
+			return file;
+		}
 
-		for (const VkLayerProperties& properties : availableLayers)
+		// The view keeps the file alive, so both handles can go right away
+		HANDLE mapping = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping)
 		{
-			if (strcmp(properties.layerName, requestedLayerName) == 0)
-			{
-				layerAvailable = true;
-			}
+			file.Data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			file.Size = file.Data ? (size_t)size.QuadPart : 0;
+			CloseHandle(mapping);
 		}
 
-		if (!layerAvailable)
+		CloseHandle(fileHandle);
+	#else
+		int descriptor = open(path.c_str(), O_RDONLY);
+		if (descriptor < 0)
 		{
-			return false;
+			return file;
 		}
-	}
 
-	return true;
+		struct stat status;
+		if (fstat(descriptor, &status) != 0 || status.st_size <= 0)
+		{
+			close(descriptor);
+			return file;
+		}
+
+		void* data = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		close(descriptor);
+
+		if (data == MAP_FAILED)
+		{
+			return file;
+		}
+
+		// Replays read front to back
+		madvise(data, (size_t)status.st_size, MADV_SEQUENTIAL);
+
+		file.Data = (const uint8_t*)data;
+		file.Size = (size_t)status.st_size;
+	#endif
+
+	return file;
 }
 
-VkDebugUtilsMessengerEXT SetupDebugMessenger(VkInstance instance)
+void UnmapFile(MappedFile& file)
 {
-	VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo = GetDebugMessengerInfo();
+	if (!file.Data)
+	{
+		return;
+	}
 
-	VkDebugUtilsMessengerEXT debugMessenger;
-	VkResult result = CreateDebugUtilsMessengerEXT(instance, &debugCreateInfo, nullptr, &debugMessenger);
+	#ifdef _WIN32
+		UnmapViewOfFile(file.Data);
+	#else
+		munmap((void*)file.Data, file.Size);
+	#endif
 
-	ASSERT(result == VK_SUCCESS, "Failed to create the debug messenger");
+	file.Data = nullptr;
+	file.Size = 0;
+}
 
-	return debugMessenger;
+// True when count elements of elementSize bytes starting at offset all lie inside a file of fileSize bytes, without overflowing on garbage values
+static bool FitsInFile(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t fileSize)
+{
+	return offset <= fileSize && count <= (fileSize - offset) / elementSize;
 }
 
-VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger)
+bool RecordingReader::Open(const fs::path& path)
 {
-	auto func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
+	auto fail = [&](const char* reason)
+	{
+		std::cout << "Can't replay " << path << ": " << reason << "\n";
+		Close();
+		return false;
+	};
 
-	if (func == nullptr)
+	File = MapFile(path);
+	if (!File.Data)
 	{
-		return VK_ERROR_EXTENSION_NOT_PRESENT;
+		return fail("failed to open or map the file");
 	}
 
-	return func(instance, pCreateInfo, pAllocator, pDebugMessenger);
-}
+	if (File.Size < sizeof(RecordingHeader))
+	{
+		return fail("the file is too small to be a recording");
+	}
 
-void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT debugMessenger, const VkAllocationCallbacks* pAllocator)
-{
-	auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
+	Header = (const RecordingHeader*)File.Data;
 
-	if (func != nullptr)
+	if (Header->Magic != RECORDING_MAGIC)
 	{
-		func(instance, debugMessenger, pAllocator);
+		return fail("not a recording file");
+	}
+
+	if (Header->Version != RECORDING_VERSION)
+	{
+		return fail("unsupported recording version");
+	}
+
+	if (Header->KeyframeInterval == 0)
+	{
+		return fail("the keyframe interval is 0");
+	}
+
+	if (Header->IndexOffset % alignof(MatchRecord) != 0 || !FitsInFile(Header->IndexOffset, Header->MatchCount, sizeof(MatchRecord), File.Size))
+	{
+		return fail("the match index is truncated or misplaced");
+	}
+
+	Matches = (const MatchRecord*)(File.Data + Header->IndexOffset);
+
+	for (uint32_t i = 0; i < Header->MatchCount; i++)
+	{
+		const MatchRecord& match = Matches[i];
+
+		// Seek relies on there being one keyframe per started interval
+		uint64_t keyframeCount = ((uint64_t)match.TickCount + Header->KeyframeInterval - 1) / Header->KeyframeInterval;
+
+		if (match.KeyframeCount != keyframeCount)
+		{
+			return fail("a match has the wrong number of keyframes");
+		}
+
+		if (match.KeyframeOffset % alignof(Keyframe) != 0 || !FitsInFile(match.KeyframeOffset, match.KeyframeCount, sizeof(Keyframe), File.Size))
+		{
+			return fail("a match's keyframes are truncated or misplaced");
+		}
+
+		if (!FitsInFile(match.InputOffset, match.InputSize, 1, File.Size))
+		{
+			return fail("a match's inputs are truncated");
+		}
 	}
+
+	return true;
 }
 
-VkSurfaceKHR CreateSurface(VkInstance instance, GLFWwindow* window)
+void RecordingReader::Close()
 {
-	VkSurfaceKHR surface;
-	VkResult result = glfwCreateWindowSurface(instance, window, NULL, &surface);
-	
-	return surface;
+	UnmapFile(File);
+
+	Header = nullptr;
+	Matches = nullptr;
 }
 
-VkPhysicalDevice ChoosePhysicalDevice(VkInstance instance, VkSurfaceKHR surface, const std::vector<const char*>& deviceExtensions)
+void MatchReplay::Begin(const RecordingReader& reader, uint32_t match)
 {
-	// Get number of devices first
-	uint32_t physicalDeviceCount;
-	vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, nullptr);
+	ASSERT(match < reader.Header->MatchCount, "There is no such match in the recording.");
 
-	// Then create & fill the buffer
-	std::vector<VkPhysicalDevice> physicalDevices(physicalDeviceCount);
-	vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, physicalDevices.data());
+	Record = &reader.Matches[match];
+	Keyframes = (const Keyframe*)(reader.File.Data + Record->KeyframeOffset);
+	Inputs = reader.File.Data + Record->InputOffset;
+	InputsEnd = Inputs + Record->InputSize;
+	KeyframeInterval = reader.Header->KeyframeInterval;
 
-	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-	QueueFamilyIndices queueFamilyIndices;
+	Sim.TimeScale = Record->TimeScale;
+	Sim.Reset(Record->Seed, Record->Stream);
 
-	for (const VkPhysicalDevice& device : physicalDevices)
+	Cursor = Inputs;
+	RunRemaining = 0;
+	Corrupt = false;
+}
+
+void MatchReplay::Seek(uint32_t tick)
+{
+	ASSERT(tick <= Record->TickCount, "Can't seek past the end of the match.");
+
+	uint32_t keyframeIndex = tick / KeyframeInterval;
+
+	if (keyframeIndex < Record->KeyframeCount)
 	{
-		queueFamilyIndices = GetQueueFamilies(device, surface);
+		const Keyframe& keyframe = Keyframes[keyframeIndex];
+
+		memcpy(Sim.Positions.data(), keyframe.Positions, sizeof(keyframe.Positions));
+		Sim.BallDirection = { keyframe.BallDirection[0], keyframe.BallDirection[1] };
+		Sim.Scores[0] = keyframe.Scores[0];
+		Sim.Scores[1] = keyframe.Scores[1];
+		Sim.Random.Position = keyframe.RandomPosition;
+		Sim.StepCount = (uint64_t)keyframeIndex * KeyframeInterval;
+
+		Corrupt = keyframe.InputOffset > Record->InputSize;
+		Cursor = Corrupt ? InputsEnd : Inputs + keyframe.InputOffset;
+		RunRemaining = 0;
+	}
+	else if (tick > 0)
+	{
+		// Only happens when seeking to the very end of a match that ends right on a keyframe tick
+		Seek(tick - 1);
+	}
+	else
+	{
+		// A match with no ticks has no keyframes either
+		Sim.Reset(Record->Seed, Record->Stream);
+		Cursor = Inputs;
+		RunRemaining = 0;
+	}
 
-		// Check if required extensions, present modes, surface formats... are supported
-		if (queueFamilyIndices.IsComplete() && IsDeviceSuitable(device, surface, deviceExtensions))
+	while (Sim.StepCount < tick && !Corrupt)
+	{
+		Step();
+	}
+}
+
+int MatchReplay::Step()
+{
+	if (RunRemaining == 0)
+	{
+		uint32_t run = 0;
+		if (!ReadVarint(Cursor, InputsEnd, run))
 		{
-			physicalDevice = device;
-			break;
+			Corrupt = true;
 		}
+
+		RunInputs = (uint8_t)(run & 0xF);
+		RunRemaining = (run >> 4) + 1;
 	}
 
-	ASSERT(physicalDevice != VK_NULL_HANDLE, "Couldn't find a suitable GPU.");
+	RunRemaining--;
+	return Sim.Step(RunInputs);
+}
 
-	return physicalDevice;
+bool MatchReplay::IsOver() const
+{
+	return Sim.StepCount >= Record->TickCount || Corrupt;
 }
 
-QueueFamilyIndices GetQueueFamilies(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface)
+bool ReplayRecording(const fs::path& path)
 {
-	// Really good queue (family) explaination lol: https://stackoverflow.com/questions/55272626/what-is-actually-a-queue-family-in-vulkan
+	// Plays every match back at full speed and checks it ends with the recorded score,
+	// then seeks into every match once and checks that lands on the same state as playing up to there
 
-	QueueFamilyIndices indices;
+	RecordingReader reader;
+	if (!reader.Open(path))
+	{
+		return false;
+	}
 
-	uint32_t queueFamilyCount;
-	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	uint32_t matchCount = reader.Header->MatchCount;
+	std::cout << "Replaying " << matchCount << " matches from " << path << " (" << reader.File.Size << " bytes)\n";
 
-	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+	std::vector<uint32_t> seekTicks(matchCount);
+	std::vector<std::array<glm::vec2, 3>> seekPositions(matchCount);
 
-	for (int i = 0; i < queueFamilies.size(); i++)
+	uint32_t seekState = 0x9E3779B9;
+	uint64_t totalTicks = 0;
+	uint32_t mismatches = 0;
+	uint32_t corruptMatches = 0;
+
+	MatchReplay replay;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t i = 0; i < matchCount; i++)
 	{
-		const VkQueueFamilyProperties& queueFamily = queueFamilies[i];
+		replay.Begin(reader, i);
 
-		if (queueFamily.queueCount <= 0)
-		{
-			continue;
-		}
+		seekTicks[i] = reader.Matches[i].TickCount ? NextTestRandom(seekState) % reader.Matches[i].TickCount : 0;
+		seekPositions[i] = replay.Sim.Positions;
 
-		// We need at least of queue family that can do graphic operations (amongst others)
-		if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		while (!replay.IsOver())
 		{
-			indices.GraphicsFamily = i;
-			indices.HasGraphicsFamily = true;
+			replay.Step();
+
+			if (replay.Sim.StepCount == seekTicks[i])
+			{
+				seekPositions[i] = replay.Sim.Positions;
+			}
 		}
 
-		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &presentSupport);
+		totalTicks += replay.Sim.StepCount;
 
-		if (presentSupport)
+		if (replay.Corrupt)
 		{
-			indices.PresentFamily = i;
-			indices.HasPresentFamily = true;
+			corruptMatches++;
+		}
+		else if (replay.Sim.Scores[0] != replay.Record->Scores[0] || replay.Sim.Scores[1] != replay.Record->Scores[1])
+		{
+			mismatches++;
 		}
+	}
 
-		if (indices.IsComplete())
+	auto end = std::chrono::high_resolution_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+
+	uint32_t seekMismatches = 0;
+
+	auto seekStart = std::chrono::high_resolution_clock::now();
+
+	for (uint32_t i = 0; i < matchCount; i++)
+	{
+		replay.Begin(reader, i);
+		replay.Seek(seekTicks[i]);
+
+		if (replay.Corrupt || memcmp(replay.Sim.Positions.data(), seekPositions[i].data(), sizeof(seekPositions[i])) != 0)
 		{
-			break;
+			seekMismatches++;
 		}
 	}
 
-	return indices;
+	auto seekEnd = std::chrono::high_resolution_clock::now();
+	double seekSeconds = std::chrono::duration<double>(seekEnd - seekStart).count();
+
+	std::cout << "Bytes/match: " << (matchCount ? (double)reader.File.Size / matchCount : 0.0) << ", bits/tick: " << (totalTicks ? 8.0 * reader.File.Size / totalTicks : 0.0) << "\n";
+	std::cout << "Replay: " << totalTicks / seconds << " ticks/sec, " << mismatches << " matches ended with a different score\n";
+	std::cout << "Seek: " << (matchCount ? seekSeconds / matchCount * 1e6 : 0.0) << " us/seek, " << seekMismatches << " seeks landed on a different state\n";
+
+	if (corruptMatches > 0)
+	{
+		std::cout << corruptMatches << " matches have input runs that run past their data\n";
+	}
+
+	reader.Close();
+
+	return mismatches == 0 && seekMismatches == 0 && corruptMatches == 0;
 }
 
-bool SupportsRequiredExtensions(const VkPhysicalDevice& device, const std::vector<const char*>& deviceExtensions)
+void BenchmarkDrawSubmission(VkDevice device, GpuAllocator& allocator, VkSwapchainKHR swapChain, VkQueue graphicsQueue, VkQueue presentQueue, const std::vector<VkCommandBuffer>& commandBuffers, FrameScheduler& scheduler, const std::vector<VkFramebuffer>& framebuffers, VkExtent2D swapChainExtent, VkRenderPass renderPass, VkPipeline pipeline, VkPipelineLayout pipelineLayout, VkDescriptorSet textureSet, VkBuffer vertexBuffer, VkBuffer indexBuffer, uint32_t indexCount)
 {
-	uint32_t extensionCount;
-	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+	// Measures what the CPU spends per frame to get N quads drawn: copying the instances, recording and submitting
+	// Recording is the same few commands for any N, only the copy grows with the instance count
 
-	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+	constexpr uint32_t frameCount = 200;
+	const uint32_t instanceCounts[] = { 3, 100, 1000, 10000, 100000 };
+	const uint32_t maxInstanceCount = 100000;
+
+	// The biggest count doesn't fit into FRAME_RING_BUFFER_SIZE, the benchmark is all instances anyway
+	FrameRingBuffer ringBuffer;
+	CreateFrameRingBuffer(allocator, (VkDeviceSize)maxInstanceCount * sizeof(QuadInstance), ringBuffer);
+
+	std::vector<QuadInstance> instances(maxInstanceCount);
+	uint32_t randomState = 0x9E3779B9;
+
+	for (QuadInstance& instance : instances)
+	{
+		float x = NextTestRandom(randomState) / 4294967296.0f;
+		float y = NextTestRandom(randomState) / 4294967296.0f;
+
+		instance.Position = { (x * 2.0f - 1.0f) * ASPECT_RATIO, y * 2.0f - 1.0f };
+		instance.Size = { 0.01f, 0.01f };
+		instance.Color = { x, y, 1.0f, 1.0f };
+	}
+
+	std::cout << "Drawing " << frameCount << " frames per instance count\n";
+	std::cout << "\n";
+	std::cout << "Instances  Upload us  Record us  Submit us  Frame ms  Ring bytes\n";
 
-	for (const VkExtensionProperties& extension : availableExtensions)
+	for (uint32_t instanceCount : instanceCounts)
 	{
-		// TODO: check for all extensions...
-		if (strcmp(extension.extensionName, deviceExtensions[0]) == 0)
+		double uploadSeconds = 0.0;
+		double recordSeconds = 0.0;
+		double submitSeconds = 0.0;
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for (uint32_t frame = 0; frame < frameCount; frame++)
 		{
-			return true;
+			// Same steps as DrawFrame(), with timers in between, don't resize the window while this runs
+			uint32_t currentFrame = scheduler.CurrentSlot();
+
+			uint32_t imageIndex;
+			VkResult acquireResult = AquireNextImage(device, swapChain, scheduler, imageIndex);
+			ASSERT(acquireResult != VK_ERROR_OUT_OF_DATE_KHR, "The window was resized during the benchmark.");
+
+			auto uploadStart = std::chrono::high_resolution_clock::now();
+			ringBuffer.BeginFrame(currentFrame);
+
+			RingAllocation instanceAllocation = ringBuffer.Allocate(instanceCount * sizeof(QuadInstance));
+			uint32_t drawCount = instanceAllocation.Data ? instanceCount : 0;
+
+			if (instanceAllocation.Data)
+			{
+				memcpy(instanceAllocation.Data, instances.data(), instanceCount * sizeof(QuadInstance));
+			}
+
+			auto recordStart = std::chrono::high_resolution_clock::now();
+			RecordCommandBuffer(commandBuffers[currentFrame], framebuffers[imageIndex], swapChainExtent, renderPass, pipeline, pipelineLayout, textureSet, vertexBuffer, indexBuffer, indexCount, instanceAllocation, drawCount);
+
+			auto submitStart = std::chrono::high_resolution_clock::now();
+			SubmitCommandBuffers(swapChain, graphicsQueue, presentQueue, commandBuffers[currentFrame], scheduler, imageIndex);
+
+			auto submitEnd = std::chrono::high_resolution_clock::now();
+
+			uploadSeconds += std::chrono::duration<double>(recordStart - uploadStart).count();
+			recordSeconds += std::chrono::duration<double>(submitStart - recordStart).count();
+			submitSeconds += std::chrono::duration<double>(submitEnd - submitStart).count();
 		}
+
+		vkDeviceWaitIdle(device);
+
+		auto end = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count();
+
+		printf("%9u  %9.2f  %9.2f  %9.2f  %8.3f  %10llu\n", instanceCount, uploadSeconds / frameCount * 1e6, recordSeconds / frameCount * 1e6, submitSeconds / frameCount * 1e6, seconds / frameCount * 1e3, (unsigned long long)ringBuffer.Offset);
 	}
 
-	return false;
+	std::cout << "\n";
+	std::cout << "Frame ring buffer high water mark: " << ringBuffer.HighWaterMark << " of " << ringBuffer.PartitionSize << " bytes\n";
+
+	DestroyFrameRingBuffer(allocator, ringBuffer);
 }
 
-SwapChainSupportDetails QuerySwapChainSupport(const VkPhysicalDevice& device, const VkSurfaceKHR& surface)
+void BenchmarkParallelRecording(VkDevice device, GpuAllocator& allocator, uint32_t queueFamily, const std::vector<VkCommandBuffer>& commandBuffers, VkFramebuffer framebuffer, VkExtent2D swapChainExtent, VkRenderPass renderPass, VkPipeline pipeline, VkPipelineLayout pipelineLayout, VkDescriptorSet textureSet, VkBuffer vertexBuffer, VkBuffer indexBuffer, uint32_t indexCount)
 {
-	SwapChainSupportDetails details{};
+	// Records one draw per quad (what a scene that can't instance would do) on more and more threads
+	// Nothing gets submitted, this only measures the CPU side of recording
 
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.Capabilities);
+	constexpr uint32_t frameCount = 50;
+	const uint32_t instanceCounts[] = { 10000, 50000, 100000 };
+	const uint32_t maxInstanceCount = 100000;
 
-	// VK_FORMAT_R32G32B32A32_SFLOAT and VK_COLOR_SPACE_SRGB_NONLINEAR_KHR for example
-	uint32_t surfaceFormatCount;
-	vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &surfaceFormatCount, nullptr);
+	uint32_t maxThreadCount = std::max(1u, std::thread::hardware_concurrency());
 
-	if (surfaceFormatCount != 0)
+	std::vector<uint32_t> threadCounts;
+
+	for (uint32_t threadCount = 1; threadCount < maxThreadCount; threadCount *= 2)
 	{
-		details.SurfaceFormats.resize(surfaceFormatCount);
-		vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &surfaceFormatCount, details.SurfaceFormats.data());
+		threadCounts.push_back(threadCount);
 	}
 
-	// Mailbox, Fifo, ...
-	uint32_t presentModesCount;
-	vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModesCount, nullptr);
+	threadCounts.push_back(maxThreadCount);
 
-	if (presentModesCount != 0)
+	// The primaries might still be in use by the upload or an earlier frame
+	vkDeviceWaitIdle(device);
+
+	FrameRingBuffer ringBuffer;
+	CreateFrameRingBuffer(allocator, (VkDeviceSize)maxInstanceCount * sizeof(QuadInstance), ringBuffer);
+
+	// The contents don't matter since nothing gets drawn, only the allocation does
+	ringBuffer.BeginFrame(0);
+	RingAllocation instanceAllocation = ringBuffer.Allocate(maxInstanceCount * sizeof(QuadInstance));
+
+	if (!instanceAllocation.Data)
 	{
-		details.PresentModes.resize(presentModesCount);
-		vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModesCount, details.PresentModes.data());
+		std::cout << "The instances don't fit into the ring buffer, nothing to benchmark.\n";
+		DestroyFrameRingBuffer(allocator, ringBuffer);
+		return;
 	}
 
-	return details;
-}
+	std::cout << "Recording " << frameCount << " frames per instance and thread count, one draw per instance\n";
+	std::cout << "\n";
+	std::cout << "Instances  Threads  Record ms  Speedup\n";
 
-bool SupportsAnisotropicSampling(const VkPhysicalDevice& device)
-{
-	VkPhysicalDeviceFeatures features;
-	vkGetPhysicalDeviceFeatures(device, &features);
+	for (uint32_t instanceCount : instanceCounts)
+	{
+		auto inlineStart = std::chrono::high_resolution_clock::now();
 
-	return features.samplerAnisotropy;
-}
+		for (uint32_t frame = 0; frame < frameCount; frame++)
+		{
+			RecordCommandBuffer(commandBuffers[frame % MAX_FRAMES_IN_FLIGHT], framebuffer, swapChainExtent, renderPass, pipeline, pipelineLayout, textureSet, vertexBuffer, indexBuffer, indexCount, instanceAllocation, instanceCount, VK_NULL_HANDLE, 0, nullptr, 0, 1);
+		}
 
-bool IsDeviceSuitable(const VkPhysicalDevice& device, const VkSurfaceKHR& surface, const std::vector<const char*>& deviceExtensions)
-{
-	SwapChainSupportDetails swapChainDetails = QuerySwapChainSupport(device, surface);
-	return SupportsRequiredExtensions(device, deviceExtensions) && swapChainDetails.IsComplete() && SupportsAnisotropicSampling(device);
-}
+		auto inlineEnd = std::chrono::high_resolution_clock::now();
+		double inlineSeconds = std::chrono::duration<double>(inlineEnd - inlineStart).count() / frameCount;
 
-uint32_t FindMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties)
-{
-	VkPhysicalDeviceMemoryProperties memoryProperties{};
-	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+		printf("%9u   inline  %9.3f  %6.2fx\n", instanceCount, inlineSeconds * 1e3, 1.0);
 
-	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
-	{
-		if ((typeFilter) & (1 << i) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		for (uint32_t threadCount : threadCounts)
 		{
-			return i;
+			ParallelRecorder recorder;
+			CreateParallelRecorder(device, queueFamily, threadCount, recorder);
+
+			auto start = std::chrono::high_resolution_clock::now();
+
+			for (uint32_t frame = 0; frame < frameCount; frame++)
+			{
+				uint32_t slot = frame % MAX_FRAMES_IN_FLIGHT;
+				RecordCommandBuffer(commandBuffers[slot], framebuffer, swapChainExtent, renderPass, pipeline, pipelineLayout, textureSet, vertexBuffer, indexBuffer, indexCount, instanceAllocation, instanceCount, VK_NULL_HANDLE, 0, &recorder, slot, 1);
+			}
+
+			auto end = std::chrono::high_resolution_clock::now();
+			double seconds = std::chrono::duration<double>(end - start).count() / frameCount;
+
+			printf("%9u  %7u  %9.3f  %6.2fx\n", instanceCount, threadCount, seconds * 1e3, inlineSeconds / seconds);
+
+			DestroyParallelRecorder(recorder);
 		}
 	}
 
-	ASSERT(false, "Failed to find a supported memory type.");
+	DestroyFrameRingBuffer(allocator, ringBuffer);
 }
 
-VkDevice ChooseLogicalDevice(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, const QueueFamilyIndices& indices, const std::vector<const char*>& deviceExtensions)
+std::string FindShaderCompiler()
 {
-	// Create 2 queues, one present queue and one graphics queue
-	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+	// Only looked up once and without running anything, starting glslc just to see if it's there costs a process per call
+	static const std::string compiler = []()
+	{
+		#ifdef _WIN32
+			const char* name = "glslc.exe";
+			const char separator = ';';
+		#else
+			const char* name = "glslc";
+			const char separator = ':';
+		#endif
 
-	std::set<uint32_t> uniqueQueueFamilies = { indices.GraphicsFamily, indices.PresentFamily };
+		std::vector<fs::path> directories;
 
-	for (uint32_t queueFamilyIndex : uniqueQueueFamilies)
-	{
-		VkDeviceQueueCreateInfo queueCreateInfo{};
-		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		// Same glslc CompileAllShaders.bat uses, or whatever is on the PATH
+		const char* vulkanSdk = getenv("VULKAN_SDK");
 
-		// Create one queue from the family ???
-		queueCreateInfo.queueCount = 1;
-		queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
+		if (vulkanSdk && *vulkanSdk)
+		{
+			directories.push_back(fs::path(vulkanSdk) / "Bin");
+			directories.push_back(fs::path(vulkanSdk) / "bin");
+		}
 
-		static constexpr float queuePriority = 1.0f;
-		queueCreateInfo.pQueuePriorities = &queuePriority;
+		const char* path = getenv("PATH");
+		std::string paths = path ? path : "";
 
-		queueCreateInfos.push_back(queueCreateInfo);
-	}
+		for (size_t begin = 0; begin <= paths.size();)
+		{
+			size_t end = std::min(paths.find(separator, begin), paths.size());
 
-	VkDeviceCreateInfo deviceCreateInfo{};
-	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+			if (end > begin)
+			{
+				directories.push_back(paths.substr(begin, end - begin));
+			}
 
-	// TODO: only set ansitorepoa filtering to true
-	VkPhysicalDeviceFeatures physicalDeviceFeatures;
-	vkGetPhysicalDeviceFeatures(physicalDevice, &physicalDeviceFeatures);
-	deviceCreateInfo.pEnabledFeatures = &physicalDeviceFeatures;
+			begin = end + 1;
+		}
 
-	deviceCreateInfo.queueCreateInfoCount = queueCreateInfos.size();
-	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
+		std::error_code error;
 
-	deviceCreateInfo.enabledExtensionCount = deviceExtensions.size();
-	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+		for (const fs::path& directory : directories)
+		{
+			fs::path candidate = directory / name;
 
-	// Debug layer ???
-	deviceCreateInfo.enabledLayerCount = 0;
-	// deviceCreateInfo.ppEnabledLayerNames = nullptr;
+			if (fs::is_regular_file(candidate, error))
+			{
+				return candidate.string();
+			}
+		}
 
-	VkDevice device;
-	VkResult result = vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device);
+		return std::string();
+	}();
 
-	ASSERT(result == VK_SUCCESS, "Failed to create the logical device.");
-	
-	return device;
+	return compiler;
 }
 
-VkQueue GetQueue(VkDevice device, uint32_t queueFamily, uint32_t queueIndex /* = 0 */)
+bool CompileShaderIfStale(const fs::path& spirvPath)
 {
-	VkQueue queue;
-	vkGetDeviceQueue(device, queueFamily, queueIndex, &queue);
+	// shaders/particles.comp.spv is compiled from shaders/particles.comp
+	fs::path sourcePath = spirvPath;
+	sourcePath.replace_extension();
 
-	return queue;
-}
+	std::error_code error;
 
-VkCommandPool CreateCommandPool(VkDevice device, uint32_t queueFamilyIndex)
-{
-	VkCommandPoolCreateInfo poolCreateInfo{};
-	poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	fs::file_time_type sourceTime = fs::last_write_time(sourcePath, error);
+	bool hasSource = !error;
 
-	// https://registry.khronos.org/vulkan/specs/1.3-extensions/man/html/VkCommandPoolCreateFlagBits.html
-	poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	fs::file_time_type spirvTime = fs::last_write_time(spirvPath, error);
+	bool hasSpirv = !error;
 
-	poolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+	if (hasSource && (!hasSpirv || sourceTime > spirvTime))
+	{
+		std::string compiler = FindShaderCompiler();
+		std::string command = "\"" + compiler + "\" \"" + sourcePath.string() + "\" -o \"" + spirvPath.string() + "\"";
 
-	VkCommandPool commandPool;
-	vkCreateCommandPool(device, &poolCreateInfo, nullptr, &commandPool);
+		if (!compiler.empty() && system(command.c_str()) != 0)
+		{
+			std::cout << "Failed to compile \"" << sourcePath.string() << "\"\n";
+		}
+	}
 
-	return commandPool;
+	return fs::exists(spirvPath, error);
 }
 
-VkSurfaceFormatKHR ChooseSwapChainSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
+void ParticleEmitterQueue::AddImpacts(const ImpactList& impacts)
 {
-	// Choose SRGB if available, else just default to the first format in the vector
+	// Sparks fall back down, a goal blows up, sized for DEFAULT_PARTICLE_COUNT and scaled to the capacity
+	// Position, Area, Direction, Spread, Speed, Color, Life, Size, Buoyancy, First, Count
+	static const ParticleEmitter templates[] = {
+		{ {}, { 0.0f, 0.0f }, {}, 2.5f, 1.2f, { 1.0f, 0.35f, 0.05f, 1.0f }, 0.5f, 0.012f, 1.0f, 0, 4000 },
+		{ {}, { 0.0f, 0.05f }, {}, 2.0f, 1.8f, { 1.0f, 0.85f, 0.4f, 1.0f }, 0.7f, 0.014f, 1.0f, 0, 12000 },
+		{ {}, { 0.02f, 0.1f }, {}, 6.2f, 2.5f, { 1.0f, 0.2f, 0.02f, 1.0f }, 1.6f, 0.02f, 0.6f, 0, 150000 },
+	};
 
-	for (const auto& availableFormat : availableFormats)
+	for (uint32_t i = 0; i < impacts.Count; i++)
 	{
-		if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
-		{
-			return availableFormat;
-		}
-	}
+		const BallImpact& impact = impacts.Impacts[i];
 
-	return availableFormats[0];
+		ParticleEmitter emitter = templates[impact.Kind];
+		emitter.Position = impact.Position;
+		emitter.Direction = impact.Normal;
+		emitter.Count = std::max(1u, (uint32_t)((uint64_t)emitter.Count * Capacity / DEFAULT_PARTICLE_COUNT));
+
+		Emitters.push_back(emitter);
+	}
 }
 
-VkPresentModeKHR ChoosePresentMode(const std::vector<VkPresentModeKHR>& availableModes)
+void ParticleEmitterQueue::AddLava(float deltaTime)
 {
-	// Choose Mailbox if available, else just default to Fifo
+	// Enough embers to keep the buffer full, they rise from all along the bottom of the field
+	LavaCarry += Capacity * deltaTime / LAVA_AVERAGE_LIFE;
 
-	for (const auto& presentMode : availableModes)
+	uint32_t count = (uint32_t)LavaCarry;
+	LavaCarry -= count;
+
+	if (count == 0)
 	{
-		if (presentMode == VK_PRESENT_MODE_MAILBOX_KHR)
-		{
-			return presentMode;
-		}
+		return;
 	}
 
-	return VK_PRESENT_MODE_FIFO_KHR;
+	ParticleEmitter emitter{};
+	emitter.Position = { 0.0f, 1.0f };
+	emitter.Area = { ASPECT_RATIO, 0.02f };
+	emitter.Direction = { 0.0f, -1.0f };
+	emitter.Spread = 0.6f;
+	emitter.Speed = 0.35f;
+	emitter.Color = { 1.0f, 0.45f, 0.05f, 1.0f };
+	emitter.Life = LAVA_AVERAGE_LIFE / 0.75f;
+	emitter.Size = 0.008f;
+	emitter.Buoyancy = -0.15f;
+	emitter.Count = count;
+
+	Emitters.push_back(emitter);
 }
 
-VkExtent2D ChooseExtent(const VkSurfaceCapabilitiesKHR& surfaceCapabilities)
+void ParticleEmitterQueue::AssignSlots()
 {
-	if (surfaceCapabilities.currentExtent.height != UINT32_MAX)
+	if (Emitters.size() > MAX_PARTICLE_EMITTERS)
 	{
-		return surfaceCapabilities.currentExtent;
+		Emitters.resize(MAX_PARTICLE_EMITTERS);
 	}
-	
-#ifndef PLATFORM_WINDOWS
-	ASSERT(false, "Not yet implemented.");
-#endif
 
-	return { WIDTH, HEIGHT };
+	for (ParticleEmitter& emitter : Emitters)
+	{
+		emitter.Count = std::min(emitter.Count, Capacity);
+		emitter.First = Cursor;
+
+		Cursor = (uint32_t)(((uint64_t)Cursor + emitter.Count) % Capacity);
+	}
+
+	FrameCount++;
 }
 
-VkSwapchainKHR CreateSwapChain(VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, VkSurfaceCapabilitiesKHR capabilities, VkExtent2D extent, VkSurfaceFormatKHR surfaceFormat, VkPresentModeKHR presentMode, const QueueFamilyIndices& queueIndices)
+bool CreateParticleSystem(VkDevice device, GpuAllocator& allocator, VkPipelineCache pipelineCache, uint32_t capacity, uint32_t indexCount, const fs::path& shaderPath, ParticleSystem& particles)
 {
-	uint32_t imageCount = capabilities.minImageCount + 1;
-
-	// == 0 -> no limit
-	uint32_t maxImageCount = capabilities.maxImageCount;
-	if (maxImageCount != 0 && imageCount > maxImageCount)
+	// The SPIR-V gets built from the GLSL next to it when it's missing or out of date and there's a glslc around
+	if (!CompileShaderIfStale(shaderPath))
 	{
-		imageCount = maxImageCount;
+		std::cout << "GPU particles unavailable: couldn't find or compile \"" << shaderPath.string() << "\"\n";
+		return false;
 	}
 
-	VkSwapchainCreateInfoKHR createInfo{};
-	createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(allocator.PhysicalDevice, &properties);
 
-	createInfo.imageExtent = extent;
-	createInfo.surface = surface;
-	createInfo.presentMode = presentMode;
+	// One thread per particle, in a single row of workgroups
+	capacity = std::min<uint64_t>(capacity, (uint64_t)properties.limits.maxComputeWorkGroupCount[0] * PARTICLE_WORKGROUP_SIZE);
 
-	createInfo.minImageCount = imageCount;
-	createInfo.imageColorSpace = surfaceFormat.colorSpace;
-	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	particles.Device = device;
+	particles.Capacity = capacity;
+	particles.IndexCount = indexCount;
+	particles.Queue.Capacity = capacity;
 
-	createInfo.imageFormat = surfaceFormat.format;
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-	// Would be 6 for cubemap (I think???)
-	createInfo.imageArrayLayers = 1;
+	bufferInfo.size = (VkDeviceSize)capacity * sizeof(GpuParticle);
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	particles.ParticleBuffer = allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, particles.ParticleMemory);
 
-	uint32_t queueFamilyIndices[2] = { queueIndices.GraphicsFamily, queueIndices.PresentFamily };
+	bufferInfo.size = (VkDeviceSize)capacity * sizeof(QuadInstance);
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	particles.InstanceBuffer = allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, particles.InstanceMemory);
 
-	if (queueIndices.GraphicsFamily == queueIndices.PresentFamily)
-	{
-		createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		createInfo.queueFamilyIndexCount = 0;
-		createInfo.pQueueFamilyIndices = nullptr;
-	}
-	else
+	bufferInfo.size = sizeof(VkDrawIndexedIndirectCommand);
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	particles.DrawBuffer = allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, particles.DrawMemory);
+
+	bufferInfo.size = MAX_PARTICLE_EMITTERS * sizeof(ParticleEmitter);
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	particles.EmitterBuffer = allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, particles.EmitterMemory);
+
+	// Particles, instances, draw and emitters, in that order
+	std::array<VkDescriptorSetLayoutBinding, 4> bindings{};
+
+	for (uint32_t i = 0; i < bindings.size(); i++)
 	{
-		createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-		createInfo.queueFamilyIndexCount = 2;
-		createInfo.pQueueFamilyIndices = queueFamilyIndices;
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 	}
 
-	// Depending on the physical device, Vulkan might apply a rotation/mirror transform
-	createInfo.preTransform = capabilities.currentTransform;
+	VkDescriptorSetLayoutCreateInfo setLayoutInfo{};
+	setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 
-	// No blending
-	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+	setLayoutInfo.bindingCount = bindings.size();
+	setLayoutInfo.pBindings = bindings.data();
 
-	// Side effect: The image might not own all of its pixels, f.e. if the window is obscured by another window
-	createInfo.clipped = VK_TRUE;
+	VkResult result = vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr, &particles.SetLayout);
+	ASSERT(result == VK_SUCCESS, "Failed to create the particle descriptor set layout.");
 
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
+	VkDescriptorPoolSize poolSize{};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = bindings.size();
 
-	VkSwapchainKHR swapChain;
-	VkResult result = vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain);
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 
-	ASSERT(result == VK_SUCCESS, "Failed to create the swap chain.");
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
 
-	return swapChain;
-}
+	result = vkCreateDescriptorPool(device, &poolInfo, nullptr, &particles.DescriptorPool);
+	ASSERT(result == VK_SUCCESS, "Failed to create the particle descriptor pool.");
 
-void GetSwapChainImages(VkDevice device, VkSwapchainKHR swapChain, std::vector<VkImage>& images)
-{
-	// We've only specified a minimum number of swap chain images, the implementation is allowed to create more
+	VkDescriptorSetAllocateInfo setInfo{};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 
-	uint32_t imageCount;
-	vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
+	setInfo.descriptorPool = particles.DescriptorPool;
+	setInfo.descriptorSetCount = 1;
+	setInfo.pSetLayouts = &particles.SetLayout;
 
-	images.resize(imageCount);
-	vkGetSwapchainImagesKHR(device, swapChain, &imageCount, images.data());
-}
+	result = vkAllocateDescriptorSets(device, &setInfo, &particles.DescriptorSet);
+	ASSERT(result == VK_SUCCESS, "Failed to allocate the particle descriptor set.");
 
-void CreateImageViews(VkDevice device, const std::vector<VkImage>& swapChainImages, VkFormat imageFormat, std::vector<VkImageView>& imageViews)
-{
-	uint32_t imageCount = swapChainImages.size();
-	imageViews.resize(imageCount);
+	// The buffers never change, so the set is written once
+	std::array<VkDescriptorBufferInfo, 4> bufferInfos = { {
+		{ particles.ParticleBuffer, 0, VK_WHOLE_SIZE },
+		{ particles.InstanceBuffer, 0, VK_WHOLE_SIZE },
+		{ particles.DrawBuffer, 0, VK_WHOLE_SIZE },
+		{ particles.EmitterBuffer, 0, VK_WHOLE_SIZE },
+	} };
 
-	for (uint32_t i = 0; i < imageCount; i++)
-	{
-		VkImageViewCreateInfo viewInfo{};
-		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	// Bindings 0 to 3 have the same type, so one write covers all of them
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 
-		viewInfo.image = swapChainImages[i];
-		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		viewInfo.format = imageFormat;
+	write.dstSet = particles.DescriptorSet;
+	write.dstBinding = 0;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.descriptorCount = bufferInfos.size();
+	write.pBufferInfo = bufferInfos.data();
 
-		// Which part of the image should be accessed (multiple layers, color or depth, ...)?
-		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		viewInfo.subresourceRange.baseArrayLayer = 0;
-		viewInfo.subresourceRange.layerCount = 1;
-		viewInfo.subresourceRange.baseMipLevel = 0;
-		viewInfo.subresourceRange.levelCount = 1;
+	vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
 
-		VkResult result = vkCreateImageView(device, &viewInfo, nullptr, &imageViews[i]);
-		
-		ASSERT(result == VK_SUCCESS, "Failed to create a swap chain image view.");
-	}
-}
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(ParticlePush);
 
-VkFormat FindSupportedDepthFormat(VkPhysicalDevice physicalDevice)
-{
-	// VK_FORMAT_D32_SFLOAT ... 32 bit for depth
-	// VK_FORMAT_D32_SFLOAT_S8_UINT ... 32 bit for depth, 8 bit for stencil
-	// VK_FORMAT_D24_UNORM_S8_UINT ... 24 bit for depth, 8 bit for stencil
-	VkFormat depthFormats[3] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT };
+	VkPipelineLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 
-	// VK_IMAGE_TILING_LINEAR ... texels are laid out as row-major
-	// VK_IMAGE_TILING_OPTIMAL ... implementation dependent, used most optimal layout
-	VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL;
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &particles.SetLayout;
+	layoutInfo.pushConstantRangeCount = 1;
+	layoutInfo.pPushConstantRanges = &pushConstantRange;
 
-	// Needs to be set so that image can be used as a depth/stencil attachment
-	VkFormatFeatureFlags formatFeatures = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	result = vkCreatePipelineLayout(device, &layoutInfo, nullptr, &particles.PipelineLayout);
+	ASSERT(result == VK_SUCCESS, "Failed to create the particle pipeline layout.");
 
-	for (auto format : depthFormats)
-	{
-		VkFormatProperties formatProperties;
-		vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+	// A driver that rejects the shader shouldn't take the game down, the callers fall back to something else
+	std::string spirv = ReadFile(shaderPath);
 
-		if (formatProperties.optimalTilingFeatures & formatFeatures)
-		{
-			return format;
-		}
+	VkShaderModuleCreateInfo moduleInfo{};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+
+	moduleInfo.codeSize = spirv.size();
+	moduleInfo.pCode = (const uint32_t*)spirv.c_str();
+
+	VkShaderModule module;
+
+	if (vkCreateShaderModule(device, &moduleInfo, nullptr, &module) != VK_SUCCESS)
+	{
+		std::cout << "GPU particles unavailable: the driver rejected \"" << shaderPath.string() << "\"\n";
+		DestroyParticleSystem(allocator, particles);
+		return false;
 	}
 
-	ASSERT(false, "Failed to find an appropiate depth format.");
-}
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
 
-void CreateDepthResources(VkDevice device, VkPhysicalDevice physicalDevice, VkMemoryPropertyFlags properties, VkFormat depthFormat, VkExtent2D swapChainExtent, uint32_t imageCount, std::vector<VkImage>& depthImages, std::vector<VkDeviceMemory>& depthMemory, std::vector<VkImageView>& depthImageViews)
-{
-	depthImages.resize(imageCount);
-	depthMemory.resize(imageCount);
-	depthImageViews.resize(imageCount);
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = module;
+	pipelineInfo.stage.pName = "main";
 
-	for (uint32_t i = 0; i < imageCount; i++)
+	pipelineInfo.layout = particles.PipelineLayout;
+
+	result = vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &particles.Pipeline);
+
+	vkDestroyShaderModule(device, module, nullptr);
+
+	if (result != VK_SUCCESS)
 	{
-		VkImageCreateInfo imageInfo{};
-		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		std::cout << "GPU particles unavailable: couldn't create a compute pipeline from \"" << shaderPath.string() << "\"\n";
+		particles.Pipeline = VK_NULL_HANDLE;
+		DestroyParticleSystem(allocator, particles);
+		return false;
+	}
 
-		imageInfo.imageType = VK_IMAGE_TYPE_2D;
-		imageInfo.format = depthFormat;
-		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-		imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	std::cout << "Simulating " << capacity << " particles in a compute shader\n";
 
-		imageInfo.extent.width = swapChainExtent.width;
-		imageInfo.extent.height = swapChainExtent.height;
-		imageInfo.extent.depth = 1;
+	return true;
+}
 
-		imageInfo.arrayLayers = 1;
-		imageInfo.mipLevels = 1;
+void DestroyParticleSystem(GpuAllocator& allocator, ParticleSystem& particles)
+{
+	vkDestroyPipeline(particles.Device, particles.Pipeline, nullptr);
+	vkDestroyPipelineLayout(particles.Device, particles.PipelineLayout, nullptr);
 
-		VkResult result = vkCreateImage(device, &imageInfo, nullptr, &depthImages[i]);
+	// Freeing the pool frees the set too
+	vkDestroyDescriptorPool(particles.Device, particles.DescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(particles.Device, particles.SetLayout, nullptr);
 
-		ASSERT(result == VK_SUCCESS, "Failed to create a depth image.");
+	allocator.DestroyBuffer(particles.ParticleBuffer, particles.ParticleMemory);
+	allocator.DestroyBuffer(particles.InstanceBuffer, particles.InstanceMemory);
+	allocator.DestroyBuffer(particles.DrawBuffer, particles.DrawMemory);
+	allocator.DestroyBuffer(particles.EmitterBuffer, particles.EmitterMemory);
 
-		VkMemoryRequirements memoryRequirements{};
-		vkGetImageMemoryRequirements(device, depthImages[i], &memoryRequirements);
+	particles = {};
+}
 
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memoryRequirements.size;
-		allocInfo.memoryTypeIndex = FindMemoryType(physicalDevice, memoryRequirements.memoryTypeBits, properties);
+void ParticleSystem::RecordSimulation(VkCommandBuffer commandBuffer)
+{
+	Queue.AssignSlots();
+	uint32_t emitterCount = Queue.Emitters.size();
 
-		result = vkAllocateMemory(device, &allocInfo, nullptr, &depthMemory[i]);
-		ASSERT(result == VK_SUCCESS, "Failed to allocate memory for the image.");
+	if (!Cleared)
+	{
+		// Life 0 everywhere, so every particle starts out dead
+		vkCmdFillBuffer(commandBuffer, ParticleBuffer, 0, VK_WHOLE_SIZE, 0);
+		Cleared = true;
+	}
 
-		result = vkBindImageMemory(device, depthImages[i], depthMemory[i], 0);
-		ASSERT(result == VK_SUCCESS, "Failed to bind the image memory.");
+	// The last frame's dispatch and draw have to be done with the buffers before anything gets overwritten
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
 
-		VkImageViewCreateInfo viewInfo{};
-		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
 
-		viewInfo.image = depthImages[i];
-		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		viewInfo.format = depthFormat;
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-		viewInfo.subresourceRange.baseMipLevel = 0;
-		viewInfo.subresourceRange.levelCount = 1;
-		viewInfo.subresourceRange.baseArrayLayer = 0;
-		viewInfo.subresourceRange.layerCount = 1;
+	// Both go into the command buffer itself, no staging needed for a few hundred bytes
+	VkDrawIndexedIndirectCommand draw{ IndexCount, 0, 0, 0, 0 };
+	vkCmdUpdateBuffer(commandBuffer, DrawBuffer, 0, sizeof(draw), &draw);
 
-		result = vkCreateImageView(device, &viewInfo, nullptr, &depthImageViews[i]);
-		ASSERT(result == VK_SUCCESS, "Failed to create a depth image view.");
+	if (emitterCount > 0)
+	{
+		vkCmdUpdateBuffer(commandBuffer, EmitterBuffer, 0, emitterCount * sizeof(ParticleEmitter), Queue.Emitters.data());
 	}
-}
 
-VkRenderPass CreateRenderPass(VkDevice device, VkPhysicalDevice physicalDevice, VkFormat imageFormat, VkFormat depthFormat)
-{
-	VkAttachmentDescription colorAttachment{};
-	colorAttachment.format = imageFormat;
-	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
 
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-	// VK_IMAGE_LAYOUT_PRESENT_SRC_KHR can only be used for presenting an image to the screen
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	ParticlePush push{};
+	push.Capacity = Capacity;
+	push.EmitterCount = emitterCount;
+	push.DeltaTime = DeltaTime;
+	push.Seed = Queue.FrameCount;
+	push.Gravity = { 0.0f, PARTICLE_GRAVITY };
+	push.Drag = PARTICLE_DRAG;
 
-	VkAttachmentReference colorReference{};
-	colorReference.attachment = 0;
-	colorReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, Pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, PipelineLayout, 0, 1, &DescriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
 
-	VkAttachmentDescription depthAttachment{};
-	depthAttachment.format = depthFormat;
+	vkCmdDispatch(commandBuffer, (Capacity + PARTICLE_WORKGROUP_SIZE - 1) / PARTICLE_WORKGROUP_SIZE, 1, 1);
 
-	// One sample per pixel
-	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
 
-	// Clear depth attachment at beginning of subpass
-	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-	// Contents of the buffer may be discareded after rendering to it
-	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	Queue.Emitters.clear();
+}
 
-	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+void ParticleSystem::RecordDraw(VkCommandBuffer commandBuffer) const
+{
+	// Same quad and pipeline as everything else, only the instances come from the compute shader
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(commandBuffer, 1, 1, &InstanceBuffer, &offset);
 
-	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	vkCmdDrawIndexedIndirect(commandBuffer, DrawBuffer, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+}
 
-	VkAttachmentReference depthReference{};
-	depthReference.attachment = 1;
-	depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+uint32_t HashParticle(uint32_t x)
+{
+	// Same as Hash() in particles.comp, so both sides spawn the same particles
+	x ^= x >> 16;
+	x *= 0x7FEB352D;
+	x ^= x >> 15;
+	x *= 0x846CA68B;
+	x ^= x >> 16;
+
+	return x;
+}
 
-	VkSubpassDescription subpassDescription{};
+float RandomParticleFloat(uint32_t& state)
+{
+	state = HashParticle(state);
+	return (state >> 8) / 16777216.0f;
+}
 
-	// The pipeline bound to VK_PIPELINE_BIND_POINT_GRAPHICS controls the behavior of all drawing commands
-	subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+CpuParticleSystem::CpuParticleSystem()
+{
+	Level = DetectSimdLevel();
+}
 
-	subpassDescription.colorAttachmentCount = 1;
-	subpassDescription.pColorAttachments = &colorReference;
-	subpassDescription.pDepthStencilAttachment = &depthReference;
+void CpuParticleSystem::Init(uint32_t capacity)
+{
+	Capacity = capacity;
+	Queue.Capacity = capacity;
 
-	// Awesome explanation: https://www.reddit.com/r/vulkan/comments/s80reu/comment/hth2uj9/?utm_source=share&utm_medium=web2x&context=3
-	// https://stackoverflow.com/questions/53984863/what-exactly-is-vk-subpass-external
-	VkSubpassDependency subpassDependency{};
+	for (std::vector<float>* field : { &PositionX, &PositionY, &VelocityX, &VelocityY, &Life, &MaxLife, &Size, &Buoyancy, &ColorR, &ColorG, &ColorB })
+	{
+		field->assign(capacity, 0.0f);
+	}
+}
 
-	subpassDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	subpassDependency.dstSubpass = 0;
+void CpuParticleSystem::Step(float deltaTime)
+{
+	Queue.AssignSlots();
 
-	subpassDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-	subpassDependency.srcAccessMask = NULL;
+	for (const ParticleEmitter& emitter : Queue.Emitters)
+	{
+		for (uint32_t i = 0; i < emitter.Count; i++)
+		{
+			uint32_t index = emitter.First + i;
+			Spawn(index < Capacity ? index : index - Capacity, emitter, Queue.FrameCount);
+		}
+	}
 
-	subpassDependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-	subpassDependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	Queue.Emitters.clear();
 
-	std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
+	Integrate(0, Capacity, deltaTime);
+}
 
-	VkRenderPassCreateInfo renderPassInfo{};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+void CpuParticleSystem::Spawn(uint32_t index, const ParticleEmitter& emitter, uint32_t seed)
+{
+	// Same order of random numbers as particles.comp
+	uint32_t state = index ^ HashParticle(seed);
 
-	renderPassInfo.attachmentCount = attachments.size();
-	renderPassInfo.pAttachments = attachments.data();
+	float angle = atan2(emitter.Direction.y, emitter.Direction.x) + (RandomParticleFloat(state) - 0.5f) * emitter.Spread;
+	float speed = emitter.Speed * (0.25f + 0.75f * RandomParticleFloat(state));
 
-	renderPassInfo.dependencyCount = 1;
-	renderPassInfo.pDependencies = &subpassDependency;
+	float offsetX = RandomParticleFloat(state) * 2.0f - 1.0f;
+	float offsetY = RandomParticleFloat(state) * 2.0f - 1.0f;
 
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subpassDescription;
+	PositionX[index] = emitter.Position.x + offsetX * emitter.Area.x;
+	PositionY[index] = emitter.Position.y + offsetY * emitter.Area.y;
+	VelocityX[index] = cos(angle) * speed;
+	VelocityY[index] = sin(angle) * speed;
 
-	VkRenderPass renderPass;
-	VkResult result = vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass);
+	MaxLife[index] = emitter.Life * (0.5f + 0.5f * RandomParticleFloat(state));
+	Life[index] = MaxLife[index];
+	Size[index] = emitter.Size * (0.5f + RandomParticleFloat(state));
+	Buoyancy[index] = emitter.Buoyancy;
 
-	ASSERT(result == VK_SUCCESS, "Failed to create the render pass.");
+	ColorR[index] = emitter.Color.r;
+	ColorG[index] = emitter.Color.g;
+	ColorB[index] = emitter.Color.b;
+}
 
-	return renderPass;
+void CpuParticleSystem::Integrate(uint32_t begin, uint32_t end, float deltaTime)
+{
+	switch (Level)
+	{
+		case SIMD_AVX2: IntegrateParticlesAVX2(*this, begin, end, deltaTime); break;
+		case SIMD_SSE: IntegrateParticlesSSE(*this, begin, end, deltaTime); break;
+		default: IntegrateParticlesScalar(*this, begin, end, deltaTime); break;
+	}
 }
 
-void CreateFramebuffers(VkDevice device, VkRenderPass renderPass, VkExtent2D swapChainExtent, uint32_t imageCount, const std::vector<VkImageView>& colorImageViews, const std::vector<VkImageView>& depthImageViews, std::vector<VkFramebuffer>& framebuffers)
+uint32_t CpuParticleSystem::CountAlive() const
 {
-	framebuffers.resize(imageCount);
+	uint32_t count = 0;
 
-	for (uint32_t i = 0; i < imageCount; i++)
+	for (uint32_t i = 0; i < Capacity; i++)
 	{
-		std::array<VkImageView, 2> attachments = { colorImageViews[i], depthImageViews[i] };
+		count += Life[i] > 0.0f;
+	}
 
-		VkFramebufferCreateInfo framebufferInfo{};
-		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	return count;
+}
 
-		framebufferInfo.attachmentCount = attachments.size();
-		framebufferInfo.pAttachments = attachments.data();
+void CpuParticleSystem::WriteInstances(std::vector<QuadInstance>& instances) const
+{
+	const glm::vec3 cold = { 0.25f, 0.02f, 0.0f };
 
-		framebufferInfo.renderPass = renderPass;
+	for (uint32_t i = 0; i < Capacity; i++)
+	{
+		if (Life[i] <= 0.0f)
+		{
+			continue;
+		}
 
-		framebufferInfo.width = swapChainExtent.width;
-		framebufferInfo.height = swapChainExtent.height;
-		framebufferInfo.layers = 1;
+		float heat = Life[i] / MaxLife[i];
+		glm::vec3 color = glm::mix(cold, glm::vec3(ColorR[i], ColorG[i], ColorB[i]), heat);
 
-		VkResult result = vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffers[i]);
-		ASSERT(result == VK_SUCCESS, "Failed to create a framebuffer.");
+		instances.push_back({ { PositionX[i], PositionY[i] }, glm::vec2(Size[i] * heat), glm::vec4(color, 1.0f) });
 	}
 }
 
-void CreateSyncObjects(VkDevice device, uint32_t imageCount, SyncObjects& syncObjects)
+void IntegrateParticlesScalar(CpuParticleSystem& particles, uint32_t begin, uint32_t end, float deltaTime)
 {
-	syncObjects.ImageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	syncObjects.RenderingFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	syncObjects.InFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-	syncObjects.ImagesInFlight.resize(imageCount, VK_NULL_HANDLE);
+	// Dead particles get moved along as well, that's cheaper than skipping them and Spawn() overwrites all of it anyway
+	const float gravity = PARTICLE_GRAVITY * deltaTime;
+	const float damping = 1.0f / (1.0f + PARTICLE_DRAG * deltaTime);
 
-	VkSemaphoreCreateInfo semaphoreInfo{};
-	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	for (uint32_t i = begin; i < end; i++)
+	{
+		particles.VelocityX[i] = particles.VelocityX[i] * damping;
+		particles.VelocityY[i] = (particles.VelocityY[i] + gravity * particles.Buoyancy[i]) * damping;
 
-	VkFenceCreateInfo fenceInfo{};
-	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		particles.PositionX[i] += particles.VelocityX[i] * deltaTime;
+		particles.PositionY[i] += particles.VelocityY[i] * deltaTime;
 
-	// VK_FENCE_CREATE_SIGNALED_BIT specifies that the fence object is created in the signaled state. Otherwise, it is created in the unsignaled state.
-	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		particles.Life[i] -= deltaTime;
+	}
+}
 
-	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+void IntegrateParticlesSSE(CpuParticleSystem& particles, uint32_t begin, uint32_t end, float deltaTime)
+{
+	const __m128 gravity = _mm_set1_ps(PARTICLE_GRAVITY * deltaTime);
+	const __m128 damping = _mm_set1_ps(1.0f / (1.0f + PARTICLE_DRAG * deltaTime));
+	const __m128 step = _mm_set1_ps(deltaTime);
+
+	uint32_t i = begin;
+
+	for (; i + 4 <= end; i += 4)
 	{
-		VkResult result = (VkResult)(
-			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &syncObjects.ImageAvailableSemaphores[i]) +
-			vkCreateSemaphore(device, &semaphoreInfo, nullptr, &syncObjects.RenderingFinishedSemaphores[i]) +
-			vkCreateFence(device, &fenceInfo, nullptr, &syncObjects.InFlightFences[i])
-		);
+		__m128 velocityX = _mm_mul_ps(_mm_loadu_ps(&particles.VelocityX[i]), damping);
+		__m128 velocityY = _mm_add_ps(_mm_loadu_ps(&particles.VelocityY[i]), _mm_mul_ps(gravity, _mm_loadu_ps(&particles.Buoyancy[i])));
+		velocityY = _mm_mul_ps(velocityY, damping);
 
-		ASSERT(result == VK_SUCCESS, "Failed to create the synchronization objects.");
+		_mm_storeu_ps(&particles.VelocityX[i], velocityX);
+		_mm_storeu_ps(&particles.VelocityY[i], velocityY);
+
+		_mm_storeu_ps(&particles.PositionX[i], _mm_add_ps(_mm_loadu_ps(&particles.PositionX[i]), _mm_mul_ps(velocityX, step)));
+		_mm_storeu_ps(&particles.PositionY[i], _mm_add_ps(_mm_loadu_ps(&particles.PositionY[i]), _mm_mul_ps(velocityY, step)));
+
+		_mm_storeu_ps(&particles.Life[i], _mm_sub_ps(_mm_loadu_ps(&particles.Life[i]), step));
 	}
+
+	IntegrateParticlesScalar(particles, i, end, deltaTime);
 }
 
-VkPipelineLayout CreatePipelineLayout(VkDevice device)
+TARGET_AVX2 void IntegrateParticlesAVX2(CpuParticleSystem& particles, uint32_t begin, uint32_t end, float deltaTime)
 {
-	VkPushConstantRange pushConstantRange{};
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-	pushConstantRange.offset = 0;
-	pushConstantRange.size = sizeof(ShaderMatrices);
+	const __m256 gravity = _mm256_set1_ps(PARTICLE_GRAVITY * deltaTime);
+	const __m256 damping = _mm256_set1_ps(1.0f / (1.0f + PARTICLE_DRAG * deltaTime));
+	const __m256 step = _mm256_set1_ps(deltaTime);
 
-	VkPipelineLayoutCreateInfo layoutInfo{};
-	layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	uint32_t i = begin;
 
-	layoutInfo.setLayoutCount = 0;
-	layoutInfo.pSetLayouts = nullptr;
-	layoutInfo.pushConstantRangeCount = 1;
-	layoutInfo.pPushConstantRanges = &pushConstantRange;
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 velocityX = _mm256_mul_ps(_mm256_loadu_ps(&particles.VelocityX[i]), damping);
+		__m256 velocityY = _mm256_add_ps(_mm256_loadu_ps(&particles.VelocityY[i]), _mm256_mul_ps(gravity, _mm256_loadu_ps(&particles.Buoyancy[i])));
+		velocityY = _mm256_mul_ps(velocityY, damping);
 
-	VkPipelineLayout pipelineLayout;
-	VkResult result = vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout);
+		_mm256_storeu_ps(&particles.VelocityX[i], velocityX);
+		_mm256_storeu_ps(&particles.VelocityY[i], velocityY);
 
-	ASSERT(result == VK_SUCCESS, "Failed to create the pipeline layout.");
+		_mm256_storeu_ps(&particles.PositionX[i], _mm256_add_ps(_mm256_loadu_ps(&particles.PositionX[i]), _mm256_mul_ps(velocityX, step)));
+		_mm256_storeu_ps(&particles.PositionY[i], _mm256_add_ps(_mm256_loadu_ps(&particles.PositionY[i]), _mm256_mul_ps(velocityY, step)));
 
-	return pipelineLayout;
+		_mm256_storeu_ps(&particles.Life[i], _mm256_sub_ps(_mm256_loadu_ps(&particles.Life[i]), step));
+	}
+
+	IntegrateParticlesScalar(particles, i, end, deltaTime);
 }
 
-VkPipeline CreatePipeline(VkDevice device, VkRenderPass renderPass, VkPipelineLayout pipelineLayout, const fs::path& vertexShaderPath, const fs::path& fragmentShaderPath)
+bool BenchmarkParticles(uint32_t capacity)
 {
-	// The render pass would usually be member of the custom swap chain class
-	// ASSERT(swapChain != VK_NULL_HANDLE, "You need a valid swap chain before creating a pipeline.");
+	// The same emitters on the GPU and with every CPU kernel: lava all the time and a goal every second
+	// No window needed, so this runs with a software ICD like lavapipe too
 
-	ASSERT(renderPass != VK_NULL_HANDLE, "You need a valid render pass before creating a pipeline.");
-	ASSERT(pipelineLayout != VK_NULL_HANDLE, "You need a valid pipeline layout when creating a pipeline.");
+	constexpr uint32_t frameCount = 300;
+	constexpr float deltaTime = 1.0f / 60.0f;
 
-	PipelineConfig config{};
-	config.UseDefaults();
+	ImpactList goal;
+	goal.Add({ BALL_LIMIT_X, 0.0f }, { -1.0f, 0.0f }, IMPACT_GOAL);
 
-	config.RenderPass = renderPass;
-	config.PipelineLayout = pipelineLayout;
+	auto queueFrame = [&](ParticleEmitterQueue& queue, uint32_t frame)
+	{
+		if (frame % 60 == 59)
+		{
+			queue.AddImpacts(goal);
+		}
 
-	std::string vertexSource = ReadFile(vertexShaderPath);
-	std::string fragmentSource = ReadFile(fragmentShaderPath);
+		queue.AddLava(deltaTime);
+	};
 
-	VkShaderModule vertexModule = CreateShaderModule(device, vertexSource);
-	VkShaderModule fragmentModule = CreateShaderModule(device, fragmentSource);
+	std::vector<const char*> validationLayers;
+	VkInstance instance = CreateInstance(false, validationLayers, false);
 
-	VkPipelineShaderStageCreateInfo shaderStageInfos[2]{};
+	std::vector<const char*> deviceExtensions;
+	VkPhysicalDevice physicalDevice = ChoosePhysicalDevice(instance, VK_NULL_HANDLE, deviceExtensions);
 
-	for (int i = 0; i < 2; i++)
+	VkPhysicalDeviceProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+	std::cout << "Using GPU: " << physicalDeviceProperties.deviceName << "\n";
+
+	// Same check as the profiler, some graphics queues can't write timestamps
+	bool timestamps = physicalDeviceProperties.limits.timestampComputeAndGraphics;
+
+	if (!timestamps)
 	{
-		shaderStageInfos[i].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		shaderStageInfos[i].pName = "main";
+		std::cout << "Timestamps aren't supported on the graphics queue, timing the GPU from the CPU (submit and wait included)\n";
 	}
 
-	shaderStageInfos[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-	shaderStageInfos[0].module = vertexModule;
+	QueueFamilyIndices queueIndices = GetQueueFamilies(physicalDevice, VK_NULL_HANDLE);
 
-	shaderStageInfos[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	shaderStageInfos[1].module = fragmentModule;
+	VkDevice device = ChooseLogicalDevice(physicalDevice, VK_NULL_HANDLE, queueIndices, deviceExtensions);
+	VkQueue graphicsQueue = GetQueue(device, queueIndices.GraphicsFamily);
 
-	std::vector<VkVertexInputBindingDescription> bindingDescriptions = Vertex::GetBindingDescriptions();
-	std::vector<VkVertexInputAttributeDescription> attributeDescriptions = Vertex::GetAttributeDescriptions();
+	GpuAllocator allocator;
+	CreateGpuAllocator(device, physicalDevice, allocator);
 
-	VkPipelineVertexInputStateCreateInfo vertexStateInfo{};
-	vertexStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	VkCommandPool commandPool = CreateCommandPool(device, queueIndices.GraphicsFamily);
 
-	vertexStateInfo.vertexBindingDescriptionCount = bindingDescriptions.size();
-	vertexStateInfo.pVertexBindingDescriptions = bindingDescriptions.data();
+	std::cout << "Simulating " << frameCount << " frames of up to " << capacity << " particles\n";
+	std::cout << "\n";
+	std::cout << "Simulation  Step ms  Alive\n";
 
-	vertexStateInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
-	vertexStateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+	ParticleSystem particles;
+	bool gpuParticles = CreateParticleSystem(device, allocator, VK_NULL_HANDLE, capacity, 6, "shaders/particles.comp.spv", particles);
 
-	VkGraphicsPipelineCreateInfo pipelineInfo{};
-	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	if (gpuParticles)
+	{
+		std::vector<VkCommandBuffer> commandBuffers;
+		CreateCommandBuffers(device, commandPool, 1, commandBuffers);
 
-	pipelineInfo.stageCount = 2;
-	pipelineInfo.pStages = shaderStageInfos;
-	pipelineInfo.pVertexInputState = &vertexStateInfo;
+		VkFenceCreateInfo fenceInfo{};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 
-	pipelineInfo.pViewportState = &config.ViewportInfo;
-	pipelineInfo.pInputAssemblyState = &config.InputAssemblyInfo;
-	pipelineInfo.pRasterizationState = &config.RasterizationInfo;
-	pipelineInfo.pMultisampleState = &config.MultisampleInfo;
-	pipelineInfo.pColorBlendState = &config.ColorBlendInfo;
-	pipelineInfo.pDepthStencilState = &config.DepthStencilInfo;
-	pipelineInfo.pDynamicState = &config.DynamicStateInfo;
+		VkFence fence;
+		VkResult result = vkCreateFence(device, &fenceInfo, nullptr, &fence);
+		ASSERT(result == VK_SUCCESS, "Failed to create a fence.");
 
-	// These don't have default values!
-	pipelineInfo.layout = config.PipelineLayout;
-	pipelineInfo.renderPass = config.RenderPass;
-	pipelineInfo.subpass = config.Subpass;
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
 
-	// Optional performance optimizations
-	pipelineInfo.basePipelineIndex = -1;
-	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = 2;
 
-	VkPipeline pipeline;
-	VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
+		VkQueryPool queryPool;
+		result = vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool);
+		ASSERT(result == VK_SUCCESS, "Failed to create the timestamp query pool.");
 
-	ASSERT(result == VK_SUCCESS, "Failed to create the pipeline.");
+		// Only to print how many are alive at the end, the game never reads this
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 
-	return pipeline;
-}
+		bufferInfo.size = sizeof(VkDrawIndexedIndirectCommand);
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-void PipelineConfig::UseDefaults()
-{
-	{
-		ViewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		GpuAllocation readbackMemory;
+		VkBuffer readbackBuffer = allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackMemory);
 
-		ViewportInfo.viewportCount = 1;
-		ViewportInfo.pViewports = nullptr;
+		double gpuSeconds = 0.0;
 
-		ViewportInfo.scissorCount = 1;
-		ViewportInfo.pScissors = nullptr;
-	}
+		for (uint32_t frame = 0; frame < frameCount; frame++)
+		{
+			queueFrame(particles.Queue, frame);
+			particles.DeltaTime = deltaTime;
 
-	{
-		InputAssemblyInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+			VkCommandBufferBeginInfo beginInfo{};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-		// Vertices: a, b, c, d, e, f
-		// Triangle list: triangles (a, b), (b, c), (e, f)
-		// Triangle strip: triangles (a, b), (b, c), (c, d), (d, e), (e, f)
-		// Could alse be point/list/...
-		InputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+			vkBeginCommandBuffer(commandBuffers[0], &beginInfo);
 
-		InputAssemblyInfo.primitiveRestartEnable = VK_FALSE;
-	}
+			if (timestamps)
+			{
+				vkCmdResetQueryPool(commandBuffers[0], queryPool, 0, 2);
+				vkCmdWriteTimestamp(commandBuffers[0], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+			}
 
-	{
-		RasterizationInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+			particles.RecordSimulation(commandBuffers[0]);
 
-		// If enabled: clamp(gl_Position.z, 0.0, 1.0)
-		// Doesn't make sense for most applications because if the z value is < 0, it's behind the camera
-		// > 1: Vertex is outside of the view frustum
-		RasterizationInfo.depthClampEnable = VK_FALSE;
+			if (timestamps)
+			{
+				vkCmdWriteTimestamp(commandBuffers[0], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+			}
 
-		// Discard all fragments immediately
-		RasterizationInfo.rasterizerDiscardEnable = VK_FALSE;
+			VkMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
-		RasterizationInfo.polygonMode = VK_POLYGON_MODE_FILL;
-		RasterizationInfo.lineWidth = 1.0f;
-		RasterizationInfo.cullMode = VK_CULL_MODE_NONE;
-		RasterizationInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+			vkCmdPipelineBarrier(commandBuffers[0], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-		// The depth values of all fragments are generated by the rasterization of a polygon
-		// Can be offset by a single value that is computed for that polygon
-		RasterizationInfo.depthBiasEnable = VK_FALSE;
-		RasterizationInfo.depthBiasConstantFactor = 0.0f;
-		RasterizationInfo.depthBiasClamp = 0.0f;
-		RasterizationInfo.depthBiasSlopeFactor = 0.0f;
-	}
+			VkBufferCopy copy{ 0, 0, sizeof(VkDrawIndexedIndirectCommand) };
+			vkCmdCopyBuffer(commandBuffers[0], particles.DrawBuffer, readbackBuffer, 1, &copy);
 
-	{
-		// Multisampling is used to prevent aliasing
-		// No multisampling: if fragments's center is contained in triangle: fragment is "fully" in triangle
-		// Results in jagged lines
-		// Multisampling: Multiple samples (VK_SAMPLE_COUNT_4_BIT or 8_BIT etc.); determines how much of a pixel
-		// contained in the triangle
-		// MSAA ... Multisample Anti Aliasing
-		MultisampleInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-		MultisampleInfo.sampleShadingEnable = VK_FALSE;
-		MultisampleInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-		MultisampleInfo.minSampleShading = 1.0f;
-		MultisampleInfo.pSampleMask = nullptr;
-		MultisampleInfo.alphaToCoverageEnable = VK_FALSE;
-		MultisampleInfo.alphaToOneEnable = VK_FALSE;
-	}
+			result = vkEndCommandBuffer(commandBuffers[0]);
+			ASSERT(result == VK_SUCCESS, "Failed to record the particle benchmark.");
 
-	{
-		ColorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-		ColorBlendAttachment.blendEnable = VK_FALSE;
+			VkSubmitInfo submitInfo{};
+			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = commandBuffers.data();
+
+			auto submitStart = std::chrono::high_resolution_clock::now();
+
+			result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence);
+			ASSERT(result == VK_SUCCESS, "Failed to submit the particle benchmark.");
+
+			vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+			vkResetFences(device, 1, &fence);
+
+			std::array<uint64_t, 2> gpuTimes;
+
+			if (!timestamps)
+			{
+				gpuSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - submitStart).count();
+			}
+			else if (vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(gpuTimes), gpuTimes.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+			{
+				gpuSeconds += (gpuTimes[1] - gpuTimes[0]) * physicalDeviceProperties.limits.timestampPeriod / 1e9;
+			}
+		}
+
+		const VkDrawIndexedIndirectCommand* draw = (const VkDrawIndexedIndirectCommand*)readbackMemory.Mapped;
+		printf("%-10s  %7.3f  %u\n", "GPU", gpuSeconds / frameCount * 1e3, draw->instanceCount);
 
-		ColorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-		ColorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-		ColorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+		allocator.DestroyBuffer(readbackBuffer, readbackMemory);
 
-		ColorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-		ColorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-		ColorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+		vkDestroyQueryPool(device, queryPool, nullptr);
+		vkDestroyFence(device, fence, nullptr);
+
+		DestroyParticleSystem(allocator, particles);
+	}
+	else
+	{
+		printf("%-10s  %7s  %s\n", "GPU", "-", "unavailable, see above");
 	}
 
+	// Includes writing the instances out, that's part of what the compute shader does too
+	std::vector<QuadInstance> instances;
+
+	for (int level = SIMD_SCALAR; level <= DetectSimdLevel(); level++)
 	{
-		ColorBlendInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		CpuParticleSystem cpuParticles;
+		cpuParticles.Level = (SimdLevel)level;
+		cpuParticles.Init(capacity);
 
-		// Logical op: &, |, ^, ...
-		// Copy(a, b) = a
-		// Is performed on all color values before writing them into the framebuffer
-		// Only for signed-, unsigned- and normalized integer framebuffers
-		// Not for floating point or SRGB framebuffers
-		ColorBlendInfo.logicOpEnable = VK_FALSE;
-		ColorBlendInfo.logicOp = VK_LOGIC_OP_COPY;
+		auto start = std::chrono::high_resolution_clock::now();
 
-		ColorBlendInfo.attachmentCount = 1;
-		ColorBlendInfo.pAttachments = &ColorBlendAttachment;
-		ColorBlendInfo.blendConstants[0] = 0.0f;
-		ColorBlendInfo.blendConstants[1] = 0.0f;
-		ColorBlendInfo.blendConstants[2] = 0.0f;
-		ColorBlendInfo.blendConstants[3] = 0.0f;
-	}
+		for (uint32_t frame = 0; frame < frameCount; frame++)
+		{
+			queueFrame(cpuParticles.Queue, frame);
 
-	{
-		DepthStencilInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-		DepthStencilInfo.depthTestEnable = VK_TRUE;
-		DepthStencilInfo.depthWriteEnable = VK_TRUE;
-		DepthStencilInfo.depthCompareOp = VK_COMPARE_OP_LESS;
+			cpuParticles.Step(deltaTime);
 
-		// Depth Bounds Test: discard fragments if their depth isn't in the specified range			
-		DepthStencilInfo.depthBoundsTestEnable = VK_FALSE;
-		DepthStencilInfo.minDepthBounds = 0.0f;
-		DepthStencilInfo.maxDepthBounds = 1.0f;
+			instances.clear();
+			cpuParticles.WriteInstances(instances);
+		}
 
-		DepthStencilInfo.stencilTestEnable = VK_FALSE;
-		DepthStencilInfo.front = {};
-		DepthStencilInfo.back = {};
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		std::string name = std::string("CPU ") + GetSimdLevelName((SimdLevel)level);
+		printf("%-10s  %7.3f  %u\n", name.c_str(), seconds / frameCount * 1e3, cpuParticles.CountAlive());
 	}
 
-	{
-		DynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	vkDestroyCommandPool(device, commandPool, nullptr);
 
-		DynamicStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-		DynamicStateInfo.pDynamicStates = DynamicStateEnables.data();
-		DynamicStateInfo.dynamicStateCount = DynamicStateEnables.size();
-		DynamicStateInfo.flags = NULL;
-	}
+	DestroyGpuAllocator(allocator);
+
+	vkDestroyDevice(device, nullptr);
+	vkDestroyInstance(instance, nullptr);
+
+	return gpuParticles;
 }
 
-std::string ReadFile(const fs::path& filePath)
+void RenderOffscreen(uint32_t frameCount, const fs::path& outputPath, uint64_t seed, float timeScale, bool depth, uint32_t particleCount)
 {
-	// ate ... put cursor at the end
-	std::ifstream file(filePath, std::ios::ate | std::ios::binary);
-
-	ASSERT(file.is_open(), "Failed to open file \"" + filePath.string() + "\"");
+	// Same setup as the window minus GLFW, the surface and the swap chain, so it runs on CI or with a software ICD like lavapipe
+	std::vector<const char*> validationLayers;
+	VkInstance instance = CreateInstance(false, validationLayers, false);
 
-	size_t size = (size_t)file.tellg();
+	std::vector<const char*> deviceExtensions;
+	VkPhysicalDevice physicalDevice = ChoosePhysicalDevice(instance, VK_NULL_HANDLE, deviceExtensions);
 
-	std::string content(size, ' ');
-	file.seekg(0);
-	file.read(&content[0], size);
+	VkPhysicalDeviceProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
 
-	return content;
-}
+	std::cout << "Using GPU: " << physicalDeviceProperties.deviceName << "\n";
 
-VkShaderModule CreateShaderModule(VkDevice device, const std::string& shaderSource)
-{
-	VkShaderModuleCreateInfo moduleInfo{};
-	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	QueueFamilyIndices queueIndices = GetQueueFamilies(physicalDevice, VK_NULL_HANDLE);
 
-	moduleInfo.codeSize = shaderSource.size();
-	moduleInfo.pCode = (const uint32_t*)shaderSource.c_str();
+	VkDevice device = ChooseLogicalDevice(physicalDevice, VK_NULL_HANDLE, queueIndices, deviceExtensions);
+	VkQueue graphicsQueue = GetQueue(device, queueIndices.GraphicsFamily);
 
-	VkShaderModule module;
-	VkResult result = vkCreateShaderModule(device, &moduleInfo, nullptr, &module);
+	GpuAllocator allocator;
+	CreateGpuAllocator(device, physicalDevice, allocator);
 
-	ASSERT(result == VK_SUCCESS, "Failed to create a shader module.");
+	VkCommandPool commandPool = CreateCommandPool(device, queueIndices.GraphicsFamily);
 
-	return module;
-}
+	VkExtent2D extent = { WIDTH, HEIGHT };
 
-VkBuffer CreateVertexBuffers(VkDevice device, VkPhysicalDevice physicalDevice, const std::vector<Vertex>& vertices, VkDeviceMemory& deviceMemory)
-{
-	uint32_t vertexCount = vertices.size();
-	ASSERT(vertexCount >= 3, "There must be more than 3 vertices.");
+	// RGBA in memory, and sRGB like the swap chain so the pictures look the same as the window
+	VkFormat colorFormat = VK_FORMAT_R8G8B8A8_SRGB;
+	VkFormat depthFormat = depth ? FindSupportedDepthFormat(physicalDevice) : VK_FORMAT_UNDEFINED;
 
-	VkDeviceSize bufferSize = vertexCount * sizeof(Vertex);
+	// One target per frame in flight so the CPU can record the next frame while the last one is read back
+	std::vector<VkImage> colorImages(MAX_FRAMES_IN_FLIGHT);
+	std::vector<GpuAllocation> colorMemory(MAX_FRAMES_IN_FLIGHT);
 
-	VkBufferCreateInfo bufferInfo{};
-	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	std::vector<VkBuffer> readbackBuffers(MAX_FRAMES_IN_FLIGHT);
+	std::vector<GpuAllocation> readbackMemory(MAX_FRAMES_IN_FLIGHT);
 
-	bufferInfo.size = bufferSize;
-	bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 
-	VkBuffer vertexBuffer;
-	VkResult result = vkCreateBuffer(device, &bufferInfo, nullptr, &vertexBuffer);
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = colorFormat;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-	ASSERT(result == VK_SUCCESS, "Failed to create a vertex buffer.");
+		imageInfo.extent.width = extent.width;
+		imageInfo.extent.height = extent.height;
+		imageInfo.extent.depth = 1;
 
-	VkMemoryRequirements memoryRequirements;
-	vkGetBufferMemoryRequirements(device, vertexBuffer, &memoryRequirements);
+		imageInfo.arrayLayers = 1;
+		imageInfo.mipLevels = 1;
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		colorImages[i] = allocator.CreateImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorMemory[i]);
 
-	allocInfo.allocationSize = memoryRequirements.size;
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 
-	// HOST_VISIBLE_BIT: allocated memory is accessible from host
-	// HOST_COHERENT_BIT: once the host memory is changed, it automatically will be flushed to update the device memory
-	// without this option, this would have to be done manually vkFlushMappedMemoryRanges
-	allocInfo.memoryTypeIndex = FindMemoryType(physicalDevice, memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		bufferInfo.size = (VkDeviceSize)extent.width * extent.height * 4;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-	result = vkAllocateMemory(device, &allocInfo, nullptr, &deviceMemory);
+		readbackBuffers[i] = allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackMemory[i]);
+	}
 
-	ASSERT(result == VK_SUCCESS, "Failed to allocate vertex buffer memory.");
+	std::vector<VkImageView> colorImageViews;
+	CreateImageViews(device, colorImages, colorFormat, colorImageViews);
 
-	vkBindBufferMemory(device, vertexBuffer, deviceMemory, 0);
+	std::vector<VkImage> depthImages;
+	std::vector<GpuAllocation> depthMemory;
+	std::vector<VkImageView> depthImageViews;
 
-	void* data;
-	vkMapMemory(device, deviceMemory, 0, bufferSize, NULL, &data);
-	memcpy(data, vertices.data(), bufferSize);
-	vkUnmapMemory(device, deviceMemory);
+	if (depth)
+	{
+		CreateDepthResources(device, allocator, ChooseTransientMemoryProperties(allocator), depthFormat, extent, 1, depthImages, depthMemory, depthImageViews);
+	}
 
-	return vertexBuffer;
-}
+	PrintAttachmentReport(physicalDevice, allocator, extent, MAX_FRAMES_IN_FLIGHT, depthFormat);
 
-void CreateCommandBuffers(VkDevice device, VkCommandPool commandPool, uint32_t imageCount, std::vector<VkCommandBuffer>& commandBuffers)
-{
-	commandBuffers.resize(imageCount);
+	// Only for the render pass timestamps
+	FrameProfiler profiler;
+	CreateFrameProfiler(device, physicalDevice, profiler);
 
-	VkCommandBufferAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	// Left as a color attachment, RecordReadback() moves it over to the copy
+	VkRenderPass renderPass = CreateRenderPass(device, physicalDevice, colorFormat, depthFormat, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 
-	allocInfo.commandBufferCount = commandBuffers.size();
+	std::vector<VkFramebuffer> framebuffers;
+	CreateFramebuffers(device, renderPass, extent, MAX_FRAMES_IN_FLIGHT, colorImageViews, depthImageViews, framebuffers);
 
-	// All of the command buffers will be created in the command pool
-	// This avoids having to search for new, free memory when allocating a new command buffer
-	allocInfo.commandPool = commandPool;
+	CompileShaderIfStale("shaders/pong.vert.spv");
+	CompileShaderIfStale("shaders/pong.frag.spv");
 
-	// Primary command buffers: can be queued for execution, but can't be called by other command buffers
-	// Secondary command buffers: can be called by other command buffers, but be can't queued for execution
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	VkDescriptorSetLayout textureSetLayout = CreateTextureSetLayout(device);
+	VkPipelineLayout pipelineLayout = CreatePipelineLayout(device, textureSetLayout);
+	VkPipeline pipeline = CreatePipeline(device, VK_NULL_HANDLE, renderPass, pipelineLayout, "shaders/pong.vert.spv", "shaders/pong.frag.spv");
 
-	VkResult result = vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data());
+	static std::vector<Vertex> vertices = {
+		{ { -0.5f,  0.5f }, { 1.0f, 1.0f, 1.0f } },
+		{ {  0.5f,  0.5f }, { 1.0f, 1.0f, 1.0f } },
+		{ {  0.5f, -0.5f }, { 1.0f, 1.0f, 1.0f } },
+		{ { -0.5f, -0.5f }, { 1.0f, 1.0f, 1.0f } },
+	};
 
-	ASSERT(result == VK_SUCCESS, "Failed to allocate the command buffers.");
-}
+	static std::vector<uint16_t> indices = { 0, 1, 2, 2, 3, 0 };
 
-void RecordCommandBuffer(const std::array<glm::mat4, 3> transforms, VkCommandBuffer commandBuffer, VkFramebuffer framebuffer, VkExtent2D swapChainExtent, VkRenderPass renderPass, VkPipeline pipeline, VkPipelineLayout layout, VkBuffer vertexBuffer, uint32_t vertexCount)
-{
-	VkCommandBufferBeginInfo beginInfo{};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	StagingUploader uploader;
+	CreateStagingUploader(device, allocator, queueIndices, uploader);
 
-	VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
-	ASSERT(result == VK_SUCCESS, "Failed to start recording a command buffer.");
+	GpuAllocation vertexBufferMemory;
+	VkBuffer vertexBuffer = CreateVertexBuffers(uploader, vertices, vertexBufferMemory);
 
-	std::array<VkClearValue, 2> clearValues = { {
-		{ 0.01, 0.01f, 0.01f, 1.0f },
-		{ 1.0f, 0 }
-	} };
+	GpuAllocation indexBufferMemory;
+	VkBuffer indexBuffer = CreateIndexBuffer(uploader, indices, indexBufferMemory);
 
-	VkRenderPassBeginInfo renderPassInfo{};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	SpriteAtlas atlas;
+	CreateSpriteAtlas(device, uploader, textureSetLayout, atlas);
 
-	renderPassInfo.framebuffer = framebuffer;
-	renderPassInfo.renderPass = renderPass;
+	uint64_t uploadValue = uploader.Submit();
 
-	renderPassInfo.renderArea.offset = { 0, 0 };
-	renderPassInfo.renderArea.extent = swapChainExtent;
+	FrameRingBuffer ringBuffer;
+	CreateFrameRingBuffer(allocator, FRAME_RING_BUFFER_SIZE, ringBuffer);
 
-	renderPassInfo.clearValueCount = clearValues.size();
-	renderPassInfo.pClearValues = clearValues.data();
+	std::vector<VkCommandBuffer> drawCommandBuffers;
+	CreateCommandBuffers(device, commandPool, MAX_FRAMES_IN_FLIGHT, drawCommandBuffers);
 
-	// Subpass: use secondary command buffers?
-	// VK_SUBPASS_CONTENTS_INLINE: nope
-	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	// Only on the GPU here, the point is to exercise the compute path without a window
+	ParticleSystem particles;
+	bool gpuParticles = particleCount > 0 && CreateParticleSystem(device, allocator, VK_NULL_HANDLE, particleCount, indices.size(), "shaders/particles.comp.spv", particles);
 
-	VkViewport viewport{};
+	if (particleCount > 0 && !gpuParticles)
+	{
+		std::cout << "Rendering without particles\n";
+	}
 
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = swapChainExtent.width;
-	viewport.height = swapChainExtent.height;
+	// The copies never change, so they're only recorded once
+	std::vector<VkCommandBuffer> readbackCommandBuffers;
+	CreateCommandBuffers(device, commandPool, MAX_FRAMES_IN_FLIGHT, readbackCommandBuffers);
 
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
+	std::vector<VkFence> fences(MAX_FRAMES_IN_FLIGHT);
 
-	VkRect2D scissor{};
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-	scissor.offset = { 0, 0 };
-	scissor.extent = swapChainExtent;
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		RecordReadback(readbackCommandBuffers[i], colorImages[i], readbackBuffers[i], extent);
 
-	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+		VkResult result = vkCreateFence(device, &fenceInfo, nullptr, &fences[i]);
+		ASSERT(result == VK_SUCCESS, "Failed to create a fence.");
+	}
 
-	// VK_PIPELINE_BIND_POINT_GRAPHICS ... graphics pipeline
-	// VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR ... raytracing pipeline
-	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	if (!outputPath.empty())
+	{
+		fs::create_directories(outputPath);
+	}
 
-	VkBuffer buffers[] = { vertexBuffer };
-	VkDeviceSize offsets[] = { 0 };
-	vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
+	SpriteBatch sprites;
 
-	static glm::mat4 projection = glm::ortho(-ASPECT_RATIO, ASPECT_RATIO, -1.0f, 1.0f);
+	// A bot vs bot match, one tick per frame
+	PongSim sim;
+	sim.TimeScale = timeScale;
+	sim.Reset(seed);
 
-	static ShaderMatrices matrices;
-	matrices.Projection = projection;
+	double waitSeconds = 0.0;
+	auto start = std::chrono::high_resolution_clock::now();
 
-	for (const auto& transform : transforms)
+	// Frame i is read back when its slot comes around again, so the loop runs MAX_FRAMES_IN_FLIGHT frames longer
+	for (uint32_t frame = 0; frame < frameCount + MAX_FRAMES_IN_FLIGHT; frame++)
 	{
-		matrices.Transform = transform;
+		uint32_t slot = frame % MAX_FRAMES_IN_FLIGHT;
 
-		vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(ShaderMatrices), &matrices);
-		vkCmdDraw(commandBuffer, vertexCount, 1, 0, 0);
-	}
+		auto waitStart = std::chrono::high_resolution_clock::now();
+		vkWaitForFences(device, 1, &fences[slot], VK_TRUE, UINT64_MAX);
+		waitSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - waitStart).count();
 
-	vkCmdEndRenderPass(commandBuffer);
+		profiler.CollectGpuTimes(slot);
 
-	result = vkEndCommandBuffer(commandBuffer);
-	ASSERT(result == VK_SUCCESS, "Failed to record a command buffer.");
-}
+		if (frame >= MAX_FRAMES_IN_FLIGHT && !outputPath.empty())
+		{
+			char fileName[32];
+			snprintf(fileName, sizeof(fileName), "frame_%05u.ppm", frame - MAX_FRAMES_IN_FLIGHT);
 
-void DrawFrame(VkDevice device, VkSwapchainKHR swapChain, VkQueue graphicsQueue, VkQueue presentQueue, const std::vector<VkCommandBuffer>& commandBuffers, SyncObjects& syncObjects, const std::array<glm::mat4, 3>& transforms, const std::vector<VkFramebuffer>& framebuffers, VkExtent2D swapChainExtent, VkRenderPass renderPass, VkPipeline pipeline, VkPipelineLayout pipelineLayout, VkBuffer vertexBuffer, uint32_t verticesSize)
-{
-	static uint32_t currentFrame = 0;
+			WritePpm(outputPath / fileName, extent.width, extent.height, readbackMemory[slot].Mapped);
+		}
 
-	uint32_t imageIndex = AquireNextImage(device, swapChain, syncObjects, currentFrame);
+		if (frame >= frameCount)
+		{
+			continue;
+		}
 
-	RecordCommandBuffer(transforms, commandBuffers[imageIndex], framebuffers[imageIndex], swapChainExtent, renderPass, pipeline, pipelineLayout, vertexBuffer, verticesSize);
-	SubmitCommandBuffers(device, swapChain, graphicsQueue, presentQueue, commandBuffers[imageIndex], syncObjects, imageIndex, currentFrame);
+		vkResetFences(device, 1, &fences[slot]);
 
-	currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
-}
+		if (!sim.IsOver())
+		{
+			sim.Step(GetBotInputs(sim));
 
-uint32_t AquireNextImage(VkDevice device, VkSwapchainKHR swapChain, SyncObjects& syncObjects, uint32_t currentFrame)
-{
-	vkWaitForFences(device, 1, &syncObjects.InFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
-	
-	uint32_t imageIndex;
-	VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, syncObjects.ImageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+			if (gpuParticles)
+			{
+				particles.Queue.AddImpacts(sim.Impacts);
+			}
+		}
 
-	ASSERT(result == VK_SUCCESS, "Failed to aquire a swap chain image.");
+		// One tick per frame, so that's how much time passes for the particles too
+		if (gpuParticles)
+		{
+			particles.DeltaTime = (float)(sim.TimeScale / REFERENCE_TICK_RATE);
+			particles.Queue.AddLava(particles.DeltaTime);
+		}
 
-	return imageIndex;
-}
+		std::array<QuadInstance, 3> instances = CalculateInstances(sim.Positions, sim.Positions, 0.0f);
 
-void SubmitCommandBuffers(VkDevice device, VkSwapchainKHR swapChain, VkQueue graphicsQueue, VkQueue presentQueue, VkCommandBuffer commandBuffer, SyncObjects& syncObjects, uint32_t imageIndex, uint32_t currentFrame)
-{
-	// Wait for the current frame we're rendering to to be signaled
-	if (syncObjects.ImagesInFlight[currentFrame] != VK_NULL_HANDLE)
-	{
-		vkWaitForFences(device, 1, &syncObjects.ImagesInFlight[currentFrame], VK_TRUE, UINT64_MAX);
-	}
+		sprites.Begin(pipeline, atlas.DescriptorSet);
+		AddGameSprites(sprites, atlas, instances, sim);
+		sprites.End();
 
-	syncObjects.ImagesInFlight[imageIndex] = syncObjects.InFlightFences[currentFrame];
-	vkResetFences(device, 1, &syncObjects.InFlightFences[currentFrame]);
+		ringBuffer.BeginFrame(slot);
 
-	VkPipelineStageFlags waitMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		RingAllocation instanceAllocation = ringBuffer.Allocate(sprites.Instances.size() * sizeof(QuadInstance));
+		uint32_t instanceCount = instanceAllocation.Data ? sprites.Instances.size() : 0;
 
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		if (instanceAllocation.Data)
+		{
+			sprites.WriteSorted((QuadInstance*)instanceAllocation.Data);
+		}
 
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
+		RecordCommandBuffer(drawCommandBuffers[slot], framebuffers[slot], extent, renderPass, pipeline, pipelineLayout, atlas.DescriptorSet, vertexBuffer, indexBuffer, indices.size(), instanceAllocation, instanceCount, profiler.QueryPool, slot * 2, nullptr, slot, 0, gpuParticles ? &particles : nullptr, &sprites.Draws);
 
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = &syncObjects.ImageAvailableSemaphores[currentFrame];
-	submitInfo.pWaitDstStageMask = &waitMask;
+		VkCommandBuffer commandBuffers[2] = { drawCommandBuffers[slot], readbackCommandBuffers[slot] };
+		VkPipelineStageFlags waitMask = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
 
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &syncObjects.RenderingFinishedSemaphores[currentFrame];
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-	// The InFlightFence will be signaled after all command buffers have completed execution
-	VkResult result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, syncObjects.InFlightFences[currentFrame]);
-	ASSERT(result == VK_SUCCESS, "Failed to submit a command buffer to the queue.");
+		submitInfo.commandBufferCount = 2;
+		submitInfo.pCommandBuffers = commandBuffers;
 
-	VkPresentInfoKHR presentInfo{};
-	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		// Only the first frame has to wait for the static buffers
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
 
-	presentInfo.swapchainCount = 1;
-	presentInfo.pSwapchains = &swapChain;
+		timelineInfo.waitSemaphoreValueCount = 1;
+		timelineInfo.pWaitSemaphoreValues = &uploadValue;
 
-	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = &syncObjects.RenderingFinishedSemaphores[currentFrame];
+		if (uploadValue > 0)
+		{
+			submitInfo.pNext = &timelineInfo;
+			submitInfo.waitSemaphoreCount = 1;
+			submitInfo.pWaitSemaphores = &uploader.Timeline;
+			submitInfo.pWaitDstStageMask = &waitMask;
+		}
 
-	presentInfo.pImageIndices = &imageIndex;
+		VkResult result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, fences[slot]);
+		ASSERT(result == VK_SUCCESS, "Failed to submit an offscreen frame.");
 
-	result = vkQueuePresentKHR(presentQueue, &presentInfo);
-	// ASSERT(result == VK_SUCCESS, "Failed to present swap chain image"); ???
-}
+		profiler.MarkSubmitted(slot);
 
-std::array<glm::mat4, 3> CalculateTransforms(const std::array<glm::vec2, 3>& positions)
-{
-	std::array<glm::mat4, 3> transforms = {
-		glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(positions[0], 0.0f)), { PLAYER_WIDTH, PLAYER_HEIGHT, 1.0f }),
-		glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(positions[1], 0.0f)), { PLAYER_WIDTH, PLAYER_HEIGHT, 1.0f }),
-		glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(positions[2], 0.0f)), { BALL_SIZE, BALL_SIZE, 1.0f })
-	};
+		uploadValue = 0;
+		uploader.Reclaim();
+	}
 
-	return transforms;
-}
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
 
-void MovePlayer(float& position, float amount)
-{
-	float newPosition = position + amount;
+	std::cout << "Rendered " << frameCount << " frames at " << extent.width << "x" << extent.height << " offscreen\n";
+	std::cout << "Frame time: " << seconds / frameCount * 1e3 << " ms, " << waitSeconds / frameCount * 1e3 << " ms of it waiting for the GPU\n";
 
-	// Collision detection
+	// Next to nothing gets drawn, so the render pass is about as long as clearing and storing the attachments takes
+	double renderPassSeconds = profiler.MedianDuration(PROFILE_TRACK_GPU, "RenderPass") / 1e9;
 
-	for (int i = 0; i < 2; i++)
+	if (renderPassSeconds > 0.0)
 	{
-		int sign = 2 * i - 1;
-		float bound = newPosition + sign * (PLAYER_HEIGHT / 2.0f + PADDING);
+		double attachmentBytes = (double)extent.width * extent.height * (4 + GetDepthFormatSize(depthFormat));
+		printf("Render pass: %.3f ms on the GPU (p50), %.2f GB/s for %.2f MB of attachment writes\n", renderPassSeconds * 1e3, attachmentBytes / renderPassSeconds / 1e9, attachmentBytes / 1e6);
+	}
 
-		if (abs(bound) >= 1.0f)
-		{
-			return;
-		}
+	if (!outputPath.empty())
+	{
+		std::cout << "Frames written to \"" << outputPath.string() << "\"\n";
 	}
 
-	position = newPosition;
-}
+	// Clean up
 
-int MoveBall(std::array<glm::vec2, 3>& positions, glm::vec2& direction)
-{
-	float angle = abs(glm::dot(direction, glm::vec2(0.0f, 1.0f)));
-	float ballSpeed = MAX_BALL_SPEED * angle / glm::pi<float>();
-	ballSpeed = std::max(MIN_BALL_SPEED, ballSpeed);
+	vkDeviceWaitIdle(device);
 
-	glm::vec2& ballPosition = positions[2];
-	glm::vec2 newPosition = ballPosition + direction * ballSpeed;
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		vkDestroyFence(device, fences[i], nullptr);
+		vkDestroyFramebuffer(device, framebuffers[i], nullptr);
 
-	// Check for ceiling/floor collision
+		vkDestroyImageView(device, colorImageViews[i], nullptr);
+		allocator.DestroyImage(colorImages[i], colorMemory[i]);
 
-	for (int i = 0; i < 2; i++)
-	{
-		int sign = 2 * i - 1;
-		float bound = newPosition.y + sign * (BALL_SIZE / 2.0f);
+		allocator.DestroyBuffer(readbackBuffers[i], readbackMemory[i]);
+	}
 
-		if (abs(bound) >= 1.0f)
-		{
-			Bounce({ 0.0f, 1.0f }, direction);
-			return 0;
-		}
+	for (uint32_t i = 0; i < depthImages.size(); i++)
+	{
+		vkDestroyImageView(device, depthImageViews[i], nullptr);
+		allocator.DestroyImage(depthImages[i], depthMemory[i]);
 	}
 
-	// Check for player/goal collision
+	DestroyFrameProfiler(profiler);
 
-	for (int i = 0; i < 2; i++)
+	if (gpuParticles)
 	{
-		int sign = 2 * i - 1;
-		float bound = newPosition.x + sign * (BALL_SIZE / 2.0f);
+		DestroyParticleSystem(allocator, particles);
+	}
 
-		if (abs(bound) < ASPECT_RATIO - PLAYER_POSITION)
-		{
-			continue;
-		}
+	DestroyStagingUploader(uploader);
 
-		// Player collision
+	allocator.DestroyBuffer(vertexBuffer, vertexBufferMemory);
+	allocator.DestroyBuffer(indexBuffer, indexBufferMemory);
 
-		bool didCollide = false;
-		int player = (glm::sign(direction.x) + 1) / 2;
+	DestroySpriteAtlas(allocator, atlas);
 
-		if (newPosition.y - BALL_SIZE > (positions[player].y + PLAYER_HEIGHT / 2.0f) || newPosition.y + BALL_SIZE < (positions[player].y - PLAYER_HEIGHT / 2.0f))
-		{
-			ballPosition = { 0.0f, 0.0f };
-			direction = glm::normalize(glm::vec2(1.0f - player * 2.0f, 1.0f));
+	DestroyFrameRingBuffer(allocator, ringBuffer);
+	DestroyGpuAllocator(allocator);
 
-			return 2 - player;
-		}
+	vkDestroyPipeline(device, pipeline, nullptr);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, textureSetLayout, nullptr);
+	vkDestroyRenderPass(device, renderPass, nullptr);
+	vkDestroyCommandPool(device, commandPool, nullptr);
 
-		Bounce({ 1.0f, 0.0f }, direction);
-		return 0;
-	}
-	
-	ballPosition = newPosition;
+	vkDestroyDevice(device, nullptr);
+	vkDestroyInstance(instance, nullptr);
+}
+
+void RecordReadback(VkCommandBuffer commandBuffer, VkImage image, VkBuffer buffer, VkExtent2D extent)
+{
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+	VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	ASSERT(result == VK_SUCCESS, "Failed to begin the readback command buffer.");
+
+	// Wait for the render pass to finish writing and get the image ready to be copied
+	VkImageMemoryBarrier imageBarrier{};
+	imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+
+	imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	imageBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.image = image;
+
+	imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	imageBarrier.subresourceRange.baseMipLevel = 0;
+	imageBarrier.subresourceRange.levelCount = 1;
+	imageBarrier.subresourceRange.baseArrayLayer = 0;
+	imageBarrier.subresourceRange.layerCount = 1;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+	// Tightly packed rows
+	VkBufferImageCopy region{};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { extent.width, extent.height, 1 };
+
+	vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &region);
+
+	// Make the copy visible to the CPU once the fence is signaled
+	VkBufferMemoryBarrier bufferBarrier{};
+	bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+
+	bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	bufferBarrier.buffer = buffer;
+	bufferBarrier.offset = 0;
+	bufferBarrier.size = VK_WHOLE_SIZE;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
 
-	return 0;
+	result = vkEndCommandBuffer(commandBuffer);
+	ASSERT(result == VK_SUCCESS, "Failed to record the readback command buffer.");
 }
 
-void Bounce(const glm::vec2& surfaceNormal, glm::vec2& direction)
+void WritePpm(const fs::path& path, uint32_t width, uint32_t height, const uint8_t* pixels)
 {
-	float random = rand() / (float)RAND_MAX;
-	random = random * 0.1f - 0.05f;
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	ASSERT(file.is_open(), "Failed to open file \"" + path.string() + "\"");
 
-	direction = glm::reflect(direction, surfaceNormal + glm::vec2(random, 0.0f));
+	file << "P6\n" << width << " " << height << "\n255\n";
 
-	int sign = glm::sign(direction.x);
-	direction.x = sign * std::max(0.5f, abs(direction.x));
-}
\ No newline at end of file
+	// PPM has no alpha
+	std::vector<uint8_t> row(width * 3);
+
+	for (uint32_t y = 0; y < height; y++)
+	{
+		const uint8_t* source = pixels + (size_t)y * width * 4;
+
+		for (uint32_t x = 0; x < width; x++)
+		{
+			row[x * 3 + 0] = source[x * 4 + 0];
+			row[x * 3 + 1] = source[x * 4 + 1];
+			row[x * 3 + 2] = source[x * 4 + 2];
+		}
+
+		file.write((const char*)row.data(), row.size());
+	}
+}